@@ -0,0 +1,322 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+#include "ScratchArena.h"
+
+#include <sys/resource.h>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file arena_bench.cpp
+ * @brief Allocator time and page faults per request, heap against arena.
+ *
+ * Usage: digit_arena_bench [--model PATH] [--images PATH] [--threads 1,2,4,8]
+ *                          [--batch B] [--seconds S] [--json PATH]
+ *
+ * Every thread serves requests back to back: B canvases (280x280, scaled
+ * up from the t10k images, or random noise without --images) are
+ * preprocessed, concatenated and classified in one predict_batch(), all
+ * inside an ArenaScope. Each thread count runs twice:
+ *
+ *  - heap: the arena is disabled and every Mat and tensor comes from the
+ *    allocators LibTorch and OpenCV ship with;
+ *  - arena: the same requests with the arena enabled.
+ *
+ * The allocators are installed in both modes with profiling on, so both
+ * time every allocation and free the same way. Each point reports
+ * images/s, p50/p99 request latency, allocations and heap allocations per
+ * request, allocator time per request and as a share of the threads' time,
+ * and minor page faults per request (from RUSAGE_THREAD, so the sampler
+ * thread does not count). Intra-op threads are 1: threads without a scope
+ * would pass their allocations through to the heap in either mode.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int CANVAS_SIZE = 280;
+constexpr size_t CANVAS_COUNT = 256;
+constexpr int WARMUP_REQUESTS = 20;
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string images;
+    std::vector<size_t> threads;
+    int64_t batch = 1;
+    double seconds = 3.0;
+    std::string json_path;
+};
+
+struct PointResult {
+    double images_per_second = 0.0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double allocations_per_request = 0.0;
+    double heap_allocations_per_request = 0.0;
+    double allocator_us_per_request = 0.0;
+    double allocator_share = 0.0; ///< Of the worker threads' wall time
+    double faults_per_request = 0.0;
+    size_t peak_rss = 0;
+};
+
+std::vector<size_t> parse_list(const std::string& text) {
+    std::vector<size_t> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(std::stoul(item));
+    }
+    return values;
+}
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--threads") o.threads = parse_list(next());
+        else if (arg == "--batch") o.batch = std::stol(next());
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.threads.empty()) {
+        const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t n = 1; n < cores; n *= 2) {
+            o.threads.push_back(n);
+        }
+        o.threads.push_back(cores);
+    }
+    if (o.batch < 1 || o.seconds <= 0.0 ||
+        std::find(o.threads.begin(), o.threads.end(), 0) != o.threads.end()) {
+        throw std::invalid_argument("--threads, --batch and --seconds must be positive");
+    }
+    return o;
+}
+
+std::vector<cv::Mat> make_canvases(const std::string& images) {
+    std::vector<cv::Mat> canvases;
+    if (!images.empty()) {
+        const MnistSet mnist = load_mnist_idx(images, "", CANVAS_COUNT);
+        for (size_t i = 0; i < mnist.count; ++i) {
+            cv::Mat digit(static_cast<int>(mnist.rows), static_cast<int>(mnist.cols), CV_8UC1,
+                          const_cast<uint8_t*>(mnist.image(i)));
+            cv::Mat canvas;
+            cv::resize(digit, canvas, cv::Size(CANVAS_SIZE, CANVAS_SIZE), 0, 0,
+                       cv::INTER_LINEAR);
+            canvases.push_back(canvas);
+        }
+        return canvases;
+    }
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pixel(0, 255);
+    for (size_t i = 0; i < CANVAS_COUNT; ++i) {
+        cv::Mat canvas(CANVAS_SIZE, CANVAS_SIZE, CV_8UC1);
+        for (int y = 0; y < CANVAS_SIZE; ++y) {
+            uint8_t* row = canvas.ptr<uint8_t>(y);
+            for (int x = 0; x < CANVAS_SIZE; ++x) {
+                row[x] = static_cast<uint8_t>(pixel(rng));
+            }
+        }
+        canvases.push_back(canvas);
+    }
+    return canvases;
+}
+
+uint64_t thread_minor_faults() {
+    rusage usage{};
+    ::getrusage(RUSAGE_THREAD, &usage);
+    return static_cast<uint64_t>(usage.ru_minflt);
+}
+
+/**
+ * @brief One request: preprocess batch canvases from `next` on, then classify them.
+ */
+void serve(InferenceEngine& engine, ImageProcessor& processor,
+           const std::vector<cv::Mat>& canvases, size_t next, int64_t batch) {
+    ArenaScope scratch;
+    std::vector<torch::Tensor> inputs;
+    inputs.reserve(static_cast<size_t>(batch));
+    for (int64_t i = 0; i < batch; ++i) {
+        inputs.push_back(processor.process(canvases[(next + i) % canvases.size()]));
+    }
+    engine.predict_batch(batch == 1 ? inputs.front() : torch::cat(inputs, 0));
+}
+
+PointResult run_point(const BenchOptions& options, InferenceEngine& engine,
+                      const std::vector<cv::Mat>& canvases, size_t threads) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+    std::vector<LatencyHistogram> latencies(threads);
+    std::vector<uint64_t> requests(threads, 0);
+    std::vector<uint64_t> faults(threads, 0);
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            at::set_num_threads(1);
+            ImageProcessor processor;
+            size_t next = t * 17;
+            for (int i = 0; i < WARMUP_REQUESTS; ++i) {
+                serve(engine, processor, canvases, next, options.batch);
+                next += static_cast<size_t>(options.batch);
+            }
+            ++ready;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            const uint64_t faults_before = thread_minor_faults();
+            while (!stop.load(std::memory_order_relaxed)) {
+                const Clock::time_point t0 = Clock::now();
+                serve(engine, processor, canvases, next, options.batch);
+                latencies[t].record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0)
+                        .count()));
+                next += static_cast<size_t>(options.batch);
+                ++requests[t];
+            }
+            faults[t] = thread_minor_faults() - faults_before;
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Counters are process-wide, so take the difference over the timed part
+    PointResult result;
+    const ArenaStats before = ScratchArena::stats();
+    const Clock::time_point start = Clock::now();
+    go.store(true, std::memory_order_release);
+    const Clock::time_point end =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options.seconds));
+    while (Clock::now() < end) {
+        result.peak_rss = std::max(result.peak_rss, resident_bytes());
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    stop.store(true, std::memory_order_relaxed);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    const ArenaStats after = ScratchArena::stats();
+
+    LatencyHistogram latency;
+    uint64_t total = 0;
+    uint64_t total_faults = 0;
+    for (size_t t = 0; t < threads; ++t) {
+        latency.merge(latencies[t]);
+        total += requests[t];
+        total_faults += faults[t];
+    }
+    const double n = static_cast<double>(std::max<uint64_t>(total, 1));
+    const double allocations =
+        static_cast<double>((after.arena_allocations - before.arena_allocations) +
+                            (after.heap_allocations - before.heap_allocations));
+    const double allocator_seconds = (after.allocate_seconds - before.allocate_seconds) +
+                                     (after.free_seconds - before.free_seconds);
+    result.images_per_second =
+        static_cast<double>(total * static_cast<uint64_t>(options.batch)) / elapsed.count();
+    result.p50_us = static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+    result.p99_us = static_cast<double>(latency.value_at_percentile(99.0)) / 1000.0;
+    result.allocations_per_request = allocations / n;
+    result.heap_allocations_per_request =
+        static_cast<double>(after.heap_allocations - before.heap_allocations) / n;
+    result.allocator_us_per_request = allocator_seconds * 1e6 / n;
+    result.allocator_share =
+        allocator_seconds / (elapsed.count() * static_cast<double>(threads));
+    result.faults_per_request = static_cast<double>(total_faults) / n;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        const std::vector<cv::Mat> canvases = make_canvases(options.images);
+
+        // 1. Install the allocators before the model allocates anything
+        ArenaOptions arena;
+        arena.profile = true;
+        ScratchArena::configure(arena);
+        InferenceEngine engine(options.model);
+
+        std::printf("batch %lld, %s canvases, %.1f s per point, %u hardware threads (%s)\n",
+                    static_cast<long long>(options.batch),
+                    options.images.empty() ? "noise" : "t10k", options.seconds,
+                    std::thread::hardware_concurrency(), cpu_model().c_str());
+        std::printf("%-6s %7s %11s %9s %9s %8s %8s %10s %7s %9s %8s\n", "mode", "threads",
+                    "images/s", "p50 us", "p99 us", "allocs", "heap", "alloc us", "alloc%",
+                    "faults", "RSS MB");
+
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["batch"] = options.batch;
+        report["hardware_threads"] = std::thread::hardware_concurrency();
+
+        // 2. Both modes at every thread count, heap first
+        for (size_t threads : options.threads) {
+            for (const bool enabled : {false, true}) {
+                arena.enabled = enabled;
+                ScratchArena::configure(arena);
+                const std::string mode = enabled ? "arena" : "heap";
+                const PointResult r = run_point(options, engine, canvases, threads);
+                std::printf("%-6s %7zu %11.0f %9.1f %9.1f %8.1f %8.1f %10.2f %6.1f%% %9.2f %8.1f\n",
+                            mode.c_str(), threads, r.images_per_second, r.p50_us, r.p99_us,
+                            r.allocations_per_request, r.heap_allocations_per_request,
+                            r.allocator_us_per_request, 100.0 * r.allocator_share,
+                            r.faults_per_request,
+                            static_cast<double>(r.peak_rss) / (1024.0 * 1024.0));
+                std::fflush(stdout);
+                report["modes"][mode].push_back(
+                    {{"threads", threads},
+                     {"images_per_second", r.images_per_second},
+                     {"p50_us", r.p50_us},
+                     {"p99_us", r.p99_us},
+                     {"allocations_per_request", r.allocations_per_request},
+                     {"heap_allocations_per_request", r.heap_allocations_per_request},
+                     {"allocator_us_per_request", r.allocator_us_per_request},
+                     {"allocator_share", r.allocator_share},
+                     {"minor_faults_per_request", r.faults_per_request},
+                     {"peak_rss_bytes", r.peak_rss}});
+            }
+        }
+
+        const ArenaStats totals = ScratchArena::stats();
+        report["chunks_mapped"] = totals.chunks_mapped;
+        report["chunks_detached"] = totals.chunks_detached;
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,441 @@
+#include "ClientConnection.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+#include "Router.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @file cluster_bench.cpp
+ * @brief Throughput of 1..N digit_server processes behind a Router.
+ *
+ * Usage: digit_cluster_bench [--server PATH] [--model PATH] [--images PATH]
+ *                            [--backends N] [--cores-per-backend K] [--pin]
+ *                            [--policy hash|least] [--connections C]
+ *                            [--pipeline D] [--seconds S] [--json PATH]
+ *
+ * Starts N digit_server processes (by default the one next to this
+ * binary), each on its own loopback port with a thread budget of K cores
+ * (default: the allowed cores / N). With --pin each is confined to its own
+ * K CPUs, as separate machines would be. One in-process Router fronts
+ * them. The backends join it one step at a time (1, 2, 4, ..., N), and
+ * each step is driven for S seconds by C connections keeping D t10k
+ * images in flight each. Every step reports:
+ *
+ *  - requests/s, the speedup over one backend, and the scaling efficiency
+ *    (speedup / backends);
+ *  - p50 and p99 as the client sees them;
+ *  - the busiest backend's share of the traffic over the fair share
+ *    (1.00 is perfectly even).
+ *
+ * A first "direct" row drives backend 0 without the router, so the cost
+ * of the extra hop shows against the one-backend row.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string server;
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    uint32_t backends = 4;
+    uint32_t cores_per_backend = 0;
+    bool pin = false;
+    RoutingPolicy policy = RoutingPolicy::ConsistentHash;
+    size_t connections = 16;
+    size_t pipeline = 8;
+    double seconds = 5.0;
+    std::string json_path;
+};
+
+struct StepResult {
+    std::string mode;
+    uint32_t backends = 0;
+    double requests_per_second = 0.0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double max_share = 0.0; ///< Busiest backend's share over 1/backends
+};
+
+struct Backend {
+    pid_t pid = 0;
+    uint16_t port = 0;
+    std::string config_path;
+};
+
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+std::string sibling_server() {
+    char path[4096];
+    const ssize_t length = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0) {
+        return "digit_server";
+    }
+    const std::string self(path, static_cast<size_t>(length));
+    return self.substr(0, self.rfind('/') + 1) + "digit_server";
+}
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--server") o.server = next();
+        else if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--backends") o.backends = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--cores-per-backend")
+            o.cores_per_backend = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--pin") o.pin = true;
+        else if (arg == "--policy") o.policy = parse_routing_policy(next());
+        else if (arg == "--connections") o.connections = std::stoul(next());
+        else if (arg == "--pipeline") o.pipeline = std::stoul(next());
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.server.empty()) {
+        o.server = sibling_server();
+    }
+    if (o.backends == 0 || o.connections == 0 || o.pipeline == 0 || o.seconds <= 0.0) {
+        throw std::invalid_argument(
+            "--backends, --connections, --pipeline and --seconds must be positive");
+    }
+    if (o.cores_per_backend == 0) {
+        const size_t cores = allowed_cpus().size();
+        o.cores_per_backend = static_cast<uint32_t>(std::max<size_t>(1, cores / o.backends));
+    }
+    return o;
+}
+
+/**
+ * @brief A loopback port that is free now; the backend binds it moments later.
+ */
+uint16_t free_port() {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("Cannot find a free port");
+    }
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+Backend start_backend(uint32_t index, const BenchOptions& options,
+                      const std::vector<int>& cpus) {
+    // 1. A config of its own: one model, this port, this many cores
+    Backend backend;
+    backend.port = free_port();
+    backend.config_path = "/tmp/digit_cluster_" + std::to_string(::getpid()) + "_" +
+                          std::to_string(index) + ".json";
+    json config;
+    config["server"] = {{"port", backend.port},
+                        {"bind_address", "127.0.0.1"},
+                        {"thread_budget", {{"cores", options.cores_per_backend}}},
+                        {"models", json::array({{{"name", "digit"},
+                                                 {"version", "1"},
+                                                 {"model_path", options.model}}})}};
+    std::ofstream(backend.config_path) << config.dump(2) << std::endl;
+
+    // 2. Fork, pin if asked, and exec the server with its log silenced
+    std::cout.flush();
+    backend.pid = ::fork();
+    if (backend.pid < 0) {
+        throw std::runtime_error("Could not fork a backend");
+    }
+    if (backend.pid == 0) {
+        if (options.pin && !cpus.empty()) {
+            cpu_set_t slice;
+            CPU_ZERO(&slice);
+            for (uint32_t k = 0; k < options.cores_per_backend; ++k) {
+                CPU_SET(cpus[(index * options.cores_per_backend + k) % cpus.size()], &slice);
+            }
+            ::sched_setaffinity(0, sizeof(slice), &slice);
+        }
+        const int null_fd = ::open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            ::dup2(null_fd, STDOUT_FILENO);
+        }
+        ::execl(options.server.c_str(), "digit_server", backend.config_path.c_str(),
+                static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    return backend;
+}
+
+/**
+ * @brief Waits until the backend answers a StatsRequest.
+ */
+void wait_listening(const Backend& backend) {
+    const Clock::time_point give_up = Clock::now() + std::chrono::seconds(60);
+    while (Clock::now() < give_up) {
+        if (::waitpid(backend.pid, nullptr, WNOHANG) == backend.pid) {
+            throw std::runtime_error("Backend on port " + std::to_string(backend.port) +
+                                     " exited during start-up");
+        }
+        try {
+            ClientConnection probe("127.0.0.1", backend.port, std::chrono::milliseconds(200));
+            probe.fetch_stats(std::chrono::milliseconds(1000));
+            return;
+        } catch (const std::exception&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    throw std::runtime_error("Backend on port " + std::to_string(backend.port) +
+                             " did not come up");
+}
+
+/**
+ * @brief Closed-loop load: C connections with D requests in flight each.
+ */
+StepResult drive(uint16_t port, const MnistSet& mnist, const BenchOptions& options) {
+    std::atomic<bool> measuring{false};
+    std::atomic<bool> stop{false};
+    std::vector<uint64_t> counts(options.connections, 0);
+    std::vector<LatencyHistogram> latencies(options.connections);
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < options.connections; ++c) {
+        clients.emplace_back([&, c] {
+            try {
+                ClientConnection connection("127.0.0.1", port);
+                std::unordered_map<uint64_t, Clock::time_point> sent;
+                uint64_t next = c * 1000003; // Different images on every connection
+                auto send_one = [&] {
+                    const size_t image = next % mnist.count;
+                    sent[next] = Clock::now();
+                    connection.send_predict(next++, mnist.image(image),
+                                            static_cast<uint16_t>(mnist.cols),
+                                            static_cast<uint16_t>(mnist.rows));
+                };
+                for (size_t i = 0; i < options.pipeline; ++i) {
+                    send_one();
+                }
+                std::vector<PredictResponse> out;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    out.clear();
+                    connection.read_responses(out, std::chrono::milliseconds(100));
+                    const Clock::time_point now = Clock::now();
+                    const bool counted = measuring.load(std::memory_order_relaxed);
+                    for (const PredictResponse& response : out) {
+                        auto it = sent.find(response.request_id);
+                        if (counted && it != sent.end()) {
+                            ++counts[c];
+                            latencies[c].record(static_cast<uint64_t>(
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    now - it->second).count()));
+                        }
+                        if (it != sent.end()) {
+                            sent.erase(it);
+                        }
+                        send_one();
+                    }
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Client " << c << ": " << e.what() << std::endl;
+            }
+        });
+    }
+    // The first second warms up connections and batchers
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    measuring.store(true);
+    const Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    measuring.store(false);
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    stop.store(true);
+    for (std::thread& client : clients) {
+        client.join();
+    }
+
+    StepResult result;
+    LatencyHistogram all;
+    uint64_t total = 0;
+    for (size_t c = 0; c < options.connections; ++c) {
+        all.merge(latencies[c]);
+        total += counts[c];
+    }
+    result.requests_per_second = static_cast<double>(total) / elapsed.count();
+    result.p50_us = static_cast<double>(all.value_at_percentile(50.0)) / 1000.0;
+    result.p99_us = static_cast<double>(all.value_at_percentile(99.0)) / 1000.0;
+    return result;
+}
+
+std::map<std::string, uint64_t> forwarded(const Router& router) {
+    std::map<std::string, uint64_t> counts;
+    for (const BackendStats& s : router.backend_stats()) {
+        counts[s.name] = s.forwarded;
+    }
+    return counts;
+}
+
+void stop_backends(const std::vector<Backend>& backends) {
+    for (const Backend& backend : backends) {
+        ::kill(backend.pid, SIGTERM);
+    }
+    for (const Backend& backend : backends) {
+        ::waitpid(backend.pid, nullptr, 0);
+        ::unlink(backend.config_path.c_str());
+    }
+}
+
+std::vector<StepResult> run_steps(const BenchOptions& options, const MnistSet& mnist,
+                                  const std::vector<Backend>& backends) {
+    std::vector<StepResult> results;
+
+    // 1. Backend 0 on its own, without the router
+    StepResult direct = drive(backends[0].port, mnist, options);
+    direct.mode = "direct";
+    direct.backends = 1;
+    direct.max_share = 1.0;
+    results.push_back(direct);
+
+    // 2. Through the router, growing the cluster one step at a time
+    RouterOptions router_options;
+    router_options.io.port = 0;
+    router_options.io.bind_address = "127.0.0.1";
+    router_options.policy = options.policy;
+    router_options.health_interval = std::chrono::milliseconds(100);
+    Router router({}, router_options);
+    std::thread loop([&router] { router.run(); });
+
+    std::vector<uint32_t> steps;
+    for (uint32_t n = 1; n < options.backends; n *= 2) {
+        steps.push_back(n);
+    }
+    steps.push_back(options.backends);
+    uint32_t joined = 0;
+    for (uint32_t n : steps) {
+        for (; joined < n; ++joined) {
+            router.add_backend({"127.0.0.1", backends[joined].port});
+        }
+        const Clock::time_point give_up = Clock::now() + std::chrono::seconds(10);
+        while (router.healthy_backends() < n && Clock::now() < give_up) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        const std::map<std::string, uint64_t> before = forwarded(router);
+        StepResult step = drive(router.port(), mnist, options);
+        step.mode = "router";
+        step.backends = n;
+
+        uint64_t total = 0;
+        uint64_t busiest = 0;
+        for (const auto& [name, count] : forwarded(router)) {
+            auto it = before.find(name);
+            const uint64_t delta = count - (it != before.end() ? it->second : 0);
+            total += delta;
+            busiest = std::max(busiest, delta);
+        }
+        step.max_share = total > 0 ? static_cast<double>(busiest) * n / static_cast<double>(total)
+                                   : 0.0;
+        results.push_back(step);
+    }
+    router.stop();
+    loop.join();
+    return results;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<Backend> backends;
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        const MnistSet mnist = load_mnist_idx(options.images);
+        const std::vector<int> cpus = allowed_cpus();
+
+        for (uint32_t i = 0; i < options.backends; ++i) {
+            backends.push_back(start_backend(i, options, cpus));
+        }
+        for (const Backend& backend : backends) {
+            wait_listening(backend);
+        }
+        const std::vector<StepResult> results = run_steps(options, mnist, backends);
+        stop_backends(backends);
+        backends.clear();
+
+        std::printf("\n%u backends x %u cores%s, %zu connections x %zu in flight, %.1f s (%s)\n",
+                    options.backends, options.cores_per_backend, options.pin ? " (pinned)" : "",
+                    options.connections, options.pipeline, options.seconds, cpu_model().c_str());
+        std::printf("%-7s %8s %12s %8s %10s %10s %10s %10s\n", "mode", "backends", "requests/s",
+                    "speedup", "efficiency", "p50 us", "p99 us", "max share");
+        const double baseline = results.size() > 1 ? results[1].requests_per_second : 0.0;
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["cores_per_backend"] = options.cores_per_backend;
+        report["pinned"] = options.pin;
+        report["connections"] = options.connections;
+        report["pipeline"] = options.pipeline;
+        report["steps"] = json::array();
+        for (const StepResult& r : results) {
+            const double speedup = baseline > 0.0 ? r.requests_per_second / baseline : 0.0;
+            std::printf("%-7s %8u %12.0f %7.2fx %9.0f%% %10.1f %10.1f %9.2fx\n", r.mode.c_str(),
+                        r.backends, r.requests_per_second, speedup,
+                        100.0 * speedup / r.backends, r.p50_us, r.p99_us, r.max_share);
+            report["steps"].push_back({{"mode", r.mode},
+                                       {"backends", r.backends},
+                                       {"requests_per_second", r.requests_per_second},
+                                       {"speedup", speedup},
+                                       {"p50_us", r.p50_us},
+                                       {"p99_us", r.p99_us},
+                                       {"max_share", r.max_share}});
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        stop_backends(backends);
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
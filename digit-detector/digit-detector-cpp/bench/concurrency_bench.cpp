@@ -0,0 +1,235 @@
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file concurrency_bench.cpp
+ * @brief Throughput and memory of concurrent predict_batch() calls.
+ *
+ * Usage: digit_concurrency_bench [--model PATH] [--max-threads N] [--batch B]
+ *                                [--seconds S] [--intra-op K] [--json PATH]
+ *
+ * For 1, 2, 4 ... N threads (N defaults to 32), every thread calls
+ * predict_batch() on its own [B, 1, 28, 28] input back to back for S
+ * seconds, in two modes:
+ *
+ *  - shared: all threads use one InferenceEngine, i.e. one copy of the
+ *    weights, and only per-thread scratch (stack, activations) is added;
+ *  - replicas: every thread loads its own engine, the usual way to get
+ *    concurrency out of an engine that is not thread-safe.
+ *
+ * Each point reports images/s, speedup over one thread, p50/p99 pass
+ * latency, and the peak resident set while it ran. Memory per added thread
+ * is (RSS at N - RSS at 1) / (N - 1). Shared runs first, so memory freed
+ * by the replicas cannot flatter it. Every thread sets its own intra-op
+ * thread count (default 1), since LibTorch's setting is per thread.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int WARMUP_PASSES = 3;
+constexpr auto RSS_SAMPLE_INTERVAL = std::chrono::milliseconds(10);
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    size_t max_threads = 32;
+    int64_t batch = 1;
+    double seconds = 2.0;
+    int intra_op = 1;
+    std::string json_path;
+};
+
+struct PointResult {
+    double images_per_second = 0.0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    size_t peak_rss = 0;
+};
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--max-threads") o.max_threads = std::stoul(next());
+        else if (arg == "--batch") o.batch = std::stol(next());
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--intra-op") o.intra_op = std::stoi(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.max_threads == 0 || o.batch < 1 || o.intra_op < 1 || o.seconds <= 0.0) {
+        throw std::invalid_argument(
+            "--max-threads, --batch, --intra-op and --seconds must be positive");
+    }
+    return o;
+}
+
+/**
+ * @brief Runs `threads` callers for the configured time; engine(i) is thread i's engine.
+ */
+template <class EngineFor>
+PointResult run_point(const BenchOptions& options, size_t threads, EngineFor engine_for) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+    std::vector<LatencyHistogram> latencies(threads);
+    std::vector<uint64_t> passes(threads, 0);
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            at::set_num_threads(options.intra_op);
+            InferenceEngine& engine = engine_for(t);
+            const torch::Tensor input = torch::randn({options.batch, 1, 28, 28});
+            for (int i = 0; i < WARMUP_PASSES; ++i) {
+                engine.predict_batch(input);
+            }
+            ++ready;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                const Clock::time_point t0 = Clock::now();
+                engine.predict_batch(input);
+                latencies[t].record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0)
+                        .count()));
+                ++passes[t];
+            }
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    PointResult result;
+    const Clock::time_point start = Clock::now();
+    go.store(true, std::memory_order_release);
+    const Clock::time_point end =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options.seconds));
+    while (Clock::now() < end) {
+        result.peak_rss = std::max(result.peak_rss, resident_bytes());
+        std::this_thread::sleep_for(RSS_SAMPLE_INTERVAL);
+    }
+    stop.store(true, std::memory_order_relaxed);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    LatencyHistogram latency;
+    uint64_t total = 0;
+    for (size_t t = 0; t < threads; ++t) {
+        latency.merge(latencies[t]);
+        total += passes[t];
+    }
+    result.images_per_second =
+        static_cast<double>(total * static_cast<uint64_t>(options.batch)) / elapsed.count();
+    result.p50_us = static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+    result.p99_us = static_cast<double>(latency.value_at_percentile(99.0)) / 1000.0;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        std::vector<size_t> counts;
+        for (size_t n = 1; n < options.max_threads; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(options.max_threads);
+
+        std::printf("batch %lld, %d intra-op thread(s) per caller, %.1f s per point, "
+                    "%u hardware threads (%s)\n",
+                    static_cast<long long>(options.batch), options.intra_op, options.seconds,
+                    std::thread::hardware_concurrency(), cpu_model().c_str());
+        std::printf("%-9s %7s %12s %8s %10s %10s %10s %10s %12s\n", "mode", "threads",
+                    "images/s", "speedup", "efficiency", "p50 us", "p99 us", "RSS MB",
+                    "MB/+thread");
+
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["batch"] = options.batch;
+        report["intra_op"] = options.intra_op;
+        report["hardware_threads"] = std::thread::hardware_concurrency();
+
+        for (const std::string mode : {"shared", "replicas"}) {
+            std::unique_ptr<InferenceEngine> shared;
+            if (mode == "shared") {
+                shared = std::make_unique<InferenceEngine>(options.model);
+                report["weight_bytes"] = shared->weight_bytes();
+            }
+            double base_rate = 0.0;
+            size_t base_rss = 0;
+            for (size_t threads : counts) {
+                std::vector<std::unique_ptr<InferenceEngine>> replicas;
+                if (mode == "replicas") {
+                    for (size_t i = 0; i < threads; ++i) {
+                        replicas.push_back(std::make_unique<InferenceEngine>(options.model));
+                    }
+                }
+                const PointResult r =
+                    run_point(options, threads, [&](size_t t) -> InferenceEngine& {
+                        return shared ? *shared : *replicas[t];
+                    });
+                if (threads == 1) {
+                    base_rate = r.images_per_second;
+                    base_rss = r.peak_rss;
+                }
+                const double speedup = base_rate > 0.0 ? r.images_per_second / base_rate : 0.0;
+                const double per_thread =
+                    threads > 1 ? (static_cast<double>(r.peak_rss) -
+                                   static_cast<double>(base_rss)) /
+                                      static_cast<double>(threads - 1)
+                                : 0.0;
+                std::printf("%-9s %7zu %12.0f %7.2fx %9.0f%% %10.1f %10.1f %10.1f %12.2f\n",
+                            mode.c_str(), threads, r.images_per_second, speedup,
+                            100.0 * speedup / static_cast<double>(threads), r.p50_us, r.p99_us,
+                            static_cast<double>(r.peak_rss) / (1024.0 * 1024.0),
+                            per_thread / (1024.0 * 1024.0));
+                std::fflush(stdout);
+                report["modes"][mode].push_back({{"threads", threads},
+                                                 {"images_per_second", r.images_per_second},
+                                                 {"speedup", speedup},
+                                                 {"p50_us", r.p50_us},
+                                                 {"p99_us", r.p99_us},
+                                                 {"peak_rss_bytes", r.peak_rss},
+                                                 {"bytes_per_added_thread", per_thread}});
+            }
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,236 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "LayerKernels.h"
+#include "MnistIdx.h"
+#include "NativeModel.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file conv_bench.cpp
+ * @brief Direct, im2col and Winograd convolution for conv1 and conv2.
+ *
+ * Usage: digit_conv_bench [--model PATH] [--images PATH] [--batches 1,16,256]
+ *                         [--seconds S] [--threads T] [--json PATH]
+ *
+ * Three ways to run each fp32 conv layer (with its ReLU):
+ *
+ *  - direct: LibTorch's conv2d;
+ *  - im2col: patches as rows, then one GEMM on LibTorch's BLAS;
+ *  - winograd: WinogradConv3x3, filters transformed at load.
+ *
+ * For each batch size, layer and algorithm it times the layer alone on
+ * real activations (t10k images for conv1, pooled conv1 outputs for
+ * conv2) for about S seconds (default 1) and reports p50 per batch, the
+ * speedup over direct and over im2col, and the largest difference from
+ * direct's output. Then the whole model with both convs on each algorithm:
+ * p50 per batch, and the largest logit difference from TorchScript.
+ * T intra-op threads, default 1.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const ConvAlgorithm ALGORITHMS[] = {ConvAlgorithm::Direct, ConvAlgorithm::Im2col,
+                                    ConvAlgorithm::Winograd};
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    std::vector<int64_t> batches{1, 16, 256};
+    double seconds = 1.0;
+    int threads = 1;
+    std::string json_path;
+};
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--batches") {
+            o.batches.clear();
+            std::stringstream list(next());
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                o.batches.push_back(std::stoll(item));
+            }
+        }
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--threads") o.threads = std::stoi(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.batches.empty() || o.seconds <= 0.0 || o.threads <= 0) {
+        throw std::invalid_argument("--batches, --seconds and --threads must be positive");
+    }
+    for (int64_t batch : o.batches) {
+        if (batch <= 0) {
+            throw std::invalid_argument("--batches must be positive");
+        }
+    }
+    return o;
+}
+
+KernelOptions both_convs(ConvAlgorithm algorithm) {
+    KernelOptions kernels;
+    kernels.conv_algorithm["conv1"] = algorithm;
+    kernels.conv_algorithm["conv2"] = algorithm;
+    return kernels;
+}
+
+/**
+ * @brief p50 in microseconds of pass() run for about seconds, after a few
+ * untimed runs.
+ */
+double p50_us(const std::function<void()>& pass, double seconds) {
+    for (int i = 0; i < 3; ++i) {
+        pass();
+    }
+    LatencyHistogram latency;
+    const Clock::time_point end =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(seconds));
+    do {
+        const Clock::time_point start = Clock::now();
+        pass();
+        latency.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+    } while (Clock::now() < end || latency.count() < 5);
+    return static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        at::set_num_threads(options.threads);
+        c10::InferenceMode inference_mode;
+
+        // 1. The largest batch of t10k images, and conv2's input for them
+        const MnistSet mnist = load_mnist_idx(options.images);
+        if (mnist.rows != 28 || mnist.cols != 28) {
+            throw std::runtime_error("Expected 28x28 images in " + options.images);
+        }
+        const int64_t largest = *std::max_element(options.batches.begin(), options.batches.end());
+        if (largest > static_cast<int64_t>(mnist.count)) {
+            throw std::runtime_error("Fewer images than the largest batch in " + options.images);
+        }
+        const at::Tensor images =
+            torch::from_blob(const_cast<uint8_t*>(mnist.pixels.data()), {largest, 1, 28, 28},
+                             torch::kUInt8)
+                .to(torch::kFloat32)
+                .div_(255.0f)
+                .sub_(ImageProcessor::MNIST_MEAN)
+                .div_(ImageProcessor::MNIST_STD);
+
+        InferenceEngine engine(options.model);
+        torch::jit::script::Module reference_model = torch::jit::load(options.model, torch::kCPU);
+        reference_model.eval();
+        std::map<ConvAlgorithm, std::unique_ptr<NativeModel>> models;
+        for (ConvAlgorithm algorithm : ALGORITHMS) {
+            models[algorithm] = std::make_unique<NativeModel>(engine, both_convs(algorithm));
+        }
+        const NativeModel& direct = *models[ConvAlgorithm::Direct];
+        const at::Tensor pooled =
+            torch::max_pool2d(direct.run_layer("conv1", images), {2, 2}).contiguous();
+        const std::map<std::string, at::Tensor> layer_inputs{{"conv1", images},
+                                                             {"conv2", pooled}};
+
+        // 2. Each layer alone
+        std::printf("\nfp32 conv layers, %d intra-op thread(s), winograd on %s (%s)\n",
+                    options.threads, WinogradConv3x3::isa().c_str(), cpu_model().c_str());
+        std::printf("%6s %-6s %-9s %11s %9s %9s %11s\n", "batch", "layer", "algorithm",
+                    "p50 us", "vs direct", "vs im2col", "max |d|");
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["threads"] = options.threads;
+        report["winograd_isa"] = WinogradConv3x3::isa();
+        for (int64_t batch : options.batches) {
+            for (const auto& layer : layer_inputs) {
+                const at::Tensor input = layer.second.slice(0, 0, batch).contiguous();
+                const at::Tensor expected = direct.run_layer(layer.first, input);
+                std::map<ConvAlgorithm, double> times;
+                for (ConvAlgorithm algorithm : ALGORITHMS) {
+                    const NativeModel& model = *models[algorithm];
+                    times[algorithm] =
+                        p50_us([&] { model.run_layer(layer.first, input); }, options.seconds);
+                }
+                for (ConvAlgorithm algorithm : ALGORITHMS) {
+                    const at::Tensor output = models[algorithm]->run_layer(layer.first, input);
+                    const float error = (output - expected).abs().max().item<float>();
+                    const double vs_direct = times[ConvAlgorithm::Direct] / times[algorithm];
+                    const double vs_im2col = times[ConvAlgorithm::Im2col] / times[algorithm];
+                    std::printf("%6lld %-6s %-9s %11.1f %8.2fx %8.2fx %11.2e\n",
+                                static_cast<long long>(batch), layer.first.c_str(),
+                                to_string(algorithm).c_str(), times[algorithm], vs_direct,
+                                vs_im2col, error);
+                    report["layers"].push_back({{"batch", batch},
+                                                {"layer", layer.first},
+                                                {"algorithm", to_string(algorithm)},
+                                                {"p50_us", times[algorithm]},
+                                                {"vs_direct", vs_direct},
+                                                {"vs_im2col", vs_im2col},
+                                                {"max_error_vs_direct", error}});
+                }
+            }
+        }
+
+        // 3. The whole model, against TorchScript
+        std::printf("\n%6s %-9s %11s %9s %16s\n", "batch", "convs", "p50 us", "vs direct",
+                    "max |dlogit| TS");
+        for (int64_t batch : options.batches) {
+            const at::Tensor input = images.slice(0, 0, batch).contiguous();
+            const at::Tensor reference = reference_model.forward({input}).toTensor();
+            double direct_us = 0.0;
+            for (ConvAlgorithm algorithm : ALGORITHMS) {
+                const NativeModel& model = *models[algorithm];
+                const double us = p50_us([&] { model.forward(input); }, options.seconds);
+                if (algorithm == ConvAlgorithm::Direct) {
+                    direct_us = us;
+                }
+                const float error =
+                    (model.forward(input) - reference).abs().max().item<float>();
+                std::printf("%6lld %-9s %11.1f %8.2fx %16.2e\n", static_cast<long long>(batch),
+                            to_string(algorithm).c_str(), us, direct_us / us, error);
+                report["model"].push_back({{"batch", batch},
+                                           {"algorithm", to_string(algorithm)},
+                                           {"p50_us", us},
+                                           {"vs_direct", direct_us / us},
+                                           {"max_logit_error_vs_torchscript", error}});
+            }
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,390 @@
+#include "ClientConnection.h"
+#include "InferenceClient.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file hedging_bench.cpp
+ * @brief Tail latency and extra load of hedged requests under injected stalls.
+ *
+ * Usage: digit_hedging_bench [--server PATH] [--model PATH] [--images PATH]
+ *                            [--replicas R] [--cores-per-replica K]
+ *                            [--rate N] [--seconds S] [--stall-ms M]
+ *                            [--stall-every-ms E] [--percentile P]
+ *                            [--budget B] [--json PATH]
+ *
+ * Starts R digit_server processes (the one next to this binary by
+ * default) and drives them through InferenceClient at an open-loop N
+ * requests/s. While it runs, a random replica is frozen with SIGSTOP for M
+ * ms about every E ms. That stands in for the stalls that set a server's
+ * p99.9: page-fault storms, preempted threads, collector pauses. The same
+ * stall schedule is replayed in every mode:
+ *
+ *  - off: no hedging;
+ *  - hedge: a second copy on another replica after the P-th percentile
+ *    latency, the loser cancelled, at most B of requests hedged;
+ *  - hedge-nocancel: the same without Cancel, to show what cancelling saves.
+ *
+ * For each mode the bench reports p50/p99/p99.9/max as the caller sees
+ * them. It also reports the share of requests hedged and won by the hedge,
+ * and the extra load: forward-pass rows the servers ran per request,
+ * from their StatsResponses, minus one.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string server;
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    uint32_t replicas = 2;
+    uint32_t cores_per_replica = 1;
+    double rate = 2000.0;
+    double seconds = 10.0;
+    uint32_t stall_ms = 50;
+    uint32_t stall_every_ms = 500;
+    double percentile = 95.0;
+    double budget = 0.05;
+    std::string json_path;
+};
+
+struct Replica {
+    pid_t pid = 0;
+    uint16_t port = 0;
+    std::string config_path;
+};
+
+struct ModeResult {
+    std::string mode;
+    uint64_t requests = 0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double p999_us = 0.0;
+    double max_us = 0.0;
+    InferenceClientStats client;
+    double server_rows = 0.0; ///< Requests the servers ran (completed), per request
+};
+
+std::string sibling_server() {
+    char path[4096];
+    const ssize_t length = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0) {
+        return "digit_server";
+    }
+    const std::string self(path, static_cast<size_t>(length));
+    return self.substr(0, self.rfind('/') + 1) + "digit_server";
+}
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--server") o.server = next();
+        else if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--replicas") o.replicas = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--cores-per-replica")
+            o.cores_per_replica = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--rate") o.rate = std::stod(next());
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--stall-ms") o.stall_ms = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--stall-every-ms")
+            o.stall_every_ms = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--percentile") o.percentile = std::stod(next());
+        else if (arg == "--budget") o.budget = std::stod(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.server.empty()) {
+        o.server = sibling_server();
+    }
+    if (o.replicas < 2) {
+        throw std::invalid_argument("--replicas must be at least 2 to hedge across replicas");
+    }
+    if (o.rate <= 0.0 || o.seconds <= 0.0 || o.stall_every_ms == 0) {
+        throw std::invalid_argument("--rate, --seconds and --stall-every-ms must be positive");
+    }
+    return o;
+}
+
+uint16_t free_port() {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("Cannot find a free port");
+    }
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+Replica start_replica(uint32_t index, const BenchOptions& options) {
+    Replica replica;
+    replica.port = free_port();
+    replica.config_path = "/tmp/digit_hedging_" + std::to_string(::getpid()) + "_" +
+                          std::to_string(index) + ".json";
+    json config;
+    config["server"] = {{"port", replica.port},
+                        {"bind_address", "127.0.0.1"},
+                        {"thread_budget", {{"cores", options.cores_per_replica}}},
+                        {"models", json::array({{{"name", "digit"},
+                                                 {"version", "1"},
+                                                 {"model_path", options.model}}})}};
+    std::ofstream(replica.config_path) << config.dump(2) << std::endl;
+
+    std::cout.flush();
+    replica.pid = ::fork();
+    if (replica.pid < 0) {
+        throw std::runtime_error("Could not fork a replica");
+    }
+    if (replica.pid == 0) {
+        const int null_fd = ::open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            ::dup2(null_fd, STDOUT_FILENO);
+        }
+        ::execl(options.server.c_str(), "digit_server", replica.config_path.c_str(),
+                static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    return replica;
+}
+
+/**
+ * @brief Waits until the replica answers a StatsRequest; returns the document.
+ */
+json fetch_stats(const Replica& replica, std::chrono::seconds patience) {
+    const Clock::time_point give_up = Clock::now() + patience;
+    while (true) {
+        try {
+            ClientConnection probe("127.0.0.1", replica.port, std::chrono::milliseconds(200));
+            return json::parse(probe.fetch_stats(std::chrono::milliseconds(1000)));
+        } catch (const std::exception&) {
+            if (Clock::now() >= give_up ||
+                ::waitpid(replica.pid, nullptr, WNOHANG) == replica.pid) {
+                throw std::runtime_error("Replica on port " + std::to_string(replica.port) +
+                                         " is not answering");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+/**
+ * @brief Requests the replicas have run to completion, over all models.
+ */
+uint64_t server_completed(const std::vector<Replica>& replicas) {
+    uint64_t completed = 0;
+    for (const Replica& replica : replicas) {
+        const json models =
+            fetch_stats(replica, std::chrono::seconds(10)).value("models", json::object());
+        for (const auto& [key, model] : models.items()) {
+            completed += model.value("completed", uint64_t{0});
+        }
+    }
+    return completed;
+}
+
+void stop_replicas(const std::vector<Replica>& replicas) {
+    for (const Replica& replica : replicas) {
+        ::kill(replica.pid, SIGCONT);
+        ::kill(replica.pid, SIGTERM);
+    }
+    for (const Replica& replica : replicas) {
+        ::waitpid(replica.pid, nullptr, 0);
+        ::unlink(replica.config_path.c_str());
+    }
+}
+
+ModeResult run_mode(const std::string& mode, const BenchOptions& options, const MnistSet& mnist,
+                    const std::vector<Replica>& replicas) {
+    InferenceClientOptions client_options;
+    client_options.hedge = mode != "off";
+    client_options.cancel_losers = mode == "hedge";
+    client_options.hedge_percentile = options.percentile;
+    client_options.hedge_budget = options.budget;
+    std::vector<BackendAddress> addresses;
+    for (const Replica& replica : replicas) {
+        addresses.push_back({"127.0.0.1", replica.port});
+    }
+    InferenceClient client(addresses, client_options);
+    const uint64_t completed_before = server_completed(replicas);
+
+    // 1. Stalls on a fixed schedule, the same in every mode
+    std::atomic<bool> stop{false};
+    std::thread staller([&] {
+        std::mt19937 random(42);
+        std::uniform_int_distribution<size_t> which(0, replicas.size() - 1);
+        std::uniform_real_distribution<double> jitter(0.5, 1.5);
+        while (!stop.load()) {
+            std::this_thread::sleep_for(
+                std::chrono::duration<double, std::milli>(options.stall_every_ms * jitter(random)));
+            if (stop.load() || options.stall_ms == 0) {
+                continue;
+            }
+            const Replica& victim = replicas[which(random)];
+            ::kill(victim.pid, SIGSTOP);
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.stall_ms));
+            ::kill(victim.pid, SIGCONT);
+        }
+    });
+
+    // 2. Open loop: requests leave on schedule whether or not earlier ones
+    // have been answered; the first second warms up the hedge delay
+    std::mutex latency_mutex;
+    LatencyHistogram latency;
+    std::atomic<uint64_t> outstanding{0};
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / options.rate));
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point measure_from = start + std::chrono::seconds(1);
+    const Clock::time_point end =
+        measure_from + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(options.seconds));
+    uint64_t sent = 0;
+    uint64_t measured = 0;
+    for (Clock::time_point due = start; due < end; due += interval) {
+        std::this_thread::sleep_until(due);
+        const bool counted = due >= measure_from;
+        measured += counted ? 1 : 0;
+        outstanding.fetch_add(1);
+        const size_t image = sent++ % mnist.count;
+        client.predict_async(
+            mnist.image(image), static_cast<uint16_t>(mnist.cols),
+            static_cast<uint16_t>(mnist.rows), [&, due, counted](const PredictResponse&) {
+                if (counted) {
+                    const auto waited = Clock::now() - due;
+                    std::lock_guard<std::mutex> lock(latency_mutex);
+                    latency.record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()));
+                }
+                outstanding.fetch_sub(1);
+            });
+    }
+    stop.store(true);
+    staller.join();
+    while (outstanding.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // Losers that were not cancelled in time finish shortly after
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    ModeResult result;
+    result.mode = mode;
+    result.requests = measured;
+    result.p50_us = static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+    result.p99_us = static_cast<double>(latency.value_at_percentile(99.0)) / 1000.0;
+    result.p999_us = static_cast<double>(latency.value_at_percentile(99.9)) / 1000.0;
+    result.max_us = static_cast<double>(latency.max()) / 1000.0;
+    result.client = client.stats();
+    result.server_rows = static_cast<double>(server_completed(replicas) - completed_before) /
+                         static_cast<double>(sent);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<Replica> replicas;
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        const MnistSet mnist = load_mnist_idx(options.images);
+        for (uint32_t i = 0; i < options.replicas; ++i) {
+            replicas.push_back(start_replica(i, options));
+        }
+        for (const Replica& replica : replicas) {
+            fetch_stats(replica, std::chrono::seconds(60));
+        }
+
+        std::vector<ModeResult> results;
+        for (const char* mode : {"off", "hedge", "hedge-nocancel"}) {
+            results.push_back(run_mode(mode, options, mnist, replicas));
+        }
+        stop_replicas(replicas);
+        replicas.clear();
+
+        std::printf("\n%u replicas x %u cores, %.0f req/s for %.1f s, %u ms stalls every ~%u ms "
+                    "(%s)\n",
+                    options.replicas, options.cores_per_replica, options.rate, options.seconds,
+                    options.stall_ms, options.stall_every_ms, cpu_model().c_str());
+        std::printf("%-15s %9s %9s %9s %9s %9s %8s %8s %8s %8s %10s\n", "mode", "p50 us",
+                    "p99 us", "p99.9 us", "max us", "delay us", "hedged", "won", "cancels",
+                    "wasted", "extra load");
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["replicas"] = options.replicas;
+        report["rate"] = options.rate;
+        report["stall_ms"] = options.stall_ms;
+        report["stall_every_ms"] = options.stall_every_ms;
+        report["budget"] = options.budget;
+        for (const ModeResult& r : results) {
+            const double requests = static_cast<double>(std::max<uint64_t>(1, r.client.requests));
+            const double hedged = 100.0 * static_cast<double>(r.client.hedged) / requests;
+            const double won = 100.0 * static_cast<double>(r.client.hedge_wins) / requests;
+            const double extra = 100.0 * (r.server_rows - 1.0);
+            std::printf("%-15s %9.0f %9.0f %9.0f %9.0f %9.0f %7.2f%% %7.2f%% %8llu %8llu %9.2f%%\n",
+                        r.mode.c_str(), r.p50_us, r.p99_us, r.p999_us, r.max_us,
+                        r.client.hedge_delay_us, hedged, won,
+                        static_cast<unsigned long long>(r.client.cancels),
+                        static_cast<unsigned long long>(r.client.wasted), extra);
+            report["modes"][r.mode] = {{"requests", r.requests},
+                                       {"p50_us", r.p50_us},
+                                       {"p99_us", r.p99_us},
+                                       {"p999_us", r.p999_us},
+                                       {"max_us", r.max_us},
+                                       {"hedge_delay_us", r.client.hedge_delay_us},
+                                       {"hedged", r.client.hedged},
+                                       {"hedge_wins", r.client.hedge_wins},
+                                       {"hedges_denied", r.client.hedges_denied},
+                                       {"cancels", r.client.cancels},
+                                       {"wasted", r.client.wasted},
+                                       {"server_rows_per_request", r.server_rows}};
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        stop_replicas(replicas);
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,287 @@
+#include "IoEngine.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file io_engine_bench.cpp
+ * @brief Compares the epoll and io_uring engines without a model in the loop.
+ *
+ * Usage: digit_io_bench [--seconds S] [--connections 1,64,1024] [--client-threads T]
+ *
+ * The server answers every PredictRequest on the engine's loop thread, so
+ * the numbers isolate network I/O cost. Each connection runs closed-loop
+ * with one request in flight; latency is measured per request on the
+ * client. Reported per engine and connection count: requests/s, p50/p99
+ * latency, and kernel entries per request on the server.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchConfig {
+    double seconds = 3.0;
+    std::vector<int> connections{1, 64, 1024};
+    int client_threads = 4;
+};
+
+struct BenchResult {
+    uint64_t requests = 0;
+    double seconds = 0.0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double kernel_entries_per_request = 0.0;
+    std::string engine_name;
+};
+
+int connect_loopback(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("socket() failed");
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        throw std::runtime_error(std::string("connect() failed: ") + std::strerror(errno));
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+void raise_fd_limit(size_t needed) {
+    rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed) {
+        limit.rlim_cur = std::min<rlim_t>(needed, limit.rlim_max);
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+/**
+ * @brief Drives a share of the connections from one thread.
+ */
+void client_loop(const std::vector<int>& fds, Clock::time_point deadline,
+                 std::vector<double>& latencies_us) {
+    constexpr size_t RESPONSE_BYTES = sizeof(WireHeader) + sizeof(PredictResponseBody);
+
+    struct ClientConn {
+        int fd = -1;
+        Clock::time_point sent_at;
+        uint64_t next_id = 1;
+        size_t received = 0;
+        uint8_t buffer[RESPONSE_BYTES];
+    };
+
+    int epfd = ::epoll_create1(EPOLL_CLOEXEC);
+    std::vector<ClientConn> conns(fds.size());
+    std::vector<uint8_t> request;
+    uint8_t pixels[28 * 28] = {};
+
+    auto send_request = [&](ClientConn& conn) {
+        request.clear();
+        append_predict_request(request, conn.next_id++, pixels, 28, 28);
+        conn.sent_at = Clock::now();
+        // Small frames on a fresh socket always fit in the send buffer
+        (void)!::send(conn.fd, request.data(), request.size(), MSG_NOSIGNAL);
+    };
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        conns[i].fd = fds[i];
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev);
+        send_request(conns[i]);
+    }
+
+    std::vector<epoll_event> events(256);
+    while (Clock::now() < deadline) {
+        const int ready = ::epoll_wait(epfd, events.data(), static_cast<int>(events.size()), 10);
+        for (int e = 0; e < ready; ++e) {
+            ClientConn& conn = conns[events[e].data.u64];
+            const ssize_t n = ::recv(conn.fd, conn.buffer + conn.received,
+                                     RESPONSE_BYTES - conn.received, 0);
+            if (n <= 0) {
+                continue;
+            }
+            conn.received += static_cast<size_t>(n);
+            if (conn.received < RESPONSE_BYTES) {
+                continue;
+            }
+            conn.received = 0;
+            const std::chrono::duration<double, std::micro> latency = Clock::now() - conn.sent_at;
+            latencies_us.push_back(latency.count());
+            send_request(conn);
+        }
+    }
+    ::close(epfd);
+}
+
+BenchResult run_one(const IoEngineConfig& io_config, int connections, const BenchConfig& bench) {
+    // 1. Server: answer on the loop thread so only I/O is measured
+    IoEngine* engine_ptr = nullptr;
+    auto engine = IoEngine::create(io_config, [&engine_ptr](uint64_t connection_id,
+                                                            const WireHeader& header,
+                                                            const uint8_t* payload) {
+        PredictRequestView view;
+        Prediction prediction;
+        if (decode_predict_request(header, payload, view)) {
+            prediction.digit = view.pixels[0] % 10;
+            prediction.confidence = 1.0f;
+        }
+        std::vector<uint8_t> frame;
+        append_predict_response(frame, header.request_id, WireStatus::Ok, prediction);
+        engine_ptr->send(connection_id, std::move(frame));
+    });
+    engine_ptr = engine.get();
+    std::thread loop([&engine] { engine->run(); });
+
+    // 2. Clients: spread the connections over the client threads
+    const int threads = std::max(1, std::min(bench.client_threads, connections));
+    std::vector<std::vector<int>> fds(threads);
+    for (int i = 0; i < connections; ++i) {
+        fds[i % threads].push_back(connect_loopback(engine->port()));
+    }
+
+    const IoEngineStats before = engine->stats();
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(bench.seconds));
+    std::vector<std::vector<double>> latencies(threads);
+    std::vector<std::thread> clients;
+    for (int t = 0; t < threads; ++t) {
+        clients.emplace_back(client_loop, std::cref(fds[t]), deadline, std::ref(latencies[t]));
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    const IoEngineStats after = engine->stats();
+
+    for (const auto& group : fds) {
+        for (int fd : group) {
+            ::close(fd);
+        }
+    }
+    engine->stop();
+    loop.join();
+
+    // 3. Summarize
+    std::vector<double> all;
+    for (const auto& part : latencies) {
+        all.insert(all.end(), part.begin(), part.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    BenchResult result;
+    result.engine_name = engine->name();
+    result.requests = all.size();
+    result.seconds = elapsed.count();
+    if (!all.empty()) {
+        result.p50_us = all[all.size() / 2];
+        result.p99_us = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+        const uint64_t served = after.frames_received - before.frames_received;
+        result.kernel_entries_per_request =
+            static_cast<double>(after.kernel_entries - before.kernel_entries) /
+            static_cast<double>(std::max<uint64_t>(served, 1));
+    }
+    return result;
+}
+
+std::vector<int> parse_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchConfig bench;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            bench.seconds = std::stod(argv[++i]);
+        } else if (arg == "--connections" && i + 1 < argc) {
+            bench.connections = parse_list(argv[++i]);
+        } else if (arg == "--client-threads" && i + 1 < argc) {
+            bench.client_threads = std::stoi(argv[++i]);
+        } else {
+            std::cerr << "Usage: digit_io_bench [--seconds S] [--connections 1,64,1024] "
+                         "[--client-threads T]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    const int max_connections =
+        *std::max_element(bench.connections.begin(), bench.connections.end());
+    raise_fd_limit(static_cast<size_t>(max_connections) * 2 + 64);
+
+    struct Variant {
+        const char* label;
+        IoEngineKind kind;
+        bool sqpoll;
+    };
+    const Variant variants[] = {
+        {"epoll", IoEngineKind::Epoll, false},
+        {"io_uring", IoEngineKind::IoUring, false},
+        {"io_uring+sqpoll", IoEngineKind::IoUring, true},
+    };
+
+    std::cout << std::left << std::setw(18) << "engine" << std::right << std::setw(8) << "conns"
+              << std::setw(12) << "req/s" << std::setw(10) << "p50 us" << std::setw(10)
+              << "p99 us" << std::setw(14) << "syscalls/req" << std::endl;
+
+    try {
+        for (int connections : bench.connections) {
+            for (const Variant& variant : variants) {
+                IoEngineConfig io;
+                io.port = 0;
+                io.bind_address = "127.0.0.1";
+                io.kind = variant.kind;
+                io.sqpoll = variant.sqpoll;
+
+                const BenchResult r = run_one(io, connections, bench);
+                std::string label = variant.label;
+                if (r.engine_name != std::string(variant.kind == IoEngineKind::Epoll
+                                                     ? "epoll"
+                                                     : "io_uring")) {
+                    label += " (fell back)";
+                }
+                std::cout << std::left << std::setw(18) << label << std::right << std::setw(8)
+                          << connections << std::setw(12) << std::fixed << std::setprecision(0)
+                          << r.requests / r.seconds << std::setw(10) << std::setprecision(1)
+                          << r.p50_us << std::setw(10) << r.p99_us << std::setw(14)
+                          << std::setprecision(3) << r.kernel_entries_per_request << std::endl;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file latency_bench.cpp
+ * @brief predict_batch() latency of any TorchScript models taking
+ * [N, 1, 28, 28], e.g. candidate students from digit-distill.
+ *
+ * Usage: digit_latency_bench --model A.ts[,B.ts...] [--images PATH]
+ *                            [--batches 1,16] [--runs N] [--threads T]
+ *                            [--json PATH]
+ *
+ * Each model is loaded into an InferenceEngine as the server would load
+ * it, warmed up, and timed for N passes (default 2000) per batch size on
+ * one intra-op thread unless T says otherwise. Inputs are t10k images
+ * normalized as for training when --images is given, random otherwise
+ * (the latency of a dense model does not depend on the pixels). Reports
+ * p50, p99 and mean per model and batch, and writes them as JSON for
+ * scripts to read.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t INPUT_POOL = 256; ///< Distinct inputs cycled through
+
+struct BenchOptions {
+    std::vector<std::string> models;
+    std::string images;
+    std::vector<int64_t> batches{1};
+    uint32_t runs = 2000;
+    int threads = 1;
+    std::string json_path;
+};
+
+std::vector<std::string> split_list(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.models = split_list(next());
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--batches") {
+            o.batches.clear();
+            for (const std::string& item : split_list(next())) {
+                o.batches.push_back(std::stoll(item));
+            }
+        }
+        else if (arg == "--runs") o.runs = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--threads") o.threads = std::stoi(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.models.empty()) {
+        throw std::invalid_argument("--model is required");
+    }
+    if (o.batches.empty() || o.runs == 0 || o.threads <= 0) {
+        throw std::invalid_argument("--batches, --runs and --threads must be positive");
+    }
+    for (int64_t batch : o.batches) {
+        if (batch <= 0 || batch > INPUT_POOL) {
+            throw std::invalid_argument("--batches must be between 1 and " +
+                                        std::to_string(INPUT_POOL));
+        }
+    }
+    return o;
+}
+
+/**
+ * @brief INPUT_POOL inputs as [INPUT_POOL, 1, 28, 28].
+ */
+at::Tensor load_inputs(const std::string& images) {
+    if (images.empty()) {
+        return torch::rand({INPUT_POOL, 1, 28, 28})
+            .sub_(ImageProcessor::MNIST_MEAN)
+            .div_(ImageProcessor::MNIST_STD);
+    }
+    const MnistSet mnist = load_mnist_idx(images, "", INPUT_POOL);
+    if (mnist.rows != 28 || mnist.cols != 28 || mnist.count < INPUT_POOL) {
+        throw std::runtime_error("Expected at least " + std::to_string(INPUT_POOL) +
+                                 " 28x28 images in " + images);
+    }
+    return torch::from_blob(const_cast<uint8_t*>(mnist.pixels.data()),
+                            {INPUT_POOL, 1, 28, 28}, torch::kUInt8)
+        .to(torch::kFloat32)
+        .div_(255.0f)
+        .sub_(ImageProcessor::MNIST_MEAN)
+        .div_(ImageProcessor::MNIST_STD);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        at::set_num_threads(options.threads);
+        const at::Tensor inputs = load_inputs(options.images);
+
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["threads"] = options.threads;
+        report["runs"] = options.runs;
+        report["models"] = json::array();
+        std::printf("\n%d intra-op thread(s), %u runs (%s)\n", options.threads, options.runs,
+                    cpu_model().c_str());
+        std::printf("%-40s %6s %11s %10s %10s %10s\n", "model", "batch", "weight B", "p50 us",
+                    "p99 us", "mean us");
+
+        for (const std::string& path : options.models) {
+            InferenceEngine engine(path);
+            for (int64_t batch : options.batches) {
+                // 1. Slices cut up front, so a pass is only predict_batch()
+                std::vector<at::Tensor> slices;
+                for (int64_t begin = 0; begin + batch <= INPUT_POOL; begin += batch) {
+                    slices.push_back(inputs.slice(0, begin, begin + batch).contiguous());
+                }
+                for (uint32_t i = 0; i < std::min<uint32_t>(options.runs, 100); ++i) {
+                    engine.predict_batch(slices[i % slices.size()]);
+                }
+
+                // 2. Timed passes
+                LatencyHistogram latency;
+                double total_ns = 0.0;
+                for (uint32_t i = 0; i < options.runs; ++i) {
+                    const Clock::time_point start = Clock::now();
+                    engine.predict_batch(slices[i % slices.size()]);
+                    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        Clock::now() - start)
+                                        .count();
+                    latency.record(static_cast<uint64_t>(ns));
+                    total_ns += static_cast<double>(ns);
+                }
+                const double p50 = static_cast<double>(latency.value_at_percentile(50.0)) / 1e3;
+                const double p99 = static_cast<double>(latency.value_at_percentile(99.0)) / 1e3;
+                const double mean = total_ns / options.runs / 1e3;
+                std::printf("%-40s %6lld %11zu %10.1f %10.1f %10.1f\n", path.c_str(),
+                            static_cast<long long>(batch), engine.weight_bytes(), p50, p99, mean);
+                report["models"].push_back({{"model", path},
+                                            {"batch", batch},
+                                            {"weight_bytes", engine.weight_bytes()},
+                                            {"quantized_engine", engine.quantized_engine()},
+                                            {"p50_us", p50},
+                                            {"p99_us", p99},
+                                            {"mean_us", mean}});
+            }
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
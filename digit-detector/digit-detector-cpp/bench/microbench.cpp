@@ -0,0 +1,337 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "MnistIdx.h"
+#include "PredictTask.h"
+#include "Renderer.h"
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file microbench.cpp
+ * @brief Google Benchmark suite for the hot-path components.
+ *
+ * Usage: digit_microbench [--benchmark_filter=...] [other benchmark flags]
+ *
+ * Inputs come from the environment so the standard benchmark flags stay
+ * untouched:
+ * - DIGIT_CONFIG        config with model_path (default configs/config.json)
+ * - DIGIT_MNIST_IMAGES  t10k idx3 file (default data/MNIST/raw/t10k-images-idx3-ubyte)
+ *
+ * Every benchmark reports items/s and bytes/s so kernel work can be
+ * compared directly across input sizes and batch sizes.
+ */
+
+namespace {
+
+std::string env_or(const char* name, const std::string& fallback) {
+    const char* value = std::getenv(name);
+    return value != nullptr && *value != '\0' ? value : fallback;
+}
+
+std::string config_path() {
+    return env_or("DIGIT_CONFIG", "configs/config.json");
+}
+
+/**
+ * @brief The MNIST test set, loaded once. Empty if the file is missing.
+ */
+const MnistSet& mnist() {
+    static const MnistSet set = [] {
+        try {
+            return load_mnist_idx(
+                env_or("DIGIT_MNIST_IMAGES", "data/MNIST/raw/t10k-images-idx3-ubyte"), "", 1024);
+        } catch (const std::exception&) {
+            return MnistSet{};
+        }
+    }();
+    return set;
+}
+
+/**
+ * @brief The engine, loaded once. Null if the config or model is missing.
+ */
+InferenceEngine* engine() {
+    static std::unique_ptr<InferenceEngine> instance = []() -> std::unique_ptr<InferenceEngine> {
+        try {
+            std::ifstream config_file(config_path());
+            json config;
+            config_file >> config;
+            return std::make_unique<InferenceEngine>(config.at("model_path").get<std::string>());
+        } catch (const std::exception&) {
+            return nullptr;
+        }
+    }();
+    return instance.get();
+}
+
+/**
+ * @brief Preprocessed MNIST images stacked into a [batch, 1, 28, 28] tensor.
+ */
+torch::Tensor mnist_batch(int64_t batch) {
+    ImageProcessor processor;
+    std::vector<torch::Tensor> rows;
+    rows.reserve(static_cast<size_t>(batch));
+    for (int64_t i = 0; i < batch; ++i) {
+        const size_t index = static_cast<size_t>(i) % mnist().count;
+        cv::Mat image(static_cast<int>(mnist().rows), static_cast<int>(mnist().cols), CV_8UC1,
+                      const_cast<uint8_t*>(mnist().image(index)));
+        rows.push_back(processor.process(image));
+    }
+    return torch::cat(rows, 0);
+}
+
+bool require_inputs(benchmark::State& state, bool need_engine) {
+    if (mnist().count == 0) {
+        state.SkipWithError("MNIST images not found (set DIGIT_MNIST_IMAGES)");
+        return false;
+    }
+    if (need_engine && engine() == nullptr) {
+        state.SkipWithError("Model not found (set DIGIT_CONFIG)");
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// ImageProcessor::process at several canvas sizes
+// ----------------------------------------------------------------------------
+
+void BM_Process(benchmark::State& state) {
+    if (!require_inputs(state, false)) {
+        return;
+    }
+    // Upscale real digits to the benchmarked canvas size ahead of time
+    const int size = static_cast<int>(state.range(0));
+    std::vector<cv::Mat> canvases;
+    for (size_t i = 0; i < 64; ++i) {
+        cv::Mat digit(static_cast<int>(mnist().rows), static_cast<int>(mnist().cols), CV_8UC1,
+                      const_cast<uint8_t*>(mnist().image(i)));
+        cv::Mat canvas;
+        cv::resize(digit, canvas, cv::Size(size, size), 0, 0, cv::INTER_LINEAR);
+        canvases.push_back(canvas);
+    }
+
+    ImageProcessor processor;
+    size_t i = 0;
+    for (auto _ : state) {
+        torch::Tensor tensor = processor.process(canvases[i++ % canvases.size()]);
+        benchmark::DoNotOptimize(tensor);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size) * size);
+}
+BENCHMARK(BM_Process)->Arg(28)->Arg(140)->Arg(280)->Arg(560)->Unit(benchmark::kMicrosecond);
+
+// ----------------------------------------------------------------------------
+// InferenceEngine::predict_batch: batch size x intra-op threads
+// ----------------------------------------------------------------------------
+
+void BM_PredictBatch(benchmark::State& state) {
+    if (!require_inputs(state, true)) {
+        return;
+    }
+    const int64_t batch = state.range(0);
+    const int threads = static_cast<int>(state.range(1));
+    const int previous_threads = at::get_num_threads();
+    at::set_num_threads(threads);
+
+    torch::Tensor input = mnist_batch(batch);
+    for (auto _ : state) {
+        std::vector<Prediction> predictions = engine()->predict_batch(input);
+        benchmark::DoNotOptimize(predictions.data());
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+    state.SetBytesProcessed(state.iterations() * batch * 28 * 28 *
+                            static_cast<int64_t>(sizeof(float)));
+    state.counters["intra_op_threads"] = threads;
+
+    at::set_num_threads(previous_threads);
+}
+BENCHMARK(BM_PredictBatch)
+    ->ArgNames({"batch", "threads"})
+    ->ArgsProduct({{1, 4, 16, 64, 256}, {1, 2, 4, 8}})
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+// Single-image predict called from several application threads at once
+void BM_PredictConcurrent(benchmark::State& state) {
+    if (!require_inputs(state, true)) {
+        return;
+    }
+    torch::Tensor input = mnist_batch(1);
+    for (auto _ : state) {
+        Prediction prediction = engine()->predict(input);
+        benchmark::DoNotOptimize(prediction);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PredictConcurrent)
+    ->ThreadRange(1, 8)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+// ----------------------------------------------------------------------------
+// predict_async from one thread with a window of requests in flight; the
+// executor coalesces whatever is queued into one forward pass
+// ----------------------------------------------------------------------------
+
+void BM_PredictAsync(benchmark::State& state) {
+    if (!require_inputs(state, true)) {
+        return;
+    }
+    const int64_t window = state.range(0);
+    torch::Tensor input = mnist_batch(1);
+    std::mutex mutex;
+    std::condition_variable cv;
+    int64_t in_flight = 0;
+    auto on_done = [&](std::exception_ptr, const Prediction&) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --in_flight;
+        }
+        cv.notify_one();
+    };
+    for (auto _ : state) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return in_flight < window; });
+            ++in_flight;
+        }
+        engine()->predict_async(input, on_done);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return in_flight == 0; });
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PredictAsync)
+    ->ArgName("in_flight")
+    ->Arg(1)->Arg(16)->Arg(256)->Arg(1024)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+Task<int> predict_chain(InferenceEngine& engine, torch::Tensor input, int count) {
+    int digits = 0;
+    for (int i = 0; i < count; ++i) {
+        digits += (co_await predict_co(engine, input)).digit;
+    }
+    co_return digits;
+}
+
+// Coroutine overhead over the future path: sequential co_awaits
+void BM_PredictCoroutine(benchmark::State& state) {
+    if (!require_inputs(state, true)) {
+        return;
+    }
+    torch::Tensor input = mnist_batch(1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sync_wait(predict_chain(*engine(), input, 16)));
+    }
+    state.SetItemsProcessed(state.iterations() * 16);
+}
+BENCHMARK(BM_PredictCoroutine)->Unit(benchmark::kMicrosecond)->UseRealTime();
+#endif
+
+// ----------------------------------------------------------------------------
+// Postprocessing: softmax + argmax over [batch, 10] logits
+// ----------------------------------------------------------------------------
+
+void BM_Postprocess(benchmark::State& state) {
+    const int64_t batch = state.range(0);
+    torch::Tensor logits = torch::randn({batch, 10});
+    for (auto _ : state) {
+        std::vector<Prediction> predictions = InferenceEngine::postprocess(logits);
+        benchmark::DoNotOptimize(predictions.data());
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+    state.SetBytesProcessed(state.iterations() * batch * 10 * static_cast<int64_t>(sizeof(float)));
+}
+BENCHMARK(BM_Postprocess)->RangeMultiplier(4)->Range(1, 256);
+
+// ----------------------------------------------------------------------------
+// Canvas copies: Renderer::get_canvas and the clone it is made of
+// ----------------------------------------------------------------------------
+
+void BM_CanvasClone(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    cv::Mat canvas(size, size, CV_8UC1, cv::Scalar(0));
+    for (auto _ : state) {
+        cv::Mat copy = canvas.clone();
+        benchmark::DoNotOptimize(copy.data);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size) * size);
+}
+BENCHMARK(BM_CanvasClone)->Arg(280)->Arg(560)->Arg(1120);
+
+void BM_RendererGetCanvas(benchmark::State& state) {
+    // Renderer opens a HighGUI window, which needs a display
+    if (std::getenv("DISPLAY") == nullptr && std::getenv("WAYLAND_DISPLAY") == nullptr) {
+        state.SkipWithError("Renderer needs a display (see BM_CanvasClone for the copy cost)");
+        return;
+    }
+    Renderer renderer("digit_microbench");
+    for (auto _ : state) {
+        cv::Mat canvas = renderer.get_canvas();
+        benchmark::DoNotOptimize(canvas.data);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * 280 * 280);
+}
+BENCHMARK(BM_RendererGetCanvas);
+
+// ----------------------------------------------------------------------------
+// Config load: nlohmann::json parse of the shipped config
+// ----------------------------------------------------------------------------
+
+void BM_ConfigParse(benchmark::State& state) {
+    std::ifstream file(config_path());
+    if (!file.is_open()) {
+        state.SkipWithError("Config not found (set DIGIT_CONFIG)");
+        return;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    const std::string contents = text.str();
+
+    for (auto _ : state) {
+        json config = json::parse(contents);
+        benchmark::DoNotOptimize(config);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(contents.size()));
+}
+BENCHMARK(BM_ConfigParse);
+
+// Same, including opening and reading the file as App::load_config does
+void BM_ConfigLoadFile(benchmark::State& state) {
+    const std::string path = config_path();
+    if (!std::ifstream(path).is_open()) {
+        state.SkipWithError("Config not found (set DIGIT_CONFIG)");
+        return;
+    }
+    for (auto _ : state) {
+        std::ifstream file(path);
+        json config;
+        file >> config;
+        benchmark::DoNotOptimize(config);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConfigLoadFile);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,285 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <sched.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @file perf_check.cpp
+ * @brief Performance regression gate run by ctest.
+ *
+ * Usage: digit_perfcheck [--stage preprocess|predict|end_to_end|all]
+ *                        [--baseline-dir DIR] [--update-baseline]
+ *                        [--repetitions N] [--iterations M] [--cpu K]
+ *                        [--threshold 0.05] [--alpha 0.01]
+ *
+ * Each stage is measured as N repetitions of M iterations, pinned to one
+ * CPU, with one intra-op and one inter-op thread, after a full warm-up
+ * repetition. The per-repetition means are compared against the samples
+ * stored in <baseline-dir>/<machine-class>.json with a Mann-Whitney U
+ * test. A stage regresses only if the difference is both significant
+ * (p < alpha) and larger than the threshold.
+ *
+ * Exit codes: 0 pass, 1 regression, 2 usage error, 77 skipped (no
+ * baseline for this machine class, or inputs missing).
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int EXIT_REGRESSION = 1;
+constexpr int EXIT_USAGE = 2;
+constexpr int EXIT_SKIPPED = 77; ///< ctest SKIP_RETURN_CODE
+
+struct CheckOptions {
+    std::string stage = "all";
+    std::string baseline_dir = "bench/baselines";
+    bool update_baseline = false;
+    int repetitions = 20;
+    int iterations = 200;
+    int cpu = 0;
+    double threshold = 0.05;
+    double alpha = 0.01;
+};
+
+std::string env_or(const char* name, const std::string& fallback) {
+    const char* value = std::getenv(name);
+    return value != nullptr && *value != '\0' ? value : fallback;
+}
+
+/**
+ * @brief Runs `body` repetitions x iterations times; returns ns/iteration per repetition.
+ */
+std::vector<double> sample(const CheckOptions& options, const std::function<void(size_t)>& body) {
+    // Warm caches, the allocator and any lazy initialisation first
+    for (int i = 0; i < options.iterations; ++i) {
+        body(static_cast<size_t>(i));
+    }
+    std::vector<double> samples;
+    size_t counter = 0;
+    for (int rep = 0; rep < options.repetitions; ++rep) {
+        const auto start = Clock::now();
+        for (int i = 0; i < options.iterations; ++i) {
+            body(counter++);
+        }
+        const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        samples.push_back(elapsed.count() / options.iterations);
+    }
+    return samples;
+}
+
+void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (::sched_setaffinity(0, sizeof(set), &set) != 0) {
+        std::cerr << "digit_perfcheck: cannot pin to CPU " << cpu << ", running unpinned"
+                  << std::endl;
+    }
+}
+
+std::string format_ns(double ns) {
+    char text[32];
+    if (ns >= 1e6) {
+        std::snprintf(text, sizeof(text), "%.2f ms", ns / 1e6);
+    } else if (ns >= 1e3) {
+        std::snprintf(text, sizeof(text), "%.2f us", ns / 1e3);
+    } else {
+        std::snprintf(text, sizeof(text), "%.0f ns", ns);
+    }
+    return text;
+}
+
+std::string timestamp_utc() {
+    const std::time_t now = std::time(nullptr);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return text;
+}
+
+CheckOptions parse_args(int argc, char** argv) {
+    CheckOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--stage") o.stage = next();
+        else if (arg == "--baseline-dir") o.baseline_dir = next();
+        else if (arg == "--update-baseline") o.update_baseline = true;
+        else if (arg == "--repetitions") o.repetitions = std::stoi(next());
+        else if (arg == "--iterations") o.iterations = std::stoi(next());
+        else if (arg == "--cpu") o.cpu = std::stoi(next());
+        else if (arg == "--threshold") o.threshold = std::stod(next());
+        else if (arg == "--alpha") o.alpha = std::stod(next());
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.repetitions < 8 || o.iterations < 1) {
+        throw std::invalid_argument("Need at least 8 repetitions for the rank test");
+    }
+    return o;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    CheckOptions options;
+    try {
+        options = parse_args(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "digit_perfcheck: " << e.what() << std::endl;
+        return EXIT_USAGE;
+    }
+
+    try {
+        // 1. Inputs: real digits drawn onto 280x280 canvases, like the app's
+        MnistSet mnist;
+        std::unique_ptr<InferenceEngine> engine;
+        try {
+            mnist = load_mnist_idx(
+                env_or("DIGIT_MNIST_IMAGES", "data/MNIST/raw/t10k-images-idx3-ubyte"), "", 256);
+            std::ifstream config_file(env_or("DIGIT_CONFIG", "configs/config.json"));
+            json config;
+            config_file >> config;
+            engine = std::make_unique<InferenceEngine>(config.at("model_path").get<std::string>());
+        } catch (const std::exception& e) {
+            std::cerr << "digit_perfcheck: skipping, inputs unavailable: " << e.what()
+                      << std::endl;
+            return EXIT_SKIPPED;
+        }
+        std::vector<cv::Mat> canvases;
+        for (uint32_t i = 0; i < mnist.count; ++i) {
+            cv::Mat digit(static_cast<int>(mnist.rows), static_cast<int>(mnist.cols), CV_8UC1,
+                          const_cast<uint8_t*>(mnist.image(i)));
+            cv::Mat canvas;
+            cv::resize(digit, canvas, cv::Size(280, 280), 0, 0, cv::INTER_LINEAR);
+            canvases.push_back(canvas);
+        }
+
+        // 2. Fixed execution environment
+        pin_to_cpu(options.cpu);
+        at::set_num_threads(1);
+        at::set_num_interop_threads(1);
+
+        ImageProcessor processor;
+        std::vector<torch::Tensor> tensors;
+        for (const cv::Mat& canvas : canvases) {
+            tensors.push_back(processor.process(canvas));
+        }
+
+        // 3. Stages
+        std::map<std::string, std::function<void(size_t)>> stages;
+        stages["preprocess"] = [&](size_t i) {
+            torch::Tensor t = processor.process(canvases[i % canvases.size()]);
+            (void)t;
+        };
+        stages["predict"] = [&](size_t i) {
+            Prediction p = engine->predict(tensors[i % tensors.size()]);
+            (void)p;
+        };
+        stages["end_to_end"] = [&](size_t i) {
+            Prediction p = engine->predict(processor.process(canvases[i % canvases.size()]));
+            (void)p;
+        };
+        if (options.stage != "all" && stages.count(options.stage) == 0) {
+            std::cerr << "digit_perfcheck: unknown stage " << options.stage << std::endl;
+            return EXIT_USAGE;
+        }
+
+        std::map<std::string, std::vector<double>> current;
+        for (const auto& [name, body] : stages) {
+            if (options.stage == "all" || options.stage == name) {
+                current[name] = sample(options, body);
+            }
+        }
+
+        // 4. Baseline for this machine class
+        const std::string machine = machine_class();
+        const std::filesystem::path baseline_path =
+            std::filesystem::path(options.baseline_dir) / (machine + ".json");
+        json baseline = json::object();
+        if (std::filesystem::exists(baseline_path)) {
+            std::ifstream(baseline_path) >> baseline;
+        }
+
+        if (options.update_baseline) {
+            baseline["machine_class"] = machine;
+            baseline["cpu_model"] = cpu_model();
+            baseline["updated"] = timestamp_utc();
+            baseline["settings"] = {{"repetitions", options.repetitions},
+                                    {"iterations", options.iterations},
+                                    {"intra_op_threads", 1},
+                                    {"interop_threads", 1}};
+            for (const auto& [name, samples] : current) {
+                baseline["stages"][name] = {{"median_ns", median(samples)},
+                                            {"samples_ns", samples}};
+            }
+            std::filesystem::create_directories(options.baseline_dir);
+            std::ofstream(baseline_path) << baseline.dump(2) << std::endl;
+            std::cout << "digit_perfcheck: wrote " << baseline_path.string() << std::endl;
+            return 0;
+        }
+
+        if (!baseline.contains("stages")) {
+            std::cout << "digit_perfcheck: no baseline for machine class '" << machine
+                      << "' (expected " << baseline_path.string()
+                      << "); record one with --update-baseline" << std::endl;
+            return EXIT_SKIPPED;
+        }
+
+        // 5. Compare and print a readable diff
+        std::printf("Perf check against %s\n", baseline_path.string().c_str());
+        std::printf("%-12s %12s %12s %9s %10s  %s\n", "stage", "baseline", "current", "delta",
+                    "p-value", "verdict");
+        bool regressed = false;
+        for (const auto& [name, samples] : current) {
+            if (!baseline["stages"].contains(name)) {
+                std::printf("%-12s %12s %12s %9s %10s  %s\n", name.c_str(), "-",
+                            format_ns(median(samples)).c_str(), "-", "-", "no baseline");
+                continue;
+            }
+            const std::vector<double> reference =
+                baseline["stages"][name]["samples_ns"].get<std::vector<double>>();
+            const double before = median(reference);
+            const double after = median(samples);
+            const double delta = before > 0.0 ? after / before - 1.0 : 0.0;
+            const MannWhitneyResult test = mann_whitney_u(samples, reference);
+
+            const char* verdict = "ok";
+            if (test.p_value < options.alpha && delta > options.threshold) {
+                verdict = "REGRESSED";
+                regressed = true;
+            } else if (test.p_value < options.alpha && delta < -options.threshold) {
+                verdict = "improved";
+            }
+            std::printf("%-12s %12s %12s %+8.1f%% %10.2g  %s\n", name.c_str(),
+                        format_ns(before).c_str(), format_ns(after).c_str(), delta * 100.0,
+                        test.p_value, verdict);
+        }
+        return regressed ? EXIT_REGRESSION : 0;
+
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return EXIT_USAGE;
+    }
+}
@@ -0,0 +1,374 @@
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+#include "PipelineExecutor.h"
+#include "ThreadBudget.h"
+
+#include <sched.h>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file pipeline_bench.cpp
+ * @brief Pipeline-parallel stage placements against data-parallel replicas.
+ *
+ * Usage: digit_pipeline_bench [--model PATH] [--images PATH] [--cores C]
+ *                             [--batch B] [--depth D] [--inflight N]
+ *                             [--seconds S] [--stages SPEC] [--pin]
+ *                             [--json PATH]
+ *
+ * Every placement gets the same C worker processes, one intra-op thread
+ * each, behind the same shared-memory queues:
+ *
+ *  - replicas: one stage with every layer and C workers, i.e. C
+ *    data-parallel copies of the model;
+ *  - conv1 | conv2+fc and conv1+conv2 | fc, each with k workers on the
+ *    first stage and C - k on the second, for a few k between 1 and C - 1;
+ *  - --stages, e.g. "conv1+conv2:3,fc:1", for one placement of your own.
+ *
+ * A closed loop keeps N batches of B t10k images in flight (default 2 C)
+ * for S seconds after a short warm-up. Each placement reports images/s
+ * and that relative to the replicas, p50/p99 batch latency from submit()
+ * to the result, and, per stage, how busy its workers were and how long
+ * they waited on a full next stage. With --pin each worker gets a core of
+ * its own: the first stage the first cores, and so on.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto WARMUP = std::chrono::milliseconds(500);
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    uint32_t cores = 0;
+    uint32_t batch = 16;
+    uint32_t depth = 4;
+    uint32_t inflight = 0;
+    double seconds = 5.0;
+    std::string stages;
+    bool pin = false;
+    std::string json_path;
+};
+
+struct Placement {
+    std::string name;
+    std::vector<PipelineStageOptions> stages;
+};
+
+struct PlacementResult {
+    std::string name;
+    double images_per_second = 0.0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double seconds = 0.0; ///< Measured interval
+    PipelineStats stats;  ///< Over the measured interval only
+};
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--cores") o.cores = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--batch") o.batch = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--depth") o.depth = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--inflight") o.inflight = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--stages") o.stages = next();
+        else if (arg == "--pin") o.pin = true;
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.cores == 0) {
+        o.cores = ThreadBudget::available_cores();
+    }
+    if (o.inflight == 0) {
+        o.inflight = 2 * o.cores;
+    }
+    if (o.batch == 0 || o.seconds <= 0.0) {
+        throw std::invalid_argument("--batch and --seconds must be positive");
+    }
+    return o;
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+PipelineStageOptions stage(const std::string& layers, uint32_t workers) {
+    PipelineStageOptions s;
+    s.layers = split(layers, '+');
+    s.workers = workers;
+    return s;
+}
+
+/**
+ * @brief "conv1+conv2:3,fc:1" as stages.
+ */
+Placement parse_placement(const std::string& spec) {
+    Placement placement{spec, {}};
+    for (const std::string& part : split(spec, ',')) {
+        const size_t colon = part.find(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("--stages wants layers:workers, got " + part);
+        }
+        const auto workers = static_cast<uint32_t>(std::stoul(part.substr(colon + 1)));
+        placement.stages.push_back(stage(part.substr(0, colon), workers));
+    }
+    return placement;
+}
+
+std::vector<Placement> placements(const BenchOptions& options) {
+    const uint32_t cores = options.cores;
+    std::vector<Placement> result{{"replicas", {stage("conv1+conv2+fc", cores)}}};
+    if (!options.stages.empty()) {
+        result.push_back(parse_placement(options.stages));
+        return result;
+    }
+    if (cores < 2) {
+        std::cerr << "Only one core: a two-stage pipeline needs at least two" << std::endl;
+        return result;
+    }
+    const std::set<uint32_t> firsts{1, std::max(1u, cores / 4), std::max(1u, cores / 2),
+                                    std::max(1u, 3 * cores / 4), cores - 1};
+    for (const char* cut : {"conv1|conv2+fc", "conv1+conv2|fc"}) {
+        const std::vector<std::string> halves = split(cut, '|');
+        for (uint32_t first : firsts) {
+            result.push_back({halves[0] + ":" + std::to_string(first) + " | " + halves[1] + ":" +
+                                  std::to_string(cores - first),
+                              {stage(halves[0], first), stage(halves[1], cores - first)}});
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Gives each worker of each stage its own core, in stage order.
+ */
+void pin_stages(std::vector<PipelineStageOptions>& stages) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    size_t next = 0;
+    for (PipelineStageOptions& s : stages) {
+        s.cores.clear();
+        for (uint32_t i = 0; i < s.workers; ++i) {
+            s.cores.push_back(cpus[next++ % cpus.size()]);
+        }
+    }
+}
+
+PipelineStats since(const PipelineStats& now, const PipelineStats& before) {
+    PipelineStats delta = now;
+    delta.batches -= before.batches;
+    delta.rows -= before.rows;
+    delta.submit_blocked_seconds -= before.submit_blocked_seconds;
+    for (size_t i = 0; i < delta.stages.size(); ++i) {
+        delta.stages[i].batches -= before.stages[i].batches;
+        delta.stages[i].rows -= before.stages[i].rows;
+        delta.stages[i].busy_seconds -= before.stages[i].busy_seconds;
+        delta.stages[i].starved_seconds -= before.stages[i].starved_seconds;
+        delta.stages[i].blocked_seconds -= before.stages[i].blocked_seconds;
+    }
+    return delta;
+}
+
+PlacementResult run_placement(InferenceEngine& engine, const Placement& placement,
+                              const BenchOptions& options, const std::vector<float>& inputs,
+                              size_t input_count) {
+    PipelineOptions pipeline_options;
+    pipeline_options.stages = placement.stages;
+    pipeline_options.queue_depth = options.depth;
+    pipeline_options.max_batch = options.batch;
+    if (options.pin) {
+        pin_stages(pipeline_options.stages);
+    }
+    PipelineExecutor pipeline(engine, pipeline_options);
+
+    // 1. Closed loop: a batch goes in as soon as one of the N in flight is answered
+    std::mutex mutex;
+    std::condition_variable answered;
+    uint32_t in_flight = 0;
+    bool measuring = false;
+    LatencyHistogram latency;
+    uint64_t measured_rows = 0;
+    const size_t batches = std::max<size_t>(1, input_count / options.batch);
+
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point measure_from = start + WARMUP;
+    const Clock::time_point end =
+        measure_from + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(options.seconds));
+    PipelineStats before;
+    bool have_before = false;
+    for (size_t next = 0;; ++next) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            answered.wait(lock, [&] { return in_flight < options.inflight; });
+            ++in_flight;
+        }
+        const Clock::time_point now = Clock::now();
+        if (now >= end) {
+            std::lock_guard<std::mutex> lock(mutex);
+            --in_flight;
+            break;
+        }
+        if (!have_before && now >= measure_from) {
+            before = pipeline.stats();
+            have_before = true;
+            std::lock_guard<std::mutex> lock(mutex);
+            measuring = true;
+        }
+        const float* batch =
+            inputs.data() + (next % batches) * options.batch * PipelineExecutor::INPUT_FLOATS;
+        pipeline.submit(batch, options.batch,
+                        [&, now](std::exception_ptr error, const std::vector<Prediction>&) {
+                            const auto waited = Clock::now() - now;
+                            std::lock_guard<std::mutex> lock(mutex);
+                            if (error) {
+                                std::cerr << "Batch failed" << std::endl;
+                            } else if (measuring) {
+                                latency.record(static_cast<uint64_t>(
+                                    std::chrono::duration_cast<std::chrono::nanoseconds>(waited)
+                                        .count()));
+                                measured_rows += options.batch;
+                            }
+                            --in_flight;
+                            answered.notify_one();
+                        });
+    }
+    const PipelineStats after = pipeline.stats();
+    const double elapsed = std::chrono::duration<double>(Clock::now() - measure_from).count();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        measuring = false;
+        answered.wait(lock, [&] { return in_flight == 0; });
+    }
+
+    PlacementResult result;
+    result.name = placement.name;
+    result.seconds = elapsed;
+    result.images_per_second = static_cast<double>(measured_rows) / elapsed;
+    result.p50_us = static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+    result.p99_us = static_cast<double>(latency.value_at_percentile(99.0)) / 1000.0;
+    result.stats = have_before ? since(after, before) : after;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+
+        // 1. Inputs as the server would hand them over: [N, 1, 28, 28] in [0, 1]
+        const MnistSet mnist = load_mnist_idx(options.images);
+        if (mnist.rows != 28 || mnist.cols != 28) {
+            throw std::runtime_error("Expected 28x28 images in " + options.images);
+        }
+        std::vector<float> inputs(mnist.pixels.size());
+        std::transform(mnist.pixels.begin(), mnist.pixels.end(), inputs.begin(),
+                       [](uint8_t pixel) { return static_cast<float>(pixel) / 255.0f; });
+
+        // 2. One intra-op thread in this process, so the workers fork from a
+        // process with no LibTorch pool
+        at::set_num_threads(1);
+        InferenceEngine engine(options.model);
+
+        std::vector<PlacementResult> results;
+        for (const Placement& placement : placements(options)) {
+            results.push_back(run_placement(engine, placement, options, inputs, mnist.count));
+        }
+
+        // 3. Report
+        std::printf("\n%u worker processes, batches of %u, %u in flight, queue depth %u (%s)\n",
+                    options.cores, options.batch, options.inflight, options.depth,
+                    cpu_model().c_str());
+        std::printf("%-28s %11s %8s %9s %9s  %s\n", "placement", "images/s", "vs repl",
+                    "p50 us", "p99 us", "per stage: busy / blocked on next stage");
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["cores"] = options.cores;
+        report["batch"] = options.batch;
+        report["inflight"] = options.inflight;
+        report["queue_depth"] = options.depth;
+        const double baseline = results.front().images_per_second;
+        for (const PlacementResult& r : results) {
+            std::string stages;
+            json stage_reports = json::array();
+            for (const PipelineStageStats& s : r.stats.stages) {
+                const double capacity = r.seconds * s.workers;
+                char text[128];
+                std::snprintf(text, sizeof(text), "%s%s x%u %.0f%% / %.0f%%",
+                              stages.empty() ? "" : " | ", s.layers.c_str(), s.workers,
+                              100.0 * s.busy_seconds / capacity,
+                              100.0 * s.blocked_seconds / capacity);
+                stages += text;
+                stage_reports.push_back({{"layers", s.layers},
+                                         {"workers", s.workers},
+                                         {"busy", s.busy_seconds / capacity},
+                                         {"blocked", s.blocked_seconds / capacity},
+                                         {"starved", s.starved_seconds / capacity}});
+            }
+            std::printf("%-28s %11.0f %7.2fx %9.0f %9.0f  %s\n", r.name.c_str(),
+                        r.images_per_second, r.images_per_second / baseline, r.p50_us, r.p99_us,
+                        stages.c_str());
+            report["placements"].push_back({{"placement", r.name},
+                                            {"images_per_second", r.images_per_second},
+                                            {"vs_replicas", r.images_per_second / baseline},
+                                            {"p50_us", r.p50_us},
+                                            {"p99_us", r.p99_us},
+                                            {"submit_blocked_s", r.stats.submit_blocked_seconds},
+                                            {"stages", stage_reports}});
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "LayerKernels.h"
+#include "MnistIdx.h"
+#include "NativeModel.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @file precision_bench.cpp
+ * @brief fp16 and bf16 weight storage against fp32: accuracy, weight bytes
+ * and batch-1 latency.
+ *
+ * Usage: digit_precision_bench [--model PATH] [--images PATH]
+ *                              [--runs N] [--cold-runs N] [--flush-mb M]
+ *                              [--threads T] [--json PATH]
+ *
+ * Runs all of t10k (labels from the matching idx1 file) through
+ * TorchScript and through NativeModel with these layer precisions:
+ *
+ *  - all fp32 (the layer-by-layer path on LibTorch's kernels);
+ *  - fc1 fp16 and fc1 bf16 (fc1 holds 95% of the weights);
+ *  - every layer fp16, and every layer bf16.
+ *
+ * For each it reports accuracy, how often the predicted digit agrees with
+ * TorchScript's, the largest logit difference from TorchScript, the weight
+ * bytes a pass reads, and batch-1 p50/p99 from input to prediction: warm
+ * (N passes back to back, default 2000) and cold (default 200, each after
+ * writing M MiB, default 64, so that weights and activations come from
+ * memory again). T intra-op threads, default 1.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t EVAL_BATCH = 256;
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    uint32_t runs = 2000;
+    uint32_t cold_runs = 200;
+    uint32_t flush_mb = 64;
+    int threads = 1;
+    std::string json_path;
+};
+
+struct Variant {
+    std::string name;
+    KernelOptions kernels; ///< Empty for TorchScript
+    bool native = false;
+};
+
+struct VariantResult {
+    std::string name;
+    std::string layers;
+    double accuracy = 0.0;
+    double agreement = 0.0;
+    float max_logit_error = 0.0f;
+    size_t weight_bytes = 0;
+    double warm_p50_us = 0.0;
+    double warm_p99_us = 0.0;
+    double cold_p50_us = 0.0;
+    double cold_p99_us = 0.0;
+};
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--runs") o.runs = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--cold-runs") o.cold_runs = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--flush-mb") o.flush_mb = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--threads") o.threads = std::stoi(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.runs == 0 || o.cold_runs == 0 || o.threads <= 0) {
+        throw std::invalid_argument("--runs, --cold-runs and --threads must be positive");
+    }
+    return o;
+}
+
+KernelOptions every_layer(WeightPrecision precision) {
+    KernelOptions kernels;
+    for (const char* layer : {"conv1", "conv2", "fc1", "fc2"}) {
+        kernels.precision[layer] = precision;
+    }
+    return kernels;
+}
+
+std::vector<Variant> variants() {
+    std::vector<Variant> result;
+    result.push_back({"torchscript", {}, false});
+    // Every layer listed as fp32 still takes the layer-by-layer path
+    KernelOptions fp32 = every_layer(WeightPrecision::Fp32);
+    result.push_back({"native fp32", fp32, true});
+    KernelOptions fc1_fp16;
+    fc1_fp16.precision["fc1"] = WeightPrecision::Fp16;
+    result.push_back({"fc1 fp16", fc1_fp16, true});
+    KernelOptions fc1_bf16;
+    fc1_bf16.precision["fc1"] = WeightPrecision::Bf16;
+    result.push_back({"fc1 bf16", fc1_bf16, true});
+    result.push_back({"all fp16", every_layer(WeightPrecision::Fp16), true});
+    result.push_back({"all bf16", every_layer(WeightPrecision::Bf16), true});
+    return result;
+}
+
+/**
+ * @brief Writes a buffer larger than the last-level cache, evicting
+ * whatever the last pass left there.
+ */
+void flush_caches(std::vector<char>& buffer) {
+    for (size_t i = 0; i < buffer.size(); i += 64) {
+        buffer[i] = static_cast<char>(buffer[i] + 1);
+    }
+}
+
+/**
+ * @brief Batch-1 p50/p99 of pass(), optionally flushing the caches first.
+ */
+void time_batch_1(const std::function<void(const at::Tensor&)>& pass,
+                  const std::vector<at::Tensor>& singles, uint32_t runs,
+                  std::vector<char>* flush, double& p50_us, double& p99_us) {
+    LatencyHistogram latency;
+    for (uint32_t i = 0; i < runs; ++i) {
+        if (flush) {
+            flush_caches(*flush);
+        }
+        const at::Tensor& input = singles[i % singles.size()];
+        const Clock::time_point start = Clock::now();
+        pass(input);
+        latency.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+    }
+    p50_us = static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+    p99_us = static_cast<double>(latency.value_at_percentile(99.0)) / 1000.0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        at::set_num_threads(options.threads);
+
+        // 1. All of t10k as [N, 1, 28, 28], normalized as for training, with its labels
+        const MnistSet mnist =
+            load_mnist_idx(options.images, mnist_labels_path_for(options.images));
+        if (mnist.rows != 28 || mnist.cols != 28 || mnist.labels.size() != mnist.count) {
+            throw std::runtime_error("Expected labelled 28x28 images in " + options.images);
+        }
+        const int64_t count = mnist.count;
+        const at::Tensor inputs =
+            torch::from_blob(const_cast<uint8_t*>(mnist.pixels.data()), {count, 1, 28, 28},
+                             torch::kUInt8)
+                .to(torch::kFloat32)
+                .div_(255.0f)
+                .sub_(ImageProcessor::MNIST_MEAN)
+                .div_(ImageProcessor::MNIST_STD);
+        std::vector<at::Tensor> singles;
+        for (int64_t i = 0; i < std::min<int64_t>(count, 1000); ++i) {
+            singles.push_back(inputs.slice(0, i, i + 1).contiguous());
+        }
+
+        // 2. TorchScript's logits, which every variant is compared with
+        InferenceEngine engine(options.model);
+        torch::jit::script::Module reference_model = torch::jit::load(options.model, torch::kCPU);
+        reference_model.eval();
+        std::vector<at::Tensor> reference;
+        {
+            c10::InferenceMode inference_mode;
+            for (int64_t begin = 0; begin < count; begin += EVAL_BATCH) {
+                const at::Tensor batch =
+                    inputs.slice(0, begin, std::min(count, begin + EVAL_BATCH));
+                reference.push_back(reference_model.forward({batch}).toTensor());
+            }
+        }
+        std::vector<char> flush(static_cast<size_t>(options.flush_mb) << 20, 1);
+
+        std::vector<VariantResult> results;
+        for (const Variant& variant : variants()) {
+            VariantResult r;
+            r.name = variant.name;
+
+            // 3. Accuracy and drift over t10k. NativeModel directly rather
+            // than use_kernels(), which leaves an all-fp32 model on TorchScript
+            std::unique_ptr<NativeModel> native;
+            if (variant.native) {
+                native = std::make_unique<NativeModel>(engine, variant.kernels);
+                r.layers = native->describe();
+                r.weight_bytes = native->weight_bytes();
+            } else {
+                r.layers = "TorchScript graph";
+                r.weight_bytes = engine.weight_bytes();
+            }
+            int64_t correct = 0;
+            int64_t agree = 0;
+            {
+                c10::InferenceMode inference_mode;
+                for (size_t b = 0; b < reference.size(); ++b) {
+                    const int64_t begin = static_cast<int64_t>(b) * EVAL_BATCH;
+                    const at::Tensor batch =
+                        inputs.slice(0, begin, std::min(count, begin + EVAL_BATCH));
+                    const at::Tensor logits = native ? native->forward(batch) : reference[b];
+                    r.max_logit_error = std::max(
+                        r.max_logit_error, (logits - reference[b]).abs().max().item<float>());
+                    const at::Tensor digits = logits.argmax(1).contiguous();
+                    const at::Tensor expected = reference[b].argmax(1).contiguous();
+                    for (int64_t i = 0; i < digits.size(0); ++i) {
+                        const int64_t digit = digits.data_ptr<int64_t>()[i];
+                        correct += digit == mnist.labels[static_cast<size_t>(begin + i)];
+                        agree += digit == expected.data_ptr<int64_t>()[i];
+                    }
+                }
+            }
+            r.accuracy = static_cast<double>(correct) / static_cast<double>(count);
+            r.agreement = static_cast<double>(agree) / static_cast<double>(count);
+
+            // 4. Batch-1 latency, logits to prediction as predict_batch() does it
+            std::function<void(const at::Tensor&)> pass = [&](const at::Tensor& input) {
+                if (native) {
+                    c10::InferenceMode inference_mode;
+                    InferenceEngine::postprocess(native->forward(input));
+                } else {
+                    engine.predict_batch(input);
+                }
+            };
+            time_batch_1(pass, singles, std::min<uint32_t>(options.runs, 100), nullptr,
+                         r.warm_p50_us, r.warm_p99_us); // Warm-up
+            time_batch_1(pass, singles, options.runs, nullptr, r.warm_p50_us, r.warm_p99_us);
+            time_batch_1(pass, singles, options.cold_runs, &flush, r.cold_p50_us,
+                         r.cold_p99_us);
+            results.push_back(r);
+        }
+
+        // 5. Report
+        std::printf("\nt10k, %lld images, %d intra-op thread(s), fp16 on %s, bf16 on %s (%s)\n",
+                    static_cast<long long>(count), options.threads,
+                    kernel_isa(WeightPrecision::Fp16).c_str(),
+                    kernel_isa(WeightPrecision::Bf16).c_str(), cpu_model().c_str());
+        std::printf("%-12s %9s %9s %10s %11s %9s %9s %9s %9s\n", "variant", "accuracy", "agree",
+                    "max |dlog|", "weight B", "warm p50", "warm p99", "cold p50", "cold p99");
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["images"] = count;
+        report["threads"] = options.threads;
+        report["flush_mb"] = options.flush_mb;
+        for (const VariantResult& r : results) {
+            std::printf("%-12s %8.2f%% %8.2f%% %10.5f %11zu %9.1f %9.1f %9.1f %9.1f\n",
+                        r.name.c_str(), 100.0 * r.accuracy, 100.0 * r.agreement,
+                        r.max_logit_error, r.weight_bytes, r.warm_p50_us, r.warm_p99_us,
+                        r.cold_p50_us, r.cold_p99_us);
+            report["variants"].push_back({{"variant", r.name},
+                                          {"layers", r.layers},
+                                          {"accuracy", r.accuracy},
+                                          {"agreement", r.agreement},
+                                          {"max_logit_error", r.max_logit_error},
+                                          {"weight_bytes", r.weight_bytes},
+                                          {"warm_p50_us", r.warm_p50_us},
+                                          {"warm_p99_us", r.warm_p99_us},
+                                          {"cold_p50_us", r.cold_p50_us},
+                                          {"cold_p99_us", r.cold_p99_us}});
+        }
+        std::printf("(latencies in us, batch 1)\n");
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
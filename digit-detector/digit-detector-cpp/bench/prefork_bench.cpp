@@ -0,0 +1,367 @@
+#include "ClientConnection.h"
+#include "InferenceServer.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+#include "PreforkServer.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file prefork_bench.cpp
+ * @brief Memory and throughput of N prefork workers against N independent processes.
+ *
+ * Usage: digit_prefork_bench [--model PATH] [--images PATH] [--workers N]
+ *                            [--connections C] [--pipeline D] [--seconds S]
+ *                            [--json PATH]
+ *
+ * Two ways to run N server processes on one SO_REUSEPORT port:
+ *
+ *  - independent: N copies of this program started with exec, each
+ *    loading the model itself, as a process manager would run them;
+ *  - prefork: a PreforkServer, which loads and freezes the model once
+ *    and forks the N workers.
+ *
+ * Each is driven for S seconds by C connections (default 4 per worker),
+ * each keeping D t10k images in flight, and reports the aggregate
+ * requests/s. Then, with the workers still running, each worker's
+ * footprint is read from /proc: RSS, and the unique set size (pages no
+ * other process maps), which is what each extra worker really costs.
+ * Total PSS counts every page once across the workers (and, for prefork,
+ * the parent holding the original copy). Independent runs first, so the
+ * benchmark process itself has not loaded LibTorch's model when it forks.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    uint32_t workers = 0;
+    size_t connections = 0;
+    size_t pipeline = 8;
+    double seconds = 5.0;
+    std::string json_path;
+};
+
+struct ModeResult {
+    double requests_per_second = 0.0;
+    std::vector<MemoryFootprint> workers;
+    MemoryFootprint parent; ///< Prefork only: the process holding the original pages
+};
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--workers") o.workers = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--connections") o.connections = std::stoul(next());
+        else if (arg == "--pipeline") o.pipeline = std::stoul(next());
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.workers == 0) {
+        o.workers = ThreadBudget::available_cores();
+    }
+    if (o.connections == 0) {
+        o.connections = 4 * static_cast<size_t>(o.workers);
+    }
+    if (o.pipeline == 0 || o.seconds <= 0.0) {
+        throw std::invalid_argument("--pipeline and --seconds must be positive");
+    }
+    return o;
+}
+
+ModelConfig model_config(const std::string& path) {
+    ModelConfig model;
+    model.model_path = path;
+    return model;
+}
+
+/**
+ * @brief An ephemeral port both modes' workers can join with SO_REUSEPORT.
+ */
+int reserve_port(uint16_t& port) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("Cannot reserve a port");
+    }
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/**
+ * @brief Reads one pid per worker from the ready pipe.
+ */
+std::vector<pid_t> wait_ready(int ready_fd, uint32_t workers) {
+    std::vector<pid_t> pids;
+    while (pids.size() < workers) {
+        pid_t pid = 0;
+        if (::read(ready_fd, &pid, sizeof(pid)) != sizeof(pid)) {
+            throw std::runtime_error("A worker exited before it was ready");
+        }
+        pids.push_back(pid);
+    }
+    return pids;
+}
+
+/**
+ * @brief Closed-loop load over C connections with D requests in flight
+ * on each; returns responses per second.
+ */
+double drive(uint16_t port, const MnistSet& mnist, const BenchOptions& options) {
+    std::atomic<uint64_t> responses{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < options.connections; ++c) {
+        clients.emplace_back([&, c] {
+            try {
+                ClientConnection connection("127.0.0.1", port);
+                uint64_t next = c * 1000003; // Different images on every connection
+                auto send_one = [&] {
+                    const size_t image = next % mnist.count;
+                    connection.send_predict(next++, mnist.image(image),
+                                            static_cast<uint16_t>(mnist.cols),
+                                            static_cast<uint16_t>(mnist.rows));
+                };
+                for (size_t i = 0; i < options.pipeline; ++i) {
+                    send_one();
+                }
+                std::vector<PredictResponse> out;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    out.clear();
+                    connection.read_responses(out, std::chrono::milliseconds(100));
+                    responses.fetch_add(out.size(), std::memory_order_relaxed);
+                    for (size_t i = 0; i < out.size(); ++i) {
+                        send_one();
+                    }
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Client " << c << ": " << e.what() << std::endl;
+            }
+        });
+    }
+    // The first second warms up connections and batchers
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const uint64_t start_count = responses.load();
+    const Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    const uint64_t end_count = responses.load();
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    stop.store(true);
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    return static_cast<double>(end_count - start_count) / elapsed.count();
+}
+
+void stop_processes(const std::vector<pid_t>& pids) {
+    for (pid_t pid : pids) {
+        ::kill(pid, SIGTERM);
+    }
+    for (pid_t pid : pids) {
+        ::waitpid(pid, nullptr, 0);
+    }
+}
+
+ModeResult run_independent(const BenchOptions& options, const MnistSet& mnist) {
+    uint16_t port = 0;
+    const int port_fd = reserve_port(port);
+    int ready[2];
+    if (::pipe(ready) != 0) {
+        throw std::runtime_error("pipe() failed");
+    }
+    const uint32_t cores = std::max(1u, ThreadBudget::available_cores() / options.workers);
+
+    // 1. N fresh processes, each loading the model as if started by hand
+    std::vector<pid_t> pids;
+    for (uint32_t i = 0; i < options.workers; ++i) {
+        const pid_t pid = ::fork();
+        if (pid == 0) {
+            const std::string port_arg = std::to_string(port);
+            const std::string fd_arg = std::to_string(ready[1]);
+            const std::string cores_arg = std::to_string(cores);
+            ::execl("/proc/self/exe", "digit_prefork_bench", "--serve", port_arg.c_str(),
+                    "--ready-fd", fd_arg.c_str(), "--cores", cores_arg.c_str(), "--model",
+                    options.model.c_str(), static_cast<char*>(nullptr));
+            ::_exit(127);
+        }
+        pids.push_back(pid);
+    }
+    ::close(ready[1]);
+    wait_ready(ready[0], options.workers);
+    ::close(ready[0]);
+
+    // 2. Load, then memory while they still run
+    ModeResult result;
+    result.requests_per_second = drive(port, mnist, options);
+    for (pid_t pid : pids) {
+        result.workers.push_back(memory_footprint(pid));
+    }
+    stop_processes(pids);
+    ::close(port_fd);
+    return result;
+}
+
+ModeResult run_prefork(const BenchOptions& options, const MnistSet& mnist) {
+    int ready[2];
+    if (::pipe(ready) != 0) {
+        throw std::runtime_error("pipe() failed");
+    }
+    PreforkOptions prefork;
+    prefork.workers = options.workers;
+    prefork.ready_fd = ready[1];
+    prefork.server.io.port = 0;
+    prefork.server.io.bind_address = "127.0.0.1";
+    PreforkServer server({model_config(options.model)}, prefork);
+    server.start();
+    const std::vector<pid_t> pids = wait_ready(ready[0], options.workers);
+    ::close(ready[0]);
+    ::close(ready[1]);
+
+    ModeResult result;
+    result.requests_per_second = drive(server.port(), mnist, options);
+    for (pid_t pid : pids) {
+        result.workers.push_back(memory_footprint(pid));
+    }
+    result.parent = memory_footprint();
+    server.shutdown();
+    return result;
+}
+
+/**
+ * @brief Body of one independent worker (--serve PORT).
+ */
+int serve(int argc, char** argv) {
+    uint16_t port = 0;
+    int ready_fd = -1;
+    uint32_t cores = 0;
+    std::string model = "models/digit_model.ts";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string arg = argv[i];
+        if (arg == "--serve") port = static_cast<uint16_t>(std::stoul(argv[i + 1]));
+        else if (arg == "--ready-fd") ready_fd = std::stoi(argv[i + 1]);
+        else if (arg == "--cores") cores = static_cast<uint32_t>(std::stoul(argv[i + 1]));
+        else if (arg == "--model") model = argv[i + 1];
+    }
+    static InferenceServer* server = nullptr;
+    std::signal(SIGTERM, [](int) {
+        if (server) {
+            server->stop();
+        }
+    });
+    InferenceServerOptions options;
+    options.io.port = port;
+    options.io.bind_address = "127.0.0.1";
+    options.io.reuse_port = true;
+    options.threads.cores = cores;
+    InferenceServer instance({model_config(model)}, options);
+    server = &instance;
+    const pid_t pid = ::getpid();
+    if (::write(ready_fd, &pid, sizeof(pid)) != sizeof(pid)) {
+        return 1;
+    }
+    instance.run();
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        if (argc > 1 && std::string(argv[1]) == "--serve") {
+            return serve(argc, argv);
+        }
+        const BenchOptions options = parse_args(argc, argv);
+        const MnistSet mnist = load_mnist_idx(options.images);
+
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["workers"] = options.workers;
+        report["connections"] = options.connections;
+        report["pipeline"] = options.pipeline;
+
+        constexpr double MB = 1024.0 * 1024.0;
+        std::vector<std::pair<std::string, ModeResult>> results;
+        results.emplace_back("independent", run_independent(options, mnist));
+        results.emplace_back("prefork", run_prefork(options, mnist));
+
+        std::printf("\n%u workers, %zu connections x %zu in flight, %.1f s (%s)\n",
+                    options.workers, options.connections, options.pipeline, options.seconds,
+                    cpu_model().c_str());
+        std::printf("%-12s %12s %14s %16s %14s\n", "mode", "requests/s", "RSS MB/worker",
+                    "unique MB/worker", "total PSS MB");
+        for (const auto& [mode, r] : results) {
+            MemoryFootprint sum = r.parent;
+            for (const MemoryFootprint& worker : r.workers) {
+                sum.rss += worker.rss;
+                sum.pss += worker.pss;
+                sum.private_bytes += worker.private_bytes;
+            }
+            const double n = static_cast<double>(r.workers.size());
+            const double rss = static_cast<double>(sum.rss - r.parent.rss) / n;
+            const double unique =
+                static_cast<double>(sum.private_bytes - r.parent.private_bytes) / n;
+            std::printf("%-12s %12.0f %14.1f %16.1f %14.1f\n", mode.c_str(),
+                        r.requests_per_second, rss / MB, unique / MB,
+                        static_cast<double>(sum.pss) / MB);
+            json workers = json::array();
+            for (const MemoryFootprint& worker : r.workers) {
+                workers.push_back({{"rss_bytes", worker.rss},
+                                   {"pss_bytes", worker.pss},
+                                   {"unique_bytes", worker.private_bytes},
+                                   {"shared_bytes", worker.shared_bytes}});
+            }
+            report["modes"][mode] = {{"requests_per_second", r.requests_per_second},
+                                     {"workers", workers},
+                                     {"parent_pss_bytes", r.parent.pss},
+                                     {"total_pss_bytes", sum.pss}};
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
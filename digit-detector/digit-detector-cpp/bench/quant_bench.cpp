@@ -0,0 +1,232 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file quant_bench.cpp
+ * @brief fp32 against the int8 model from `digit-train --qat`, both on
+ * InferenceEngine: accuracy, model size and latency.
+ *
+ * Usage: digit_quant_bench [--model PATH] [--quantized PATH] [--images PATH]
+ *                          [--batches 1,16,256] [--seconds S] [--threads T]
+ *                          [--json PATH]
+ *
+ * Loads both models the way the server does and runs all of t10k (labels
+ * from the matching idx1 file) through predict_batch(). Reports, per
+ * model, the quantized engine it selected, the file size, accuracy, how
+ * often it agrees with fp32 and the largest confidence difference from
+ * fp32; then p50 of predict_batch() per batch size, run for about S
+ * seconds (default 1) each, and the int8 speedup. T intra-op threads,
+ * default 1.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t EVAL_BATCH = 256;
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string quantized = "models/digit_model_int8.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    std::vector<int64_t> batches{1, 16, 256};
+    double seconds = 1.0;
+    int threads = 1;
+    std::string json_path;
+};
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--quantized") o.quantized = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--batches") {
+            o.batches.clear();
+            std::stringstream list(next());
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                o.batches.push_back(std::stoll(item));
+            }
+        }
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--threads") o.threads = std::stoi(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.batches.empty() || o.seconds <= 0.0 || o.threads <= 0) {
+        throw std::invalid_argument("--batches, --seconds and --threads must be positive");
+    }
+    for (int64_t batch : o.batches) {
+        if (batch <= 0) {
+            throw std::invalid_argument("--batches must be positive");
+        }
+    }
+    return o;
+}
+
+/**
+ * @brief p50 in microseconds of pass() run for about seconds, after a few
+ * untimed runs.
+ */
+double p50_us(const std::function<void()>& pass, double seconds) {
+    for (int i = 0; i < 3; ++i) {
+        pass();
+    }
+    LatencyHistogram latency;
+    const Clock::time_point end =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(seconds));
+    do {
+        const Clock::time_point start = Clock::now();
+        pass();
+        latency.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+    } while (Clock::now() < end || latency.count() < 5);
+    return static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+}
+
+/**
+ * @brief Every t10k prediction, in order.
+ */
+std::vector<Prediction> predict_all(InferenceEngine& engine, const at::Tensor& inputs) {
+    std::vector<Prediction> predictions;
+    const int64_t count = inputs.size(0);
+    for (int64_t begin = 0; begin < count; begin += EVAL_BATCH) {
+        const std::vector<Prediction> batch =
+            engine.predict_batch(inputs.slice(0, begin, std::min(count, begin + EVAL_BATCH)));
+        predictions.insert(predictions.end(), batch.begin(), batch.end());
+    }
+    return predictions;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        at::set_num_threads(options.threads);
+
+        // 1. All of t10k, normalized as for training, with its labels
+        const MnistSet mnist =
+            load_mnist_idx(options.images, mnist_labels_path_for(options.images));
+        if (mnist.rows != 28 || mnist.cols != 28 || mnist.labels.size() != mnist.count) {
+            throw std::runtime_error("Expected labelled 28x28 images in " + options.images);
+        }
+        const int64_t count = mnist.count;
+        const int64_t largest = *std::max_element(options.batches.begin(), options.batches.end());
+        if (largest > count) {
+            throw std::runtime_error("Fewer images than the largest batch in " + options.images);
+        }
+        const at::Tensor inputs =
+            torch::from_blob(const_cast<uint8_t*>(mnist.pixels.data()), {count, 1, 28, 28},
+                             torch::kUInt8)
+                .to(torch::kFloat32)
+                .div_(255.0f)
+                .sub_(ImageProcessor::MNIST_MEAN)
+                .div_(ImageProcessor::MNIST_STD);
+
+        // 2. Both models, loaded as the server loads them
+        InferenceEngine fp32(options.model);
+        InferenceEngine int8(options.quantized);
+        if (!int8.quantized()) {
+            throw std::runtime_error(options.quantized + " has no quantized modules; export it "
+                                     "with digit-train --qat");
+        }
+        const std::vector<Prediction> reference = predict_all(fp32, inputs);
+
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["images"] = count;
+        report["threads"] = options.threads;
+        std::printf("\nt10k, %lld images, %d intra-op thread(s) (%s)\n",
+                    static_cast<long long>(count), options.threads, cpu_model().c_str());
+        std::printf("%-8s %-8s %11s %9s %9s %10s\n", "model", "engine", "file B", "accuracy",
+                    "agree", "max |dconf|");
+        struct Row {
+            const char* name;
+            InferenceEngine* engine;
+            std::string path;
+        };
+        const Row rows[] = {{"fp32", &fp32, options.model}, {"int8", &int8, options.quantized}};
+
+        // 3. Accuracy and drift from fp32
+        for (const Row& row : rows) {
+            const std::vector<Prediction> predictions = predict_all(*row.engine, inputs);
+            int64_t correct = 0;
+            int64_t agree = 0;
+            float drift = 0.0f;
+            for (size_t i = 0; i < predictions.size(); ++i) {
+                correct += predictions[i].digit == mnist.labels[i];
+                agree += predictions[i].digit == reference[i].digit;
+                if (predictions[i].digit == reference[i].digit) {
+                    drift = std::max(drift, std::abs(predictions[i].confidence -
+                                                     reference[i].confidence));
+                }
+            }
+            const std::string engine =
+                row.engine->quantized() ? row.engine->quantized_engine() : "fp32";
+            const uintmax_t file_bytes = std::filesystem::file_size(row.path);
+            const double accuracy = static_cast<double>(correct) / static_cast<double>(count);
+            const double agreement = static_cast<double>(agree) / static_cast<double>(count);
+            std::printf("%-8s %-8s %11ju %8.2f%% %8.2f%% %10.5f\n", row.name, engine.c_str(),
+                        file_bytes, 100.0 * accuracy, 100.0 * agreement, drift);
+            report["models"].push_back({{"model", row.name},
+                                        {"path", row.path},
+                                        {"engine", engine},
+                                        {"file_bytes", file_bytes},
+                                        {"accuracy", accuracy},
+                                        {"agreement", agreement},
+                                        {"max_confidence_error", drift}});
+        }
+
+        // 4. Latency through predict_batch(), softmax and argmax included
+        std::printf("\n%6s %12s %12s %9s\n", "batch", "fp32 p50", "int8 p50", "speedup");
+        for (int64_t batch : options.batches) {
+            const at::Tensor input = inputs.slice(0, 0, batch).contiguous();
+            const double fp32_us = p50_us([&] { fp32.predict_batch(input); }, options.seconds);
+            const double int8_us = p50_us([&] { int8.predict_batch(input); }, options.seconds);
+            std::printf("%6lld %12.1f %12.1f %8.2fx\n", static_cast<long long>(batch), fp32_us,
+                        int8_us, fp32_us / int8_us);
+            report["latency"].push_back({{"batch", batch},
+                                         {"fp32_p50_us", fp32_us},
+                                         {"int8_p50_us", int8_us},
+                                         {"speedup", fp32_us / int8_us}});
+        }
+        std::printf("(latencies in us per batch)\n");
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+#include "WorkStealingPool.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file scaling_bench.cpp
+ * @brief Core scaling of the MNIST eval workload under three threading setups.
+ *
+ * Usage: digit_scaling_bench [--images PATH] [--labels PATH] [--model PATH]
+ *                            [--max-threads N] [--batch B] [--limit K]
+ *                            [--repeat R] [--pin] [--json PATH]
+ *
+ * The workload is the t10k evaluation end to end: every digit is drawn on
+ * a 280x280 canvas like the app's, preprocessed, batched and classified,
+ * and the predictions are checked against the labels. For 1, 2, 4 ... N
+ * cores it is run as
+ *
+ *  - intra_op: one thread walks the batches and LibTorch's intra-op pool
+ *    gets the N cores (the behaviour before the executor existed);
+ *  - pool: a WorkStealingPool of N workers runs the batches as tasks and
+ *    LibTorch gets one thread per pass, so nothing else competes for the
+ *    cores;
+ *  - pool_oversubscribed: the same pool with N intra-op threads, i.e. the
+ *    two thread pools fighting.
+ *
+ * All threads share one engine, whose forward passes run concurrently.
+ * The best of R runs is reported.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int CANVAS_SIZE = 280;
+
+struct BenchOptions {
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    std::string labels;
+    std::string model = "models/digit_model.ts";
+    size_t max_threads = 0;
+    size_t batch = 64;
+    size_t limit = 0;
+    int repeat = 3;
+    bool pin = false;
+    std::string json_path;
+};
+
+struct RunResult {
+    double images_per_second = 0.0;
+    double accuracy = 0.0;
+};
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--images") o.images = next();
+        else if (arg == "--labels") o.labels = next();
+        else if (arg == "--model") o.model = next();
+        else if (arg == "--max-threads") o.max_threads = std::stoul(next());
+        else if (arg == "--batch") o.batch = std::stoul(next());
+        else if (arg == "--limit") o.limit = std::stoul(next());
+        else if (arg == "--repeat") o.repeat = std::stoi(next());
+        else if (arg == "--pin") o.pin = true;
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.batch == 0 || o.repeat < 1) {
+        throw std::invalid_argument("--batch and --repeat must be at least 1");
+    }
+    return o;
+}
+
+/**
+ * @brief Preprocesses and classifies images [first, last); returns how many were right.
+ */
+size_t eval_range(const MnistSet& mnist, size_t first, size_t last, ImageProcessor& processor,
+                  InferenceEngine& engine) {
+    std::vector<torch::Tensor> tensors;
+    tensors.reserve(last - first);
+    cv::Mat canvas;
+    for (size_t i = first; i < last; ++i) {
+        cv::Mat digit(static_cast<int>(mnist.rows), static_cast<int>(mnist.cols), CV_8UC1,
+                      const_cast<uint8_t*>(mnist.image(i)));
+        cv::resize(digit, canvas, cv::Size(CANVAS_SIZE, CANVAS_SIZE), 0, 0, cv::INTER_LINEAR);
+        tensors.push_back(processor.process(canvas));
+    }
+    const std::vector<Prediction> predictions = engine.predict_batch(torch::cat(tensors, 0));
+    size_t correct = 0;
+    for (size_t i = 0; i < predictions.size(); ++i) {
+        if (!mnist.labels.empty() && predictions[i].digit == mnist.labels[first + i]) {
+            ++correct;
+        }
+    }
+    return correct;
+}
+
+RunResult finish(const MnistSet& mnist, Clock::time_point start, size_t correct) {
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    RunResult r;
+    r.images_per_second = static_cast<double>(mnist.count) / elapsed.count();
+    r.accuracy = static_cast<double>(correct) / static_cast<double>(mnist.count);
+    return r;
+}
+
+RunResult run_intra_op(const BenchOptions& options, const MnistSet& mnist, size_t threads,
+                       InferenceEngine& engine) {
+    at::set_num_threads(static_cast<int>(threads));
+    ImageProcessor processor;
+    const Clock::time_point start = Clock::now();
+    size_t correct = 0;
+    for (size_t first = 0; first < mnist.count; first += options.batch) {
+        correct += eval_range(mnist, first, std::min<size_t>(mnist.count, first + options.batch),
+                              processor, engine);
+    }
+    return finish(mnist, start, correct);
+}
+
+RunResult run_pool(const BenchOptions& options, const MnistSet& mnist, WorkStealingPool& pool,
+                   InferenceEngine& engine, int intra_op) {
+    at::set_num_threads(intra_op);
+    const size_t batches = (mnist.count + options.batch - 1) / options.batch;
+    std::atomic<size_t> correct{0};
+    const Clock::time_point start = Clock::now();
+    pool.parallel_for(0, batches, 1, [&](size_t b) {
+        thread_local ImageProcessor processor;
+        const size_t first = b * options.batch;
+        correct += eval_range(mnist, first, std::min<size_t>(mnist.count, first + options.batch),
+                              processor, engine);
+    });
+    return finish(mnist, start, correct.load());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        const std::string labels =
+            options.labels.empty() ? mnist_labels_path_for(options.images) : options.labels;
+        const MnistSet mnist = load_mnist_idx(options.images, labels, options.limit);
+        const size_t max_threads =
+            options.max_threads != 0 ? options.max_threads
+                                     : std::max(1u, std::thread::hardware_concurrency());
+
+        std::vector<size_t> counts;
+        for (size_t n = 1; n < max_threads; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(max_threads);
+
+        std::printf("%u images, batch %zu, %zu cores max, best of %d (%s)\n", mnist.count,
+                    options.batch, max_threads, options.repeat, cpu_model().c_str());
+        std::printf("%-20s %7s %12s %8s %10s %9s\n", "mode", "threads", "images/s", "speedup",
+                    "efficiency", "accuracy");
+
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["images"] = mnist.count;
+        report["batch"] = options.batch;
+        report["pinned"] = options.pin;
+
+        InferenceEngine engine(options.model);
+        for (const char* mode : {"intra_op", "pool", "pool_oversubscribed"}) {
+            const std::string name = mode;
+            double base = 0.0;
+            for (size_t threads : counts) {
+                std::unique_ptr<WorkStealingPool> pool;
+                if (name != "intra_op") {
+                    pool = std::make_unique<WorkStealingPool>(
+                        ExecutorConfig{static_cast<uint32_t>(threads), options.pin});
+                }
+
+                RunResult best;
+                for (int rep = 0; rep < options.repeat; ++rep) {
+                    const RunResult r =
+                        name == "intra_op"
+                            ? run_intra_op(options, mnist, threads, engine)
+                        : name == "pool"
+                            ? run_pool(options, mnist, *pool, engine, 1)
+                            : run_pool(options, mnist, *pool, engine, static_cast<int>(threads));
+                    if (r.images_per_second > best.images_per_second) {
+                        best = r;
+                    }
+                }
+                if (threads == 1) {
+                    base = best.images_per_second;
+                }
+                const double speedup = base > 0.0 ? best.images_per_second / base : 0.0;
+                std::printf("%-20s %7zu %12.0f %7.2fx %9.0f%% %8.2f%%\n", mode, threads,
+                            best.images_per_second, speedup,
+                            100.0 * speedup / static_cast<double>(threads),
+                            100.0 * best.accuracy);
+                std::fflush(stdout);
+                report["modes"][name].push_back({{"threads", threads},
+                                                 {"images_per_second", best.images_per_second},
+                                                 {"speedup", speedup},
+                                                 {"accuracy", best.accuracy}});
+            }
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "LayerKernels.h"
+#include "MnistIdx.h"
+#include "NativeModel.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file sparse_bench.cpp
+ * @brief Block-sparse fc1 against dense: latency by sparsity, and the
+ * accuracy of models pruned by digit-prune.
+ *
+ * Usage: digit_sparse_bench [--model PATH] [--images PATH] [--pruned A.ts,B.ts]
+ *                           [--block RxC] [--sparsities 0.5,0.8,0.9,0.95]
+ *                           [--batches 1,16] [--seconds S] [--threads T]
+ *                           [--json PATH]
+ *
+ * 1. fc1 alone, on its real inputs (t10k through the conv layers): the
+ *    model's weights with the weakest RxC blocks (default 4x16) zeroed,
+ *    by L2 norm and without fine-tuning, for each sparsity. Reports p50
+ *    per batch for LibTorch's dense linear and for BlockSparseLinear, the
+ *    speedup, the bytes each reads, and the largest output difference
+ *    between them (the kernel's own error, not pruning's).
+ *
+ * 2. Each pruned model X.ts next to its X.fc1.bsr: t10k accuracy (labels
+ *    from the matching idx1 file) of the dense model, of X.ts on
+ *    TorchScript and of X.ts with fc1 block-sparse, and the whole model's
+ *    p50 per batch on each, against the dense model's.
+ *
+ * About S seconds (default 1) per measurement, T intra-op threads
+ * (default 1).
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t EVAL_BATCH = 256;
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    std::vector<std::string> pruned;
+    size_t block_rows = 4;
+    size_t block_cols = 16;
+    std::vector<double> sparsities{0.5, 0.8, 0.9, 0.95};
+    std::vector<int64_t> batches{1, 16};
+    double seconds = 1.0;
+    int threads = 1;
+    std::string json_path;
+};
+
+std::vector<std::string> split_list(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--pruned") o.pruned = split_list(next());
+        else if (arg == "--block") {
+            const std::string block = next();
+            const size_t x = block.find('x');
+            if (x == std::string::npos) {
+                throw std::invalid_argument("--block takes RxC, e.g. 4x16");
+            }
+            o.block_rows = std::stoul(block.substr(0, x));
+            o.block_cols = std::stoul(block.substr(x + 1));
+        }
+        else if (arg == "--sparsities") {
+            o.sparsities.clear();
+            for (const std::string& item : split_list(next())) {
+                o.sparsities.push_back(std::stod(item));
+            }
+        }
+        else if (arg == "--batches") {
+            o.batches.clear();
+            for (const std::string& item : split_list(next())) {
+                o.batches.push_back(std::stoll(item));
+            }
+        }
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--threads") o.threads = std::stoi(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.batches.empty() || o.seconds <= 0.0 || o.threads <= 0) {
+        throw std::invalid_argument("--batches, --seconds and --threads must be positive");
+    }
+    for (int64_t batch : o.batches) {
+        if (batch <= 0) {
+            throw std::invalid_argument("--batches must be positive");
+        }
+    }
+    for (double sparsity : o.sparsities) {
+        if (sparsity < 0.0 || sparsity >= 1.0) {
+            throw std::invalid_argument("--sparsities must be in [0, 1)");
+        }
+    }
+    return o;
+}
+
+/**
+ * @brief p50 in microseconds of pass() run for about seconds, after a few
+ * untimed runs.
+ */
+double p50_us(const std::function<void()>& pass, double seconds) {
+    for (int i = 0; i < 3; ++i) {
+        pass();
+    }
+    LatencyHistogram latency;
+    const Clock::time_point end =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(seconds));
+    do {
+        const Clock::time_point start = Clock::now();
+        pass();
+        latency.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+    } while (Clock::now() < end || latency.count() < 5);
+    return static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+}
+
+/**
+ * @brief weight [outputs, inputs] with the share sparsity of its RxC blocks
+ * that have the smallest L2 norm set to zero, as digit-prune's first step.
+ */
+std::vector<float> prune_blocks(const float* weight, size_t outputs, size_t inputs, size_t rows,
+                                size_t cols, double sparsity) {
+    const size_t block_cols = inputs / cols;
+    std::vector<float> norms((outputs / rows) * block_cols, 0.0f);
+    for (size_t o = 0; o < outputs; ++o) {
+        for (size_t k = 0; k < inputs; ++k) {
+            const float w = weight[o * inputs + k];
+            norms[(o / rows) * block_cols + k / cols] += w * w;
+        }
+    }
+    std::vector<size_t> order(norms.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return norms[a] < norms[b]; });
+    std::vector<float> pruned(weight, weight + outputs * inputs);
+    const size_t count = static_cast<size_t>(std::llround(sparsity * norms.size()));
+    for (size_t i = 0; i < count; ++i) {
+        const size_t br = order[i] / block_cols;
+        const size_t bc = order[i] % block_cols;
+        for (size_t r = 0; r < rows; ++r) {
+            float* row = pruned.data() + (br * rows + r) * inputs + bc * cols;
+            std::fill(row, row + cols, 0.0f);
+        }
+    }
+    return pruned;
+}
+
+/**
+ * @brief X.ts to X.fc1.bsr, as digit-prune names them.
+ */
+std::string bsr_path_for(const std::string& model_path) {
+    const std::string suffix = ".ts";
+    std::string stem = model_path;
+    if (stem.size() > suffix.size() &&
+        stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        stem.resize(stem.size() - suffix.size());
+    }
+    return stem + ".fc1.bsr";
+}
+
+/**
+ * @brief Share of the labels that forward() gets right.
+ */
+double accuracy(const std::function<at::Tensor(const at::Tensor&)>& forward,
+                const at::Tensor& inputs, const MnistSet& mnist) {
+    c10::InferenceMode inference_mode;
+    const int64_t count = inputs.size(0);
+    int64_t correct = 0;
+    for (int64_t begin = 0; begin < count; begin += EVAL_BATCH) {
+        const at::Tensor batch = inputs.slice(0, begin, std::min(count, begin + EVAL_BATCH));
+        const at::Tensor digits = forward(batch).argmax(1).contiguous();
+        for (int64_t i = 0; i < digits.size(0); ++i) {
+            correct +=
+                digits.data_ptr<int64_t>()[i] == mnist.labels[static_cast<size_t>(begin + i)];
+        }
+    }
+    return static_cast<double>(correct) / static_cast<double>(count);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        at::set_num_threads(options.threads);
+
+        // 1. All of t10k, normalized as for training, with its labels
+        const MnistSet mnist =
+            load_mnist_idx(options.images, mnist_labels_path_for(options.images));
+        if (mnist.rows != 28 || mnist.cols != 28 || mnist.labels.size() != mnist.count) {
+            throw std::runtime_error("Expected labelled 28x28 images in " + options.images);
+        }
+        const int64_t count = mnist.count;
+        const int64_t largest = *std::max_element(options.batches.begin(), options.batches.end());
+        if (largest > count) {
+            throw std::runtime_error("Fewer images than the largest batch in " + options.images);
+        }
+        const at::Tensor images =
+            torch::from_blob(const_cast<uint8_t*>(mnist.pixels.data()), {count, 1, 28, 28},
+                             torch::kUInt8)
+                .to(torch::kFloat32)
+                .div_(255.0f)
+                .sub_(ImageProcessor::MNIST_MEAN)
+                .div_(ImageProcessor::MNIST_STD);
+
+        // 2. fc1's weights and its inputs for the largest batch
+        InferenceEngine engine(options.model);
+        const NativeModel dense(engine, KernelOptions{});
+        const torch::jit::script::Module fc1 = engine.submodule("fc1");
+        const at::Tensor weight = fc1.attr("weight").toTensor().contiguous();
+        const at::Tensor bias = fc1.attr("bias").toTensor().contiguous();
+        const size_t outputs = static_cast<size_t>(weight.size(0));
+        const size_t inputs = static_cast<size_t>(weight.size(1));
+        if (outputs % options.block_rows != 0 || inputs % options.block_cols != 0) {
+            throw std::invalid_argument("--block must divide fc1's " + std::to_string(outputs) +
+                                        "x" + std::to_string(inputs));
+        }
+        at::Tensor features;
+        {
+            c10::InferenceMode inference_mode;
+            at::Tensor x = images.slice(0, 0, largest).contiguous();
+            x = torch::max_pool2d(dense.run_layer("conv1", x), {2, 2});
+            x = torch::max_pool2d(dense.run_layer("conv2", x), {2, 2});
+            features = x.reshape({largest, -1}).contiguous();
+        }
+
+        // 3. fc1 alone, dense against block-sparse, by sparsity
+        std::printf("\nfc1 %zux%zu in %zux%zu blocks, %d intra-op thread(s), %s (%s)\n", outputs,
+                    inputs, options.block_rows, options.block_cols, options.threads,
+                    BlockSparseLinear::isa().c_str(), cpu_model().c_str());
+        std::printf("%8s %6s %7s %12s %12s %8s %11s %11s %10s\n", "sparsity", "batch", "blocks",
+                    "dense p50", "sparse p50", "speedup", "dense B", "sparse B", "max |d|");
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["threads"] = options.threads;
+        report["block"] = {options.block_rows, options.block_cols};
+        report["isa"] = BlockSparseLinear::isa();
+        const size_t dense_bytes = outputs * inputs * sizeof(float);
+        for (double sparsity : options.sparsities) {
+            const std::vector<float> pruned =
+                prune_blocks(weight.data_ptr<float>(), outputs, inputs, options.block_rows,
+                             options.block_cols, sparsity);
+            const BlockSparseLinear sparse(pruned.data(), bias.data_ptr<float>(), outputs,
+                                           inputs, options.block_rows, options.block_cols);
+            const at::Tensor pruned_weight =
+                torch::from_blob(const_cast<float*>(pruned.data()),
+                                 {static_cast<int64_t>(outputs), static_cast<int64_t>(inputs)});
+            for (int64_t batch : options.batches) {
+                c10::InferenceMode inference_mode;
+                const at::Tensor x = features.slice(0, 0, batch).contiguous();
+                at::Tensor out = torch::empty({batch, static_cast<int64_t>(outputs)});
+                const auto run_sparse = [&] {
+                    sparse.run(x.data_ptr<float>(), static_cast<size_t>(batch),
+                               out.data_ptr<float>(), outputs, 1, true);
+                };
+                const double dense_us = p50_us(
+                    [&] { torch::relu(torch::linear(x, pruned_weight, bias)); }, options.seconds);
+                const double sparse_us = p50_us(run_sparse, options.seconds);
+                run_sparse();
+                const at::Tensor expected = torch::relu(torch::linear(x, pruned_weight, bias));
+                const float error = (out - expected).abs().max().item<float>();
+                std::printf("%8.2f %6lld %7zu %12.1f %12.1f %7.2fx %11zu %11zu %10.2e\n",
+                            sparsity, static_cast<long long>(batch), sparse.blocks(), dense_us,
+                            sparse_us, dense_us / sparse_us, dense_bytes, sparse.weight_bytes(),
+                            error);
+                report["fc1"].push_back({{"sparsity", sparsity},
+                                         {"batch", batch},
+                                         {"blocks", sparse.blocks()},
+                                         {"dense_p50_us", dense_us},
+                                         {"sparse_p50_us", sparse_us},
+                                         {"speedup", dense_us / sparse_us},
+                                         {"dense_bytes", dense_bytes},
+                                         {"sparse_bytes", sparse.weight_bytes()},
+                                         {"max_error", error}});
+            }
+        }
+
+        // 4. Pruned models end to end, against the dense one
+        if (!options.pruned.empty()) {
+            std::printf("\n%-32s %9s %-12s %6s %11s %9s\n", "model", "accuracy", "path", "batch",
+                        "p50 us", "vs dense");
+            std::vector<double> dense_us;
+            for (int64_t batch : options.batches) {
+                const at::Tensor x = images.slice(0, 0, batch).contiguous();
+                dense_us.push_back(p50_us([&] { engine.predict_batch(x); }, options.seconds));
+            }
+            const auto report_model = [&](const std::string& name, const std::string& path,
+                                          double acc,
+                                          const std::function<void(const at::Tensor&)>& pass) {
+                for (size_t i = 0; i < options.batches.size(); ++i) {
+                    const int64_t batch = options.batches[i];
+                    const at::Tensor x = images.slice(0, 0, batch).contiguous();
+                    const double us = p50_us([&] { pass(x); }, options.seconds);
+                    std::printf("%-32s %8.2f%% %-12s %6lld %11.1f %8.2fx\n", name.c_str(),
+                                100.0 * acc, path.c_str(), static_cast<long long>(batch), us,
+                                dense_us[i] / us);
+                    report["models"].push_back({{"model", name},
+                                                {"path", path},
+                                                {"accuracy", acc},
+                                                {"batch", batch},
+                                                {"p50_us", us},
+                                                {"vs_dense", dense_us[i] / us}});
+                }
+            };
+            torch::jit::script::Module dense_module =
+                torch::jit::load(options.model, torch::kCPU);
+            dense_module.eval();
+            report_model(options.model, "torchscript",
+                         accuracy([&](const at::Tensor& x) {
+                             return dense_module.forward({x}).toTensor();
+                         }, images, mnist),
+                         [&](const at::Tensor& x) { engine.predict_batch(x); });
+
+            for (const std::string& path : options.pruned) {
+                InferenceEngine pruned_engine(path);
+                torch::jit::script::Module module = torch::jit::load(path, torch::kCPU);
+                module.eval();
+                KernelOptions kernels;
+                kernels.block_sparse["fc1"] = bsr_path_for(path);
+                const NativeModel sparse(pruned_engine, kernels);
+
+                report_model(path, "torchscript",
+                             accuracy([&](const at::Tensor& x) {
+                                 return module.forward({x}).toTensor();
+                             }, images, mnist),
+                             [&](const at::Tensor& x) { pruned_engine.predict_batch(x); });
+                report_model(path, "block-sparse",
+                             accuracy([&](const at::Tensor& x) { return sparse.forward(x); },
+                                      images, mnist),
+                             [&](const at::Tensor& x) {
+                                 c10::InferenceMode inference_mode;
+                                 InferenceEngine::postprocess(sparse.forward(x));
+                             });
+            }
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
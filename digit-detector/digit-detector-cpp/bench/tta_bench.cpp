@@ -0,0 +1,273 @@
+#include "Augmentation.h"
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "PerfStats.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file tta_bench.cpp
+ * @brief What test-time augmentation buys in accuracy and costs in latency,
+ * and how fast Augmenter warps images.
+ *
+ * Usage: digit_tta_bench [--model PATH] [--images PATH] [--variants 1,3,5,9]
+ *                        [--batches 1,16] [--seconds S] [--threads T]
+ *                        [--json PATH]
+ *
+ * Runs all of t10k (labels from the matching idx1 file) through
+ * predict_batch() once per variant count K, the model loaded once and
+ * switched with use_tta(). Reports per K the accuracy, the predictions it
+ * fixed and broke relative to K = 1, and p50 of predict_batch() per batch
+ * size, run for about S seconds (default 1) each. Then Augmenter's own
+ * throughput: expanding images into every TTA variant, and random
+ * training augmentation with and without the elastic field, in images per
+ * second. T intra-op threads, default 1.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t EVAL_BATCH = 256;
+
+struct BenchOptions {
+    std::string model = "models/digit_model.ts";
+    std::string images = "data/MNIST/raw/t10k-images-idx3-ubyte";
+    std::vector<int64_t> variants{1, 3, 5, 9};
+    std::vector<int64_t> batches{1, 16};
+    double seconds = 1.0;
+    int threads = 1;
+    std::string json_path;
+};
+
+std::vector<int64_t> parse_list(const std::string& text) {
+    std::vector<int64_t> values;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        values.push_back(std::stoll(item));
+    }
+    return values;
+}
+
+BenchOptions parse_args(int argc, char** argv) {
+    BenchOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--model") o.model = next();
+        else if (arg == "--images") o.images = next();
+        else if (arg == "--variants") o.variants = parse_list(next());
+        else if (arg == "--batches") o.batches = parse_list(next());
+        else if (arg == "--seconds") o.seconds = std::stod(next());
+        else if (arg == "--threads") o.threads = std::stoi(next());
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.variants.empty() || o.batches.empty() || o.seconds <= 0.0 || o.threads <= 0) {
+        throw std::invalid_argument("--variants, --batches, --seconds and --threads must be "
+                                    "positive");
+    }
+    for (int64_t k : o.variants) {
+        if (k <= 0 || static_cast<size_t>(k) > Augmenter::max_tta_variants()) {
+            throw std::invalid_argument("--variants must be in 1.." +
+                                        std::to_string(Augmenter::max_tta_variants()));
+        }
+    }
+    for (int64_t batch : o.batches) {
+        if (batch <= 0) {
+            throw std::invalid_argument("--batches must be positive");
+        }
+    }
+    return o;
+}
+
+/**
+ * @brief p50 in microseconds of pass() run for about seconds, after a few
+ * untimed runs.
+ */
+double p50_us(const std::function<void()>& pass, double seconds) {
+    for (int i = 0; i < 3; ++i) {
+        pass();
+    }
+    LatencyHistogram latency;
+    const Clock::time_point end =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(seconds));
+    do {
+        const Clock::time_point start = Clock::now();
+        pass();
+        latency.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+    } while (Clock::now() < end || latency.count() < 5);
+    return static_cast<double>(latency.value_at_percentile(50.0)) / 1000.0;
+}
+
+/**
+ * @brief Images per second of pass(), which warps `images` images, over
+ * about seconds.
+ */
+double images_per_second(const std::function<void()>& pass, int64_t images, double seconds) {
+    pass();
+    int64_t passes = 0;
+    const Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+        pass();
+        ++passes;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < seconds);
+    return static_cast<double>(passes * images) / elapsed;
+}
+
+/**
+ * @brief Every t10k prediction, in order.
+ */
+std::vector<Prediction> predict_all(InferenceEngine& engine, const at::Tensor& inputs) {
+    std::vector<Prediction> predictions;
+    const int64_t count = inputs.size(0);
+    for (int64_t begin = 0; begin < count; begin += EVAL_BATCH) {
+        const std::vector<Prediction> batch =
+            engine.predict_batch(inputs.slice(0, begin, std::min(count, begin + EVAL_BATCH)));
+        predictions.insert(predictions.end(), batch.begin(), batch.end());
+    }
+    return predictions;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = parse_args(argc, argv);
+        at::set_num_threads(options.threads);
+
+        // 1. All of t10k, normalized as for training, with its labels
+        const MnistSet mnist =
+            load_mnist_idx(options.images, mnist_labels_path_for(options.images));
+        if (mnist.rows != 28 || mnist.cols != 28 || mnist.labels.size() != mnist.count) {
+            throw std::runtime_error("Expected labelled 28x28 images in " + options.images);
+        }
+        const int64_t count = mnist.count;
+        const int64_t largest = *std::max_element(options.batches.begin(), options.batches.end());
+        if (largest > count || EVAL_BATCH > count) {
+            throw std::runtime_error("Too few images for the batches in " + options.images);
+        }
+        const at::Tensor inputs =
+            torch::from_blob(const_cast<uint8_t*>(mnist.pixels.data()), {count, 1, 28, 28},
+                             torch::kUInt8)
+                .to(torch::kFloat32)
+                .div_(255.0f)
+                .sub_(ImageProcessor::MNIST_MEAN)
+                .div_(ImageProcessor::MNIST_STD);
+
+        // 2. The model as the server loads it; K = 1 is the reference
+        InferenceEngine engine(options.model);
+        const std::vector<Prediction> reference = predict_all(engine, inputs);
+
+        json report;
+        report["cpu_model"] = cpu_model();
+        report["images"] = count;
+        report["threads"] = options.threads;
+        report["isa"] = Augmenter::isa();
+        std::printf("\nt10k, %lld images, %d intra-op thread(s), augmentation on %s (%s)\n",
+                    static_cast<long long>(count), options.threads, Augmenter::isa().c_str(),
+                    cpu_model().c_str());
+        std::printf("%4s %9s %7s %7s", "K", "accuracy", "fixed", "broken");
+        for (int64_t batch : options.batches) {
+            std::printf("  p50 b=%-5lld", static_cast<long long>(batch));
+        }
+        std::printf("\n");
+
+        // 3. Accuracy and latency per variant count
+        for (int64_t k : options.variants) {
+            engine.use_tta(static_cast<size_t>(k));
+            const std::vector<Prediction> predictions = predict_all(engine, inputs);
+            int64_t correct = 0;
+            int64_t fixed = 0;
+            int64_t broken = 0;
+            for (size_t i = 0; i < predictions.size(); ++i) {
+                const bool right = predictions[i].digit == mnist.labels[i];
+                const bool was_right = reference[i].digit == mnist.labels[i];
+                correct += right;
+                fixed += right && !was_right;
+                broken += was_right && !right;
+            }
+            const double accuracy = static_cast<double>(correct) / static_cast<double>(count);
+            std::printf("%4lld %8.2f%% %7lld %7lld", static_cast<long long>(k), 100.0 * accuracy,
+                        static_cast<long long>(fixed), static_cast<long long>(broken));
+            json latency = json::array();
+            for (int64_t batch : options.batches) {
+                const at::Tensor input = inputs.slice(0, 0, batch).contiguous();
+                const double us = p50_us([&] { engine.predict_batch(input); }, options.seconds);
+                std::printf("  %11.1f", us);
+                latency.push_back({{"batch", batch}, {"p50_us", us}});
+            }
+            std::printf("\n");
+            report["variants"].push_back({{"k", k},
+                                          {"accuracy", accuracy},
+                                          {"fixed", fixed},
+                                          {"broken", broken},
+                                          {"latency", latency}});
+        }
+        engine.use_tta(1);
+        std::printf("(latencies in us per batch)\n");
+
+        // 4. Augmenter alone, on one batch of t10k
+        const at::Tensor batch = inputs.slice(0, 0, EVAL_BATCH).contiguous();
+        const Augmenter tta;
+        const std::vector<ImageTransform> all_variants =
+            Augmenter::tta_variants(Augmenter::max_tta_variants());
+        AugmentOptions affine;
+        affine.max_rotation_deg = 10.0f;
+        affine.max_scale = 0.1f;
+        affine.max_shear_deg = 10.0f;
+        affine.max_translate = 2.0f;
+        affine.thickness_probability = 0.2f;
+        AugmentOptions elastic = affine;
+        elastic.elastic_alpha = 2.0f;
+        const Augmenter affine_augmenter(affine);
+        const Augmenter elastic_augmenter(elastic);
+        uint64_t seed = 0;
+
+        const double expand_rate = images_per_second(
+            [&] { tta.expand(batch, all_variants); },
+            EVAL_BATCH * static_cast<int64_t>(all_variants.size()), options.seconds);
+        const double affine_rate = images_per_second(
+            [&] { affine_augmenter.augment(batch, ++seed); }, EVAL_BATCH, options.seconds);
+        const double elastic_rate = images_per_second(
+            [&] { elastic_augmenter.augment(batch, ++seed); }, EVAL_BATCH, options.seconds);
+        std::printf("\n%-34s %12s\n", "augmentation", "images/s");
+        std::printf("%-34s %12.0f\n", "TTA variants (expand)", expand_rate);
+        std::printf("%-34s %12.0f\n", "random affine + thickness", affine_rate);
+        std::printf("%-34s %12.0f\n", "random affine + thickness + elastic", elastic_rate);
+        report["augmentation"] = {{"tta_expand_images_per_second", expand_rate},
+                                  {"affine_images_per_second", affine_rate},
+                                  {"elastic_images_per_second", elastic_rate}};
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+#ifndef AUGMENTATION_H
+#define AUGMENTATION_H
+
+#include <torch/script.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ImageProcessor.h"
+
+/**
+ * @file Augmentation.h
+ * @brief Batched augmentation of 28x28 digits: affine warps, elastic
+ * distortion and stroke thickness, for training and for test-time
+ * augmentation.
+ */
+
+/**
+ * @struct ImageTransform
+ * @brief One deterministic augmentation of an image, about its centre.
+ */
+struct ImageTransform {
+    float rotation_deg = 0.0f; ///< Clockwise on screen
+    float scale = 1.0f;
+    float shear_deg = 0.0f;    ///< Horizontal shear
+    float shift_x = 0.0f;      ///< Pixels, right
+    float shift_y = 0.0f;      ///< Pixels, down
+    int thickness = 0;         ///< +1 thickens strokes by a pixel, -1 thins them
+};
+
+/**
+ * @struct AugmentOptions
+ * @brief Ranges random augmentation draws from, uniformly; zero turns a
+ * transform off.
+ */
+struct AugmentOptions {
+    float max_rotation_deg = 0.0f;
+    float max_scale = 0.0f;            ///< Scale in [1 - max_scale, 1 + max_scale]
+    float max_shear_deg = 0.0f;
+    float max_translate = 0.0f;        ///< Pixels, each axis
+    float elastic_alpha = 0.0f;        ///< Largest elastic displacement, pixels
+    float elastic_sigma = 4.0f;        ///< Smoothness of the displacement field, pixels
+    float thickness_probability = 0.0f; ///< Chance of thickening or thinning, evenly split
+
+    bool enabled() const {
+        return max_rotation_deg > 0.0f || max_scale > 0.0f || max_shear_deg > 0.0f ||
+               max_translate > 0.0f || elastic_alpha > 0.0f || thickness_probability > 0.0f;
+    }
+};
+
+/**
+ * @class Augmenter
+ * @brief Warps and resamples batches of 28x28 float images.
+ *
+ * Each image gets one pass of stroke thickness (a 3x3 max or min filter)
+ * and one bilinear resample through the affine map plus, when elastic,
+ * a smoothed random displacement field (Simard et al., 2003). Points
+ * outside the image read the background value. The resample runs eight
+ * output pixels at a time on AVX2+FMA gathers where the CPU has them, else
+ * scalar; both give the same images to rounding.
+ *
+ * Images are in whatever value space the caller uses, normalized by
+ * default, so the background is the value blank paper maps to. Read-only
+ * and thread-safe once constructed.
+ */
+class Augmenter {
+public:
+    static constexpr int SIDE = 28;
+    static constexpr size_t PIXELS = static_cast<size_t>(SIDE) * SIDE;
+
+    /// Blank paper after (x / 255 - mean) / std.
+    static constexpr float NORMALIZED_BACKGROUND =
+        static_cast<float>(-ImageProcessor::MNIST_MEAN / ImageProcessor::MNIST_STD);
+
+    /**
+     * @throws std::invalid_argument for non-finite values, negative
+     *         ranges, a probability outside [0, 1] or a non-positive
+     *         elastic sigma.
+     */
+    explicit Augmenter(AugmentOptions options = {},
+                       float background = NORMALIZED_BACKGROUND);
+
+    /**
+     * @brief Random augmentation of `count` images stored back to back.
+     *
+     * Image i's draw depends only on (seed, i), so the tensor overload
+     * gives the same images however it splits the batch across threads.
+     * `in` and `out` may be the same buffer.
+     */
+    void augment(const float* in, float* out, size_t count, uint64_t seed) const;
+
+    /**
+     * @brief Random augmentation of [N, 1, 28, 28], images in parallel on
+     * the intra-op pool.
+     * @throws std::invalid_argument for any other shape or dtype.
+     */
+    at::Tensor augment(const at::Tensor& batch, uint64_t seed) const;
+
+    /**
+     * @brief One transform applied to `count` images stored back to back.
+     */
+    void transform(const float* in, float* out, size_t count,
+                   const ImageTransform& transform) const;
+
+    /**
+     * @brief [N, 1, 28, 28] to [N * K, 1, 28, 28]: row n * K + k is image
+     * n under variants[k]. Images in parallel on the intra-op pool.
+     * @throws std::invalid_argument for any other shape or dtype.
+     */
+    at::Tensor expand(const at::Tensor& batch, const std::vector<ImageTransform>& variants) const;
+
+    /**
+     * @brief The first k of a fixed list of mild test-time variants,
+     * starting with the identity: small rotations, scales, one-pixel
+     * shifts and thickness changes.
+     * @throws std::invalid_argument if k is 0 or beyond the list.
+     */
+    static std::vector<ImageTransform> tta_variants(size_t k);
+
+    /// Length of the tta_variants() list.
+    static size_t max_tta_variants();
+
+    const AugmentOptions& options() const { return m_options; }
+    float background() const { return m_background; }
+
+    /**
+     * @brief "avx2+fma" or "scalar".
+     */
+    static std::string isa();
+
+private:
+    /**
+     * @brief One random draw, from the image's own seed.
+     */
+    void augment_image(const float* in, float* out, uint64_t seed) const;
+
+    /**
+     * @brief One image: thickness, then a single resample through the
+     * transform and the displacement field (null for none).
+     */
+    void apply(const float* in, float* out, const ImageTransform& transform, const float* dx,
+               const float* dy) const;
+
+    /**
+     * @brief A displacement field of peak magnitude elastic_alpha.
+     */
+    void elastic_field(uint64_t seed, float* dx, float* dy) const;
+
+    AugmentOptions m_options;
+    float m_background;
+    std::vector<float> m_gaussian; ///< Elastic smoothing kernel, 2 * radius + 1 taps
+};
+
+#endif // AUGMENTATION_H
@@ -0,0 +1,113 @@
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ModelRegistry.h"
+
+/**
+ * @file Autotuner.h
+ * @brief Finds the intra-op threads, max batch and batch delay that give a
+ * model the most throughput on this machine within a p99 latency SLO.
+ *
+ * The sweep runs in two phases inside a fixed time budget:
+ *
+ *  1. Profile: for every intra-op thread count and batch size, time a
+ *     preprocess + forward pass of that batch. From the upper quantile of
+ *     those times each (threads, batch) pair gets a capacity (rows per
+ *     second) and, for every batch delay, a predicted p99 of
+ *     delay + two passes.
+ *  2. Validate: the candidates predicted to meet the SLO are run, best
+ *     first, through a real ModelScheduler with open-loop Poisson
+ *     arrivals at a fraction of their predicted capacity. The winner is
+ *     the highest measured throughput whose measured p99 met the SLO.
+ *
+ * Both phases run the model with its configured kernels and TTA variants
+ * but in-process, without its pipeline.
+ *
+ * Results are stored in a JSON cache keyed by CPU model, core count, a
+ * hash of the model file and a hash of the kernels, TTA variants and
+ * pipeline it is served with, so the next start on the same kind of
+ * machine with the same model and settings reuses them without tuning
+ * again.
+ */
+
+/**
+ * @struct AutotuneOptions
+ * @brief What to sweep and for how long.
+ */
+struct AutotuneOptions {
+    double seconds = 30.0;      ///< Budget for both phases
+    double slo_p99_us = 10000.0; ///< Submit-to-result p99 the winner must meet
+    uint32_t cores = 0;         ///< 0: the CPUs this process may run on
+    std::string inputs;         ///< MNIST idx3 images; synthetic digits if empty
+    std::vector<uint32_t> intra_op_threads; ///< Empty: 1, 2, 4 ... cores
+    std::vector<uint32_t> max_batches = {1, 4, 8, 16, 32, 64};
+    std::vector<uint32_t> batch_delays_us = {0, 100, 250, 500, 1000, 2000};
+};
+
+/**
+ * @struct AutotuneResult
+ * @brief The chosen configuration and what it was measured to do.
+ */
+struct AutotuneResult {
+    std::string cpu_model;
+    std::string model_hash;
+    std::string config_hash; ///< model_config_hash() of the tuned model
+    uint32_t cores = 0;
+    uint32_t intra_op_threads = 1;
+    uint32_t max_batch = 1;
+    uint32_t batch_delay_us = 0;
+    double throughput = 0.0; ///< Requests/s completed in the validation run
+    double p99_us = 0.0;     ///< Measured in the same run
+    double slo_p99_us = 0.0;
+    bool met_slo = false;    ///< false: nothing met the SLO; this had the lowest p99
+    uint32_t profiled = 0;   ///< (threads, batch) pairs timed
+    uint32_t validated = 0;  ///< Candidates run through the scheduler
+    double seconds = 0.0;    ///< Time the sweep took
+    std::string tuned_at;    ///< UTC, ISO 8601
+};
+
+/**
+ * @brief Runs the sweep for one model.
+ *
+ * Changes LibTorch's intra-op thread count while it runs and restores
+ * it before returning or throwing.
+ * @throws std::runtime_error if the model cannot be loaded.
+ */
+AutotuneResult autotune(const ModelConfig& model, const AutotuneOptions& options);
+
+/**
+ * @brief 64-bit FNV-1a of the file's bytes, as 16 hex digits.
+ * @throws std::runtime_error if the file cannot be read.
+ */
+std::string model_file_hash(const std::string& path);
+
+/**
+ * @brief 64-bit FNV-1a, as 16 hex digits, of the model's kernels, TTA
+ * variants and pipeline: the settings besides batching that change
+ * what a pass costs.
+ */
+std::string model_config_hash(const ModelConfig& model);
+
+/**
+ * @brief Looks up a stored result for this CPU model, model and config
+ * hashes, and core count.
+ * @return Nothing if the cache is missing, unreadable or has no such entry.
+ */
+std::optional<AutotuneResult> load_autotune_result(const std::string& cache_path,
+                                                   const std::string& cpu_model,
+                                                   const std::string& model_hash,
+                                                   const std::string& config_hash,
+                                                   uint32_t cores);
+
+/**
+ * @brief Adds or replaces the entry for the result's key, keeping the others.
+ * @throws std::runtime_error if the cache cannot be written.
+ */
+void save_autotune_result(const std::string& cache_path, const AutotuneResult& result);
+
+#endif // AUTOTUNER_H
@@ -0,0 +1,49 @@
+#ifndef CANCELLATION_H
+#define CANCELLATION_H
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+/**
+ * @file Cancellation.h
+ * @brief Cancellation flags shared by InferenceEngine::predict_async and
+ * the server's scheduler; free of LibTorch so the server headers can use them.
+ */
+
+/**
+ * @class CancellationToken
+ * @brief Observes whether an asynchronous prediction was cancelled.
+ *
+ * A default-constructed token can never be cancelled.
+ */
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    bool cancelled() const { return m_flag && m_flag->load(std::memory_order_acquire); }
+
+private:
+    friend class CancellationSource;
+    explicit CancellationToken(std::shared_ptr<std::atomic<bool>> flag)
+        : m_flag(std::move(flag)) {}
+
+    std::shared_ptr<std::atomic<bool>> m_flag;
+};
+
+/**
+ * @class CancellationSource
+ * @brief Cancels every prediction that was given one of its tokens.
+ */
+class CancellationSource {
+public:
+    CancellationSource() : m_flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() { m_flag->store(true, std::memory_order_release); }
+    CancellationToken token() const { return CancellationToken(m_flag); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_flag;
+};
+
+#endif // CANCELLATION_H
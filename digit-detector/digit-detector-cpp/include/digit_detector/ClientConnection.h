@@ -0,0 +1,126 @@
+#ifndef CLIENT_CONNECTION_H
+#define CLIENT_CONNECTION_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "Protocol.h"
+
+/**
+ * @file ClientConnection.h
+ * @brief Blocking TCP connection to digit_server.
+ *
+ * Writes and reads are independent, so one thread can keep sending
+ * pipelined requests while another collects the responses.
+ */
+
+/**
+ * @struct PredictResponse
+ * @brief One decoded response frame.
+ */
+struct PredictResponse {
+    uint64_t request_id = 0;
+    WireStatus status = WireStatus::Ok;
+    Prediction prediction;
+};
+
+/**
+ * @struct BackendAddress
+ * @brief Where a digit_server listens.
+ */
+struct BackendAddress {
+    std::string host;
+    uint16_t port = 0;
+
+    std::string name() const { return host + ":" + std::to_string(port); }
+};
+
+/**
+ * @brief Parses "host:port".
+ * @throws std::invalid_argument if there is no port.
+ */
+BackendAddress parse_backend_address(const std::string& spec);
+
+/**
+ * @class ClientConnection
+ * @brief One TCP connection speaking the Protocol.h wire format.
+ */
+class ClientConnection {
+public:
+    /**
+     * @brief Connects to a server (TCP_NODELAY is set).
+     * @param connect_timeout Give up on an address after this long; 0 waits
+     *        as long as the kernel does.
+     * @throws std::runtime_error if the connection fails.
+     */
+    ClientConnection(const std::string& host, uint16_t port,
+                     std::chrono::milliseconds connect_timeout = std::chrono::milliseconds(0));
+
+    /**
+     * @brief Destructor. Closes the socket.
+     */
+    ~ClientConnection();
+
+    ClientConnection(const ClientConnection&) = delete;
+    ClientConnection& operator=(const ClientConnection&) = delete;
+
+    /**
+     * @brief Sends one PredictRequest. Blocks until the frame is written.
+     * Safe to call from several threads.
+     * @param options Model, priority class and deadline; defaults use the
+     *        server's default model with no deadline.
+     * @throws std::runtime_error if the connection is lost.
+     */
+    void send_predict(uint64_t request_id, const uint8_t* pixels, uint16_t width,
+                      uint16_t height, const PredictOptions& options = {});
+
+    /**
+     * @brief Sends pre-encoded frames in one write. Safe to call from several threads.
+     * @throws std::runtime_error if the connection is lost.
+     */
+    void send_frames(const std::vector<uint8_t>& frames);
+
+    /**
+     * @brief Waits for responses and appends every complete one to out.
+     * Call from one thread at a time.
+     * @param timeout Maximum time to wait for the first bytes.
+     * @return Number of responses appended; 0 on timeout.
+     * @throws std::runtime_error if the server closed the connection or
+     *         sent a malformed frame.
+     */
+    size_t read_responses(std::vector<PredictResponse>& out, std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Sends a StatsRequest and waits for the StatsResponse.
+     *
+     * Only for a connection with no predictions in flight, e.g. a health
+     * check's own.
+     * @return The server's JSON document.
+     * @throws std::runtime_error on timeout, a lost connection or a bad frame.
+     */
+    std::string fetch_stats(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Shuts the socket down, unblocking a concurrent reader.
+     */
+    void shutdown();
+
+    int fd() const { return m_fd; }
+
+private:
+    void write_all(const uint8_t* data, size_t length);
+    bool connect_with_timeout(const sockaddr* address, socklen_t length,
+                              std::chrono::milliseconds timeout);
+
+    int m_fd = -1;
+    std::mutex m_send_mutex;
+    std::vector<uint8_t> m_send_buffer; ///< Guarded by m_send_mutex
+    std::vector<uint8_t> m_recv_buffer; ///< Bytes of a partially received frame
+};
+
+#endif // CLIENT_CONNECTION_H
@@ -0,0 +1,68 @@
+#ifndef CONSISTENT_HASH_RING_H
+#define CONSISTENT_HASH_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+/**
+ * @file ConsistentHashRing.h
+ * @brief Key-to-member placement that moves few keys when members change.
+ */
+
+/**
+ * @brief 64-bit hash of a byte string; fast, well mixed, not cryptographic.
+ */
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed = 0);
+
+/**
+ * @class ConsistentHashRing
+ * @brief Maps keys to members; adding or removing one of N members moves
+ * only about 1/N of the keys.
+ *
+ * Each member is placed at virtual_nodes pseudo-random points on a 64-bit
+ * ring, and a key belongs to the first point at or after its hash. More
+ * points per member even out the members' shares. Not thread-safe.
+ */
+class ConsistentHashRing {
+public:
+    explicit ConsistentHashRing(uint32_t virtual_nodes = 160);
+
+    /**
+     * @brief Adds a member; does nothing if it is already present.
+     */
+    void add(const std::string& member);
+
+    /**
+     * @brief Removes a member; does nothing if it is absent.
+     */
+    void remove(const std::string& member);
+
+    bool contains(const std::string& member) const { return m_members.count(member) != 0; }
+    size_t size() const { return m_members.size(); }
+    bool empty() const { return m_members.empty(); }
+
+    /**
+     * @brief The member that owns key, or an empty string if the ring is empty.
+     */
+    const std::string& owner(uint64_t key) const;
+
+    /**
+     * @brief Offers each member once, in ring order from key's owner, until
+     * visit returns true.
+     *
+     * For bounded-load placement: the first member with room takes the key,
+     * and a key only leaves its owner while the owner is full.
+     */
+    void walk(uint64_t key, const std::function<bool(const std::string&)>& visit) const;
+
+private:
+    uint32_t m_virtual_nodes;
+    std::map<uint64_t, const std::string*> m_points; ///< Point -> element of m_members
+    std::set<std::string> m_members;
+};
+
+#endif // CONSISTENT_HASH_RING_H
@@ -0,0 +1,55 @@
+#ifndef DIGIT_RECOGNIZER_H
+#define DIGIT_RECOGNIZER_H
+
+#include <torch/torch.h>
+
+#include <string>
+
+/**
+ * @file DigitRecognizer.h
+ * @brief The Python package's DigitRecognizer on the LibTorch C++ frontend,
+ * for training without Python.
+ */
+
+/**
+ * @class DigitRecognizerImpl
+ * @brief Same layers, shapes, initialization and parameter names as
+ * digit_model.model.DigitRecognizer:
+ *
+ *   conv1 (1 -> 32, 3x3, pad 1), ReLU, pool 2x2
+ *   conv2 (32 -> 64, 3x3, pad 1), ReLU, pool 2x2
+ *   fc1 (64*7*7 -> 128), ReLU
+ *   fc2 (128 -> 10)
+ *
+ * Input [N, 1, 28, 28] normalized as for training; output [N, 10] logits.
+ */
+class DigitRecognizerImpl : public torch::nn::Module {
+public:
+    DigitRecognizerImpl();
+
+    at::Tensor forward(at::Tensor x);
+
+    torch::nn::Conv2d conv1{nullptr};
+    torch::nn::Conv2d conv2{nullptr};
+    torch::nn::MaxPool2d pool{nullptr};
+    torch::nn::Linear fc1{nullptr};
+    torch::nn::Linear fc2{nullptr};
+};
+
+TORCH_MODULE(DigitRecognizer);
+
+/**
+ * @brief Saves a copy of the model's weights as a TorchScript module that
+ * loads like the Python export.
+ *
+ * The C++ frontend cannot script a module, so the module is built
+ * directly: submodules conv1, conv2, pool, fc1 and fc2 with `weight` and
+ * `bias` parameters and TorchScript forward() methods, chained as the
+ * Python forward() chains them. InferenceEngine, NativeModel and
+ * PipelineExecutor all find what they look for.
+ *
+ * @throws c10::Error if the file cannot be written.
+ */
+void save_torchscript(DigitRecognizer& model, const std::string& path);
+
+#endif // DIGIT_RECOGNIZER_H
@@ -11,6 +11,9 @@
  * This is a stateless utility class that converts a raw
  * cv::Mat from the canvas into a normalized, correctly-sized
  * tensor for the InferenceEngine.
+ *
+ * Inside an ArenaScope its temporaries, and the tensor it returns, are
+ * carved from the thread's scratch arena (see ScratchArena.h).
  */
 class ImageProcessor {
 public:
@@ -23,11 +26,13 @@ public:
      * @brief Processes a raw image into a model-ready tensor.
      * @param raw_image The 1-channel, 280x280 image from the Renderer.
      * @return A [1, 1, 28, 28] float tensor, scaled and normalized.
+     * @throws std::invalid_argument if the image is not CV_8UC1.
      */
     torch::Tensor process(const cv::Mat& raw_image);
 
-private:
-    // MNIST dataset-specific normalization constants
+    // MNIST dataset-specific normalization constants, as the model was
+    // trained. Public for code that builds model inputs without process(),
+    // such as the benches reading IDX files.
     static constexpr double MNIST_MEAN = 0.1307;
     static constexpr double MNIST_STD = 0.3081;
 };
@@ -0,0 +1,207 @@
+#ifndef INFERENCE_CLIENT_H
+#define INFERENCE_CLIENT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "ClientConnection.h"
+#include "LatencyHistogram.h"
+
+/**
+ * @file InferenceClient.h
+ * @brief Client library for digit_server: pooled, pipelined connections,
+ * batched writes and hedged requests.
+ *
+ * A client holds a few connections to each replica. Every connection has
+ * a writer thread and a reader thread. Requests are pipelined: any number
+ * may be in flight on a connection, and replies are matched to requests
+ * by id. Requests queued while the writer is busy (or within
+ * batch_window) leave in a single write.
+ *
+ * With hedging on, a request that has not been answered after the
+ * hedge_percentile latency seen so far is sent again on another replica.
+ * The first answer wins. The server is told to drop the other copy, so a
+ * stall on one process (a page-fault storm, a preempted thread, a
+ * stop-the-world pause) costs roughly the hedge delay instead of the
+ * whole stall. hedge_budget caps the extra load, so an overloaded
+ * cluster is not made worse by duplicates.
+ */
+
+/**
+ * @struct InferenceClientOptions
+ * @brief Settings for InferenceClient.
+ */
+struct InferenceClientOptions {
+    size_t connections_per_replica = 2;
+    /// A writer holds its first queued frame this long for others to share
+    /// the write; 0 sends whatever has queued by the time it runs
+    std::chrono::microseconds batch_window{0};
+    size_t max_batch = 64; ///< A held write leaves once this many frames are queued
+    std::chrono::milliseconds connect_timeout{1000};
+    std::chrono::milliseconds reconnect_interval{500};
+
+    bool hedge = false;
+    double hedge_percentile = 95.0;                     ///< Of recent single-attempt latencies
+    std::chrono::microseconds hedge_min_delay{100};
+    std::chrono::microseconds hedge_initial_delay{5000}; ///< Until hedge_warmup samples
+    size_t hedge_warmup = 200;
+    double hedge_budget = 0.05; ///< At most this share of requests is sent twice
+    bool cancel_losers = true;  ///< Send Cancel for the slower copy
+};
+
+/**
+ * @struct InferenceClientStats
+ * @brief Counters since the client was created.
+ */
+struct InferenceClientStats {
+    uint64_t requests = 0;
+    uint64_t completed = 0;  ///< Answered by a server, whatever the status
+    uint64_t unavailable = 0; ///< Failed locally: no connection could carry them
+    uint64_t hedged = 0;     ///< Second copies sent
+    uint64_t hedge_wins = 0; ///< Answered by the second copy
+    uint64_t hedges_denied = 0; ///< Due for a hedge but over the budget
+    uint64_t cancels = 0;    ///< Cancel frames sent for losers
+    uint64_t wasted = 0;     ///< Loser replies that arrived anyway: work done twice
+    uint64_t writes = 0;
+    uint64_t frames = 0;     ///< frames / writes is the mean write batch
+    double hedge_delay_us = 0.0;
+    double p50_us = 0.0;     ///< Call to callback
+    double p99_us = 0.0;
+    double p999_us = 0.0;
+};
+
+/**
+ * @class InferenceClient
+ * @brief Sends predictions to one or more digit_server replicas.
+ *
+ * Thread-safe. Callbacks run on a connection's reader thread (or the
+ * caller's when no connection is open) and must be short.
+ */
+class InferenceClient {
+public:
+    /// PredictResponse::request_id is the id predict_async() returned
+    using Callback = std::function<void(const PredictResponse& response)>;
+
+    /**
+     * @brief Connects to every replica. Replicas that cannot be reached
+     * now are retried every reconnect_interval.
+     * @throws std::runtime_error if no replica can be reached.
+     */
+    InferenceClient(const std::vector<BackendAddress>& replicas,
+                    InferenceClientOptions options = {});
+
+    /**
+     * @brief Destructor. Closes the connections; calls still waiting get
+     * WireStatus::Unavailable.
+     */
+    ~InferenceClient();
+
+    InferenceClient(const InferenceClient&) = delete;
+    InferenceClient& operator=(const InferenceClient&) = delete;
+
+    /**
+     * @brief Queues one prediction; done runs exactly once.
+     * @return The call's id, echoed in the response.
+     */
+    uint64_t predict_async(const uint8_t* pixels, uint16_t width, uint16_t height,
+                           Callback done, const PredictOptions& options = {});
+
+    /**
+     * @brief predict_async() with a future.
+     */
+    std::future<PredictResponse> predict(const uint8_t* pixels, uint16_t width,
+                                         uint16_t height, const PredictOptions& options = {});
+
+    InferenceClientStats stats() const;
+
+    /**
+     * @brief The current hedge delay.
+     */
+    std::chrono::microseconds hedge_delay() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Call;
+    struct Connection;
+
+    struct HedgeTimer {
+        Clock::time_point due;
+        std::weak_ptr<Call> call;
+        bool operator>(const HedgeTimer& other) const { return due > other.due; }
+    };
+
+    static constexpr size_t HEDGE_WINDOW = 8192; ///< Samples per hedge-delay window
+    static constexpr size_t NO_REPLICA = static_cast<size_t>(-1);
+
+    /**
+     * @brief Sends one copy of call on connection.
+     * @return False if the connection is closed.
+     */
+    bool send_attempt(const std::shared_ptr<Call>& call, Connection& connection);
+
+    /**
+     * @brief The open connection with the fewest requests in flight, other
+     * than exclude, preferring replicas other than avoid.
+     */
+    Connection* pick(size_t avoid, const Connection* exclude);
+
+    void complete(const std::shared_ptr<Call>& call, uint64_t attempt_id,
+                  const PredictResponse& response, Clock::time_point now);
+    void abandon(const std::shared_ptr<Call>& call, uint64_t attempt_id, size_t replica);
+    /**
+     * @brief Delivers the result unless another copy already did.
+     * @return False if the call had already finished.
+     */
+    bool finish(Call& call, WireStatus status, const Prediction& prediction);
+    void withdraw(Connection& connection, uint64_t attempt_id);
+    void record_attempt(uint64_t latency_ns);
+
+    void open(Connection& connection);
+    void reader_loop(Connection& connection);
+    void writer_loop(Connection& connection);
+    void timer_loop();
+    void hedge(const std::shared_ptr<Call>& call);
+    void reconnect();
+
+    InferenceClientOptions m_options;
+    std::vector<std::unique_ptr<Connection>> m_connections;
+    std::atomic<uint64_t> m_next_call{1};
+    std::atomic<uint64_t> m_next_attempt{1};
+    std::atomic<size_t> m_rotation{0};
+    std::atomic<bool> m_stopping{false};
+
+    std::mutex m_timer_mutex;
+    std::condition_variable m_timer_cv;
+    std::priority_queue<HedgeTimer, std::vector<HedgeTimer>, std::greater<HedgeTimer>> m_hedges;
+    std::thread m_timer;
+
+    mutable std::mutex m_delay_mutex;
+    LatencyHistogram m_window; ///< Single-attempt latencies since the window restarted
+    std::atomic<int64_t> m_hedge_delay_ns;
+
+    mutable std::mutex m_latency_mutex;
+    LatencyHistogram m_latency; ///< Call to callback
+
+    std::atomic<uint64_t> m_requests{0};
+    std::atomic<uint64_t> m_completed{0};
+    std::atomic<uint64_t> m_unavailable{0};
+    std::atomic<uint64_t> m_hedged{0};
+    std::atomic<uint64_t> m_hedge_wins{0};
+    std::atomic<uint64_t> m_hedges_denied{0};
+    std::atomic<uint64_t> m_cancels{0};
+    std::atomic<uint64_t> m_wasted{0};
+    std::atomic<uint64_t> m_writes{0};
+    std::atomic<uint64_t> m_frames{0};
+};
+
+#endif // INFERENCE_CLIENT_H
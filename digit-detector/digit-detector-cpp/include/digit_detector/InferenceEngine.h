@@ -2,34 +2,261 @@
 #define INFERENCE_ENGINE_H
 
 #include <torch/script.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
+#include "Cancellation.h"
 #include "types.h"
 
+class Augmenter;
+class NativeModel;
+struct ImageTransform;
+struct KernelOptions;
+
+/**
+ * @class PredictCancelled
+ * @brief Delivered instead of a result when a prediction was cancelled
+ * before it ran, or the engine was destroyed first.
+ */
+class PredictCancelled : public std::runtime_error {
+public:
+    PredictCancelled() : std::runtime_error("Prediction cancelled") {}
+};
+
+/**
+ * @brief Completion of an asynchronous prediction.
+ *
+ * error is null on success; otherwise it holds PredictCancelled or the
+ * exception the forward pass threw, and the prediction is empty.
+ */
+using PredictCallback = std::function<void(std::exception_ptr error, const Prediction& prediction)>;
+
 /**
  * @class InferenceEngine
  * @brief Manages loading the AI model and running predictions.
  *
  * This class loads a TorchScript model at construction and provides
  * a single method 'predict' to run inference on an input tensor.
+ *
+ * predict() and predict_batch() may be called from any number of threads
+ * at once, and their forward passes run concurrently over the one loaded
+ * copy of the weights. The weights are read-only after construction:
+ * gradients are switched off for every parameter and each pass runs under
+ * c10::InferenceMode, so no pass writes autograd state or version counters
+ * to shared tensors. What a pass does write (the interpreter stack, the
+ * activations it allocates) belongs to the calling thread. The graph
+ * executor's one-time optimization happens in the constructor, before
+ * any concurrent caller can race it.
+ *
+ * predict_async() hands the input to an executor owned by the engine
+ * (started on first use) and returns immediately, so a caller can keep
+ * any number of requests in flight without a thread per request.
+ * Requests that pile up while a forward pass runs are coalesced into
+ * one batch. See PredictTask.h for the C++20 co_await interface.
+ *
+ * Models quantized to int8 by `digit-train --qat` load the same way. Their
+ * weights were packed for one quantized backend (fbgemm or qnnpack), which
+ * the export records in the archive; the engine selects that backend
+ * before loading, since the weights are unpacked as they load. The
+ * quantized backend is process-wide, so every quantized model in a process
+ * must use the same one.
+ *
+ * With test-time augmentation on (use_tta()), every input is run as K
+ * mildly warped copies in the same forward pass and the prediction comes
+ * from their averaged probabilities: K times the compute per input for a
+ * steadier answer on off-centre or unusually drawn digits.
  */
 class InferenceEngine {
 public:
     /**
      * @brief Constructs the engine and loads the model.
      * @param model_path Path to the exported .ts (TorchScript) model file.
-     * @throws std::runtime_error if the model fails to load.
+     * @throws std::runtime_error if the model fails to load, or is quantized
+     *         for a backend this LibTorch lacks or another model in the
+     *         process does not use.
      */
     explicit InferenceEngine(const std::string& model_path);
 
+    /**
+     * @brief Destructor. Cancels queued asynchronous predictions and joins the executor.
+     */
+    ~InferenceEngine();
+
+    InferenceEngine(const InferenceEngine&) = delete;
+    InferenceEngine& operator=(const InferenceEngine&) = delete;
+
     /**
      * @brief Runs inference on a pre-processed input tensor.
+     *
+     * Runs on the calling thread; blocking on predict_async() instead
+     * would only add a thread hop.
      * @param input_tensor The input tensor, expected to be [1, 1, 28, 28].
      * @return A Prediction struct containing the predicted digit and confidence.
      */
     Prediction predict(const torch::Tensor& input_tensor);
 
+    /**
+     * @brief Queues inference on the engine's executor.
+     * @param input_tensor Expected to be [1, 1, 28, 28].
+     * @param token Cancels the prediction if it has not started yet.
+     * @return A future holding the prediction, or PredictCancelled / the
+     *         forward pass's exception.
+     */
+    std::future<Prediction> predict_async(torch::Tensor input_tensor,
+                                          CancellationToken token = {});
+
+    /**
+     * @brief Queues inference on the engine's executor.
+     *
+     * The callback runs exactly once, on an executor thread (or on the
+     * calling thread if the token is already cancelled); keep it short.
+     */
+    void predict_async(torch::Tensor input_tensor, PredictCallback callback,
+                       CancellationToken token = {});
+
+    /**
+     * @brief Runs inference on a batch of pre-processed inputs.
+     *
+     * Thread-safe and lock-free with respect to other callers.
+     * @param input_batch The input tensor, expected to be [N, 1, 28, 28].
+     * @return One Prediction per input, in order.
+     */
+    std::vector<Prediction> predict_batch(const torch::Tensor& input_batch);
+
+    /**
+     * @brief Converts model output into predictions (softmax + argmax per row).
+     * @param logits Raw scores of shape [N, 10].
+     * @return One Prediction per row.
+     */
+    static std::vector<Prediction> postprocess(const at::Tensor& logits);
+
+    /**
+     * @brief Returns the memory held by the model's parameters and buffers.
+     */
+    size_t weight_bytes() const;
+
+    /**
+     * @brief Moves the parameters and buffers onto pages of their own and
+     * makes those pages read-only.
+     *
+     * For processes forked after loading: pages nobody writes stay shared
+     * with the parent, and a stray write to a weight faults at once instead
+     * of quietly giving one process a private copy. Call before the engine
+     * is in use; later calls do nothing. Tensors that are not dense and
+     * contiguous (quantized ones, for instance) stay where they are.
+     * @return Bytes of weights on the read-only pages.
+     * @throws std::runtime_error if the pages cannot be mapped or protected.
+     */
+    size_t freeze_weights();
+
+    /**
+     * @brief Returns one of the model's direct submodules ("conv1", say),
+     * for running part of the model on its own. It shares the engine's
+     * weights, frozen or not.
+     * @throws std::runtime_error if the model has no such submodule.
+     */
+    torch::jit::script::Module submodule(const std::string& name) const;
+
+    /**
+     * @brief Runs forward passes layer by layer on NativeModel instead of
+     * the TorchScript graph, with each layer's weights stored as the
+     * options say (fp16 or bf16 halve what a pass reads).
+     *
+     * Logs how far the logits drift from TorchScript's on a random batch.
+     * Call before the engine is in use; options that change nothing put
+     * the engine back on TorchScript.
+     * @throws std::runtime_error if the model is not a fp32 DigitRecognizer.
+     */
+    void use_kernels(const KernelOptions& options);
+
+    /**
+     * @brief Predicts from the averaged softmax of `variants` augmented
+     * copies of each input (Augmenter::tta_variants(), identity first),
+     * run as one batch of N * variants.
+     *
+     * Works with TorchScript, layer kernels and int8 models alike. Call
+     * before the engine is in use; 0 or 1 turns it off.
+     * @throws std::invalid_argument beyond Augmenter::max_tta_variants().
+     */
+    void use_tta(size_t variants);
+
+    /**
+     * @brief Copies averaged per input; 1 when test-time augmentation is off.
+     */
+    size_t tta_variants() const;
+
+    /**
+     * @brief The layer-by-layer model, or null when running TorchScript.
+     */
+    const NativeModel* native_model() const { return m_native.get(); }
+
+    /**
+     * @brief True for an int8 model (quantized modules in the graph).
+     */
+    bool quantized() const { return !m_quantized_engine.empty(); }
+
+    /**
+     * @brief "fbgemm" or "qnnpack" for a quantized model, else empty.
+     */
+    const std::string& quantized_engine() const { return m_quantized_engine; }
+
 private:
-    torch::jit::script::Module m_model; ///< The loaded TorchScript module
+    /**
+     * @brief One queued predict_async() call.
+     */
+    struct AsyncJob {
+        torch::Tensor input;
+        PredictCallback done;
+        CancellationToken token;
+    };
+
+    static constexpr size_t ASYNC_MAX_BATCH = 64; ///< Inputs coalesced per forward pass
+    static constexpr int WARMUP_RUNS = 3; ///< Enough for the profiling executor to settle
+    static constexpr int64_t KERNEL_CHECK_BATCH = 64; ///< Inputs compared by use_kernels()
+
+    void executor_loop();
+
+    /**
+     * @brief Runs the passes that let the graph executor specialize and
+     * optimize the graph. Logs and carries on if the model does not take
+     * [N, 1, 28, 28]; it is then optimized on first use instead.
+     */
+    void warm_up();
+
+    /**
+     * @brief Logits for a batch, from NativeModel or the TorchScript graph.
+     */
+    at::Tensor forward(const torch::Tensor& input_batch);
+
+    /**
+     * @brief Argmax and its probability per row of [N, 10] probabilities.
+     */
+    static std::vector<Prediction> predictions(const at::Tensor& probabilities);
+
+    torch::jit::script::Module m_model; ///< The loaded TorchScript module; read-only after load
+    std::optional<torch::jit::Method> m_forward; ///< Looked up once instead of per pass
+    bool m_frozen = false;
+    size_t m_frozen_bytes = 0;
+    std::string m_quantized_engine; ///< Empty for a fp32 model
+    std::unique_ptr<NativeModel> m_native; ///< Runs passes instead of m_forward when set
+    std::unique_ptr<Augmenter> m_augmenter; ///< Set while test-time augmentation is on
+    std::vector<ImageTransform> m_tta;      ///< Its variants, identity first
+
+    std::mutex m_async_mutex;
+    std::condition_variable m_async_cv;
+    std::deque<AsyncJob> m_async_queue;
+    bool m_async_stopping = false;
+    std::thread m_executor; ///< Started by the first predict_async()
 };
 
 #endif // INFERENCE_ENGINE_H
@@ -0,0 +1,118 @@
+#ifndef INFERENCE_SERVER_H
+#define INFERENCE_SERVER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Cancellation.h"
+#include "IoEngine.h"
+#include "ModelRegistry.h"
+#include "ThreadBudget.h"
+
+// Forward declaration to avoid pulling LibTorch/OpenCV into this header
+class ModelScheduler;
+class WorkStealingPool;
+struct ModelStats;
+
+/**
+ * @file InferenceServer.h
+ * @brief TCP inference service speaking the Protocol.h wire format.
+ *
+ * The IoEngine's loop thread only frames requests and hands them to the
+ * ModelScheduler, which runs preprocessing, the model and the response
+ * callbacks as tasks on one WorkStealingPool; responses go back to the
+ * engine, which batches them into as few kernel entries as it can.
+ * A ThreadBudget divides the cores between concurrent forward passes and
+ * LibTorch's intra-op threads so the two pools do not oversubscribe them.
+ * Several models can be served at once; requests name theirs, and
+ * StatsRequest returns per-model metrics. PreforkServer runs several of
+ * these as processes sharing one copy of the weights.
+ */
+
+/**
+ * @struct InferenceServerOptions
+ * @brief Settings for InferenceServer.
+ */
+struct InferenceServerOptions {
+    IoEngineConfig io;          ///< Network engine and its tuning
+    uint32_t workers = 0;       ///< Executor threads shared by all models; 0: one per budgeted core
+    bool pin_workers = false;   ///< Pin each executor thread to its own CPU
+    ThreadBudgetConfig threads; ///< Cores and how LibTorch may use them
+};
+
+/**
+ * @class InferenceServer
+ * @brief Serves digit predictions over TCP.
+ */
+class InferenceServer {
+public:
+    /**
+     * @brief Loads the models and starts listening.
+     * @param models At least one; the first is the default model.
+     * @throws std::runtime_error if a model or the socket cannot be set up.
+     */
+    InferenceServer(const std::vector<ModelConfig>& models, InferenceServerOptions options);
+
+    /**
+     * @brief Serves models that are already loaded and starts listening.
+     * @param models At least one; the first is the default model.
+     * @throws std::runtime_error if the socket cannot be set up.
+     */
+    InferenceServer(const std::vector<std::shared_ptr<ServedModel>>& models,
+                    InferenceServerOptions options);
+
+    /**
+     * @brief Destructor. Stops the engine and waits for batches in flight.
+     */
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    /**
+     * @brief Runs the network loop on the calling thread until stop().
+     */
+    void run();
+
+    /**
+     * @brief Requests shutdown. Safe to call from any thread or signal handler.
+     */
+    void stop();
+
+    uint16_t port() const { return m_io->port(); }
+    ThreadSplit thread_split() const { return m_budget->split(); }
+    const char* io_engine_name() const { return m_io->name(); }
+    IoEngineStats io_stats() const { return m_io->stats(); }
+    std::vector<ModelStats> model_stats() const;
+
+    /**
+     * @brief Returns the StatsResponse document: I/O counters and per-model metrics.
+     */
+    std::string stats_json() const;
+
+private:
+    void on_frame(uint64_t connection_id, const WireHeader& header, const uint8_t* payload);
+    void reply(uint64_t connection_id, uint64_t request_id, WireStatus status,
+               const Prediction& prediction);
+    void cancel(uint64_t connection_id, uint64_t request_id);
+
+    /// (connection, request id) of a queued cancellable request
+    using CancelKey = std::pair<uint64_t, uint64_t>;
+
+    InferenceServerOptions m_options;
+    ModelRegistry m_registry;
+    std::unique_ptr<ThreadBudget> m_budget;
+    std::unique_ptr<WorkStealingPool> m_pool;
+    std::unique_ptr<ModelScheduler> m_scheduler;
+    std::unique_ptr<IoEngine> m_io;
+
+    std::mutex m_cancel_mutex;
+    std::map<CancelKey, CancellationSource> m_cancellable; ///< Until their result is delivered
+};
+
+#endif // INFERENCE_SERVER_H
@@ -0,0 +1,173 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Protocol.h"
+
+/**
+ * @file IoEngine.h
+ * @brief Pluggable network I/O engines for the inference server.
+ *
+ * An engine owns the listening socket and every client connection. It
+ * runs a single event loop thread that accepts connections, splits the
+ * incoming byte streams into frames and hands each frame to a
+ * FrameHandler. Responses may be sent from any thread with send().
+ */
+
+/**
+ * @brief Available engine implementations.
+ */
+enum class IoEngineKind {
+    Epoll,   ///< epoll + non-blocking recv/writev
+    IoUring, ///< io_uring: multishot accept/recv, registered buffers, batched submission
+};
+
+/**
+ * @brief Parses "epoll" or "io_uring".
+ * @throws std::invalid_argument for unknown names.
+ */
+IoEngineKind parse_io_engine_kind(const std::string& name);
+
+/**
+ * @struct IoEngineConfig
+ * @brief Engine settings. io_uring-only fields are ignored by epoll.
+ */
+struct IoEngineConfig {
+    IoEngineKind kind = IoEngineKind::Epoll;
+    uint16_t port = 9000;            ///< TCP port, or 0 for an ephemeral one
+    std::string bind_address = "0.0.0.0";
+    bool reuse_port = false;         ///< SO_REUSEPORT: several processes listen on one port
+
+    // --- io_uring ---
+    bool sqpoll = false;             ///< Kernel thread polls the SQ (IORING_SETUP_SQPOLL)
+    uint32_t sqpoll_idle_ms = 1000;  ///< Idle time before the SQ thread sleeps
+    uint32_t ring_entries = 4096;    ///< Submission queue size
+    uint32_t recv_buffers = 1024;    ///< Provided buffers for multishot recv (power of two)
+    uint32_t recv_buffer_size = 16384;
+    uint32_t send_slots = 1024;      ///< Slots in the registered send arena
+    uint32_t send_slot_size = 4096;
+};
+
+/**
+ * @struct IoEngineStats
+ * @brief Counters exported by every engine.
+ */
+struct IoEngineStats {
+    uint64_t connections_accepted = 0;
+    uint64_t frames_received = 0;
+    uint64_t frames_sent = 0;
+    uint64_t kernel_entries = 0; ///< System calls made by the event loop
+};
+
+/**
+ * @class IoEngine
+ * @brief Base class for the event-loop implementations.
+ */
+class IoEngine {
+public:
+    /**
+     * @brief Called on the event loop thread for every complete frame.
+     *
+     * The payload pointer is only valid for the duration of the call.
+     * Handlers must not block; long work belongs on another thread.
+     */
+    using FrameHandler = std::function<void(uint64_t connection_id, const WireHeader& header,
+                                            const uint8_t* payload)>;
+
+    /**
+     * @brief Creates the requested engine, bound and listening.
+     *
+     * If io_uring is requested but unavailable (not compiled in, or
+     * blocked by the kernel/seccomp), falls back to epoll with a warning.
+     *
+     * @throws std::runtime_error if the socket cannot be set up.
+     */
+    static std::unique_ptr<IoEngine> create(const IoEngineConfig& config, FrameHandler handler);
+
+    virtual ~IoEngine();
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    /**
+     * @brief Runs the event loop on the calling thread until stop().
+     */
+    virtual void run() = 0;
+
+    /**
+     * @brief Requests the loop to exit. Safe to call from any thread.
+     */
+    void stop();
+
+    /**
+     * @brief Queues a complete frame for a connection. Thread-safe.
+     *
+     * Frames for a closed connection are dropped silently.
+     */
+    void send(uint64_t connection_id, std::vector<uint8_t> frame);
+
+    /**
+     * @brief Returns a snapshot of the engine counters.
+     */
+    IoEngineStats stats() const;
+
+    /**
+     * @brief Returns the engine's name ("epoll" or "io_uring").
+     */
+    virtual const char* name() const = 0;
+
+    uint16_t port() const { return m_port; }
+
+protected:
+    IoEngine(const IoEngineConfig& config, FrameHandler handler);
+
+    /**
+     * @brief Queues a frame from the loop thread itself.
+     */
+    virtual void queue_frame(uint64_t connection_id, std::vector<uint8_t> frame) = 0;
+
+    /**
+     * @brief Interrupts the loop's wait. Called from foreign threads.
+     */
+    virtual void wake() = 0;
+
+    /**
+     * @brief Moves frames sent from foreign threads onto their connections.
+     * Must be called by the loop after consuming a wake-up.
+     */
+    void drain_remote_frames();
+
+    /**
+     * @brief Marks the current thread as the loop thread.
+     */
+    void enter_loop();
+
+    IoEngineConfig m_config;
+    FrameHandler m_handler;
+    int m_listen_fd = -1;
+    uint16_t m_port = 0;
+    std::atomic<bool> m_running{true};
+
+    // --- Counters (updated by the loop thread) ---
+    std::atomic<uint64_t> m_connections_accepted{0};
+    std::atomic<uint64_t> m_frames_received{0};
+    std::atomic<uint64_t> m_frames_sent{0};
+    std::atomic<uint64_t> m_kernel_entries{0};
+
+private:
+    std::atomic<std::thread::id> m_loop_thread{}; ///< Set by run(), read by senders
+    std::mutex m_remote_mutex;
+    std::vector<std::pair<uint64_t, std::vector<uint8_t>>> m_remote_frames;
+    std::atomic<bool> m_wake_pending{false}; ///< Collapses wake-ups under load
+};
+
+#endif // IO_ENGINE_H
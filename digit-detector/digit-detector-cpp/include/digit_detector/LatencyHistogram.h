@@ -0,0 +1,74 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * @file LatencyHistogram.h
+ * @brief Fixed-precision latency histogram in the style of HdrHistogram.
+ *
+ * Values (nanoseconds) are kept in log-linear buckets with 2048
+ * sub-buckets per power of two, so any recorded value is reported
+ * within 0.1% regardless of magnitude. Recording is O(1) and allocation
+ * free; histograms from several threads can be merged.
+ */
+class LatencyHistogram {
+public:
+    /**
+     * @brief Creates an empty histogram.
+     * @param highest_trackable_ns Larger values are clamped to this.
+     */
+    explicit LatencyHistogram(uint64_t highest_trackable_ns = 3600ull * 1000 * 1000 * 1000);
+
+    /**
+     * @brief Records one or more occurrences of a value.
+     */
+    void record(uint64_t value_ns, uint64_t count = 1);
+
+    /**
+     * @brief Adds all counts of another histogram.
+     */
+    void merge(const LatencyHistogram& other);
+
+    void reset();
+
+    uint64_t count() const { return m_total; }
+    uint64_t min() const { return m_total == 0 ? 0 : m_min; }
+    uint64_t max() const { return m_max; }
+    double mean() const;
+    double stddev() const;
+
+    /**
+     * @brief Returns the value at a percentile in [0, 100].
+     *
+     * The result is the highest value equivalent to the bucket holding
+     * the requested rank, like HdrHistogram's getValueAtPercentile().
+     */
+    uint64_t value_at_percentile(double percentile) const;
+
+    /**
+     * @brief Writes the percentile distribution in HdrHistogram's .hgrm text
+     * format, which the standard HdrHistogram plotters accept.
+     * @param unit_divisor Values are divided by this (1000 = microseconds).
+     */
+    void write_percentile_distribution(std::ostream& out, double unit_divisor = 1000.0) const;
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 11;
+    static constexpr uint64_t SUB_BUCKET_COUNT = 1ull << SUB_BUCKET_BITS;
+    static constexpr uint64_t SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+
+    size_t index_of(uint64_t value) const;
+    uint64_t lowest_equivalent(size_t index) const;
+    uint64_t highest_equivalent(size_t index) const;
+
+    uint64_t m_highest_trackable;
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,302 @@
+#ifndef LAYER_KERNELS_H
+#define LAYER_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @file LayerKernels.h
+ * @brief Hand-written CPU kernels for DigitRecognizer's layers, on plain
+ * float arrays. NativeModel.h runs the model on them.
+ *
+ * Weights can be stored as fp16 or bf16, half the bytes of fp32, and are
+ * widened to fp32 as they are loaded; every sum is accumulated in fp32.
+ * The kernel is picked once, from what the CPU supports:
+ *
+ *  - fp16: F16C's vcvtph2ps with AVX2 FMA;
+ *  - bf16: AVX512-BF16's vdpbf16ps, which also rounds the activations to
+ *    bf16, or else a 16-bit shift into fp32 with AVX2 FMA;
+ *  - without AVX2, F16C and FMA: portable scalar code.
+ *
+ * The 3x3 convolutions can also run as Winograd F(2x2, 3x3) in fp32, and
+ * pruned linear layers as block-sparse fp32.
+ */
+
+/**
+ * @brief How a layer's weights are stored.
+ */
+enum class WeightPrecision { Fp32, Fp16, Bf16 };
+
+/**
+ * @brief Parses "fp32", "fp16" or "bf16".
+ * @throws std::invalid_argument for anything else.
+ */
+WeightPrecision parse_weight_precision(const std::string& name);
+
+std::string to_string(WeightPrecision precision);
+
+/**
+ * @brief Names of the instruction sets the kernels will use, e.g. "avx2+f16c".
+ */
+std::string kernel_isa(WeightPrecision precision);
+
+/**
+ * @brief How a 3x3 convolution is computed.
+ */
+enum class ConvAlgorithm {
+    Direct,  ///< LibTorch's conv2d; fp32 only
+    Im2col,  ///< Patches as rows, then one matrix product; the only choice for fp16/bf16
+    Winograd ///< F(2x2, 3x3) with filters transformed at load; fp32 only
+};
+
+/**
+ * @brief Parses "direct", "im2col" or "winograd".
+ * @throws std::invalid_argument for anything else.
+ */
+ConvAlgorithm parse_conv_algorithm(const std::string& name);
+
+std::string to_string(ConvAlgorithm algorithm);
+
+/**
+ * @struct KernelOptions
+ * @brief How each of DigitRecognizer's layers runs; see NativeModel.h.
+ */
+struct KernelOptions {
+    /// By layer: "conv1", "conv2", "fc1", "fc2". Layers not listed stay fp32
+    /// and run on LibTorch's own kernels
+    std::map<std::string, WeightPrecision> precision;
+
+    /// By conv layer: "conv1", "conv2". Layers not listed run Direct in fp32
+    /// and Im2col in fp16/bf16
+    std::map<std::string, ConvAlgorithm> conv_algorithm;
+
+    /// By linear layer: "fc1", "fc2". A .bsr file of the layer's pruned
+    /// weights (see BlockSparseLinear), run skipping the pruned blocks
+    std::map<std::string, std::string> block_sparse;
+
+    /**
+     * @brief True if any layer departs from plain TorchScript.
+     */
+    bool enabled() const;
+};
+
+/**
+ * @class PackedLinear
+ * @brief out = x W^T + b, optionally followed by ReLU, with W in fp16 or bf16.
+ */
+class PackedLinear {
+public:
+    /**
+     * @param weight [outputs, inputs] fp32, row-major (nn.Linear's layout).
+     * @param bias [outputs] fp32, or null.
+     * @throws std::invalid_argument if precision is Fp32: fp32 layers are
+     *         left to LibTorch.
+     */
+    PackedLinear(const float* weight, const float* bias, size_t outputs, size_t inputs,
+                 WeightPrecision precision);
+
+    /**
+     * @brief out[r * row_stride + o * col_stride] for each of rows inputs
+     * x[r * inputs ...]. Thread-safe.
+     */
+    void run(const float* x, size_t rows, float* out, size_t row_stride, size_t col_stride,
+             bool relu) const;
+
+    size_t outputs() const { return m_outputs; }
+    size_t inputs() const { return m_inputs; }
+    WeightPrecision precision() const { return m_precision; }
+
+    /**
+     * @brief Bytes of weights as stored, padding included.
+     */
+    size_t weight_bytes() const { return m_weights.size() * sizeof(uint16_t); }
+
+private:
+    size_t m_outputs;
+    size_t m_inputs;
+    size_t m_stride; ///< Of a weight row; inputs rounded up to 32
+    WeightPrecision m_precision;
+    bool m_dot_bf16; ///< AVX512-BF16 kernel
+    bool m_avx2;     ///< AVX2 + FMA + F16C kernel
+    std::vector<uint16_t> m_weights; ///< [outputs, stride], zero padded
+    std::vector<float> m_bias;       ///< Zeros without a bias
+};
+
+/**
+ * @brief The 3x3 windows (padding 1) of one [channels, height, width]
+ * image as rows: columns [height * width, channels * 9], each row in
+ * nn.Conv2d's [channel][ky][kx] weight order, zero outside the image.
+ */
+void im2col_3x3(const float* image, size_t channels, size_t height, size_t width,
+                float* columns);
+
+/**
+ * @class PackedConv3x3
+ * @brief 3x3 convolution, stride 1, padding 1 (both of DigitRecognizer's),
+ * optionally followed by ReLU: im2col, then PackedLinear over the patches.
+ */
+class PackedConv3x3 {
+public:
+    /**
+     * @param weight [out_channels, in_channels, 3, 3] fp32 (nn.Conv2d's layout).
+     */
+    PackedConv3x3(const float* weight, const float* bias, size_t out_channels,
+                  size_t in_channels, WeightPrecision precision);
+
+    /**
+     * @brief x [batch, in_channels, height, width] to out [batch,
+     * out_channels, height, width]. Thread-safe.
+     */
+    void run(const float* x, size_t batch, size_t height, size_t width, float* out,
+             bool relu) const;
+
+    size_t weight_bytes() const { return m_linear.weight_bytes(); }
+
+private:
+    size_t m_in_channels;
+    PackedLinear m_linear; ///< [out_channels, in_channels * 9]
+};
+
+/**
+ * @class WinogradConv3x3
+ * @brief 3x3 convolution, stride 1, padding 1, optionally followed by
+ * ReLU, as Winograd F(2x2, 3x3) in fp32.
+ *
+ * Each 2x2 block of outputs takes 16 multiplies per channel pair instead
+ * of 36: the 4x4 input tile and the filter are each transformed, multiplied
+ * elementwise (16 matrix products over the channels, batched across tiles)
+ * and transformed back. The filters are transformed once, here; the tile
+ * transforms run eight tiles at a time with AVX2 where the CPU has it.
+ */
+class WinogradConv3x3 {
+public:
+    /**
+     * @param weight [out_channels, in_channels, 3, 3] fp32 (nn.Conv2d's layout).
+     * @param bias [out_channels] fp32, or null.
+     */
+    WinogradConv3x3(const float* weight, const float* bias, size_t out_channels,
+                    size_t in_channels);
+
+    /**
+     * @brief x [batch, in_channels, height, width] to out [batch,
+     * out_channels, height, width]. Thread-safe.
+     * @throws std::invalid_argument if height or width is odd.
+     */
+    void run(const float* x, size_t batch, size_t height, size_t width, float* out,
+             bool relu) const;
+
+    /**
+     * @brief Bytes of transformed filters: 16/9 of the fp32 weights.
+     */
+    size_t weight_bytes() const { return m_filters.size() * sizeof(float); }
+
+    /**
+     * @brief "avx2+fma" or "scalar".
+     */
+    static std::string isa();
+
+private:
+    size_t m_out_channels;
+    size_t m_in_channels;
+    bool m_avx2;
+    std::vector<float> m_filters; ///< [16][out_channels][in_channels], G g G^T
+    std::vector<float> m_bias;    ///< Zeros without a bias
+};
+
+/**
+ * @class BlockSparseLinear
+ * @brief out = x W^T + b, optionally followed by ReLU, with W stored in
+ * block-sparse rows (BSR): only the blocks of block_rows x block_cols
+ * weights that survived pruning are kept, and only they are multiplied.
+ *
+ * block_rows must be 1, 2 or 4 and block_cols a multiple of 8, so that a
+ * block is whole AVX2 vectors; outputs and inputs must be multiples of
+ * them. The values are fp32.
+ *
+ * A .bsr file, as digit-prune writes it, is little-endian:
+ *
+ *     char     magic[4] = "BSR1"
+ *     uint32   outputs, inputs, block_rows, block_cols, blocks
+ *     int32    row_start[outputs / block_rows + 1]   first block of each block row
+ *     int32    column[blocks]                        block column of each block
+ *     float32  values[blocks][block_rows][block_cols]
+ *     float32  bias[outputs]
+ *
+ * which is torch's to_sparse_bsr() layout (crow_indices, col_indices,
+ * values) plus the bias.
+ */
+class BlockSparseLinear {
+public:
+    /**
+     * @brief Keeps the blocks of a dense [outputs, inputs] weight that have
+     * any non-zero entry.
+     * @param bias [outputs], or null.
+     * @throws std::invalid_argument for an unsupported block shape.
+     */
+    BlockSparseLinear(const float* weight, const float* bias, size_t outputs, size_t inputs,
+                      size_t block_rows, size_t block_cols);
+
+    /**
+     * @brief Loads a .bsr file.
+     * @throws std::runtime_error on a missing or malformed file.
+     * @throws std::invalid_argument for an unsupported block shape.
+     */
+    static BlockSparseLinear read(const std::string& path);
+
+    /**
+     * @brief As PackedLinear::run(). Thread-safe.
+     */
+    void run(const float* x, size_t rows, float* out, size_t row_stride, size_t col_stride,
+             bool relu) const;
+
+    /**
+     * @brief The weights as a dense [outputs, inputs] matrix, zeros where
+     * blocks were pruned.
+     */
+    std::vector<float> dense() const;
+
+    size_t outputs() const { return m_outputs; }
+    size_t inputs() const { return m_inputs; }
+    size_t block_rows() const { return m_block_rows; }
+    size_t block_cols() const { return m_block_cols; }
+    size_t blocks() const { return m_columns.size(); }
+    const std::vector<float>& bias() const { return m_bias; }
+
+    /**
+     * @brief Share of the blocks kept, in [0, 1].
+     */
+    double density() const;
+
+    /**
+     * @brief Bytes of stored values and indices.
+     */
+    size_t weight_bytes() const;
+
+    /**
+     * @brief "avx2+fma" or "scalar".
+     */
+    static std::string isa();
+
+private:
+    BlockSparseLinear() = default;
+
+    /**
+     * @throws std::invalid_argument for an unsupported block shape.
+     */
+    void check_shape() const;
+
+    size_t m_outputs = 0;
+    size_t m_inputs = 0;
+    size_t m_block_rows = 0;
+    size_t m_block_cols = 0;
+    bool m_avx2 = false;
+    std::vector<uint32_t> m_row_start; ///< [outputs / block_rows + 1], into m_columns
+    std::vector<uint32_t> m_columns;   ///< Block column of each stored block
+    std::vector<float> m_values;       ///< [blocks][block_rows][block_cols]
+    std::vector<float> m_bias;         ///< Zeros without a bias
+};
+
+#endif // LAYER_KERNELS_H
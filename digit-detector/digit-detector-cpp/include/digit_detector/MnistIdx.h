@@ -0,0 +1,100 @@
+#ifndef MNIST_IDX_H
+#define MNIST_IDX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @file MnistIdx.h
+ * @brief Reader for the MNIST IDX files (the format torchvision downloads).
+ *
+ * The raw files live under <data_dir>/MNIST/raw/, e.g.
+ * t10k-images-idx3-ubyte and t10k-labels-idx1-ubyte.
+ */
+
+/**
+ * @struct MnistSet
+ * @brief Images stored back to back, plus optional labels.
+ */
+struct MnistSet {
+    uint32_t count = 0;
+    uint32_t rows = 0;
+    uint32_t cols = 0;
+    std::vector<uint8_t> pixels;  ///< count * rows * cols bytes, row-major
+    std::vector<uint8_t> labels;  ///< Empty if no label file was given
+
+    const uint8_t* image(size_t index) const {
+        return pixels.data() + index * static_cast<size_t>(rows) * cols;
+    }
+    size_t image_bytes() const { return static_cast<size_t>(rows) * cols; }
+};
+
+/**
+ * @brief Loads an idx3 image file and, optionally, the matching idx1 labels.
+ * @param images_path Path to the *-images-idx3-ubyte file.
+ * @param labels_path Path to the *-labels-idx1-ubyte file, or empty.
+ * @param limit Load at most this many images (0 = all).
+ * @throws std::runtime_error on missing or malformed files.
+ */
+MnistSet load_mnist_idx(const std::string& images_path, const std::string& labels_path = "",
+                        size_t limit = 0);
+
+/**
+ * @class MappedMnist
+ * @brief An idx3 image file and, optionally, its idx1 labels, mapped
+ * read-only instead of copied into memory.
+ *
+ * The pages are shared with the page cache and faulted in as images are
+ * touched, so several loaders, or processes, over one file cost one copy.
+ * Read-only and thread-safe; must outlive anything reading from it.
+ */
+class MappedMnist {
+public:
+    /**
+     * @param images_path Path to the *-images-idx3-ubyte file.
+     * @param labels_path Path to the *-labels-idx1-ubyte file, or empty.
+     * @throws std::runtime_error on missing, malformed or truncated files.
+     */
+    explicit MappedMnist(const std::string& images_path, const std::string& labels_path = "");
+    ~MappedMnist();
+
+    MappedMnist(const MappedMnist&) = delete;
+    MappedMnist& operator=(const MappedMnist&) = delete;
+
+    uint32_t count() const { return m_count; }
+    uint32_t rows() const { return m_rows; }
+    uint32_t cols() const { return m_cols; }
+    size_t image_bytes() const { return static_cast<size_t>(m_rows) * m_cols; }
+
+    const uint8_t* image(size_t index) const { return m_pixels + index * image_bytes(); }
+    bool has_labels() const { return m_labels != nullptr; }
+    uint8_t label(size_t index) const { return m_labels[index]; }
+
+private:
+    struct Mapping {
+        void* base = nullptr;
+        size_t size = 0;
+    };
+
+    static Mapping map_file(const std::string& path);
+    void unmap();
+
+    Mapping m_images;
+    Mapping m_label_file;
+    uint32_t m_count = 0;
+    uint32_t m_rows = 0;
+    uint32_t m_cols = 0;
+    const uint8_t* m_pixels = nullptr;
+    const uint8_t* m_labels = nullptr; ///< nullptr if no label file was given
+};
+
+/**
+ * @brief Guesses the labels file next to an images file
+ * ("...-images-idx3-ubyte" -> "...-labels-idx1-ubyte").
+ * @return The guessed path, or an empty string if the name does not match.
+ */
+std::string mnist_labels_path_for(const std::string& images_path);
+
+#endif // MNIST_IDX_H
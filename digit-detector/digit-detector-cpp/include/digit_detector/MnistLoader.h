@@ -0,0 +1,116 @@
+#ifndef MNIST_LOADER_H
+#define MNIST_LOADER_H
+
+#include <torch/script.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Augmentation.h"
+#include "MnistIdx.h"
+
+/**
+ * @file MnistLoader.h
+ * @brief Shuffled, normalized training batches from a mapped IDX file,
+ * assembled ahead of the training loop by worker threads.
+ */
+
+/**
+ * @struct LoaderOptions
+ * @brief How MnistBatchLoader cuts and prepares batches.
+ */
+struct LoaderOptions {
+    int64_t batch_size = 64;
+    int workers = 2;        ///< Threads assembling batches
+    size_t prefetch = 8;    ///< Batches assembled ahead of the consumer
+    bool shuffle = true;    ///< Reshuffle at every epoch
+    bool drop_last = false; ///< Skip a final short batch
+    uint64_t seed = 0;      ///< Epoch e shuffles with seed + e
+    AugmentOptions augment; ///< Random augmentation of every batch; off by default
+};
+
+/**
+ * @struct MnistBatch
+ * @brief One batch, in the layout and normalization DigitRecognizer was
+ * trained on.
+ */
+struct MnistBatch {
+    at::Tensor images; ///< [B, 1, rows, cols] float, (x / 255 - mean) / std
+    at::Tensor labels; ///< [B] int64; undefined if the set has no labels
+};
+
+/**
+ * @class MnistBatchLoader
+ * @brief Prefetching batch iterator over a MappedMnist, the C++ side's
+ * counterpart to torch's DataLoader.
+ *
+ * Workers claim batches in order, gather their images through the epoch's
+ * permutation and convert each batch to float in one pass, normalization
+ * folded into a single multiply-add per pixel, into a ring of `prefetch`
+ * slots. With augmentation on, the worker also warps its batch in place
+ * (Augmenter), from a seed fixed by the loader seed, epoch and batch
+ * index. next() hands the batches out in order, so an epoch is the same
+ * for a given seed however many workers there are. One consumer thread.
+ */
+class MnistBatchLoader {
+public:
+    /**
+     * @param set Images and labels; must outlive the loader.
+     * @throws std::invalid_argument for a non-positive batch size, worker
+     *         count or prefetch depth, bad augmentation ranges, or
+     *         augmentation of images that are not 28x28.
+     */
+    MnistBatchLoader(const MappedMnist& set, LoaderOptions options);
+    ~MnistBatchLoader();
+
+    MnistBatchLoader(const MnistBatchLoader&) = delete;
+    MnistBatchLoader& operator=(const MnistBatchLoader&) = delete;
+
+    /**
+     * @brief Abandons the current epoch, if any, and starts assembling
+     * epoch `epoch`.
+     */
+    void start_epoch(uint64_t epoch);
+
+    /**
+     * @brief The epoch's next batch; blocks until a worker has it ready.
+     * @return false once the epoch is exhausted.
+     * @throws whatever a worker threw while assembling the batch.
+     */
+    bool next(MnistBatch& batch);
+
+    /// Batches per epoch.
+    size_t batches() const { return m_batches; }
+
+    const LoaderOptions& options() const { return m_options; }
+
+private:
+    void work();
+    void stop();
+    MnistBatch assemble(size_t index) const;
+
+    const MappedMnist& m_set;
+    const LoaderOptions m_options;
+    const size_t m_batches;
+    const Augmenter m_augmenter;
+
+    uint64_t m_epoch = 0;
+    std::vector<uint32_t> m_order;   ///< The epoch's permutation of the images
+    std::vector<MnistBatch> m_slots; ///< Ring of prefetch batches
+    std::vector<bool> m_ready;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready_cv; ///< A slot was filled
+    std::condition_variable m_space_cv; ///< A slot was consumed, or stop
+    size_t m_next_claim = 0;            ///< Next batch a worker takes on
+    size_t m_consumed = 0;              ///< Batches next() has handed out
+    bool m_stopping = false;
+    std::exception_ptr m_error;
+    std::vector<std::thread> m_workers;
+};
+
+#endif // MNIST_LOADER_H
@@ -0,0 +1,125 @@
+#ifndef MODEL_REGISTRY_H
+#define MODEL_REGISTRY_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LayerKernels.h"
+#include "PipelineExecutor.h"
+
+class InferenceEngine;
+
+/**
+ * @file ModelRegistry.h
+ * @brief Named, versioned models served side by side from one process.
+ */
+
+/**
+ * @struct ModelConfig
+ * @brief Per-model serving settings.
+ */
+struct ModelConfig {
+    std::string name = "digit";
+    std::string version = "1";
+    std::string model_path;
+    double weight = 1.0;      ///< Share of the worker pool while models compete
+    uint32_t max_batch = 32;  ///< Requests per forward pass
+    std::chrono::microseconds batch_delay{0}; ///< How long a partial batch may wait to fill
+    uint32_t max_queue = 4096; ///< Requests beyond this are rejected
+    std::chrono::microseconds deadline{0}; ///< For requests that carry none; 0 = no deadline
+    bool coalesce = true;     ///< Identical in-flight inputs share one row
+    PipelineOptions pipeline; ///< With stages, batches run on a pipeline of processes
+    KernelOptions kernels;    ///< Per-layer weight precision; all fp32 runs TorchScript
+    uint32_t tta_variants = 1; ///< Augmented copies averaged per input; 1 = off; no pipelines
+};
+
+/**
+ * @class ServedModel
+ * @brief One loaded model and its configuration.
+ */
+class ServedModel {
+public:
+    /**
+     * @brief Loads the model, and starts its pipeline if it has stages.
+     * @throws std::runtime_error if the model fails to load.
+     */
+    explicit ServedModel(ModelConfig config);
+    ~ServedModel();
+
+    ServedModel(const ServedModel&) = delete;
+    ServedModel& operator=(const ServedModel&) = delete;
+
+    const ModelConfig& config() const { return m_config; }
+    InferenceEngine& engine() { return *m_engine; }
+
+    /**
+     * @brief The model's pipeline, or nullptr if batches run in-process.
+     */
+    PipelineExecutor* pipeline() { return m_pipeline.get(); }
+
+    /**
+     * @brief Returns "name:version".
+     */
+    std::string key() const { return m_config.name + ":" + m_config.version; }
+
+    /**
+     * @brief Bytes held by the model's weights (parameters and buffers).
+     */
+    size_t weight_bytes() const { return m_weight_bytes; }
+
+private:
+    ModelConfig m_config;
+    std::unique_ptr<InferenceEngine> m_engine;
+    std::unique_ptr<PipelineExecutor> m_pipeline; ///< Declared after the engine it runs
+    size_t m_weight_bytes = 0;
+};
+
+/**
+ * @class ModelRegistry
+ * @brief Looks models up by name and version. Thread-safe.
+ */
+class ModelRegistry {
+public:
+    /**
+     * @brief Loads and registers a model.
+     *
+     * The most recently added version of a name becomes that name's
+     * default; the first model added becomes the registry's default.
+     *
+     * @throws std::invalid_argument if name:version is already registered.
+     * @throws std::runtime_error if the model fails to load.
+     */
+    std::shared_ptr<ServedModel> add(const ModelConfig& config);
+
+    /**
+     * @brief Registers an already loaded model, e.g. one a prefork parent
+     * loaded before its workers existed.
+     * @throws std::invalid_argument if name:version is already registered.
+     */
+    std::shared_ptr<ServedModel> add(std::shared_ptr<ServedModel> model);
+
+    /**
+     * @brief Resolves "name", "name:version", or "" (the default model).
+     * @return The model, or nullptr if there is no match.
+     */
+    std::shared_ptr<ServedModel> find(const std::string& spec) const;
+
+    /**
+     * @brief Returns every registered model, ordered by name and version.
+     */
+    std::vector<std::shared_ptr<ServedModel>> models() const;
+
+private:
+    mutable std::shared_mutex m_mutex;
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<ServedModel>> m_models;
+    std::map<std::string, std::shared_ptr<ServedModel>> m_latest; ///< Per-name default
+    std::shared_ptr<ServedModel> m_default;
+};
+
+#endif // MODEL_REGISTRY_H
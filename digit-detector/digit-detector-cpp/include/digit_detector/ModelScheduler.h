@@ -0,0 +1,274 @@
+#ifndef MODEL_SCHEDULER_H
+#define MODEL_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Cancellation.h"
+#include "LatencyHistogram.h"
+#include "ModelRegistry.h"
+#include "ServiceTimeEstimator.h"
+#include "ThreadBudget.h"
+#include "WorkStealingPool.h"
+#include "types.h"
+
+/**
+ * @file ModelScheduler.h
+ * @brief Shares one WorkStealingPool between several models.
+ *
+ * Each model has a bounded queue per priority class. Interactive batches
+ * always go before bulk ones; within a class, requests run earliest
+ * deadline first and a batch never mixes classes. Between models,
+ * batches are picked by weighted fair queuing (self-clocked: a waiting model
+ * starts at max(virtual time, its last finish), its next batch finishes
+ * at start + size / weight, and the smallest finish runs), so a model
+ * with weight 2 gets twice the throughput of a weight-1 model while both
+ * are backlogged, and an idle model cannot bank credit. A queue is ready
+ * once it holds max_batch requests, its head has waited batch_delay, or
+ * its head's deadline cannot afford more waiting. At most one batch per
+ * model runs at a time.
+ *
+ * Picking is event driven: submit() and every finished batch pick what is
+ * ready and post it to the pool as a task, and a timer thread does the
+ * same when a batch_delay or deadline falls due. Admitted requests are
+ * preprocessed by pool tasks before they join the queue, so preprocessing
+ * overlaps the batching delay; each model has at most
+ * max(2 x max_batch, workers) of those tasks out at once, so one model's
+ * flood cannot delay another's preprocessing. Responses are delivered
+ * from the task that ran the forward pass. With a ThreadBudget, the number
+ * of batches in flight follows its concurrency and every finished batch is
+ * reported to it.
+ *
+ * Coalescing ("singleflight"): each preprocessed input is keyed by a hash
+ * of its 28x28 tensor. Within a model and class, a request whose input is
+ * identical to one already queued or running joins that one's flight
+ * instead of adding a row. The flight runs once and its result fans out
+ * to every waiter. A joiner with an earlier deadline moves a queued flight
+ * up, and waiters are shed one by one, so no waiter is served later than
+ * it would have been alone. Flights are forgotten the moment their result
+ * is delivered; nothing is cached. ModelConfig::coalesce turns it off.
+ *
+ * Admission control: every model keeps a live estimate of its batch
+ * service time. A request whose deadline the estimate says cannot be met
+ * behind the work already queued is rejected at submit, and requests
+ * that have become hopeless by the time they reach the head are shed
+ * instead of run. Both end with RequestStatus::Overloaded, so under
+ * overload the pool only spends time on requests that will still
+ * be useful when they finish.
+ */
+
+/**
+ * @enum Priority
+ * @brief Scheduling class of a request.
+ */
+enum class Priority : uint8_t {
+    Interactive = 0, ///< Someone is waiting on it
+    Bulk = 1,        ///< Throughput work; runs when no interactive batch is ready
+};
+
+/**
+ * @enum RequestStatus
+ * @brief How a submitted request ended.
+ */
+enum class RequestStatus {
+    Ok,
+    QueueFull,  ///< Rejected at submit; the model's queue was at max_queue
+    Overloaded, ///< Rejected or shed; it would have missed its deadline
+    Failed,     ///< Preprocessing or the forward pass threw, or shutdown
+    Cancelled   ///< Dropped from the queue after its token was cancelled
+};
+
+/**
+ * @struct InferenceRequest
+ * @brief One raw 8-bit grayscale image and where to deliver its result.
+ */
+struct InferenceRequest {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<uint8_t> pixels;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    Priority priority = Priority::Interactive;
+    /// Absolute deadline; max() means the model's default deadline (if any)
+    Clock::time_point deadline = Clock::time_point::max();
+    /// Checked when batches are picked; a cancelled request does not run
+    CancellationToken token;
+    /// Called exactly once, on a pool worker (or the submitter on rejection)
+    std::function<void(RequestStatus, const Prediction&)> done;
+};
+
+/**
+ * @struct ModelStats
+ * @brief Counters for one model since the scheduler started.
+ */
+struct ModelStats {
+    std::string model;      ///< "name:version"
+    double weight = 0.0;
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    uint64_t goodput = 0;   ///< Completed within their deadline
+    uint64_t late = 0;      ///< Completed, but after their deadline
+    uint64_t rejected = 0;  ///< Queue full
+    uint64_t overloaded = 0; ///< Refused at admission
+    uint64_t shed = 0;      ///< Dropped from the queue as hopeless
+    uint64_t cancelled = 0; ///< Dropped from the queue at the client's request
+    uint64_t failed = 0;
+    uint64_t batches = 0;
+    double mean_batch = 0.0;  ///< Rows per forward pass
+    uint64_t coalesced = 0;   ///< Answered by another request's row
+    double collapse_ratio = 1.0; ///< Requests answered per row run
+    double coalesced_p99_us = 0.0; ///< Submit-to-result p99 of coalesced requests
+    size_t queue_depth = 0;
+    double p50_us = 0.0;    ///< Submit-to-result latency, all classes
+    double p99_us = 0.0;
+    double interactive_p99_us = 0.0;
+    double bulk_p99_us = 0.0;
+    double service_estimate_us = 0.0; ///< Upper-quantile forward time of a full batch
+    size_t weight_bytes = 0; ///< Model parameters and buffers
+    size_t queued_bytes = 0; ///< Pixels waiting to be preprocessed
+};
+
+/**
+ * @class ModelScheduler
+ * @brief Runs requests for any registered model as tasks on a shared pool.
+ */
+class ModelScheduler {
+public:
+    /**
+     * @brief Starts the timer thread.
+     * @param pool Runs the batches; must outlive the scheduler.
+     * @param max_batches Batches in flight across all models; 0 means pool.size().
+     * @param budget If given, overrides max_batches with its concurrency;
+     *        must outlive the scheduler.
+     */
+    explicit ModelScheduler(WorkStealingPool& pool, uint32_t max_batches = 0,
+                            ThreadBudget* budget = nullptr);
+
+    /**
+     * @brief Destructor. Waits for batches in flight and fails anything still queued.
+     */
+    ~ModelScheduler();
+
+    ModelScheduler(const ModelScheduler&) = delete;
+    ModelScheduler& operator=(const ModelScheduler&) = delete;
+
+    /**
+     * @brief Queues a request for a model.
+     * @return false if the request was refused (queue full, or its deadline
+     *         cannot be met); request.done has then already been called.
+     */
+    bool submit(const std::shared_ptr<ServedModel>& model, InferenceRequest request);
+
+    /**
+     * @brief Returns a snapshot of every model seen so far, ordered by key.
+     */
+    std::vector<ModelStats> stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t CLASS_COUNT = 2;
+
+    struct Pending {
+        InferenceRequest request;
+        Clock::time_point enqueued;
+    };
+
+    /// One preprocessed input and every request waiting for its row
+    struct Flight;
+
+    using Order = std::pair<Clock::time_point, uint64_t>;
+
+    /// Earliest deadline first; the sequence number keeps FIFO among equals
+    using ClassQueue = std::map<Order, std::shared_ptr<Flight>>;
+
+    struct ModelQueue {
+        std::shared_ptr<ServedModel> model;
+        ClassQueue classes[CLASS_COUNT];
+        /// Queued and running flights by input key, while coalescing
+        std::unordered_map<uint64_t, std::shared_ptr<Flight>> flights[CLASS_COUNT];
+        std::deque<Pending> raw;   ///< Admitted, waiting for a preprocessing slot
+        size_t preparing = 0;      ///< Preprocessing tasks out on the pool
+        size_t size = 0;           ///< Admitted requests not yet in a batch
+        bool stamped = false;      ///< start_stamp is set until the next dispatch
+        double start_stamp = 0.0;
+        double last_finish = 0.0;
+        bool busy = false;
+        size_t inflight = 0;
+        Clock::time_point inflight_start;
+        size_t queued_bytes = 0;
+        ServiceTimeEstimator service;
+        uint64_t submitted = 0;
+        uint64_t completed = 0;
+        uint64_t goodput = 0;
+        uint64_t late = 0;
+        uint64_t rejected = 0;
+        uint64_t overloaded = 0;
+        uint64_t shed = 0;
+        uint64_t cancelled = 0;
+        uint64_t failed = 0;
+        uint64_t batches = 0;
+        uint64_t rows = 0;
+        uint64_t coalesced = 0;
+        LatencyHistogram latency[CLASS_COUNT];
+        LatencyHistogram coalesced_latency;
+    };
+
+    /**
+     * @brief Posts every batch that is ready, up to the in-flight limit.
+     *
+     * Called with m_mutex held; releases it while delivering shed requests.
+     */
+    void dispatch(std::unique_lock<std::mutex>& lock);
+    void timer_loop();
+    uint32_t max_running() const;
+    bool admissible(const ModelQueue& queue, Priority priority,
+                    Clock::time_point deadline, Clock::time_point now) const;
+    /**
+     * @brief Moves raw requests into free preprocessing slots. Called with
+     * m_mutex held; the caller posts the result with post_prepares().
+     */
+    std::vector<std::shared_ptr<Pending>> take_raw(ModelQueue& queue);
+    void post_prepares(ModelQueue& queue, std::vector<std::shared_ptr<Pending>> pending);
+
+    /**
+     * @brief Pool task: preprocesses one admitted request and queues it,
+     * joining an identical flight if there is one.
+     */
+    void prepare(ModelQueue& queue, Pending pending);
+
+    /**
+     * @brief Queues a new single-waiter flight, or hands its waiter to an
+     * identical flight already queued or running. Called with m_mutex held.
+     */
+    void enqueue(ModelQueue& queue, std::shared_ptr<Flight> flight);
+
+    void run_batch(ModelQueue& queue, std::vector<std::shared_ptr<Flight>>& batch);
+
+    WorkStealingPool& m_pool;
+    ThreadBudget* m_budget;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv; ///< Timer wake-ups and the destructor's drain
+    std::map<const ServedModel*, std::unique_ptr<ModelQueue>> m_queues;
+    double m_virtual_time = 0.0; ///< Finish stamp of the last dispatched batch
+    uint64_t m_sequence = 0;
+    uint32_t m_max_running;
+    uint32_t m_running = 0;      ///< Batches counted against max_running()
+    uint32_t m_tasks = 0;        ///< Pool tasks (preprocess, batch) that may still touch this
+    Clock::time_point m_timer_wake = Clock::time_point::max();
+    bool m_stopping = false;
+
+    std::thread m_timer;
+};
+
+#endif // MODEL_SCHEDULER_H
@@ -0,0 +1,94 @@
+#ifndef NATIVE_MODEL_H
+#define NATIVE_MODEL_H
+
+#include <torch/script.h>
+
+#include <memory>
+#include <string>
+
+#include "LayerKernels.h"
+
+class InferenceEngine;
+
+/**
+ * @file NativeModel.h
+ * @brief DigitRecognizer's forward pass run layer by layer in C++, so that
+ * individual layers can use the kernels of LayerKernels.h.
+ */
+
+/**
+ * @class NativeModel
+ * @brief Runs DigitRecognizer (conv1, conv2, pool, fc1, fc2) with each
+ * layer as configured.
+ *
+ * Layers stored as fp16 or bf16 get a packed copy of their weights at
+ * construction; the model's own fp32 weights are left in place for
+ * anything else that runs it, so memory grows by the copy while a pass
+ * reads half the bytes for that layer. Winograd conv layers likewise get
+ * their transformed filters at construction, and block-sparse linear
+ * layers their kept blocks, read from the .bsr file the options name.
+ * Pooling and the other fp32 layers are LibTorch's operators on the
+ * model's own weights. Thread-safe and read-only once constructed.
+ */
+class NativeModel {
+public:
+    /**
+     * @throws std::runtime_error if the engine's model does not have
+     *         DigitRecognizer's layers and shapes, or a .bsr file cannot be
+     *         read or does not hold the model's own (pruned) weights.
+     * @throws std::invalid_argument for an unknown layer name, a conv
+     *         algorithm the layer's precision does not support, or a
+     *         block-sparse layer not in fp32.
+     */
+    NativeModel(const InferenceEngine& engine, KernelOptions options);
+    ~NativeModel();
+
+    NativeModel(const NativeModel&) = delete;
+    NativeModel& operator=(const NativeModel&) = delete;
+
+    /**
+     * @brief [N, 1, 28, 28] float inputs to [N, 10] logits.
+     */
+    at::Tensor forward(const at::Tensor& input) const;
+
+    /**
+     * @brief One layer on its own, ReLU included where the model has one
+     * ("conv1" takes [N, 1, 28, 28], "conv2" [N, 32, 14, 14], "fc1"
+     * [N, 3136], "fc2" [N, 128]). For measuring layers.
+     * @throws std::invalid_argument for an unknown layer name.
+     */
+    at::Tensor run_layer(const std::string& name, const at::Tensor& input) const;
+
+    /**
+     * @brief Bytes of weights a forward pass reads, as stored.
+     */
+    size_t weight_bytes() const;
+
+    /**
+     * @brief e.g. "conv1 fp32 direct, conv2 fp32 winograd (avx2+fma), fc1 bf16
+     * (avx512_bf16), fc2 fp32", or "fc1 fp32 block-sparse 4x16 (10% dense,
+     * avx2+fma)".
+     */
+    std::string describe() const;
+
+    const KernelOptions& options() const { return m_options; }
+
+private:
+    struct Layer;
+
+    at::Tensor conv(const Layer& layer, const at::Tensor& x) const;
+    at::Tensor linear(const Layer& layer, const at::Tensor& x, bool relu) const;
+
+    /**
+     * @throws std::runtime_error unless layer.block_sparse matches layer.weight.
+     */
+    void check_block_sparse(const Layer& layer, const std::string& path) const;
+
+    KernelOptions m_options;
+    std::unique_ptr<Layer> m_conv1;
+    std::unique_ptr<Layer> m_conv2;
+    std::unique_ptr<Layer> m_fc1;
+    std::unique_ptr<Layer> m_fc2;
+};
+
+#endif // NATIVE_MODEL_H
@@ -0,0 +1,83 @@
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @file PerfStats.h
+ * @brief Small statistics toolkit for comparing benchmark samples.
+ */
+
+/**
+ * @struct MannWhitneyResult
+ * @brief Outcome of a two-sided Mann-Whitney U test.
+ */
+struct MannWhitneyResult {
+    double u = 0.0;       ///< U statistic of the first sample
+    double z = 0.0;       ///< Normal approximation (tie- and continuity-corrected)
+    double p_value = 1.0; ///< Two-sided
+};
+
+/**
+ * @brief Tests whether two samples come from the same distribution.
+ *
+ * Rank based, so it is robust to the skewed, outlier-prone timings that
+ * benchmarks produce. Uses the normal approximation, which is adequate
+ * from about 8 samples per side.
+ */
+MannWhitneyResult mann_whitney_u(const std::vector<double>& a, const std::vector<double>& b);
+
+/**
+ * @brief Median of a sample (0 for an empty one).
+ */
+double median(std::vector<double> values);
+
+/**
+ * @brief Returns a name for this kind of machine, e.g.
+ * "intel-r-xeon-r-platinum-8375c-cpu-2-90ghz-8c".
+ *
+ * Derived from the CPU model and the online CPU count; the
+ * DIGIT_PERF_MACHINE_CLASS environment variable overrides it.
+ */
+std::string machine_class();
+
+/**
+ * @brief Returns the CPU model string (or "unknown").
+ */
+std::string cpu_model();
+
+/**
+ * @brief Resident set size of this process in bytes (0 if unavailable).
+ */
+size_t resident_bytes();
+
+/**
+ * @brief Threads of this process, from /proc/self/task (0 if unreadable).
+ */
+size_t thread_count();
+
+/**
+ * @struct MemoryFootprint
+ * @brief How much of a process's resident memory is its own.
+ *
+ * Pages shared with other processes (libraries, or a parent's pages that
+ * a forked child has not written to) count in full toward rss but only
+ * pro rata toward pss; private_bytes is what exiting the process would free.
+ */
+struct MemoryFootprint {
+    size_t rss = 0;           ///< Resident set size
+    size_t pss = 0;           ///< Proportional set size; sums to the true total across processes
+    size_t private_bytes = 0; ///< Unique set size: resident pages mapped by no other process
+    size_t shared_bytes = 0;  ///< Resident pages also mapped by another process
+};
+
+/**
+ * @brief Reads a process's footprint from /proc/<pid>/smaps_rollup (or
+ * smaps on kernels before 4.14). pid 0 is this process.
+ * @return All zeros if the process is gone or /proc is unreadable.
+ */
+MemoryFootprint memory_footprint(int pid = 0);
+
+#endif // PERF_STATS_H
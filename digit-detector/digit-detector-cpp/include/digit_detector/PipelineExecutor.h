@@ -0,0 +1,205 @@
+#ifndef PIPELINE_EXECUTOR_H
+#define PIPELINE_EXECUTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+class InferenceEngine;
+
+/**
+ * @file PipelineExecutor.h
+ * @brief DigitRecognizer split into stages that run in separate processes.
+ *
+ * The model is cut into three layers: "conv1" (conv, ReLU, pool to
+ * 32x14x14), "conv2" (to 64x7x7) and "fc" (fc1, ReLU, fc2 to 10 logits).
+ * Each stage runs a contiguous run of them in its own worker processes,
+ * forked from the caller after the weights are loaded and frozen, so
+ * every worker shares one read-only copy (see PreforkServer.h).
+ *
+ * Batches move between stages through queues in one MAP_SHARED region.
+ * Each queue holds queue_depth slots of max_batch rows. A worker takes a
+ * ready slot from its input queue, then a free slot on its output queue,
+ * runs its layers on the input slot in place and copies the activations
+ * into the free slot. A stage that falls behind therefore leaves the
+ * stage before it without free slots: that stage waits, and in the end
+ * so does submit().
+ * No queue grows past its depth.
+ *
+ * A stage with all three layers and N workers is N data-parallel
+ * replicas behind the same queues, which is what digit_pipeline_bench
+ * compares the split placements against.
+ *
+ * If a worker dies, the pipeline fails: batches in flight and every later
+ * submit() get a std::runtime_error. Workers are not restarted, since a
+ * batch the dead worker held cannot be recovered.
+ */
+
+/**
+ * @struct PipelineStageOptions
+ * @brief One stage: the layers it runs and where its processes run.
+ */
+struct PipelineStageOptions {
+    std::vector<std::string> layers; ///< Contiguous run of "conv1", "conv2", "fc"
+    uint32_t workers = 1;            ///< Processes running the stage
+    uint32_t threads = 1;            ///< Intra-op threads per process
+    /// CPUs for the stage; worker i gets the i-th run of `threads` of them.
+    /// Empty: the workers are not pinned
+    std::vector<int> cores;
+};
+
+/**
+ * @struct PipelineOptions
+ * @brief Stage placement and queue sizes.
+ */
+struct PipelineOptions {
+    std::vector<PipelineStageOptions> stages; ///< In order; together they cover every layer once
+    uint32_t queue_depth = 4; ///< Batches each queue holds
+    uint32_t max_batch = 64;  ///< Rows per batch
+};
+
+/**
+ * @struct PipelineStageStats
+ * @brief Time a stage's workers spent, summed over them.
+ */
+struct PipelineStageStats {
+    std::string layers; ///< e.g. "conv1+conv2"
+    uint32_t workers = 0;
+    uint64_t batches = 0;
+    uint64_t rows = 0;
+    double busy_seconds = 0.0;    ///< Running layers
+    double starved_seconds = 0.0; ///< Waiting for input
+    double blocked_seconds = 0.0; ///< Waiting for a free output slot: back-pressure
+};
+
+/**
+ * @struct PipelineStats
+ * @brief Counters since the pipeline started.
+ */
+struct PipelineStats {
+    uint64_t batches = 0;
+    uint64_t rows = 0;
+    double submit_blocked_seconds = 0.0; ///< Callers waiting for a free input slot
+    std::vector<PipelineStageStats> stages;
+    std::vector<uint32_t> queued; ///< Ready batches per queue now, input queue first
+};
+
+/**
+ * @brief Completion of a submitted batch: error is null on success, and
+ * then there is one prediction per row.
+ */
+using PipelineCallback =
+    std::function<void(std::exception_ptr error, const std::vector<Prediction>& predictions)>;
+
+/**
+ * @class PipelineExecutor
+ * @brief Runs DigitRecognizer as a pipeline of worker processes.
+ *
+ * Thread-safe. Construct it while the process is still single-threaded,
+ * as for PreforkServer: a forked worker has none of its parent's threads,
+ * and an intra-op pool the parent had started can hang the worker's
+ * first parallel layer.
+ */
+class PipelineExecutor {
+public:
+    /**
+     * @brief Freezes the engine's weights, checks that the stages compute
+     * what the whole model does, and forks the workers.
+     * @throws std::invalid_argument if the stages do not cover the layers
+     *         in order, or a setting is out of range.
+     * @throws std::runtime_error if the model is not a DigitRecognizer or
+     *         the workers cannot be started.
+     */
+    PipelineExecutor(InferenceEngine& engine, PipelineOptions options);
+
+    /**
+     * @brief Destructor. Stops the workers; batches in flight fail.
+     */
+    ~PipelineExecutor();
+
+    PipelineExecutor(const PipelineExecutor&) = delete;
+    PipelineExecutor& operator=(const PipelineExecutor&) = delete;
+
+    /**
+     * @brief Queues rows [rows, 1, 28, 28] float inputs. Blocks while the
+     * input queue is full.
+     *
+     * done runs exactly once, on the pipeline's collector thread (or the
+     * caller's, if the pipeline has failed); keep it short.
+     * @throws std::invalid_argument if rows is 0 or above max_batch.
+     */
+    void submit(const float* inputs, size_t rows, PipelineCallback done);
+
+    /**
+     * @brief submit() with a future.
+     */
+    std::future<std::vector<Prediction>> submit(const float* inputs, size_t rows);
+
+    /**
+     * @brief Runs any number of rows, max_batch at a time, and waits.
+     * @throws std::runtime_error if the pipeline has failed.
+     */
+    std::vector<Prediction> predict_batch(const float* inputs, size_t rows);
+
+    const PipelineOptions& options() const { return m_options; }
+    PipelineStats stats() const;
+
+    /**
+     * @brief Rows of 1x28x28 floats per input.
+     */
+    static constexpr size_t INPUT_FLOATS = 28 * 28;
+
+private:
+    struct Region;
+    struct Layers;
+
+    static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(50); ///< Liveness checks
+
+    [[noreturn]] void worker_main(size_t stage, uint32_t index);
+    void collector_loop();
+
+    /**
+     * @brief Reaps workers that have exited.
+     * @return A description of the first, or "" if all are running.
+     */
+    std::string reap_workers();
+
+    /**
+     * @brief Marks the pipeline failed and fails every batch in flight.
+     */
+    void fail(const std::string& reason);
+
+    PipelineOptions m_options;
+    std::unique_ptr<Layers> m_layers; ///< Submodules of the engine's model
+    std::vector<size_t> m_first_layer; ///< Per stage
+    std::vector<size_t> m_last_layer;
+    Region* m_region = nullptr;
+    size_t m_region_bytes = 0;
+    std::vector<int> m_pids;
+    std::vector<size_t> m_stage_of; ///< Stage of each entry in m_pids
+    int m_parent_pid = 0;
+
+    mutable std::mutex m_mutex;
+    std::map<uint64_t, PipelineCallback> m_pending; ///< By ticket
+    uint64_t m_next_ticket = 1;
+    std::string m_failure; ///< Empty while the pipeline works
+    std::atomic<bool> m_failed{false};
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<uint64_t> m_rows{0};
+    std::atomic<uint64_t> m_submit_blocked_ns{0};
+    std::atomic<bool> m_stopping{false};
+    std::thread m_collector;
+};
+
+#endif // PIPELINE_EXECUTOR_H
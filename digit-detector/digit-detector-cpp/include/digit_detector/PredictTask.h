@@ -0,0 +1,226 @@
+#ifndef PREDICT_TASK_H
+#define PREDICT_TASK_H
+
+/**
+ * @file PredictTask.h
+ * @brief C++20 coroutine interface to InferenceEngine::predict_async().
+ *
+ *     Task<int> classify(InferenceEngine& engine, torch::Tensor input) {
+ *         Prediction p = co_await predict_co(engine, input);
+ *         co_return p.digit;
+ *     }
+ *     int digit = sync_wait(classify(engine, input));
+ *
+ * Tasks are lazy: nothing runs until the task is awaited or passed to
+ * sync_wait(). A coroutine suspended in predict_co() resumes on the
+ * engine's executor thread, so long work after it should move elsewhere
+ * rather than hold up the next batch.
+ *
+ * Only available when compiled as C++20 with coroutine support; the
+ * header is empty otherwise.
+ */
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "InferenceEngine.h"
+
+template <typename T>
+class Task;
+
+/**
+ * @brief State shared by Task promises: the awaiting coroutine and any exception.
+ */
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    /// Symmetric transfer back to whoever awaited the task
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            return handle.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+    void return_value(T v) { value = std::move(v); }
+
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+/**
+ * @class Task
+ * @brief Lazily started coroutine producing a T; co_await it from another coroutine.
+ */
+template <typename T>
+class Task {
+public:
+    using promise_type = TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+    T await_resume() { return m_handle.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * @class PredictAwaiter
+ * @brief Awaitable returned by predict_co(); suspends until the executor
+ * has run the prediction.
+ */
+class PredictAwaiter {
+public:
+    PredictAwaiter(InferenceEngine& engine, torch::Tensor input, CancellationToken token)
+        : m_engine(engine), m_input(std::move(input)), m_token(std::move(token)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // The callback may resume the coroutine before this returns; do
+        // not touch *this after handing it over
+        m_engine.predict_async(
+            std::move(m_input),
+            [this, handle](std::exception_ptr error, const Prediction& prediction) {
+                m_error = error;
+                m_prediction = prediction;
+                handle.resume();
+            },
+            std::move(m_token));
+    }
+
+    Prediction await_resume() {
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        return m_prediction;
+    }
+
+private:
+    InferenceEngine& m_engine;
+    torch::Tensor m_input;
+    CancellationToken m_token;
+    std::exception_ptr m_error;
+    Prediction m_prediction;
+};
+
+/**
+ * @brief co_await-able prediction on the engine's executor.
+ * @throws PredictCancelled (from co_await) if the token fires first.
+ */
+inline PredictAwaiter predict_co(InferenceEngine& engine, torch::Tensor input,
+                                 CancellationToken token = {}) {
+    return PredictAwaiter(engine, std::move(input), std::move(token));
+}
+
+/**
+ * @brief Eagerly started coroutine that reports its end to a std::promise.
+ */
+struct SyncWaitTask {
+    struct promise_type {
+        SyncWaitTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+template <typename T>
+SyncWaitTask sync_wait_into(Task<T> task, std::promise<T>& result) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            result.set_value();
+        } else {
+            result.set_value(co_await task);
+        }
+    } catch (...) {
+        result.set_exception(std::current_exception());
+    }
+}
+
+/**
+ * @brief Runs a task to completion from ordinary code and returns its result.
+ *
+ * Blocks the calling thread; do not call it from the engine's executor.
+ */
+template <typename T>
+T sync_wait(Task<T> task) {
+    std::promise<T> result;
+    std::future<T> future = result.get_future();
+    sync_wait_into(std::move(task), result);
+    return future.get();
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // PREDICT_TASK_H
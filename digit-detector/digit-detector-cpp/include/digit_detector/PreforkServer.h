@@ -0,0 +1,153 @@
+#ifndef PREFORK_SERVER_H
+#define PREFORK_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "InferenceServer.h"
+#include "PerfStats.h"
+
+/**
+ * @file PreforkServer.h
+ * @brief The inference server as N worker processes sharing one copy of the weights.
+ *
+ * The parent loads every model, moves the weights onto read-only pages
+ * (InferenceEngine::freeze_weights()) and forks the workers before it has
+ * started a single thread, LibTorch's included. Each child inherits the
+ * weights, the optimized graphs and LibTorch's start-up state as
+ * copy-on-write pages. Nothing writes to the weight pages, so they stay
+ * shared, and a stray write to one faults instead of copying it. Each worker then
+ * builds its own InferenceServer (pool, budget, scheduler, I/O engine) and
+ * listens on the same port with SO_REUSEPORT, and the kernel spreads
+ * connections over the workers. The parent only supervises: it restarts
+ * workers that die and stops them all on stop().
+ *
+ * Pages a worker does write (tensor reference counts, the heap around
+ * them) become private to it; memory_footprint() of a worker shows how
+ * much that is.
+ */
+
+/**
+ * @struct PreforkOptions
+ * @brief Settings for PreforkServer.
+ */
+struct PreforkOptions {
+    uint32_t workers = 0;          ///< Worker processes; 0: one per available core
+    bool pin_processes = false;    ///< Confine each worker to its own slice of the allowed CPUs
+    InferenceServerOptions server; ///< Per worker; threads.cores 0 means the worker's share
+    /// If set, each worker writes its pid (a pid_t) here once listening
+    int ready_fd = -1;
+};
+
+/**
+ * @struct PreforkWorkerStats
+ * @brief One worker slot. A restarted worker keeps its slot.
+ */
+struct PreforkWorkerStats {
+    uint32_t index = 0;
+    int pid = 0;                   ///< Current process; 0 once stopped
+    uint32_t restarts = 0;
+    uint64_t responses = 0;        ///< Sent by the slot's processes that have exited
+    uint64_t connections = 0;      ///< Accepted by the slot's processes that have exited
+    MemoryFootprint memory;        ///< Read when asked, or just before the workers were stopped
+};
+
+/**
+ * @class PreforkServer
+ * @brief Loads the models once and serves them from forked worker processes.
+ */
+class PreforkServer {
+public:
+    /**
+     * @brief Loads and freezes the models and claims the port. Starts no threads.
+     * @param models At least one; the first is the default model.
+     * @throws std::runtime_error if a model fails to load or the port is taken.
+     */
+    PreforkServer(const std::vector<ModelConfig>& models, PreforkOptions options);
+
+    /**
+     * @brief Destructor. Stops the workers and waits for them.
+     */
+    ~PreforkServer();
+
+    PreforkServer(const PreforkServer&) = delete;
+    PreforkServer& operator=(const PreforkServer&) = delete;
+
+    /**
+     * @brief Forks the workers and returns. Call it while the process is
+     * still single-threaded; a warning is logged if it is not.
+     */
+    void start();
+
+    /**
+     * @brief Calls start() if needed, then restarts workers that exit until
+     * stop(); then stops the workers and waits for them.
+     */
+    void run();
+
+    /**
+     * @brief Requests shutdown. Safe to call from a signal handler.
+     */
+    void stop();
+
+    /**
+     * @brief Stops the workers and waits for them; run() does this on its way out.
+     */
+    void shutdown();
+
+    uint16_t port() const { return m_port; }
+    uint32_t workers() const { return m_options.workers; }
+
+    /**
+     * @brief Bytes of weights the workers share (the sum of freeze_weights()).
+     */
+    size_t frozen_bytes() const { return m_frozen_bytes; }
+
+    /**
+     * @brief Per worker slot; live workers report their memory as of now.
+     */
+    std::vector<PreforkWorkerStats> worker_stats() const;
+
+private:
+    /**
+     * @brief Counters a worker leaves behind when it exits. Lives in a
+     * MAP_SHARED page, the one place child and parent both see.
+     */
+    struct WorkerSlot {
+        std::atomic<uint64_t> responses{0};
+        std::atomic<uint64_t> connections{0};
+    };
+
+    struct Worker {
+        int pid = 0;
+        uint32_t restarts = 0;
+        std::chrono::steady_clock::time_point started;
+        MemoryFootprint final_memory;
+    };
+
+    static constexpr auto RESTART_BACKOFF = std::chrono::seconds(1); ///< For workers that die young
+    static constexpr auto SUPERVISE_INTERVAL = std::chrono::milliseconds(50);
+
+    void spawn(uint32_t index);
+
+    /**
+     * @brief Body of a worker process; never returns.
+     */
+    [[noreturn]] void worker_main(uint32_t index);
+
+    PreforkOptions m_options;
+    std::vector<std::shared_ptr<ServedModel>> m_models;
+    size_t m_frozen_bytes = 0;
+    int m_parent_pid = 0;
+    int m_port_fd = -1; ///< Bound, not listening: holds the port between worker restarts
+    uint16_t m_port = 0;
+    WorkerSlot* m_slots = nullptr;
+    std::vector<Worker> m_workers;
+    bool m_started = false;
+    std::atomic<bool> m_stopping{false};
+};
+
+#endif // PREFORK_SERVER_H
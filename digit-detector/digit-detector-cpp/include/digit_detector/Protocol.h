@@ -0,0 +1,181 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "types.h"
+
+/**
+ * @file Protocol.h
+ * @brief Binary wire format spoken by digit_server and its clients.
+ *
+ * Every message is a fixed 24-byte WireHeader followed by payload_len
+ * bytes. Fields are in host byte order; the server is only meant to be
+ * reached from machines of the same endianness.
+ */
+
+constexpr uint32_t WIRE_MAGIC = 0x54494744;        ///< "DGIT"
+constexpr uint32_t WIRE_MAX_PAYLOAD = 1u << 20;    ///< Larger frames are a protocol error
+
+/**
+ * @brief Message types.
+ */
+enum class MessageType : uint8_t {
+    PredictRequest = 1,  ///< PredictRequestHeader + model name + pixels
+    PredictResponse = 2, ///< PredictResponseBody
+    StatsRequest = 3,    ///< Empty payload
+    StatsResponse = 4,   ///< JSON document with server and per-model metrics
+    Cancel = 5,          ///< Empty payload; withdraws request_id, sent earlier on this connection
+};
+
+/// PredictRequest flag: the client may cancel it, so the server tracks it by id
+constexpr uint16_t WIRE_FLAG_CANCELLABLE = 1;
+
+/**
+ * @brief Per-response status.
+ */
+enum class WireStatus : uint8_t {
+    Ok = 0,
+    BadRequest = 1,
+    InternalError = 2,
+    UnknownModel = 3,
+    Overloaded = 4, ///< Shed: the request could not have met its deadline
+    Unavailable = 5, ///< digit_router: no healthy backend could take the request
+};
+
+/**
+ * @struct WireHeader
+ * @brief Fixed header in front of every frame.
+ */
+struct WireHeader {
+    uint32_t magic = WIRE_MAGIC;
+    uint8_t type = 0;         ///< MessageType
+    uint8_t status = 0;       ///< WireStatus (responses only)
+    uint16_t flags = 0;
+    uint32_t payload_len = 0;
+    uint32_t reserved = 0;
+    uint64_t request_id = 0;  ///< Chosen by the client, echoed in the response
+};
+static_assert(sizeof(WireHeader) == 24, "WireHeader must be 24 bytes");
+
+/**
+ * @struct PredictRequestHeader
+ * @brief Start of a PredictRequest payload.
+ *
+ * Followed by model_len bytes naming the model ("name" or
+ * "name:version"; empty selects the server's default model), then
+ * width * height pixels.
+ */
+struct PredictRequestHeader {
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint16_t model_len = 0;
+    uint8_t priority = 0;     ///< 0 interactive, 1 bulk
+    uint8_t reserved = 0;
+    uint32_t deadline_us = 0; ///< Budget from arrival at the server; 0 for none
+};
+static_assert(sizeof(PredictRequestHeader) == 12, "PredictRequestHeader must be 12 bytes");
+
+/**
+ * @struct PredictResponseBody
+ * @brief Payload of a PredictResponse.
+ */
+struct PredictResponseBody {
+    int32_t digit = -1;
+    float confidence = 0.0f;
+};
+
+/**
+ * @struct PredictRequestView
+ * @brief Non-owning view of a decoded PredictRequest.
+ */
+struct PredictRequestView {
+    uint16_t width = 0;
+    uint16_t height = 0;
+    std::string_view model;          ///< Empty for the default model
+    uint8_t priority = 0;
+    uint32_t deadline_us = 0;
+    const uint8_t* pixels = nullptr; ///< Row-major 8-bit grayscale
+};
+
+/**
+ * @struct PredictOptions
+ * @brief Optional routing and scheduling fields of a PredictRequest.
+ */
+struct PredictOptions {
+    std::string_view model;   ///< "name" or "name:version"; empty for the default
+    uint8_t priority = 0;     ///< 0 interactive, 1 bulk
+    uint32_t deadline_us = 0; ///< 0 for the model's default deadline
+};
+
+/**
+ * @brief Appends a PredictRequest frame to out.
+ */
+void append_predict_request(std::vector<uint8_t>& out, uint64_t request_id,
+                            const uint8_t* pixels, uint16_t width, uint16_t height,
+                            const PredictOptions& options = {});
+
+/**
+ * @brief Appends a PredictResponse frame to out.
+ */
+void append_predict_response(std::vector<uint8_t>& out, uint64_t request_id,
+                             WireStatus status, const Prediction& prediction);
+
+/**
+ * @brief Appends a Cancel frame for an earlier cancellable PredictRequest to out.
+ *
+ * A request that has already started runs to completion and is answered
+ * as usual; one that has not is dropped without a response.
+ */
+void append_cancel(std::vector<uint8_t>& out, uint64_t request_id);
+
+/**
+ * @brief Appends a StatsRequest frame to out.
+ */
+void append_stats_request(std::vector<uint8_t>& out, uint64_t request_id);
+
+/**
+ * @brief Appends a StatsResponse frame carrying a JSON document to out.
+ */
+void append_stats_response(std::vector<uint8_t>& out, uint64_t request_id,
+                           const std::string& json_text);
+
+/**
+ * @brief Decodes the payload of a PredictRequest.
+ * @return False if the payload is malformed.
+ */
+bool decode_predict_request(const WireHeader& header, const uint8_t* payload,
+                            PredictRequestView& out);
+
+/**
+ * @brief Decodes the payload of a PredictResponse.
+ * @return False if the payload is malformed.
+ */
+bool decode_predict_response(const WireHeader& header, const uint8_t* payload,
+                             Prediction& out);
+
+/**
+ * @struct ParseResult
+ * @brief Outcome of scanning a byte stream for frames.
+ */
+struct ParseResult {
+    size_t consumed = 0; ///< Bytes belonging to complete frames
+    bool error = false;  ///< Bad magic or oversized frame; drop the connection
+};
+
+/**
+ * @brief Calls on_frame for every complete frame at the start of data.
+ *
+ * Trailing bytes of an incomplete frame are left unconsumed so the
+ * caller can retry once more data has arrived.
+ */
+ParseResult parse_frames(
+    const uint8_t* data, size_t length,
+    const std::function<void(const WireHeader&, const uint8_t*)>& on_frame);
+
+#endif // PROTOCOL_H
@@ -0,0 +1,208 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ClientConnection.h"
+#include "ConsistentHashRing.h"
+#include "IoEngine.h"
+#include "LatencyHistogram.h"
+
+/**
+ * @file Router.h
+ * @brief Front end that spreads requests over several digit_server backends.
+ *
+ * The router speaks the Protocol.h wire format on both sides. Clients
+ * connect to it as they would to a digit_server. Each request is
+ * forwarded, under a router-chosen id, over one of a few pipelined
+ * connections to the backend the routing policy picks, and the answer is
+ * relayed back under the client's id. A health checker polls every
+ * backend with a StatsRequest. A backend that stops answering is taken
+ * out of rotation, and one that answers again is put back. Requests
+ * stranded on a lost connection are retried once on another backend.
+ */
+
+/**
+ * @brief How a request picks its backend.
+ */
+enum class RoutingPolicy {
+    ConsistentHash,   ///< By a hash of model and pixels: equal inputs meet on one backend
+    LeastOutstanding, ///< The backend with the fewest requests in flight
+};
+
+/**
+ * @brief Parses "consistent_hash" (or "hash") and "least_outstanding" (or "least").
+ * @throws std::invalid_argument for unknown names.
+ */
+RoutingPolicy parse_routing_policy(const std::string& name);
+
+/**
+ * @struct RouterOptions
+ * @brief Settings for Router.
+ */
+struct RouterOptions {
+    IoEngineConfig io;                    ///< Client-facing listener
+    RoutingPolicy policy = RoutingPolicy::ConsistentHash;
+    uint32_t virtual_nodes = 160;         ///< Ring points per backend
+    double load_bound = 1.25;             ///< Hash policy: a backend with more than this
+                                          ///< multiple of the mean load in flight passes keys
+                                          ///< on to the next; 0 never does
+    uint32_t connections_per_backend = 2; ///< Pipelined connections to each backend
+    std::chrono::milliseconds health_interval{500};
+    std::chrono::milliseconds health_timeout{1000};
+    uint32_t eject_after_failures = 2;    ///< Consecutive failed checks before ejection
+};
+
+/**
+ * @struct BackendStats
+ * @brief Router-side view of one backend.
+ */
+struct BackendStats {
+    std::string name;
+    bool healthy = false;
+    int64_t outstanding = 0;
+    uint64_t forwarded = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;  ///< Answered with an error status, or lost with its connection
+    uint64_t retried = 0; ///< Lost with a connection and sent elsewhere
+    double share = 0.0;   ///< Of all requests forwarded
+    double p50_us = 0.0;  ///< Forward to reply, measured at the router
+    double p99_us = 0.0;
+};
+
+/**
+ * @class Router
+ * @brief Routes digit_server requests over a set of backends.
+ */
+class Router {
+public:
+    /**
+     * @brief Starts listening and health-checking. Backends join the
+     * rotation once their first health check passes.
+     * @throws std::runtime_error if the listener cannot be set up.
+     */
+    Router(const std::vector<BackendAddress>& backends, RouterOptions options);
+
+    /**
+     * @brief Destructor. Stops the listener, the health checker and every backend connection.
+     */
+    ~Router();
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    /**
+     * @brief Runs the client-facing loop on the calling thread until stop().
+     */
+    void run();
+
+    /**
+     * @brief Requests shutdown. Safe to call from any thread or signal handler.
+     */
+    void stop();
+
+    /**
+     * @brief Adds a backend; it is checked at once and joins when healthy.
+     */
+    void add_backend(const BackendAddress& address);
+
+    /**
+     * @brief Removes a backend; its requests in flight are retried elsewhere.
+     */
+    void remove_backend(const std::string& name);
+
+    /**
+     * @brief Adds and removes backends until the set matches.
+     */
+    void set_backends(const std::vector<BackendAddress>& backends);
+
+    /**
+     * @brief Number of backends in rotation.
+     */
+    size_t healthy_backends() const;
+
+    uint16_t port() const { return m_io->port(); }
+    std::vector<BackendStats> backend_stats() const;
+
+    /**
+     * @brief Returns the StatsResponse document: the router's counters, each
+     * backend's, and the backends' own model metrics summed.
+     */
+    std::string stats_json() const;
+
+private:
+    struct Backend;
+    struct Link;
+
+    /**
+     * @brief A request on its way through a backend.
+     */
+    struct PendingRequest {
+        uint64_t connection_id = 0; ///< Client connection
+        uint64_t request_id = 0;    ///< Client's id
+        uint64_t key = 0;           ///< Routing hash
+        std::chrono::steady_clock::time_point received;
+        std::chrono::steady_clock::time_point forwarded;
+        std::vector<uint8_t> frame; ///< As forwarded, kept for a retry
+        bool retried = false;
+    };
+
+    static constexpr size_t BALANCE_PROBES = 4096; ///< Keys sampled to measure a rebalance
+
+    void on_frame(uint64_t connection_id, const WireHeader& header, const uint8_t* payload);
+    void dispatch(PendingRequest request, const Backend* exclude);
+    Backend* choose(uint64_t key, const Backend* exclude);
+    void reply(const PendingRequest& request, WireStatus status, const Prediction& prediction);
+
+    void reader_loop(Backend& backend, Link& link);
+    void writer_loop(Link& link);
+    void fail_link(Backend& backend, Link& link);
+    std::unique_ptr<Link> open_link(Backend& backend);
+    static void close_link(Link& link);
+
+    void health_loop();
+    void check(const std::shared_ptr<Backend>& backend);
+
+    /**
+     * @brief Adds or removes a ring member and logs the share of keys that moved.
+     * Caller holds m_mutex exclusively.
+     */
+    void rebalance(const std::string& name, bool join);
+
+    RouterOptions m_options;
+    std::unique_ptr<IoEngine> m_io;
+
+    mutable std::shared_mutex m_mutex; ///< Guards the backend table, the ring and the links
+    std::unordered_map<std::string, std::shared_ptr<Backend>> m_backends;
+    std::vector<Backend*> m_healthy; ///< In rotation, for least-outstanding scans
+    ConsistentHashRing m_ring;
+
+    std::atomic<uint64_t> m_next_id{1};
+    std::atomic<uint64_t> m_rotation{0};
+
+    // --- Router counters ---
+    std::atomic<uint64_t> m_requests{0};
+    std::atomic<uint64_t> m_unavailable{0};
+    std::atomic<uint64_t> m_rebalances{0};
+    std::atomic<double> m_last_moved{0.0}; ///< Share of keys the last rebalance moved
+    mutable std::mutex m_latency_mutex;
+    LatencyHistogram m_latency; ///< Client arrival to reply
+
+    std::mutex m_health_mutex;
+    std::condition_variable m_health_cv;
+    bool m_check_now = false;             ///< Guarded by m_health_mutex
+    std::atomic<bool> m_stopping{false};  ///< Stranded requests fail instead of retrying
+    std::thread m_health;
+};
+
+#endif // ROUTER_H
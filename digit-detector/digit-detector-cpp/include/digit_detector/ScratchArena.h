@@ -0,0 +1,149 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @file ScratchArena.h
+ * @brief Per-thread bump allocator for the scratch memory of one request.
+ *
+ * While an ArenaScope is open on a thread, every cv::Mat buffer and every
+ * CPU tensor that thread allocates (the resized image, the normalized
+ * input, the activations of the forward pass) is carved out of the
+ * thread's arena by bumping an offset, and closing the outermost scope
+ * takes all of it back at once. Allocation never takes a lock, and since
+ * the same pages are reused request after request they are faulted in
+ * once, not on every request as with buffers the heap hands back to the
+ * kernel.
+ *
+ * The arena is installed as LibTorch's CPU allocator and as OpenCV's
+ * default Mat allocator. The forward pass allocates its activations
+ * inside the interpreter, where no caller could hand it memory, so
+ * wrapping arena memory with from_blob() would not reach them. Outside a
+ * scope, on threads without one (LibTorch's intra-op pool, say) and for
+ * requests larger than the arena, both pass allocations through to the
+ * allocator they replaced.
+ *
+ * Memory that outlives its scope stays valid: every block holds a
+ * reference to its chunk, and a chunk still referenced when the scope
+ * closes is handed over to those blocks and unmapped with the last of
+ * them, while the arena maps a fresh one. That is the slow path; the
+ * stats count it as detached chunks.
+ */
+
+/**
+ * @struct ArenaOptions
+ * @brief Process-wide arena settings.
+ */
+struct ArenaOptions {
+    bool enabled = false;
+    size_t chunk_bytes = size_t(4) << 20; ///< First chunk per thread; grows to the largest request
+    size_t max_bytes = size_t(256) << 20; ///< Per thread; allocations beyond it go to the heap
+    bool profile = false; ///< Time every allocation and free, in the arena or not
+};
+
+/**
+ * @struct ArenaStats
+ * @brief Counters summed over every thread since the process started.
+ */
+struct ArenaStats {
+    uint64_t arena_allocations = 0;
+    uint64_t arena_bytes = 0;
+    uint64_t heap_allocations = 0; ///< Passed through to the replaced allocators
+    uint64_t heap_bytes = 0;
+    double allocate_seconds = 0.0; ///< Only counted with profile on
+    double free_seconds = 0.0;
+    uint64_t resets = 0;
+    uint64_t chunks_mapped = 0;
+    uint64_t chunks_detached = 0; ///< Outlived their scope
+    size_t mapped_bytes = 0; ///< Held by chunks now
+};
+
+/**
+ * @class ScratchArena
+ * @brief The calling thread's arena. Reached through ArenaScope; the
+ * static members configure and report on all of them.
+ */
+class ScratchArena {
+public:
+    struct Chunk;
+
+    /**
+     * @brief Applies new settings. The first call installs the LibTorch and
+     * OpenCV allocators; they stay installed and pass everything through
+     * while the arena is disabled. Call before other threads allocate.
+     * @throws std::invalid_argument if chunk_bytes is 0 or above max_bytes.
+     */
+    static void configure(const ArenaOptions& options);
+
+    static ArenaOptions options();
+    static ArenaStats stats();
+
+    /**
+     * @brief The calling thread's arena while a scope is open on it, else null.
+     */
+    static ScratchArena* active();
+
+    /**
+     * @brief Carves out bytes, 64-byte aligned, and takes a reference on
+     * the chunk they come from; drop it with release().
+     * @return Null if the arena would grow past max_bytes.
+     */
+    void* allocate(size_t bytes, Chunk** chunk);
+
+    /**
+     * @brief Drops a reference allocate() took; any thread may call it.
+     */
+    static void release(Chunk* chunk);
+
+    /**
+     * @brief Bytes handed out since the last reset.
+     */
+    size_t used() const { return m_request_bytes; }
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+private:
+    friend class ArenaScope;
+
+    ScratchArena() = default;
+    ~ScratchArena();
+
+    static ScratchArena& local();
+
+    /**
+     * @brief Takes back everything handed out. O(1) once the first chunk
+     * fits a whole request; until then the chunks are replaced by one of
+     * the largest request's size.
+     */
+    void reset();
+
+    std::vector<Chunk*> m_chunks; ///< This request's; the last one is bumped
+    size_t m_offset = 0;          ///< Into the last chunk
+    size_t m_request_bytes = 0;
+    size_t m_mapped_bytes = 0;
+    size_t m_next_chunk_bytes = 0; ///< 0 until the first chunk is mapped
+};
+
+/**
+ * @class ArenaScope
+ * @brief Routes the thread's allocations to its arena for the lifetime of
+ * the scope. Scopes nest; the outermost one resets the arena when it
+ * closes. Does nothing while the arena is disabled.
+ */
+class ArenaScope {
+public:
+    ArenaScope();
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    bool m_open = false;
+};
+
+#endif // SCRATCH_ARENA_H
@@ -0,0 +1,67 @@
+#ifndef SERVICE_TIME_ESTIMATOR_H
+#define SERVICE_TIME_ESTIMATOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @file ServiceTimeEstimator.h
+ * @brief Live model of how long a batch takes, for admission control.
+ */
+
+/**
+ * @class ServiceTimeEstimator
+ * @brief Fits batch time = fixed + per_item * batch_size online.
+ *
+ * Samples are weighted by an exponential decay, so the fit follows
+ * changes in load, thread counts or CPU frequency within a few dozen
+ * batches. The spread of the residuals is tracked too, and estimate()
+ * returns an upper quantile rather than the mean: admission decisions
+ * made on the mean would admit half the requests that then miss.
+ *
+ * Not thread-safe; callers hold their own lock.
+ */
+class ServiceTimeEstimator {
+public:
+    /**
+     * @param decay Weight kept by the existing samples on every new one.
+     * @param margin Standard deviations added to the mean (2 is about p97).
+     */
+    explicit ServiceTimeEstimator(double decay = 0.95, double margin = 2.0);
+
+    /**
+     * @brief Adds one observed batch.
+     */
+    void record(size_t batch_size, uint64_t duration_ns);
+
+    /**
+     * @brief True once enough batches were seen to trust the estimate.
+     */
+    bool ready() const { return m_samples >= MIN_SAMPLES; }
+
+    /**
+     * @brief Expected time of a batch of the given size.
+     */
+    double mean_ns(size_t batch_size) const;
+
+    /**
+     * @brief Upper-quantile time of a batch of the given size; 0 until ready().
+     */
+    double estimate_ns(size_t batch_size) const;
+
+private:
+    static constexpr uint64_t MIN_SAMPLES = 8;
+
+    double m_decay;
+    double m_margin;
+    uint64_t m_samples = 0;
+    // Exponentially weighted sums for the least-squares fit
+    double m_w = 0.0;
+    double m_x = 0.0;
+    double m_y = 0.0;
+    double m_xx = 0.0;
+    double m_xy = 0.0;
+    double m_residual_sq = 0.0; ///< Weighted mean squared residual
+};
+
+#endif // SERVICE_TIME_ESTIMATOR_H
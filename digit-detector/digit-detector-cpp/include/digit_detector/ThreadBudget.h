@@ -0,0 +1,126 @@
+#ifndef THREAD_BUDGET_H
+#define THREAD_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @file ThreadBudget.h
+ * @brief Splits a fixed number of cores between concurrent forward passes
+ * and LibTorch's intra-op threads.
+ *
+ * Left alone, every thread that runs a forward pass fans out over the full
+ * intra-op pool, so N concurrent passes ask for N x cores threads and
+ * throughput collapses. The budget keeps concurrency x intra_op within the
+ * configured cores; whatever is left over is spare for preprocessing and
+ * I/O.
+ *
+ * The split follows the batch sizes actually seen. Intra-op threads only
+ * pay off when a pass has enough rows to divide (items_per_thread rows
+ * each), so large batches get a few wide passes and small batches get many
+ * narrow ones. It is re-evaluated every REBALANCE_INTERVAL batches and only
+ * changed when the answer differs.
+ *
+ * The inter-op pool is unused by these models and is sized once, at
+ * construction. at::set_num_threads() only reaches the calling thread's
+ * OpenMP settings, so threads that run forward passes call
+ * prepare_thread() first to pick up the current split.
+ */
+
+/**
+ * @struct ThreadBudgetConfig
+ * @brief Settings for ThreadBudget.
+ */
+struct ThreadBudgetConfig {
+    uint32_t cores = 0;             ///< 0: the CPUs this process may run on
+    uint32_t intra_op_threads = 0;  ///< Fixed intra-op threads; 0 adapts to batch sizes
+    uint32_t interop_threads = 1;   ///< 0 leaves LibTorch's default
+    uint32_t items_per_thread = 8;  ///< Batch rows that justify one more intra-op thread
+};
+
+/**
+ * @struct ThreadSplit
+ * @brief The budget's current decision.
+ */
+struct ThreadSplit {
+    uint32_t cores = 0;
+    uint32_t concurrency = 1; ///< Forward passes allowed to run at once
+    uint32_t intra_op = 1;    ///< LibTorch threads per pass
+    uint32_t interop = 0;     ///< 0: LibTorch's default
+    uint32_t spare = 0;       ///< cores - concurrency * intra_op
+    bool adaptive = true;
+    double mean_batch = 0.0;  ///< Recent batch size the split is based on
+    uint64_t batches = 0;     ///< Batches observed
+    uint64_t changes = 0;     ///< Times the split was changed after startup
+};
+
+/**
+ * @class ThreadBudget
+ * @brief Process-wide owner of LibTorch's thread settings.
+ */
+class ThreadBudget {
+public:
+    static constexpr uint64_t REBALANCE_INTERVAL = 64; ///< Batches between re-evaluations
+    static constexpr double DECAY = 0.98;              ///< Weight of history in mean_batch
+
+    /**
+     * @brief Applies the initial split (as if every batch were max_batch).
+     * @param max_concurrency Passes that could ever run at once, e.g. the
+     *        number of models when each runs one batch at a time.
+     * @param max_batch Largest batch expected, used until batches are seen.
+     * @throws std::invalid_argument if max_concurrency or items_per_thread is 0.
+     */
+    ThreadBudget(ThreadBudgetConfig config, uint32_t max_concurrency, size_t max_batch);
+
+    ThreadBudget(const ThreadBudget&) = delete;
+    ThreadBudget& operator=(const ThreadBudget&) = delete;
+
+    ThreadSplit split() const;
+
+    /**
+     * @brief Forward passes allowed at once under the current split.
+     */
+    uint32_t concurrency() const { return m_concurrency.load(std::memory_order_relaxed); }
+
+    uint32_t cores() const { return m_cores; }
+
+    /**
+     * @brief CPUs this process may run on (the default for cores).
+     */
+    static uint32_t available_cores();
+
+    /**
+     * @brief Applies the current intra-op setting to the calling thread if it
+     * changed since this thread last ran a pass. Cheap otherwise.
+     */
+    void prepare_thread() const;
+
+    /**
+     * @brief Feeds one finished forward pass into the running batch size.
+     */
+    void record_batch(size_t batch_size);
+
+private:
+    /**
+     * @brief Split for a given mean batch size; does not apply it.
+     */
+    ThreadSplit compute(double mean_batch) const;
+    void apply(const ThreadSplit& split);
+
+    const ThreadBudgetConfig m_config;
+    const uint32_t m_cores;
+    const uint32_t m_max_concurrency;
+
+    mutable std::mutex m_mutex;
+    ThreadSplit m_split;
+    double m_batch_sum = 0.0;    ///< Decayed sum of batch sizes
+    double m_batch_weight = 0.0; ///< Decayed count of batches
+
+    std::atomic<uint32_t> m_concurrency{1};
+    std::atomic<uint32_t> m_intra_op{1};
+    std::atomic<uint64_t> m_generation{0}; ///< Process-unique; renewed whenever intra_op changes
+};
+
+#endif // THREAD_BUDGET_H
@@ -0,0 +1,418 @@
+#ifndef VERBS_H
+#define VERBS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @file Verbs.h
+ * @brief A software emulation of the RDMA verbs object model.
+ *
+ * The classes here mirror libibverbs (ibv_pd, ibv_mr, ibv_cq, ibv_qp)
+ * closely enough that the inference data path can be written against
+ * them today and moved onto real hardware later. The "wire" is a
+ * connected loopback TCP socket per queue pair:
+ *
+ * - Two-sided SEND consumes a posted receive on the peer.
+ * - One-sided RDMA_WRITE lands directly in a registered peer buffer,
+ *   validated against the peer's rkey, without a receive.
+ * - RDMA_WRITE_WITH_IMM additionally consumes a receive so the peer
+ *   learns that data has arrived.
+ *
+ * All work requests handed to a single post_send() call are flushed
+ * with one gather-write (one "doorbell"), and only WRs marked as
+ * signaled produce a send completion (selective signaling).
+ */
+
+/**
+ * @brief Memory region access rights (mirrors IBV_ACCESS_*).
+ */
+enum VerbsAccess : uint32_t {
+    VERBS_ACCESS_LOCAL_WRITE = 1u << 0,  ///< Local receives may write the region
+    VERBS_ACCESS_REMOTE_WRITE = 1u << 1, ///< Peers may RDMA_WRITE into the region
+    VERBS_ACCESS_REMOTE_READ = 1u << 2,  ///< Reserved: RDMA_READ is not emulated
+};
+
+/**
+ * @brief Send-queue work request opcodes.
+ */
+enum class WrOpcode : uint8_t {
+    Send = 0,             ///< Two-sided send, consumes a peer receive
+    RdmaWrite = 1,        ///< One-sided write into peer memory
+    RdmaWriteWithImm = 2, ///< One-sided write plus a receive completion on the peer
+};
+
+/**
+ * @brief Completion opcodes (mirrors ibv_wc_opcode).
+ */
+enum class WcOpcode : uint8_t {
+    Send,
+    RdmaWrite,
+    Recv,
+    RecvRdmaWithImm,
+};
+
+/**
+ * @brief Completion status (subset of ibv_wc_status).
+ */
+enum class WcStatus : uint8_t {
+    Success,
+    LocalLengthError,     ///< Incoming message larger than the receive buffer
+    LocalProtectionError, ///< SGE not covered by a registered region / lkey
+    RemoteAccessError,    ///< Peer rejected an rkey or address range
+    FlushError,           ///< Work request flushed because the QP went to error
+    TransportError,       ///< The underlying socket failed
+};
+
+/**
+ * @brief Returns a printable name for a completion status.
+ */
+const char* wc_status_str(WcStatus status);
+
+/**
+ * @struct Sge
+ * @brief A scatter/gather element describing registered local memory.
+ */
+struct Sge {
+    uint64_t addr = 0;   ///< Virtual address of the buffer
+    uint32_t length = 0; ///< Buffer length in bytes
+    uint32_t lkey = 0;   ///< Local key of the covering memory region
+};
+
+/**
+ * @struct SendWr
+ * @brief A work request for the send queue.
+ */
+struct SendWr {
+    uint64_t wr_id = 0;               ///< Opaque id returned in the completion
+    WrOpcode opcode = WrOpcode::Send; ///< Operation to perform
+    Sge sge;                          ///< Local source buffer (may be empty)
+    bool signaled = true;             ///< Generate a send completion (IBV_SEND_SIGNALED)
+    uint32_t imm_data = 0;            ///< Immediate for RdmaWriteWithImm
+    uint64_t remote_addr = 0;         ///< Peer virtual address for RDMA writes
+    uint32_t rkey = 0;                ///< Peer remote key for RDMA writes
+};
+
+/**
+ * @struct RecvWr
+ * @brief A work request for the receive queue.
+ */
+struct RecvWr {
+    uint64_t wr_id = 0; ///< Opaque id returned in the completion
+    Sge sge;            ///< Local destination buffer (may be empty)
+};
+
+/**
+ * @struct WorkCompletion
+ * @brief A completion queue entry.
+ */
+struct WorkCompletion {
+    uint64_t wr_id = 0;
+    WcStatus status = WcStatus::Success;
+    WcOpcode opcode = WcOpcode::Send;
+    uint32_t byte_len = 0; ///< Bytes received (receive completions only)
+    uint32_t imm_data = 0; ///< Valid when has_imm is true
+    bool has_imm = false;
+    uint32_t qp_num = 0;   ///< Queue pair that produced the completion
+};
+
+class ProtectionDomain;
+
+/**
+ * @class MemoryRegion
+ * @brief A registered buffer that work requests may target.
+ *
+ * Created only through ProtectionDomain::register_memory(). The region
+ * does not own the memory it describes; the caller keeps it alive until
+ * the region is deregistered.
+ */
+class MemoryRegion {
+public:
+    MemoryRegion(const MemoryRegion&) = delete;
+    MemoryRegion& operator=(const MemoryRegion&) = delete;
+
+    uint64_t addr() const { return m_addr; }
+    size_t length() const { return m_length; }
+    uint32_t lkey() const { return m_lkey; }
+    uint32_t rkey() const { return m_rkey; }
+    uint32_t access() const { return m_access; }
+
+    /**
+     * @brief Builds an SGE for a sub-range of this region.
+     * @param offset Byte offset into the region.
+     * @param length Length in bytes.
+     */
+    Sge sge(size_t offset, uint32_t length) const;
+
+    /**
+     * @brief Checks whether [addr, addr + length) lies inside the region.
+     */
+    bool contains(uint64_t addr, size_t length) const;
+
+private:
+    friend class ProtectionDomain;
+    MemoryRegion(uint64_t addr, size_t length, uint32_t lkey, uint32_t rkey, uint32_t access)
+        : m_addr(addr), m_length(length), m_lkey(lkey), m_rkey(rkey), m_access(access) {}
+
+    uint64_t m_addr;
+    size_t m_length;
+    uint32_t m_lkey;
+    uint32_t m_rkey;
+    uint32_t m_access;
+};
+
+/**
+ * @class ProtectionDomain
+ * @brief Container for memory regions and queue pairs.
+ *
+ * Keys are only valid within the domain that issued them, so a peer
+ * can only reach memory that was registered with remote access in the
+ * domain its queue pair belongs to.
+ */
+class ProtectionDomain {
+public:
+    ProtectionDomain() = default;
+    ProtectionDomain(const ProtectionDomain&) = delete;
+    ProtectionDomain& operator=(const ProtectionDomain&) = delete;
+
+    /**
+     * @brief Registers a buffer and issues its local/remote keys.
+     * @param addr Start of the buffer.
+     * @param length Buffer length in bytes.
+     * @param access Bitwise OR of VerbsAccess flags.
+     * @throws std::invalid_argument on a null or empty buffer.
+     */
+    std::shared_ptr<MemoryRegion> register_memory(void* addr, size_t length, uint32_t access);
+
+    /**
+     * @brief Revokes a region's keys. Later work requests using them fail.
+     */
+    void deregister_memory(const std::shared_ptr<MemoryRegion>& mr);
+
+    /**
+     * @brief Validates a local SGE against its lkey.
+     * @return True if the SGE is covered by a registered region.
+     */
+    bool check_local(const Sge& sge, bool needs_write) const;
+
+    /**
+     * @brief Validates a remote access against an rkey.
+     * @return True if the range is covered and remote writes are allowed.
+     */
+    bool check_remote_write(uint32_t rkey, uint64_t addr, size_t length) const;
+
+private:
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<uint32_t, std::shared_ptr<MemoryRegion>> m_by_lkey;
+    std::unordered_map<uint32_t, std::shared_ptr<MemoryRegion>> m_by_rkey;
+    uint32_t m_next_key = 1;
+};
+
+/**
+ * @class CompletionQueue
+ * @brief Collects work completions from one or more queue pairs.
+ *
+ * Consumers either busy-poll with poll() (the user-space polling loop)
+ * or block in wait(), which implements completion moderation: the
+ * waiter is only woken once `count` completions are pending or
+ * `period` has elapsed since the first of them arrived.
+ */
+class CompletionQueue {
+public:
+    /**
+     * @param capacity Maximum outstanding completions before overrun.
+     */
+    explicit CompletionQueue(size_t capacity = 4096);
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    /**
+     * @brief Non-blocking poll for up to max_entries completions.
+     * @return Number of completions written to wc.
+     * @throws std::runtime_error if the queue has overrun.
+     */
+    int poll(WorkCompletion* wc, int max_entries);
+
+    /**
+     * @brief Blocks until the moderation threshold is met or timeout expires.
+     * @return Number of completions written to wc (0 on timeout).
+     */
+    int wait(WorkCompletion* wc, int max_entries, std::chrono::microseconds timeout);
+
+    /**
+     * @brief Configures completion coalescing for wait().
+     * @param count Wake the waiter once this many completions are pending.
+     * @param period Or once the oldest pending completion is this old.
+     */
+    void set_moderation(size_t count, std::chrono::microseconds period);
+
+    /**
+     * @brief Appends a completion. Called by queue pairs.
+     */
+    void push(const WorkCompletion& wc);
+
+private:
+    int drain_locked(WorkCompletion* wc, int max_entries);
+
+    size_t m_capacity;
+    size_t m_moderation_count = 1;
+    std::chrono::microseconds m_moderation_period{0};
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<WorkCompletion> m_entries;
+    std::chrono::steady_clock::time_point m_oldest;
+    bool m_overrun = false;
+};
+
+/**
+ * @struct QpCaps
+ * @brief Queue pair sizing.
+ */
+struct QpCaps {
+    uint32_t max_send_wr = 256; ///< Max work requests per post_send() doorbell
+    uint32_t max_recv_wr = 256; ///< Max outstanding posted receives
+};
+
+/**
+ * @class QueuePair
+ * @brief A reliable-connected queue pair carried over a TCP socket.
+ *
+ * A background progress thread plays the role of the responder side of
+ * the HCA: it reads incoming frames, places SEND payloads into posted
+ * receive buffers and RDMA_WRITE payloads straight into registered
+ * memory (the socket is read directly into the target buffer, so there
+ * is no intermediate copy in user space).
+ *
+ * As with an RC QP, any protocol or access violation is fatal: the QP
+ * moves to the error state, the connection is closed and outstanding
+ * receives are flushed.
+ */
+class QueuePair {
+public:
+    /**
+     * @brief Creates an unconnected queue pair.
+     * @param pd Domain that owns every lkey/rkey used by this QP.
+     * @param send_cq Queue receiving send-side completions.
+     * @param recv_cq Queue receiving receive-side completions.
+     */
+    QueuePair(ProtectionDomain& pd, CompletionQueue& send_cq, CompletionQueue& recv_cq,
+              QpCaps caps = {});
+
+    /**
+     * @brief Destructor. Disconnects and joins the progress thread.
+     */
+    ~QueuePair();
+
+    QueuePair(const QueuePair&) = delete;
+    QueuePair& operator=(const QueuePair&) = delete;
+
+    /**
+     * @brief Connects to a listening peer (active side).
+     * @throws std::runtime_error if the connection fails.
+     */
+    void connect(const std::string& host, uint16_t port);
+
+    /**
+     * @brief Takes ownership of an accepted socket (passive side).
+     */
+    void attach(int fd);
+
+    /**
+     * @brief Posts a chain of send work requests with a single doorbell.
+     *
+     * Every WR is validated first; the whole chain is then written to the
+     * wire with one gather-write whose iovecs point at registered memory.
+     *
+     * @return False if the chain was rejected (bad lkey, QP in error, or
+     *         more than max_send_wr entries). Signaled WRs of a rejected
+     *         chain complete with an error status.
+     */
+    bool post_send(const SendWr* wrs, size_t count);
+
+    /**
+     * @brief Posts a batch of receive work requests.
+     * @return False if the receive queue would exceed max_recv_wr.
+     */
+    bool post_recv(const RecvWr* wrs, size_t count);
+
+    /**
+     * @brief Closes the connection and flushes outstanding receives.
+     */
+    void disconnect();
+
+    uint32_t qp_num() const { return m_qp_num; }
+    bool is_error() const { return m_error.load(std::memory_order_acquire); }
+
+private:
+    void start();
+    void progress_loop();
+    bool read_exact(void* dst, size_t length);
+    bool discard(size_t length);
+    bool take_recv(RecvWr& out);
+    void to_error(const char* reason);
+    void flush_recvs();
+
+    ProtectionDomain& m_pd;
+    CompletionQueue& m_send_cq;
+    CompletionQueue& m_recv_cq;
+    QpCaps m_caps;
+    uint32_t m_qp_num;
+
+    int m_fd = -1;
+    std::thread m_progress;
+    std::atomic<bool> m_error{false};
+    std::mutex m_send_mutex; ///< Serializes doorbells onto the socket
+
+    std::mutex m_recv_mutex;
+    std::condition_variable m_recv_cv;
+    std::deque<RecvWr> m_recv_queue;
+};
+
+/**
+ * @class VerbsListener
+ * @brief Passive-side connection manager (the rdma_cm listen/accept role).
+ */
+class VerbsListener {
+public:
+    /**
+     * @brief Binds and listens on the loopback interface.
+     * @param port TCP port, or 0 to pick an ephemeral one.
+     */
+    explicit VerbsListener(uint16_t port);
+    ~VerbsListener();
+
+    VerbsListener(const VerbsListener&) = delete;
+    VerbsListener& operator=(const VerbsListener&) = delete;
+
+    /**
+     * @brief Blocks until a peer connects.
+     * @return Connected socket for QueuePair::attach(), or -1 once closed.
+     */
+    int accept();
+
+    /**
+     * @brief Unblocks accept() and stops listening.
+     */
+    void close();
+
+    uint16_t port() const { return m_port; }
+
+private:
+    std::atomic<int> m_fd{-1};
+    uint16_t m_port = 0;
+};
+
+#endif // VERBS_H
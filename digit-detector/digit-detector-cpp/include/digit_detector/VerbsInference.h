@@ -0,0 +1,212 @@
+#ifndef VERBS_INFERENCE_H
+#define VERBS_INFERENCE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Verbs.h"
+#include "types.h"
+
+// Forward declarations to avoid pulling LibTorch/OpenCV into clients
+class InferenceEngine;
+class ImageProcessor;
+
+/**
+ * @file VerbsInference.h
+ * @brief Zero-copy inference service built on the verbs emulation.
+ *
+ * Data path for one request:
+ * 1. The client SENDs a VerbsInferRequest that names a slot in its own
+ *    registered result buffer (address + rkey).
+ * 2. The server batches receive completions, runs the batch's requests
+ *    through the model in one forward pass, and RDMA_WRITE_WITH_IMMs
+ *    each VerbsInferResult directly into that slot.
+ *    All writes for one client in a batch go out with one doorbell and
+ *    only the last one is signaled.
+ * 3. The immediate carries the client's tag, so the client learns which
+ *    slot is ready from the receive completion alone.
+ */
+
+constexpr int VERBS_IMAGE_SIZE = 28;
+constexpr int VERBS_IMAGE_BYTES = VERBS_IMAGE_SIZE * VERBS_IMAGE_SIZE;
+
+/**
+ * @struct VerbsInferRequest
+ * @brief Two-sided request message: where to write the answer, plus pixels.
+ */
+struct VerbsInferRequest {
+    uint64_t request_id = 0;
+    uint64_t result_addr = 0;  ///< Client address of the VerbsInferResult slot
+    uint32_t result_rkey = 0;  ///< rkey of the client's result region
+    uint32_t tag = 0;          ///< Echoed back as the write immediate
+    uint8_t pixels[VERBS_IMAGE_BYTES] = {}; ///< 28x28 grayscale, row-major
+};
+
+/**
+ * @struct VerbsInferResult
+ * @brief One-sided response written into the client's memory.
+ */
+struct VerbsInferResult {
+    uint64_t request_id = 0;
+    int32_t digit = -1;
+    float confidence = 0.0f;
+};
+
+/**
+ * @struct VerbsServerOptions
+ * @brief Tuning knobs for VerbsInferenceServer.
+ */
+struct VerbsServerOptions {
+    uint32_t recv_depth = 64;        ///< Receives posted per connection
+    uint32_t max_batch = 32;         ///< Completions handled per service iteration
+    std::chrono::microseconds batch_delay{200}; ///< CQ moderation period
+};
+
+/**
+ * @class VerbsInferenceServer
+ * @brief Serves digit predictions over the verbs emulation.
+ *
+ * One acceptor thread creates a queue pair per client; a single service
+ * thread drains a shared receive CQ, runs inference and writes results
+ * back one-sided.
+ */
+class VerbsInferenceServer {
+public:
+    /**
+     * @brief Loads the model and starts listening.
+     * @param model_path Path to the TorchScript model.
+     * @param port Loopback port, or 0 for an ephemeral one.
+     * @throws std::runtime_error if the model or listener cannot be set up.
+     */
+    VerbsInferenceServer(const std::string& model_path, uint16_t port,
+                         VerbsServerOptions options = {});
+
+    /**
+     * @brief Destructor. Stops the service and disconnects all clients.
+     */
+    ~VerbsInferenceServer();
+
+    VerbsInferenceServer(const VerbsInferenceServer&) = delete;
+    VerbsInferenceServer& operator=(const VerbsInferenceServer&) = delete;
+
+    /**
+     * @brief Runs the service loop until stop() is called.
+     */
+    void run();
+
+    /**
+     * @brief Requests shutdown. Safe to call from any thread.
+     */
+    void stop();
+
+    uint16_t port() const { return m_listener.port(); }
+
+private:
+    /**
+     * @brief Per-client state: the QP plus its registered slot buffers.
+     */
+    struct Connection {
+        std::unique_ptr<QueuePair> qp;
+        std::vector<VerbsInferRequest> requests; ///< Receive slots
+        std::vector<VerbsInferResult> results;   ///< RDMA_WRITE source slots
+        std::shared_ptr<MemoryRegion> request_mr;
+        std::shared_ptr<MemoryRegion> result_mr;
+    };
+
+    void accept_loop();
+    void handle_completions(const WorkCompletion* wc, int count);
+    void reap_connections();
+
+    std::unique_ptr<InferenceEngine> m_engine;
+    std::unique_ptr<ImageProcessor> m_processor;
+    VerbsServerOptions m_options;
+
+    ProtectionDomain m_pd;
+    CompletionQueue m_send_cq;
+    CompletionQueue m_recv_cq;
+    VerbsListener m_listener;
+
+    std::mutex m_connections_mutex;
+    std::unordered_map<uint32_t, std::unique_ptr<Connection>> m_connections;
+
+    std::thread m_acceptor;
+    std::atomic<bool> m_running{false};
+};
+
+/**
+ * @class VerbsInferenceClient
+ * @brief Pipelined client for VerbsInferenceServer.
+ *
+ * Keeps up to `depth` requests in flight. Results are written by the
+ * server straight into the client's registered result slots.
+ */
+class VerbsInferenceClient {
+public:
+    /**
+     * @brief Connects to a server.
+     * @param depth Maximum requests in flight.
+     * @throws std::runtime_error if the connection fails.
+     */
+    VerbsInferenceClient(const std::string& host, uint16_t port, uint32_t depth = 64);
+
+    VerbsInferenceClient(const VerbsInferenceClient&) = delete;
+    VerbsInferenceClient& operator=(const VerbsInferenceClient&) = delete;
+
+    /**
+     * @brief Sends one 28x28 image without waiting for the answer.
+     * @param pixels VERBS_IMAGE_BYTES grayscale pixels.
+     * @return The request id, or 0 if all slots are in flight.
+     */
+    uint64_t submit(const uint8_t* pixels);
+
+    /**
+     * @brief Collects finished requests.
+     *
+     * A completion whose immediate names no slot in flight (out of range,
+     * or already answered) is dropped and counted in bad_completions().
+     * @param out Receives (request id, prediction) pairs.
+     * @param timeout Maximum time to wait for the first result.
+     * @return Number of results appended to out.
+     * @throws std::runtime_error if the connection has failed.
+     */
+    size_t poll(std::vector<std::pair<uint64_t, Prediction>>& out,
+                std::chrono::microseconds timeout);
+
+    /**
+     * @brief Convenience: submit one image and wait for its result.
+     */
+    Prediction infer(const uint8_t* pixels);
+
+    uint32_t in_flight() const { return m_in_flight; }
+
+    /// Completions dropped because their immediate named no slot in flight.
+    uint64_t bad_completions() const { return m_bad_completions; }
+
+private:
+    ProtectionDomain m_pd;
+    CompletionQueue m_send_cq;
+    CompletionQueue m_recv_cq;
+
+    // Declared before the QP so they outlive its progress thread
+    std::vector<VerbsInferRequest> m_requests;
+    std::vector<VerbsInferResult> m_results;
+    std::shared_ptr<MemoryRegion> m_request_mr;
+    std::shared_ptr<MemoryRegion> m_result_mr;
+    QueuePair m_qp;
+
+    std::vector<uint32_t> m_free_slots;
+    std::vector<uint8_t> m_busy; ///< Per slot: a request is in flight
+    uint32_t m_in_flight = 0;
+    uint64_t m_bad_completions = 0;
+    uint64_t m_next_request_id = 1;
+};
+
+#endif // VERBS_INFERENCE_H
@@ -0,0 +1,211 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @file WorkStealingPool.h
+ * @brief Process-wide task executor with one work-stealing deque per core.
+ *
+ * Each worker pushes and pops tasks it spawns at the bottom of its own
+ * deque (LIFO, cache-warm) while idle workers steal from the top of
+ * others' (FIFO, the oldest and usually largest pieces of work). Thieves
+ * try workers on their own NUMA node before crossing to another one.
+ * Tasks submitted from outside the pool go through a shared injection
+ * queue, which every worker checks before its own deque once every
+ * INJECTION_CHECK_INTERVAL tasks, so tasks that keep spawning tasks cannot
+ * starve outside submissions. Idle workers spin briefly, then park until
+ * work arrives.
+ *
+ * Blocking inside a task is allowed (a forward pass does) but ties up a
+ * core; waiting for other tasks should go through parallel_for() or
+ * TaskGroup::wait(), which run queued tasks while they wait.
+ */
+
+/**
+ * @struct ExecutorConfig
+ * @brief Settings for WorkStealingPool.
+ */
+struct ExecutorConfig {
+    uint32_t threads = 0; ///< 0: one per CPU this process may run on
+    bool pin = false;     ///< Pin worker i to the i-th allowed CPU
+};
+
+/**
+ * @struct ExecutorStats
+ * @brief Totals across all workers.
+ */
+struct ExecutorStats {
+    uint64_t executed = 0;
+    uint64_t stolen = 0;       ///< Taken from another worker's deque
+    uint64_t stolen_remote = 0; ///< ... on another NUMA node
+    uint64_t injected = 0;     ///< Submitted from outside the pool
+    uint64_t parks = 0;        ///< Times a worker went to sleep
+};
+
+/**
+ * @class WorkStealingDeque
+ * @brief Bounded Chase-Lev deque of task pointers.
+ *
+ * The owner calls push() and pop(); any thread may call steal(). Uses the
+ * memory orderings of Le, Pop, Cohen and Zappa Nardelli (PPoPP 2013).
+ */
+class WorkStealingDeque {
+public:
+    static constexpr int64_t CAPACITY = 4096;
+
+    /**
+     * @return false if the deque is full.
+     */
+    bool push(void* item);
+    void* pop();
+    void* steal();
+    bool empty() const;
+
+private:
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    std::atomic<void*> m_items[CAPACITY] = {};
+};
+
+/**
+ * @class WorkStealingPool
+ * @brief Fixed set of worker threads executing std::function tasks.
+ */
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * @brief Starts the workers.
+     */
+    explicit WorkStealingPool(ExecutorConfig config = {});
+
+    /**
+     * @brief Destructor. Runs every task already submitted, then joins.
+     */
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * @brief Queues a task. From a worker it goes on that worker's deque.
+     *
+     * An exception escaping a task is logged and dropped.
+     */
+    void submit(Task task);
+
+    /**
+     * @brief Calls body(i) for every i in [begin, end) on the pool and waits.
+     *
+     * The range is split into chunks of at least grain indices; the caller
+     * runs chunks too, so this may be called from inside a task.
+     * @throws The first exception thrown by body.
+     */
+    void parallel_for(size_t begin, size_t end, size_t grain,
+                      const std::function<void(size_t)>& body);
+
+    size_t size() const { return m_workers.size(); }
+
+    /**
+     * @brief Index of the calling worker in this pool, or -1 outside it.
+     */
+    int current_worker() const;
+
+    /**
+     * @brief CPU and NUMA node assigned to a worker.
+     */
+    int worker_cpu(size_t worker) const { return m_workers[worker]->cpu; }
+    int worker_node(size_t worker) const { return m_workers[worker]->node; }
+    size_t numa_nodes() const { return m_node_count; }
+
+    ExecutorStats stats() const;
+
+    /**
+     * @brief Runs one queued task on the calling thread, if there is one.
+     * @return false if nothing was found.
+     */
+    bool run_one();
+
+private:
+    struct Job {
+        Task fn;
+    };
+
+    struct Worker {
+        WorkStealingDeque deque;
+        int cpu = -1;
+        int node = 0;
+        std::vector<size_t> victims; ///< Same node first, then the rest
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> stolen_remote{0};
+        uint32_t takes = 0; ///< Owner only; paces the injection check
+        std::thread thread;
+    };
+
+    void worker_loop(size_t index);
+    Job* take(int self);
+    void enqueue(Job* job);
+    void execute(Job* job);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    size_t m_node_count = 1;
+    bool m_pin = false;
+
+    std::mutex m_inject_mutex;
+    std::deque<Job*> m_injected;
+
+    std::atomic<int64_t> m_queued{0}; ///< Jobs in deques and the injection queue
+    std::atomic<uint32_t> m_sleepers{0};
+    std::atomic<uint64_t> m_injected_total{0};
+    std::atomic<uint64_t> m_parks{0};
+    std::mutex m_park_mutex;
+    std::condition_variable m_park_cv;
+    std::atomic<bool> m_stopping{false};
+};
+
+/**
+ * @class TaskGroup
+ * @brief Tracks a set of submitted tasks so the caller can wait for all of them.
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingPool& pool) : m_pool(pool) {}
+
+    /**
+     * @brief Waits for outstanding tasks; exceptions are dropped.
+     */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(WorkStealingPool::Task task);
+
+    /**
+     * @brief Runs queued tasks until every task of the group has finished.
+     * @throws The first exception a task of the group threw.
+     */
+    void wait();
+
+private:
+    WorkStealingPool& m_pool;
+    std::atomic<size_t> m_pending{0};
+    std::mutex m_mutex;
+    std::condition_variable m_cv; ///< Signalled when m_pending drops to zero
+    std::exception_ptr m_error;
+};
+
+#endif // WORK_STEALING_POOL_H
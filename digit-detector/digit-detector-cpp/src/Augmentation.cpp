@@ -0,0 +1,457 @@
+#include "Augmentation.h"
+
+// The gather resample is x86 only; elsewhere every image takes the scalar path
+#if defined(__x86_64__) || defined(__i386__)
+#define DIGIT_AUGMENT_X86 1
+#include <immintrin.h>
+#else
+#define DIGIT_AUGMENT_X86 0
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+constexpr int SIDE = Augmenter::SIDE;
+constexpr size_t PIXELS = Augmenter::PIXELS;
+
+// Images are copied into a 32x32 frame of background, one pixel of border
+// on the top and left and three on the bottom and right, so that every
+// bilinear tap of a clamped source point is inside the frame
+constexpr int FRAME = 32;
+constexpr size_t FRAME_PIXELS = static_cast<size_t>(FRAME) * FRAME;
+
+constexpr float CENTRE = (SIDE - 1) * 0.5f;
+constexpr float DEGREES = 3.14159265358979f / 180.0f;
+constexpr int64_t PARALLEL_GRAIN = 16; ///< Images per intra-op task
+constexpr size_t TTA_VARIANTS = 11;
+
+/**
+ * @brief Output pixel coordinates of the flattened image, so the
+ * resample walks it eight pixels at a time without row bookkeeping.
+ */
+struct Grid {
+    alignas(32) float x[PIXELS];
+    alignas(32) float y[PIXELS];
+
+    Grid() {
+        for (size_t i = 0; i < PIXELS; ++i) {
+            x[i] = static_cast<float>(i % SIDE);
+            y[i] = static_cast<float>(i / SIDE);
+        }
+    }
+};
+
+const Grid& grid() {
+    static const Grid g;
+    return g;
+}
+
+bool have_avx2() {
+#if DIGIT_AUGMENT_X86
+    static const bool avx2 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }();
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+uint64_t mix(uint64_t seed, uint64_t index) {
+    // splitmix64 of the pair, so neighbouring images get unrelated streams
+    uint64_t z = seed + 0x9e3779b97f4a7c15ull * (index + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Source coordinates (sx, sy) = (m0 x + m1 y + m2, m3 x + m4 y + m5)
+ * for output pixel (x, y): the inverse of the transform about the centre.
+ */
+std::array<float, 6> source_map(const ImageTransform& t) {
+    // Forward: shift . rotate . shear . scale, about the centre
+    const float c = std::cos(t.rotation_deg * DEGREES);
+    const float s = std::sin(t.rotation_deg * DEGREES);
+    const float k = std::tan(t.shear_deg * DEGREES);
+    const float f00 = c * t.scale;
+    const float f01 = (c * k - s) * t.scale;
+    const float f10 = s * t.scale;
+    const float f11 = (s * k + c) * t.scale;
+    const float det = f00 * f11 - f01 * f10;
+    if (std::abs(det) < 1e-6f) {
+        throw std::invalid_argument("Augmenter: transform is singular");
+    }
+    const float a = f11 / det;
+    const float b = -f01 / det;
+    const float d = -f10 / det;
+    const float e = f00 / det;
+    const float ox = CENTRE + t.shift_x;
+    const float oy = CENTRE + t.shift_y;
+    return {a, b, CENTRE - (a * ox + b * oy), d, e, CENTRE - (d * ox + e * oy)};
+}
+
+bool is_identity(const std::array<float, 6>& m) {
+    return m[0] == 1.0f && m[1] == 0.0f && m[2] == 0.0f && m[3] == 0.0f && m[4] == 1.0f &&
+           m[5] == 0.0f;
+}
+
+void frame_image(const float* in, float background, float* frame) {
+    std::fill(frame, frame + FRAME_PIXELS, background);
+    for (int y = 0; y < SIDE; ++y) {
+        std::memcpy(frame + (y + 1) * FRAME + 1, in + y * SIDE, SIDE * sizeof(float));
+    }
+}
+
+/**
+ * @brief 3x3 max (thicken) or min (thin) filter over the framed image.
+ */
+template <bool THICKEN>
+void stroke_filter(const float* frame, float background, float* out) {
+    std::fill(out, out + FRAME_PIXELS, background);
+    for (int y = 1; y <= SIDE; ++y) {
+        const float* above = frame + (y - 1) * FRAME;
+        const float* row = frame + y * FRAME;
+        const float* below = frame + (y + 1) * FRAME;
+        float* dst = out + y * FRAME;
+        for (int x = 1; x <= SIDE; ++x) {
+            float v = row[x];
+            for (int dx = -1; dx <= 1; ++dx) {
+                v = THICKEN ? std::max({v, above[x + dx], row[x + dx], below[x + dx]})
+                            : std::min({v, above[x + dx], row[x + dx], below[x + dx]});
+            }
+            dst[x] = v;
+        }
+    }
+}
+
+/**
+ * @brief Clamps a source coordinate to [-1, SIDE]. A NaN lands on -1, as
+ * it does in _mm256_max_ps, rather than reaching the int cast.
+ */
+float clamp_source(float v) {
+    if (!(v > -1.0f)) {
+        return -1.0f;
+    }
+    return v < static_cast<float>(SIDE) ? v : static_cast<float>(SIDE);
+}
+
+void resample_scalar(const float* frame, float* out, const std::array<float, 6>& m,
+                     const float* dx, const float* dy) {
+    const Grid& g = grid();
+    for (size_t i = 0; i < PIXELS; ++i) {
+        float sx = m[0] * g.x[i] + m[1] * g.y[i] + m[2];
+        float sy = m[3] * g.x[i] + m[4] * g.y[i] + m[5];
+        if (dx != nullptr) {
+            sx += dx[i];
+            sy += dy[i];
+        }
+        sx = clamp_source(sx);
+        sy = clamp_source(sy);
+        const float x0 = std::floor(sx);
+        const float y0 = std::floor(sy);
+        const float wx = sx - x0;
+        const float wy = sy - y0;
+        const float* p = frame + (static_cast<int>(y0) + 1) * FRAME + static_cast<int>(x0) + 1;
+        const float top = p[0] + wx * (p[1] - p[0]);
+        const float bottom = p[FRAME] + wx * (p[FRAME + 1] - p[FRAME]);
+        out[i] = top + wy * (bottom - top);
+    }
+}
+
+#if DIGIT_AUGMENT_X86
+
+__attribute__((target("avx2,fma"))) void resample_avx2(const float* frame, float* out,
+                                                       const std::array<float, 6>& m,
+                                                       const float* dx, const float* dy) {
+    const Grid& g = grid();
+    const __m256 m0 = _mm256_set1_ps(m[0]);
+    const __m256 m1 = _mm256_set1_ps(m[1]);
+    const __m256 m2 = _mm256_set1_ps(m[2]);
+    const __m256 m3 = _mm256_set1_ps(m[3]);
+    const __m256 m4 = _mm256_set1_ps(m[4]);
+    const __m256 m5 = _mm256_set1_ps(m[5]);
+    const __m256 lo = _mm256_set1_ps(-1.0f);
+    const __m256 hi = _mm256_set1_ps(static_cast<float>(SIDE));
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i stride = _mm256_set1_epi32(FRAME);
+    const __m256i right = _mm256_set1_epi32(1);
+    const __m256i down = _mm256_set1_epi32(FRAME);
+
+    // PIXELS is a multiple of 8, so there is no tail
+    for (size_t i = 0; i < PIXELS; i += 8) {
+        const __m256 x = _mm256_load_ps(g.x + i);
+        const __m256 y = _mm256_load_ps(g.y + i);
+        __m256 sx = _mm256_fmadd_ps(m0, x, _mm256_fmadd_ps(m1, y, m2));
+        __m256 sy = _mm256_fmadd_ps(m3, x, _mm256_fmadd_ps(m4, y, m5));
+        if (dx != nullptr) {
+            sx = _mm256_add_ps(sx, _mm256_loadu_ps(dx + i));
+            sy = _mm256_add_ps(sy, _mm256_loadu_ps(dy + i));
+        }
+        // max_ps returns its second operand for a NaN, so NaN lands on -1
+        sx = _mm256_min_ps(_mm256_max_ps(sx, lo), hi);
+        sy = _mm256_min_ps(_mm256_max_ps(sy, lo), hi);
+        const __m256 x0 = _mm256_floor_ps(sx);
+        const __m256 y0 = _mm256_floor_ps(sy);
+        const __m256 wx = _mm256_sub_ps(sx, x0);
+        const __m256 wy = _mm256_sub_ps(sy, y0);
+
+        // Frame index of the top-left tap; the other three are +1, +32, +33
+        const __m256i base = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_cvttps_epi32(_mm256_add_ps(y0, one)), stride),
+            _mm256_cvttps_epi32(_mm256_add_ps(x0, one)));
+        const __m256 p00 = _mm256_i32gather_ps(frame, base, 4);
+        const __m256 p01 = _mm256_i32gather_ps(frame, _mm256_add_epi32(base, right), 4);
+        const __m256i lower = _mm256_add_epi32(base, down);
+        const __m256 p10 = _mm256_i32gather_ps(frame, lower, 4);
+        const __m256 p11 = _mm256_i32gather_ps(frame, _mm256_add_epi32(lower, right), 4);
+
+        const __m256 top = _mm256_fmadd_ps(wx, _mm256_sub_ps(p01, p00), p00);
+        const __m256 bottom = _mm256_fmadd_ps(wx, _mm256_sub_ps(p11, p10), p10);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(wy, _mm256_sub_ps(bottom, top), top));
+    }
+}
+
+#endif // DIGIT_AUGMENT_X86
+
+void check_batch(const at::Tensor& batch) {
+    if (batch.dim() != 4 || batch.size(1) != 1 || batch.size(2) != SIDE ||
+        batch.size(3) != SIDE || batch.scalar_type() != torch::kFloat32) {
+        throw std::invalid_argument("Augmenter: expected a float [N, 1, 28, 28] batch");
+    }
+}
+
+} // namespace
+
+Augmenter::Augmenter(AugmentOptions options, float background)
+    : m_options(options), m_background(background)
+{
+    // A non-finite range would put NaN source coordinates into every resample
+    for (float value : {options.max_rotation_deg, options.max_scale, options.max_shear_deg,
+                        options.max_translate, options.elastic_alpha, options.elastic_sigma,
+                        options.thickness_probability, background}) {
+        if (!std::isfinite(value)) {
+            throw std::invalid_argument("Augmenter: options and background must be finite");
+        }
+    }
+    if (options.max_rotation_deg < 0.0f || options.max_scale < 0.0f ||
+        options.max_scale >= 1.0f || options.max_shear_deg < 0.0f ||
+        options.max_shear_deg >= 45.0f || options.max_translate < 0.0f ||
+        options.elastic_alpha < 0.0f) {
+        throw std::invalid_argument("Augmenter: ranges must be non-negative, max_scale below 1 "
+                                    "and max_shear_deg below 45");
+    }
+    if (options.thickness_probability < 0.0f || options.thickness_probability > 1.0f) {
+        throw std::invalid_argument("Augmenter: thickness_probability must be in [0, 1]");
+    }
+    if (options.elastic_alpha > 0.0f) {
+        if (options.elastic_sigma <= 0.0f) {
+            throw std::invalid_argument("Augmenter: elastic_sigma must be positive");
+        }
+        const int radius =
+            std::min(SIDE - 1, static_cast<int>(std::ceil(3.0f * options.elastic_sigma)));
+        m_gaussian.resize(2 * radius + 1);
+        for (int i = -radius; i <= radius; ++i) {
+            m_gaussian[i + radius] =
+                std::exp(-0.5f * i * i / (options.elastic_sigma * options.elastic_sigma));
+        }
+    }
+}
+
+void Augmenter::augment(const float* in, float* out, size_t count, uint64_t seed) const {
+    for (size_t i = 0; i < count; ++i) {
+        augment_image(in + i * PIXELS, out + i * PIXELS, mix(seed, i));
+    }
+}
+
+void Augmenter::augment_image(const float* in, float* out, uint64_t seed) const {
+    // 1. The image's draw
+    std::mt19937_64 rng(seed);
+    auto uniform = [&](float range) {
+        return range > 0.0f ? std::uniform_real_distribution<float>(-range, range)(rng) : 0.0f;
+    };
+    ImageTransform t;
+    t.rotation_deg = uniform(m_options.max_rotation_deg);
+    t.scale = 1.0f + uniform(m_options.max_scale);
+    t.shear_deg = uniform(m_options.max_shear_deg);
+    t.shift_x = uniform(m_options.max_translate);
+    t.shift_y = uniform(m_options.max_translate);
+    if (m_options.thickness_probability > 0.0f &&
+        std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) <
+            m_options.thickness_probability) {
+        t.thickness = (rng() & 1) != 0 ? 1 : -1;
+    }
+
+    // 2. Its displacement field, if elastic
+    if (m_options.elastic_alpha > 0.0f) {
+        alignas(32) float dx[PIXELS];
+        alignas(32) float dy[PIXELS];
+        elastic_field(rng(), dx, dy);
+        apply(in, out, t, dx, dy);
+    } else {
+        apply(in, out, t, nullptr, nullptr);
+    }
+}
+
+at::Tensor Augmenter::augment(const at::Tensor& batch, uint64_t seed) const {
+    check_batch(batch);
+    const at::Tensor input = batch.contiguous();
+    at::Tensor output = torch::empty({input.size(0), 1, SIDE, SIDE}, torch::kFloat32);
+    const float* in = input.data_ptr<float>();
+    float* out = output.data_ptr<float>();
+    at::parallel_for(0, input.size(0), PARALLEL_GRAIN, [&](int64_t begin, int64_t end) {
+        // Seeded by absolute index, as the pointer overload seeds them
+        for (int64_t i = begin; i < end; ++i) {
+            augment_image(in + i * PIXELS, out + i * PIXELS, mix(seed, static_cast<uint64_t>(i)));
+        }
+    });
+    return output;
+}
+
+void Augmenter::transform(const float* in, float* out, size_t count,
+                          const ImageTransform& transform) const {
+    for (size_t i = 0; i < count; ++i) {
+        apply(in + i * PIXELS, out + i * PIXELS, transform, nullptr, nullptr);
+    }
+}
+
+at::Tensor Augmenter::expand(const at::Tensor& batch,
+                             const std::vector<ImageTransform>& variants) const {
+    check_batch(batch);
+    const at::Tensor input = batch.contiguous();
+    const int64_t n = input.size(0);
+    const int64_t k = static_cast<int64_t>(variants.size());
+    at::Tensor output = torch::empty({n * k, 1, SIDE, SIDE}, torch::kFloat32);
+    const float* in = input.data_ptr<float>();
+    float* out = output.data_ptr<float>();
+    at::parallel_for(0, n * k, PARALLEL_GRAIN, [&](int64_t begin, int64_t end) {
+        for (int64_t row = begin; row < end; ++row) {
+            apply(in + (row / k) * PIXELS, out + row * PIXELS, variants[row % k], nullptr,
+                  nullptr);
+        }
+    });
+    return output;
+}
+
+std::vector<ImageTransform> Augmenter::tta_variants(size_t k) {
+    // Mild enough to keep every digit legible, identity first; the
+    // thickness changes come last as the strongest
+    static const std::vector<ImageTransform> variants = [] {
+        std::vector<ImageTransform> v(TTA_VARIANTS);
+        v[1].rotation_deg = 6.0f;
+        v[2].rotation_deg = -6.0f;
+        v[3].scale = 1.08f;
+        v[4].scale = 0.92f;
+        v[5].shift_x = 1.0f;
+        v[6].shift_x = -1.0f;
+        v[7].shift_y = 1.0f;
+        v[8].shift_y = -1.0f;
+        v[9].thickness = 1;
+        v[10].thickness = -1;
+        return v;
+    }();
+    if (k == 0 || k > variants.size()) {
+        throw std::invalid_argument("Augmenter: test-time variants must be between 1 and " +
+                                    std::to_string(variants.size()));
+    }
+    return std::vector<ImageTransform>(variants.begin(), variants.begin() + k);
+}
+
+size_t Augmenter::max_tta_variants() {
+    return TTA_VARIANTS;
+}
+
+std::string Augmenter::isa() {
+    return have_avx2() ? "avx2+fma" : "scalar";
+}
+
+void Augmenter::apply(const float* in, float* out, const ImageTransform& transform,
+                      const float* dx, const float* dy) const {
+    // 1. Framed copy first, so in and out may alias
+    alignas(32) float frame[FRAME_PIXELS];
+    alignas(32) float filtered[FRAME_PIXELS];
+    frame_image(in, m_background, frame);
+    const float* source = frame;
+    if (transform.thickness > 0) {
+        stroke_filter<true>(frame, m_background, filtered);
+        source = filtered;
+    } else if (transform.thickness < 0) {
+        stroke_filter<false>(frame, m_background, filtered);
+        source = filtered;
+    }
+
+    // 2. One resample through the affine map and the field
+    const std::array<float, 6> m = source_map(transform);
+    if (is_identity(m) && dx == nullptr) {
+        for (int y = 0; y < SIDE; ++y) {
+            std::memcpy(out + y * SIDE, source + (y + 1) * FRAME + 1, SIDE * sizeof(float));
+        }
+        return;
+    }
+#if DIGIT_AUGMENT_X86
+    if (have_avx2()) {
+        resample_avx2(source, out, m, dx, dy);
+        return;
+    }
+#endif
+    resample_scalar(source, out, m, dx, dy);
+}
+
+void Augmenter::elastic_field(uint64_t seed, float* dx, float* dy) const {
+    const int radius = static_cast<int>(m_gaussian.size() / 2);
+    std::mt19937_64 rng(seed);
+    float padded[SIDE + 2 * (SIDE - 1)] = {}; // Radius is at most SIDE - 1
+    alignas(32) float rows[PIXELS];
+    float* fields[2] = {dx, dy};
+    float peak = 0.0f;
+    for (float* field : fields) {
+        // 1. Uniform noise in [-1, 1), two pixels per draw, smoothed along
+        // each row; the zero padding keeps the inner loop branch-free
+        for (int y = 0; y < SIDE; ++y) {
+            for (int x = 0; x < SIDE; x += 2) {
+                const uint64_t bits = rng();
+                padded[radius + x] = static_cast<int32_t>(bits) * 0x1p-31f;
+                padded[radius + x + 1] = static_cast<int32_t>(bits >> 32) * 0x1p-31f;
+            }
+            float* row = rows + y * SIDE;
+            std::fill(row, row + SIDE, 0.0f);
+            for (int j = 0; j <= 2 * radius; ++j) {
+                const float w = m_gaussian[j];
+                const float* src = padded + j;
+                for (int x = 0; x < SIDE; ++x) {
+                    row[x] += w * src[x];
+                }
+            }
+        }
+
+        // 2. Then down each column, zero outside
+        std::fill(field, field + PIXELS, 0.0f);
+        for (int j = -radius; j <= radius; ++j) {
+            const float w = m_gaussian[j + radius];
+            for (int y = std::max(0, -j); y < std::min(SIDE, SIDE - j); ++y) {
+                const float* src = rows + (y + j) * SIDE;
+                float* dst = field + y * SIDE;
+                for (int x = 0; x < SIDE; ++x) {
+                    dst[x] += w * src[x];
+                }
+            }
+        }
+        for (size_t i = 0; i < PIXELS; ++i) {
+            peak = std::max(peak, std::abs(field[i]));
+        }
+    }
+
+    // 3. Scaled so the largest displacement is elastic_alpha pixels
+    const float scale = peak > 0.0f ? m_options.elastic_alpha / peak : 0.0f;
+    for (size_t i = 0; i < PIXELS; ++i) {
+        dx[i] *= scale;
+        dy[i] *= scale;
+    }
+}
@@ -0,0 +1,541 @@
+#include "Autotuner.h"
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "ModelScheduler.h"
+#include "PerfStats.h"
+#include "ThreadBudget.h"
+#include "WorkStealingPool.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double PROFILE_SHARE = 0.3;        ///< Part of the budget spent timing passes
+constexpr double PASS_QUANTILE = 0.9;        ///< Pass time used for capacity and latency
+constexpr size_t MAX_PROFILE_SAMPLES = 200;  ///< Per (threads, batch) pair
+constexpr size_t MAX_VALIDATIONS = 6;        ///< Candidates run through the scheduler
+constexpr double MIN_VALIDATION_SECONDS = 0.5;
+/// Offered load as a fraction of predicted capacity; the second try if the first misses
+constexpr double VALIDATION_LOADS[] = {0.8, 0.5};
+constexpr size_t INPUT_COUNT = 512;
+constexpr int DIGIT_SIZE = 28;
+
+struct Image {
+    std::vector<uint8_t> pixels;
+    uint16_t width = 0;
+    uint16_t height = 0;
+};
+
+/// One (threads, batch, delay) point with its predictions
+struct Candidate {
+    uint32_t threads = 1;
+    uint32_t batch = 1;
+    uint32_t delay_us = 0;
+    double capacity = 0.0;          ///< Requests/s at back-to-back full batches
+    double predicted_p99_us = 0.0;
+};
+
+struct Measurement {
+    double throughput = 0.0;
+    double p99_us = 0.0;
+};
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string timestamp_utc() {
+    const std::time_t now = std::time(nullptr);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return text;
+}
+
+constexpr uint64_t FNV_OFFSET = 1469598103934665603ull;
+constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+uint64_t fnv1a(uint64_t hash, const char* bytes, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8_t>(bytes[i]);
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+std::string hex(uint64_t hash) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+    return text;
+}
+
+std::string cache_key(const std::string& cpu_model, uint32_t cores, const std::string& hash,
+                      const std::string& config_hash) {
+    return cpu_model + "|" + std::to_string(cores) + "c|" + hash + "|" + config_hash;
+}
+
+/**
+ * @brief Restores LibTorch's intra-op thread count on every way out of
+ * the sweep, exceptions included.
+ */
+class IntraOpThreadsGuard {
+public:
+    IntraOpThreadsGuard() : m_saved(at::get_num_threads()) {}
+    ~IntraOpThreadsGuard() { at::set_num_threads(m_saved); }
+
+    IntraOpThreadsGuard(const IntraOpThreadsGuard&) = delete;
+    IntraOpThreadsGuard& operator=(const IntraOpThreadsGuard&) = delete;
+
+private:
+    int m_saved;
+};
+
+/**
+ * @brief The model as it is served, minus any pipeline: the same
+ * kernels and TTA variants, run in-process.
+ */
+ModelConfig tuning_config(const ModelConfig& model) {
+    ModelConfig config = model;
+    config.pipeline = PipelineOptions{};
+    return config;
+}
+
+/**
+ * @brief MNIST digits if a file was given and loads, otherwise rings of
+ * random size and stroke width, which exercise the same code paths.
+ */
+std::vector<Image> load_inputs(const AutotuneOptions& options) {
+    std::vector<Image> images;
+    if (!options.inputs.empty()) {
+        try {
+            const MnistSet mnist = load_mnist_idx(options.inputs, "", INPUT_COUNT);
+            for (uint32_t i = 0; i < mnist.count; ++i) {
+                images.push_back({std::vector<uint8_t>(mnist.image(i),
+                                                       mnist.image(i) + mnist.image_bytes()),
+                                  static_cast<uint16_t>(mnist.cols),
+                                  static_cast<uint16_t>(mnist.rows)});
+            }
+            return images;
+        } catch (const std::exception& e) {
+            std::cerr << "Autotuner: " << e.what() << "; using synthetic digits" << std::endl;
+        }
+    }
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> radius(5.0, 10.0);
+    std::uniform_real_distribution<double> stroke(1.0, 2.5);
+    std::uniform_real_distribution<double> offset(-3.0, 3.0);
+    for (size_t i = 0; i < INPUT_COUNT; ++i) {
+        Image image{std::vector<uint8_t>(DIGIT_SIZE * DIGIT_SIZE), DIGIT_SIZE, DIGIT_SIZE};
+        const double r = radius(rng);
+        const double w = stroke(rng);
+        const double cx = DIGIT_SIZE / 2.0 + offset(rng);
+        const double cy = DIGIT_SIZE / 2.0 + offset(rng);
+        for (int y = 0; y < DIGIT_SIZE; ++y) {
+            for (int x = 0; x < DIGIT_SIZE; ++x) {
+                const double d = std::hypot(x - cx, y - cy);
+                if (std::abs(d - r) < w) {
+                    image.pixels[static_cast<size_t>(y * DIGIT_SIZE + x)] = 255;
+                }
+            }
+        }
+        images.push_back(std::move(image));
+    }
+    return images;
+}
+
+double quantile(std::vector<double> values, double q) {
+    std::sort(values.begin(), values.end());
+    const size_t index = std::min(values.size() - 1,
+                                  static_cast<size_t>(q * static_cast<double>(values.size())));
+    return values[index];
+}
+
+/**
+ * @brief Phase 1: upper-quantile preprocess + forward time of one batch, in ns.
+ */
+double profile_pass(InferenceEngine& engine, ImageProcessor& processor,
+                    const std::vector<Image>& inputs, uint32_t batch, double seconds) {
+    auto pass = [&](size_t first) {
+        std::vector<torch::Tensor> tensors;
+        tensors.reserve(batch);
+        for (uint32_t i = 0; i < batch; ++i) {
+            const Image& image = inputs[(first + i) % inputs.size()];
+            cv::Mat mat(image.height, image.width, CV_8UC1,
+                        const_cast<uint8_t*>(image.pixels.data()));
+            tensors.push_back(processor.process(mat));
+        }
+        engine.predict_batch(torch::cat(tensors, 0));
+    };
+
+    pass(0);
+    std::vector<double> samples;
+    const Clock::time_point start = Clock::now();
+    while (samples.size() < MAX_PROFILE_SAMPLES &&
+           (samples.size() < 3 || seconds_since(start) < seconds)) {
+        const Clock::time_point t0 = Clock::now();
+        pass(samples.size() * batch);
+        samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count());
+    }
+    return quantile(samples, PASS_QUANTILE);
+}
+
+/**
+ * @brief Phase 2: open-loop Poisson arrivals through a real scheduler.
+ *
+ * Latency runs from each request's intended send time, so a run that
+ * falls behind is charged for it. `base` is the tuning_config() that was
+ * profiled.
+ */
+Measurement validate(const ModelConfig& base, const Candidate& candidate, uint32_t cores,
+                     const std::vector<Image>& inputs, double rate, double seconds) {
+    ModelConfig config = base;
+    config.max_batch = candidate.batch;
+    config.batch_delay = std::chrono::microseconds(candidate.delay_us);
+    config.max_queue = 1u << 20;
+    config.deadline = std::chrono::microseconds(0);
+    config.coalesce = false; // The inputs repeat; collapsing them would flatter throughput
+    auto model = std::make_shared<ServedModel>(config);
+
+    ThreadBudgetConfig budget_config;
+    budget_config.cores = cores;
+    budget_config.intra_op_threads = candidate.threads;
+    budget_config.interop_threads = 0;
+    ThreadBudget budget(budget_config, 1, candidate.batch);
+    WorkStealingPool pool(ExecutorConfig{cores, false});
+
+    std::mutex mutex;
+    LatencyHistogram latency;
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> submitted{0};
+    Clock::time_point last_done;
+
+    const Clock::time_point start = Clock::now();
+    {
+        ModelScheduler scheduler(pool, 0, &budget);
+        std::mt19937_64 rng(7);
+        std::exponential_distribution<double> gap(rate);
+        Clock::time_point intended = start;
+        const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(seconds));
+        // Give up early once the backlog alone is worth half a second
+        const uint64_t max_backlog = std::max<uint64_t>(1000, static_cast<uint64_t>(rate / 2));
+        for (size_t i = 0; intended < end; ++i) {
+            std::this_thread::sleep_until(intended);
+            if (submitted.load() - completed.load() > max_backlog) {
+                break;
+            }
+            const Image& image = inputs[i % inputs.size()];
+            InferenceRequest request;
+            request.pixels = image.pixels;
+            request.width = image.width;
+            request.height = image.height;
+            request.done = [&, intended](RequestStatus status, const Prediction&) {
+                const Clock::time_point now = Clock::now();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (status == RequestStatus::Ok) {
+                    latency.record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(now - intended)
+                            .count()));
+                    last_done = std::max(last_done, now);
+                }
+                completed.fetch_add(1);
+            };
+            submitted.fetch_add(1);
+            scheduler.submit(model, std::move(request));
+            intended += std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(gap(rng)));
+        }
+        // Let the queue drain so the tail is counted
+        const Clock::time_point drain_until = Clock::now() + std::chrono::seconds(2);
+        while (completed.load() < submitted.load() && Clock::now() < drain_until) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Measurement m;
+    const double elapsed = std::chrono::duration<double>(last_done - start).count();
+    m.throughput = elapsed > 0.0 ? static_cast<double>(latency.count()) / elapsed : 0.0;
+    m.p99_us = static_cast<double>(latency.value_at_percentile(99.0)) / 1000.0;
+    if (completed.load() < submitted.load()) {
+        m.p99_us = std::numeric_limits<double>::infinity();
+    }
+    return m;
+}
+
+} // namespace
+
+AutotuneResult autotune(const ModelConfig& model, const AutotuneOptions& options) {
+    const Clock::time_point start = Clock::now();
+    AutotuneResult result;
+    result.cpu_model = cpu_model();
+    result.model_hash = model_file_hash(model.model_path);
+    result.config_hash = model_config_hash(model);
+    result.cores = options.cores != 0 ? options.cores : ThreadBudget::available_cores();
+    result.slo_p99_us = options.slo_p99_us;
+
+    std::vector<uint32_t> thread_counts = options.intra_op_threads;
+    if (thread_counts.empty()) {
+        for (uint32_t n = 1; n < result.cores; n *= 2) {
+            thread_counts.push_back(n);
+        }
+        thread_counts.push_back(result.cores);
+    }
+    const std::vector<Image> inputs = load_inputs(options);
+    const IntraOpThreadsGuard restore_threads;
+
+    // 1. Profile every (threads, batch) pair on the engine as served
+    const ModelConfig config = tuning_config(model);
+    ServedModel profiled(config);
+    InferenceEngine& engine = profiled.engine();
+    ImageProcessor processor;
+    const double cell_seconds = options.seconds * PROFILE_SHARE /
+                                static_cast<double>(thread_counts.size() *
+                                                    options.max_batches.size());
+    std::vector<Candidate> candidates;
+    for (uint32_t threads : thread_counts) {
+        at::set_num_threads(static_cast<int>(threads));
+        for (uint32_t batch : options.max_batches) {
+            const double pass_ns = profile_pass(engine, processor, inputs, batch, cell_seconds);
+            ++result.profiled;
+
+            // A request waits at most the delay to fill its batch, then
+            // for the pass ahead of it and its own
+            const double capacity = static_cast<double>(batch) * 1e9 / pass_ns;
+            if (batch == 1) {
+                // Nothing to fill, so no delay to choose
+                candidates.push_back({threads, batch, 0, capacity, 2.0 * pass_ns / 1000.0});
+                continue;
+            }
+            const double fill_us =
+                static_cast<double>(batch) * 1e6 / (capacity * VALIDATION_LOADS[0]);
+            Candidate best;
+            bool found = false;
+            for (uint32_t delay : options.batch_delays_us) {
+                Candidate c{threads, batch, delay, capacity,
+                            static_cast<double>(delay) + 2.0 * pass_ns / 1000.0};
+                // Prefer the shortest delay that still lets a batch fill
+                const bool fills = static_cast<double>(delay) >= fill_us;
+                const bool best_fills = found && static_cast<double>(best.delay_us) >= fill_us;
+                if (!found || (fills && (!best_fills || delay < best.delay_us)) ||
+                    (!fills && !best_fills && delay > best.delay_us)) {
+                    best = c;
+                    found = true;
+                }
+            }
+            if (found) {
+                candidates.push_back(best);
+            }
+        }
+    }
+
+    // 2. Validate, most promising first: predicted to meet the SLO by
+    // capacity, then (if none is) by predicted latency
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [&](const Candidate& a, const Candidate& b) {
+                         const bool a_ok = a.predicted_p99_us <= options.slo_p99_us;
+                         const bool b_ok = b.predicted_p99_us <= options.slo_p99_us;
+                         if (a_ok != b_ok) {
+                             return a_ok;
+                         }
+                         return a_ok ? a.capacity > b.capacity
+                                     : a.predicted_p99_us < b.predicted_p99_us;
+                     });
+    if (candidates.size() > MAX_VALIDATIONS) {
+        candidates.resize(MAX_VALIDATIONS);
+    }
+
+    double best_p99 = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const double remaining = options.seconds - seconds_since(start);
+        if (remaining < MIN_VALIDATION_SECONDS && result.validated > 0) {
+            break;
+        }
+        const Candidate& c = candidates[i];
+        const double run_seconds =
+            std::max(MIN_VALIDATION_SECONDS,
+                     remaining / static_cast<double>(candidates.size() - i) /
+                         static_cast<double>(std::size(VALIDATION_LOADS)));
+        for (double load : VALIDATION_LOADS) {
+            const Measurement m =
+                validate(config, c, result.cores, inputs, c.capacity * load, run_seconds);
+            ++result.validated;
+            std::printf("Autotuner: %u threads, batch %u, delay %u us @ %.0f/s -> %.0f/s, "
+                        "p99 %.0f us\n",
+                        c.threads, c.batch, c.delay_us, c.capacity * load, m.throughput,
+                        m.p99_us);
+            const bool met = m.p99_us <= options.slo_p99_us;
+            const bool better = met ? (!result.met_slo || m.throughput > result.throughput)
+                                    : (!result.met_slo && m.p99_us < best_p99);
+            if (better) {
+                result.intra_op_threads = c.threads;
+                result.max_batch = c.batch;
+                result.batch_delay_us = c.delay_us;
+                result.throughput = m.throughput;
+                result.p99_us = m.p99_us;
+                result.met_slo = met;
+                best_p99 = std::min(best_p99, m.p99_us);
+            }
+            if (met) {
+                break;
+            }
+        }
+    }
+    if (result.validated == 0) {
+        throw std::runtime_error("Autotuner: no configuration could be validated");
+    }
+
+    result.seconds = seconds_since(start);
+    result.tuned_at = timestamp_utc();
+    return result;
+}
+
+std::string model_file_hash(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot read model file: " + path);
+    }
+    uint64_t hash = FNV_OFFSET;
+    char buffer[64 * 1024];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        hash = fnv1a(hash, buffer, static_cast<size_t>(file.gcount()));
+    }
+    return hex(hash);
+}
+
+std::string model_config_hash(const ModelConfig& model) {
+    // A canonical text of every setting that changes what a pass costs
+    std::string text = "tta=" + std::to_string(model.tta_variants);
+    for (const auto& [layer, precision] : model.kernels.precision) {
+        text += ";precision:" + layer + "=" + to_string(precision);
+    }
+    for (const auto& [layer, algorithm] : model.kernels.conv_algorithm) {
+        text += ";conv:" + layer + "=" + to_string(algorithm);
+    }
+    for (const auto& [layer, path] : model.kernels.block_sparse) {
+        text += ";bsr:" + layer + "=" + path;
+    }
+    const PipelineOptions& pipeline = model.pipeline;
+    text += ";pipeline=" + std::to_string(pipeline.queue_depth) + "," +
+            std::to_string(pipeline.max_batch);
+    for (const PipelineStageOptions& stage : pipeline.stages) {
+        text += ";stage=";
+        for (const std::string& layer : stage.layers) {
+            text += layer + "+";
+        }
+        text += "/" + std::to_string(stage.workers) + "x" + std::to_string(stage.threads) + "@";
+        for (int core : stage.cores) {
+            text += std::to_string(core) + ",";
+        }
+    }
+    return hex(fnv1a(FNV_OFFSET, text.data(), text.size()));
+}
+
+std::optional<AutotuneResult> load_autotune_result(const std::string& cache_path,
+                                                   const std::string& cpu_model,
+                                                   const std::string& model_hash,
+                                                   const std::string& config_hash,
+                                                   uint32_t cores) {
+    std::ifstream file(cache_path);
+    if (!file) {
+        return std::nullopt;
+    }
+    try {
+        json cache;
+        file >> cache;
+        const std::string key = cache_key(cpu_model, cores, model_hash, config_hash);
+        if (!cache.contains("entries") || !cache["entries"].contains(key)) {
+            return std::nullopt;
+        }
+        const json& e = cache["entries"][key];
+        AutotuneResult r;
+        r.cpu_model = cpu_model;
+        r.model_hash = model_hash;
+        r.config_hash = config_hash;
+        r.cores = cores;
+        r.intra_op_threads = e.at("intra_op_threads").get<uint32_t>();
+        r.max_batch = e.at("max_batch").get<uint32_t>();
+        r.batch_delay_us = e.at("batch_delay_us").get<uint32_t>();
+        r.throughput = e.value("throughput", 0.0);
+        r.p99_us = e.value("p99_us", 0.0);
+        r.slo_p99_us = e.value("slo_p99_us", 0.0);
+        r.met_slo = e.value("met_slo", false);
+        r.profiled = e.value("profiled", 0u);
+        r.validated = e.value("validated", 0u);
+        r.seconds = e.value("seconds", 0.0);
+        r.tuned_at = e.value("tuned_at", std::string());
+        return r;
+    } catch (const std::exception& e) {
+        std::cerr << "Autotuner: ignoring unreadable cache " << cache_path << ": " << e.what()
+                  << std::endl;
+        return std::nullopt;
+    }
+}
+
+void save_autotune_result(const std::string& cache_path, const AutotuneResult& result) {
+    json cache = json::object();
+    {
+        std::ifstream file(cache_path);
+        if (file) {
+            try {
+                file >> cache;
+            } catch (const std::exception&) {
+                cache = json::object();
+            }
+        }
+    }
+    const std::string key =
+        cache_key(result.cpu_model, result.cores, result.model_hash, result.config_hash);
+    cache["entries"][key] = {
+        {"cpu_model", result.cpu_model},
+        {"model_hash", result.model_hash},
+        {"config_hash", result.config_hash},
+        {"cores", result.cores},
+        {"intra_op_threads", result.intra_op_threads},
+        {"max_batch", result.max_batch},
+        {"batch_delay_us", result.batch_delay_us},
+        {"throughput", result.throughput},
+        {"p99_us", result.p99_us},
+        {"slo_p99_us", result.slo_p99_us},
+        {"met_slo", result.met_slo},
+        {"profiled", result.profiled},
+        {"validated", result.validated},
+        {"seconds", result.seconds},
+        {"tuned_at", result.tuned_at}};
+
+    // Write beside the cache and rename, so a crash never leaves half a file
+    const std::filesystem::path path(cache_path);
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path());
+    }
+    const std::string temporary = cache_path + ".tmp";
+    {
+        std::ofstream out(temporary);
+        if (!out) {
+            throw std::runtime_error("Cannot write autotune cache: " + temporary);
+        }
+        out << cache.dump(2) << std::endl;
+    }
+    std::filesystem::rename(temporary, path);
+}
@@ -0,0 +1,210 @@
+#include "ClientConnection.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+BackendAddress parse_backend_address(const std::string& spec) {
+    const size_t colon = spec.rfind(':');
+    if (colon == std::string::npos || colon + 1 == spec.size()) {
+        throw std::invalid_argument("Backend '" + spec + "' is not host:port");
+    }
+    BackendAddress address;
+    address.host = spec.substr(0, colon);
+    address.port = static_cast<uint16_t>(std::stoul(spec.substr(colon + 1)));
+    return address;
+}
+
+ClientConnection::ClientConnection(const std::string& host, uint16_t port,
+                                   std::chrono::milliseconds connect_timeout) {
+    // 1. Resolve (numeric or DNS) and connect to the first address that answers
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    const std::string service = std::to_string(port);
+    if (::getaddrinfo(host.c_str(), service.c_str(), &hints, &results) != 0) {
+        throw std::runtime_error("ClientConnection: cannot resolve " + host);
+    }
+    for (addrinfo* ai = results; ai != nullptr; ai = ai->ai_next) {
+        m_fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (m_fd < 0) {
+            continue;
+        }
+        if (connect_timeout.count() > 0
+                ? connect_with_timeout(ai->ai_addr, ai->ai_addrlen, connect_timeout)
+                : ::connect(m_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    ::freeaddrinfo(results);
+    if (m_fd < 0) {
+        throw std::runtime_error("ClientConnection: cannot connect to " + host + ":" + service);
+    }
+
+    // 2. Requests are small; do not let Nagle hold them back
+    int one = 1;
+    ::setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+ClientConnection::~ClientConnection() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+bool ClientConnection::connect_with_timeout(const sockaddr* address, socklen_t length,
+                                            std::chrono::milliseconds timeout) {
+    // Non-blocking only for the handshake; reads and writes stay blocking
+    const int flags = ::fcntl(m_fd, F_GETFL, 0);
+    ::fcntl(m_fd, F_SETFL, flags | O_NONBLOCK);
+    bool connected = ::connect(m_fd, address, length) == 0;
+    if (!connected && errno == EINPROGRESS) {
+        pollfd pfd{m_fd, POLLOUT, 0};
+        int error = 0;
+        socklen_t error_length = sizeof(error);
+        connected = ::poll(&pfd, 1, static_cast<int>(timeout.count())) == 1 &&
+                    ::getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == 0 &&
+                    error == 0;
+    }
+    ::fcntl(m_fd, F_SETFL, flags);
+    return connected;
+}
+
+void ClientConnection::send_predict(uint64_t request_id, const uint8_t* pixels,
+                                    uint16_t width, uint16_t height,
+                                    const PredictOptions& options) {
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+    m_send_buffer.clear();
+    append_predict_request(m_send_buffer, request_id, pixels, width, height, options);
+    write_all(m_send_buffer.data(), m_send_buffer.size());
+}
+
+void ClientConnection::send_frames(const std::vector<uint8_t>& frames) {
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+    write_all(frames.data(), frames.size());
+}
+
+void ClientConnection::write_all(const uint8_t* data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        const ssize_t n = ::send(m_fd, data + written, length - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("ClientConnection: send failed: ") +
+                                     std::strerror(errno));
+        }
+        written += static_cast<size_t>(n);
+    }
+}
+
+size_t ClientConnection::read_responses(std::vector<PredictResponse>& out,
+                                        std::chrono::milliseconds timeout) {
+    // 1. Wait for data
+    pollfd pfd{m_fd, POLLIN, 0};
+    const int ready = ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+    if (ready <= 0) {
+        return 0;
+    }
+
+    // 2. Read whatever is available behind any partial frame from last time
+    const size_t old_size = m_recv_buffer.size();
+    m_recv_buffer.resize(old_size + 65536);
+    const ssize_t n = ::recv(m_fd, m_recv_buffer.data() + old_size, 65536, 0);
+    if (n <= 0) {
+        m_recv_buffer.resize(old_size);
+        if (n < 0 && errno == EINTR) {
+            return 0;
+        }
+        throw std::runtime_error("ClientConnection: connection closed by server");
+    }
+    m_recv_buffer.resize(old_size + static_cast<size_t>(n));
+
+    // 3. Decode every complete frame
+    const size_t before = out.size();
+    bool malformed = false;
+    ParseResult result = parse_frames(
+        m_recv_buffer.data(), m_recv_buffer.size(),
+        [&](const WireHeader& header, const uint8_t* payload) {
+            PredictResponse response;
+            response.request_id = header.request_id;
+            response.status = static_cast<WireStatus>(header.status);
+            if (header.type != static_cast<uint8_t>(MessageType::PredictResponse) ||
+                !decode_predict_response(header, payload, response.prediction)) {
+                malformed = true;
+                return;
+            }
+            out.push_back(response);
+        });
+    if (result.error || malformed) {
+        throw std::runtime_error("ClientConnection: malformed response from server");
+    }
+    m_recv_buffer.erase(m_recv_buffer.begin(),
+                        m_recv_buffer.begin() + static_cast<std::ptrdiff_t>(result.consumed));
+    return out.size() - before;
+}
+
+std::string ClientConnection::fetch_stats(std::chrono::milliseconds timeout) {
+    std::vector<uint8_t> request;
+    append_stats_request(request, 0);
+    send_frames(request);
+
+    // 1. Read until one whole frame is buffered
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::string document;
+    bool done = false;
+    while (!done) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        pollfd pfd{m_fd, POLLIN, 0};
+        if (left.count() <= 0 || ::poll(&pfd, 1, static_cast<int>(left.count())) <= 0) {
+            throw std::runtime_error("ClientConnection: no stats response in time");
+        }
+        const size_t old_size = m_recv_buffer.size();
+        m_recv_buffer.resize(old_size + 65536);
+        const ssize_t n = ::recv(m_fd, m_recv_buffer.data() + old_size, 65536, 0);
+        if (n <= 0) {
+            m_recv_buffer.resize(old_size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("ClientConnection: connection closed by server");
+        }
+        m_recv_buffer.resize(old_size + static_cast<size_t>(n));
+
+        // 2. Decode it
+        bool malformed = false;
+        const ParseResult result = parse_frames(
+            m_recv_buffer.data(), m_recv_buffer.size(),
+            [&](const WireHeader& header, const uint8_t* payload) {
+                if (done || header.type != static_cast<uint8_t>(MessageType::StatsResponse)) {
+                    malformed = true;
+                    return;
+                }
+                document.assign(reinterpret_cast<const char*>(payload), header.payload_len);
+                done = true;
+            });
+        if (result.error || malformed) {
+            throw std::runtime_error("ClientConnection: malformed stats response");
+        }
+        m_recv_buffer.erase(m_recv_buffer.begin(),
+                            m_recv_buffer.begin() + static_cast<std::ptrdiff_t>(result.consumed));
+    }
+    return document;
+}
+
+void ClientConnection::shutdown() {
+    ::shutdown(m_fd, SHUT_RDWR);
+}
@@ -0,0 +1,99 @@
+#include "ConsistentHashRing.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+constexpr uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+/// splitmix64's finalizer: every input bit affects every output bit
+uint64_t mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+} // namespace
+
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    uint64_t h = seed ^ (length * HASH_MULTIPLIER);
+    // Eight bytes at a time; an image is hashed on every routed request
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        h = (h ^ word) * HASH_MULTIPLIER;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    if (i < length) {
+        // Also keeps a zero-length key (bytes may be null) away from memcpy
+        std::memcpy(&tail, bytes + i, length - i);
+    }
+    h = (h ^ tail) * HASH_MULTIPLIER;
+    return mix(h);
+}
+
+ConsistentHashRing::ConsistentHashRing(uint32_t virtual_nodes)
+    : m_virtual_nodes(virtual_nodes)
+{
+    if (virtual_nodes == 0) {
+        throw std::invalid_argument("ConsistentHashRing: virtual_nodes must be at least 1");
+    }
+}
+
+void ConsistentHashRing::add(const std::string& member) {
+    const auto [it, inserted] = m_members.insert(member);
+    if (!inserted) {
+        return;
+    }
+    for (uint32_t i = 0; i < m_virtual_nodes; ++i) {
+        const uint64_t point = hash_bytes(member.data(), member.size(), mix(i + 1));
+        // A collision (vanishingly rare) keeps the first owner
+        m_points.emplace(point, &*it);
+    }
+}
+
+void ConsistentHashRing::remove(const std::string& member) {
+    const auto found = m_members.find(member);
+    if (found == m_members.end()) {
+        return;
+    }
+    for (auto it = m_points.begin(); it != m_points.end();) {
+        it = it->second == &*found ? m_points.erase(it) : std::next(it);
+    }
+    m_members.erase(found);
+}
+
+const std::string& ConsistentHashRing::owner(uint64_t key) const {
+    static const std::string none;
+    if (m_points.empty()) {
+        return none;
+    }
+    auto it = m_points.lower_bound(key);
+    return it == m_points.end() ? *m_points.begin()->second : *it->second;
+}
+
+void ConsistentHashRing::walk(uint64_t key,
+                              const std::function<bool(const std::string&)>& visit) const {
+    if (m_points.empty()) {
+        return;
+    }
+    std::unordered_set<const std::string*> offered;
+    auto it = m_points.lower_bound(key);
+    for (size_t step = 0; step < m_points.size() && offered.size() < m_members.size(); ++step) {
+        if (it == m_points.end()) {
+            it = m_points.begin();
+        }
+        if (offered.insert(it->second).second && visit(*it->second)) {
+            return;
+        }
+        ++it;
+    }
+}
@@ -0,0 +1,98 @@
+#include "DigitRecognizer.h"
+
+#include <torch/script.h>
+
+#include <memory>
+
+namespace {
+
+constexpr const char* CONV_FORWARD = R"JIT(
+def forward(self, x: Tensor) -> Tensor:
+    return torch.conv2d(x, self.weight, self.bias, [1, 1], [1, 1])
+)JIT";
+
+constexpr const char* POOL_FORWARD = R"JIT(
+def forward(self, x: Tensor) -> Tensor:
+    return torch.max_pool2d(x, [2, 2], [2, 2])
+)JIT";
+
+constexpr const char* LINEAR_FORWARD = R"JIT(
+def forward(self, x: Tensor) -> Tensor:
+    return torch.linear(x, self.weight, self.bias)
+)JIT";
+
+constexpr const char* MODEL_FORWARD = R"JIT(
+def forward(self, x: Tensor) -> Tensor:
+    x = self.pool(torch.relu(self.conv1(x)))
+    x = self.pool(torch.relu(self.conv2(x)))
+    x = x.view([x.size(0), -1])
+    x = torch.relu(self.fc1(x))
+    return self.fc2(x)
+)JIT";
+
+/**
+ * @brief An empty module of class `name`, with the `training` attribute
+ * Module::eval() sets.
+ */
+torch::jit::Module scripted_module(const std::string& name,
+                                   const std::shared_ptr<torch::jit::CompilationUnit>& unit) {
+    torch::jit::Module module(c10::QualifiedName("__torch__.digit_detector." + name), unit,
+                              /*shouldMangle=*/true);
+    module.register_attribute("training", c10::BoolType::get(), false);
+    return module;
+}
+
+torch::jit::Module scripted_layer(const std::string& name, const char* forward,
+                                  const at::Tensor& weight, const at::Tensor& bias,
+                                  const std::shared_ptr<torch::jit::CompilationUnit>& unit) {
+    torch::jit::Module module = scripted_module(name, unit);
+    module.register_parameter("weight", weight.detach().clone(), /*is_buffer=*/false);
+    module.register_parameter("bias", bias.detach().clone(), /*is_buffer=*/false);
+    module.define(forward);
+    return module;
+}
+
+} // namespace
+
+DigitRecognizerImpl::DigitRecognizerImpl()
+    : conv1(register_module(
+          "conv1", torch::nn::Conv2d(torch::nn::Conv2dOptions(1, 32, 3).stride(1).padding(1)))),
+      conv2(register_module(
+          "conv2", torch::nn::Conv2d(torch::nn::Conv2dOptions(32, 64, 3).stride(1).padding(1)))),
+      pool(register_module("pool", torch::nn::MaxPool2d(torch::nn::MaxPool2dOptions(2).stride(2)))),
+      fc1(register_module("fc1", torch::nn::Linear(64 * 7 * 7, 128))),
+      fc2(register_module("fc2", torch::nn::Linear(128, 10)))
+{
+}
+
+at::Tensor DigitRecognizerImpl::forward(at::Tensor x) {
+    x = pool(torch::relu(conv1(x)));
+    x = pool(torch::relu(conv2(x)));
+    x = x.view({x.size(0), -1});
+    x = torch::relu(fc1(x));
+    return fc2(x);
+}
+
+void save_torchscript(DigitRecognizer& model, const std::string& path) {
+    torch::NoGradGuard no_grad;
+    auto unit = std::make_shared<torch::jit::CompilationUnit>();
+
+    // 1. Leaf layers first; the parent's forward() is compiled against them
+    torch::jit::Module scripted = scripted_module("DigitRecognizer", unit);
+    scripted.register_module("conv1", scripted_layer("Conv2d", CONV_FORWARD, model->conv1->weight,
+                                                     model->conv1->bias, unit));
+    scripted.register_module("conv2", scripted_layer("Conv2d", CONV_FORWARD, model->conv2->weight,
+                                                     model->conv2->bias, unit));
+    torch::jit::Module pool = scripted_module("MaxPool2d", unit);
+    pool.define(POOL_FORWARD);
+    scripted.register_module("pool", pool);
+    scripted.register_module("fc1", scripted_layer("Linear", LINEAR_FORWARD, model->fc1->weight,
+                                                   model->fc1->bias, unit));
+    scripted.register_module("fc2", scripted_layer("Linear", LINEAR_FORWARD, model->fc2->weight,
+                                                   model->fc2->bias, unit));
+    scripted.define(MODEL_FORWARD);
+
+    // 2. Saved in eval mode, as the Python export is
+    scripted.eval();
+    scripted.save(path);
+}
@@ -0,0 +1,314 @@
+#include "IoEngine.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <deque>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+constexpr uint64_t LISTEN_ID = 0;
+constexpr uint64_t WAKE_ID = 1;
+constexpr uint64_t FIRST_CONNECTION_ID = 16;
+constexpr size_t READ_CHUNK = 64 * 1024;
+constexpr int MAX_IOV = 64;
+
+/**
+ * @class EpollEngine
+ * @brief Level-triggered epoll loop with non-blocking sockets.
+ *
+ * Responses queued during one loop iteration are flushed with a single
+ * sendmsg() per connection at the end of the iteration.
+ */
+class EpollEngine : public IoEngine {
+public:
+    EpollEngine(const IoEngineConfig& config, FrameHandler handler);
+    ~EpollEngine() override;
+
+    void run() override;
+    const char* name() const override { return "epoll"; }
+
+protected:
+    void queue_frame(uint64_t connection_id, std::vector<uint8_t> frame) override;
+    void wake() override;
+
+private:
+    struct Connection {
+        int fd = -1;
+        uint64_t id = 0;
+        std::vector<uint8_t> in;                  ///< Bytes of an incomplete frame
+        std::deque<std::vector<uint8_t>> out;     ///< Frames waiting to be written
+        size_t out_offset = 0;                    ///< Bytes of out.front() already written
+        bool want_write = false;                  ///< EPOLLOUT armed
+        bool dirty = false;                       ///< Listed in m_dirty
+    };
+
+    void accept_all();
+    void read_connection(Connection& conn);
+    bool deliver(Connection& conn, const uint8_t* data, size_t length);
+    bool flush(Connection& conn);
+    void close_connection(uint64_t id);
+    void update_events(Connection& conn, bool want_write);
+
+    int m_epoll_fd = -1;
+    int m_event_fd = -1;
+    uint64_t m_next_id = FIRST_CONNECTION_ID;
+    std::unordered_map<uint64_t, Connection> m_connections;
+    std::vector<uint64_t> m_dirty;
+    std::vector<uint8_t> m_scratch;
+};
+
+EpollEngine::EpollEngine(const IoEngineConfig& config, FrameHandler handler)
+    : IoEngine(config, std::move(handler)), m_scratch(READ_CHUNK)
+{
+    m_epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    m_event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll_fd < 0 || m_event_fd < 0) {
+        throw std::runtime_error("EpollEngine: cannot create epoll/eventfd");
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTEN_ID;
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev);
+    ev.data.u64 = WAKE_ID;
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &ev);
+}
+
+EpollEngine::~EpollEngine() {
+    for (auto& [id, conn] : m_connections) {
+        ::close(conn.fd);
+    }
+    ::close(m_event_fd);
+    ::close(m_epoll_fd);
+}
+
+void EpollEngine::wake() {
+    uint64_t one = 1;
+    (void)!::write(m_event_fd, &one, sizeof(one));
+}
+
+void EpollEngine::run() {
+    enter_loop();
+    epoll_event events[256];
+
+    while (m_running.load(std::memory_order_relaxed)) {
+        // 1. Wait for readiness
+        int count = ::epoll_wait(m_epoll_fd, events, 256, -1);
+        m_kernel_entries.fetch_add(1, std::memory_order_relaxed);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("EpollEngine: epoll_wait failed");
+        }
+
+        // 2. Dispatch events
+        for (int i = 0; i < count; ++i) {
+            const uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID) {
+                accept_all();
+            } else if (id == WAKE_ID) {
+                uint64_t value;
+                (void)!::read(m_event_fd, &value, sizeof(value));
+                m_kernel_entries.fetch_add(1, std::memory_order_relaxed);
+                drain_remote_frames();
+            } else {
+                auto it = m_connections.find(id);
+                if (it == m_connections.end()) {
+                    continue; // Closed earlier in this batch
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+                    read_connection(it->second);
+                }
+                it = m_connections.find(id);
+                if (it != m_connections.end() && (events[i].events & EPOLLOUT)) {
+                    if (!flush(it->second)) {
+                        close_connection(id);
+                    }
+                }
+            }
+        }
+
+        // 3. One write per connection for everything queued this iteration
+        std::vector<uint64_t> dirty;
+        dirty.swap(m_dirty);
+        for (uint64_t id : dirty) {
+            auto it = m_connections.find(id);
+            if (it == m_connections.end()) {
+                continue;
+            }
+            it->second.dirty = false;
+            if (!it->second.want_write && !flush(it->second)) {
+                close_connection(id);
+            }
+        }
+    }
+}
+
+void EpollEngine::accept_all() {
+    while (true) {
+        int fd = ::accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        m_kernel_entries.fetch_add(1, std::memory_order_relaxed);
+        if (fd < 0) {
+            return; // EAGAIN, or a transient error such as EMFILE
+        }
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        const uint64_t id = m_next_id++;
+        Connection& conn = m_connections[id];
+        conn.fd = fd;
+        conn.id = id;
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = id;
+        ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        m_kernel_entries.fetch_add(2, std::memory_order_relaxed);
+        m_connections_accepted.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void EpollEngine::read_connection(Connection& conn) {
+    const uint64_t id = conn.id;
+    while (true) {
+        ssize_t n = ::recv(conn.fd, m_scratch.data(), m_scratch.size(), 0);
+        m_kernel_entries.fetch_add(1, std::memory_order_relaxed);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            close_connection(id);
+            return;
+        }
+        if (n < 0) {
+            return; // Drained
+        }
+        if (!deliver(conn, m_scratch.data(), static_cast<size_t>(n))) {
+            close_connection(id);
+            return;
+        }
+        if (static_cast<size_t>(n) < m_scratch.size()) {
+            return; // Short read: the socket is (almost certainly) empty
+        }
+    }
+}
+
+bool EpollEngine::deliver(Connection& conn, const uint8_t* data, size_t length) {
+    auto on_frame = [&](const WireHeader& header, const uint8_t* payload) {
+        m_frames_received.fetch_add(1, std::memory_order_relaxed);
+        m_handler(conn.id, header, payload);
+    };
+
+    // Fast path: nothing buffered, parse straight out of the scratch buffer
+    if (conn.in.empty()) {
+        ParseResult result = parse_frames(data, length, on_frame);
+        if (result.error) {
+            return false;
+        }
+        conn.in.assign(data + result.consumed, data + length);
+        return true;
+    }
+
+    conn.in.insert(conn.in.end(), data, data + length);
+    ParseResult result = parse_frames(conn.in.data(), conn.in.size(), on_frame);
+    if (result.error) {
+        return false;
+    }
+    conn.in.erase(conn.in.begin(), conn.in.begin() + static_cast<std::ptrdiff_t>(result.consumed));
+    return true;
+}
+
+void EpollEngine::queue_frame(uint64_t connection_id, std::vector<uint8_t> frame) {
+    auto it = m_connections.find(connection_id);
+    if (it == m_connections.end()) {
+        return;
+    }
+    Connection& conn = it->second;
+    conn.out.push_back(std::move(frame));
+    if (!conn.dirty) {
+        conn.dirty = true;
+        m_dirty.push_back(connection_id);
+    }
+}
+
+bool EpollEngine::flush(Connection& conn) {
+    while (!conn.out.empty()) {
+        // Gather as many queued frames as fit in one call
+        iovec iov[MAX_IOV];
+        int iov_count = 0;
+        for (auto it = conn.out.begin(); it != conn.out.end() && iov_count < MAX_IOV; ++it) {
+            const size_t skip = iov_count == 0 ? conn.out_offset : 0;
+            iov[iov_count].iov_base = it->data() + skip;
+            iov[iov_count].iov_len = it->size() - skip;
+            ++iov_count;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = static_cast<size_t>(iov_count);
+        ssize_t written = ::sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        m_kernel_entries.fetch_add(1, std::memory_order_relaxed);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                update_events(conn, true); // Resume on EPOLLOUT
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // Retire fully written frames
+        size_t remaining = static_cast<size_t>(written);
+        while (remaining > 0) {
+            const size_t left = conn.out.front().size() - conn.out_offset;
+            if (remaining < left) {
+                conn.out_offset += remaining;
+                break;
+            }
+            remaining -= left;
+            conn.out.pop_front();
+            conn.out_offset = 0;
+            m_frames_sent.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    update_events(conn, false);
+    return true;
+}
+
+void EpollEngine::update_events(Connection& conn, bool want_write) {
+    if (conn.want_write == want_write) {
+        return;
+    }
+    conn.want_write = want_write;
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (want_write ? EPOLLOUT : 0u);
+    ev.data.u64 = conn.id;
+    ::epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+    m_kernel_entries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EpollEngine::close_connection(uint64_t id) {
+    auto it = m_connections.find(id);
+    if (it == m_connections.end()) {
+        return;
+    }
+    ::close(it->second.fd); // Also removes it from the epoll set
+    m_kernel_entries.fetch_add(1, std::memory_order_relaxed);
+    m_connections.erase(it);
+}
+
+} // namespace
+
+std::unique_ptr<IoEngine> create_epoll_engine(const IoEngineConfig& config,
+                                              IoEngine::FrameHandler handler) {
+    return std::make_unique<EpollEngine>(config, std::move(handler));
+}
@@ -1,30 +1,34 @@
 #include "ImageProcessor.h"
 
+#include <stdexcept>
+
 torch::Tensor ImageProcessor::process(const cv::Mat& raw_image) {
+    if (raw_image.type() != CV_8UC1) {
+        throw std::invalid_argument("ImageProcessor: expected an 8-bit, 1-channel image");
+    }
+
     // 1. Resize the image to 28x28
     // The model was trained on 28x28 images
+    // Inside an ArenaScope its pixels come from the thread's scratch arena
     cv::Mat resized_image;
     cv::resize(raw_image, resized_image, cv::Size(28, 28), 0, 0, cv::INTER_LINEAR);
 
-    // 2. Convert cv::Mat to torch::Tensor
-    // torch::from_blob creates a tensor that "views" the cv::Mat's data
-    // Input is 1-channel grayscale, shape [1, 1, 28, 28] (B, C, H, W)
-    // Data type is CV_8UC1 (uint8), which corresponds to torch::kByte
-    torch::Tensor tensor = torch::from_blob(
-        resized_image.data,
-        {1, 1, 28, 28},
-        torch::kByte
-    );
-
-    // 3. Convert type, scale, and clone
-    // Must clone() because from_blob() doesn't own memory
-    // and resized_image will go out of scope
-    // Convert to float and scale from [0, 255] to [0.0, 1.0]
-    tensor = tensor.to(torch::kFloat32).div(255.0);
-
-    // 4. Normalize using MNIST dataset statistics
-    // (tensor - mean) / std
-    tensor = tensor.sub(MNIST_MEAN).div(MNIST_STD);
+    // 2. Allocate the model input, shape [1, 1, 28, 28] (B, C, H, W)
+    // It outlives resized_image, so it is a tensor of its own rather than
+    // a from_blob() view; inside a scope, that too is arena memory
+    torch::Tensor tensor = torch::empty({1, 1, 28, 28}, torch::kFloat32);
 
+    // 3. Scale from [0, 255] to [0.0, 1.0] and normalize using MNIST
+    // dataset statistics, (x / 255 - mean) / std, in one pass instead of
+    // one temporary tensor per step
+    const float mean = static_cast<float>(MNIST_MEAN);
+    const float stddev = static_cast<float>(MNIST_STD);
+    float* out = tensor.data_ptr<float>();
+    for (int y = 0; y < 28; ++y) {
+        const uint8_t* row = resized_image.ptr<uint8_t>(y);
+        for (int x = 0; x < 28; ++x) {
+            *out++ = (static_cast<float>(row[x]) / 255.0f - mean) / stddev;
+        }
+    }
     return tensor;
 }
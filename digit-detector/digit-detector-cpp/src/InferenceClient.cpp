@@ -0,0 +1,555 @@
+#include "InferenceClient.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+constexpr auto READ_POLL = std::chrono::milliseconds(100); ///< How often a reader checks for close
+
+int64_t to_ns(std::chrono::microseconds us) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(us).count();
+}
+
+} // namespace
+
+struct InferenceClient::Call {
+    struct Attempt {
+        Connection* connection = nullptr;
+        uint64_t id = 0;
+        Clock::time_point sent;
+        bool live = true; ///< Neither answered, withdrawn nor lost
+    };
+
+    uint64_t id = 0;
+    Callback done;
+    std::vector<uint8_t> frame; ///< Encoded once; each attempt writes its own id
+    Clock::time_point started;
+    std::atomic<bool> finished{false};
+    std::mutex mutex;              ///< Guards attempts and retried
+    std::vector<Attempt> attempts; ///< The first is the original, a second the hedge
+    bool retried = false;
+};
+
+struct InferenceClient::Connection {
+    size_t replica = 0;
+    BackendAddress address;
+    std::unique_ptr<ClientConnection> socket; ///< Replaced by open() only while closed
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<uint8_t> outbox;
+    size_t queued = 0; ///< Frames in outbox
+    Clock::time_point first_queued;
+    std::unordered_map<uint64_t, std::shared_ptr<Call>> pending; ///< By attempt id
+    std::atomic<size_t> outstanding{0};
+    std::atomic<bool> closed{true}; ///< Set under mutex; read without it to pick
+    std::thread reader;
+    std::thread writer;
+};
+
+InferenceClient::InferenceClient(const std::vector<BackendAddress>& replicas,
+                                 InferenceClientOptions options)
+    : m_options(std::move(options)),
+      m_hedge_delay_ns(to_ns(m_options.hedge_initial_delay))
+{
+    if (replicas.empty() || m_options.connections_per_replica == 0 || m_options.max_batch == 0) {
+        throw std::invalid_argument(
+            "InferenceClient: needs a replica, and connections_per_replica and max_batch > 0");
+    }
+    for (size_t r = 0; r < replicas.size(); ++r) {
+        for (size_t c = 0; c < m_options.connections_per_replica; ++c) {
+            auto connection = std::make_unique<Connection>();
+            connection->replica = r;
+            connection->address = replicas[r];
+            m_connections.push_back(std::move(connection));
+        }
+    }
+    size_t opened = 0;
+    for (const auto& connection : m_connections) {
+        try {
+            open(*connection);
+            ++opened;
+        } catch (const std::exception& e) {
+            std::cerr << "InferenceClient: " << connection->address.name() << ": " << e.what()
+                      << std::endl;
+        }
+    }
+    if (opened == 0) {
+        throw std::runtime_error("InferenceClient: no replica could be reached");
+    }
+    m_timer = std::thread(&InferenceClient::timer_loop, this);
+}
+
+InferenceClient::~InferenceClient() {
+    m_stopping.store(true);
+    {
+        std::lock_guard<std::mutex> lock(m_timer_mutex);
+    }
+    m_timer_cv.notify_all();
+    if (m_timer.joinable()) {
+        m_timer.join();
+    }
+    for (const auto& connection : m_connections) {
+        {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            connection->closed.store(true);
+        }
+        connection->cv.notify_all();
+        if (connection->socket) {
+            connection->socket->shutdown();
+        }
+    }
+    // The readers hand what they still hold back as Unavailable
+    for (const auto& connection : m_connections) {
+        if (connection->writer.joinable()) {
+            connection->writer.join();
+        }
+        if (connection->reader.joinable()) {
+            connection->reader.join();
+        }
+    }
+}
+
+uint64_t InferenceClient::predict_async(const uint8_t* pixels, uint16_t width, uint16_t height,
+                                        Callback done, const PredictOptions& options) {
+    auto call = std::make_shared<Call>();
+    call->id = m_next_call.fetch_add(1, std::memory_order_relaxed);
+    call->done = std::move(done);
+    append_predict_request(call->frame, 0, pixels, width, height, options);
+    if (m_options.hedge && m_options.cancel_losers) {
+        const uint16_t flags = WIRE_FLAG_CANCELLABLE;
+        std::memcpy(call->frame.data() + offsetof(WireHeader, flags), &flags, sizeof(flags));
+    }
+    call->started = Clock::now();
+    m_requests.fetch_add(1, std::memory_order_relaxed);
+
+    // 1. The least busy open connection; pick again if it closes under us
+    bool sent = false;
+    for (size_t i = 0; i < m_connections.size() && !sent; ++i) {
+        Connection* connection = pick(NO_REPLICA, nullptr);
+        if (connection == nullptr) {
+            break;
+        }
+        sent = send_attempt(call, *connection);
+    }
+    const uint64_t id = call->id;
+    if (!sent) {
+        m_unavailable.fetch_add(1, std::memory_order_relaxed);
+        finish(*call, WireStatus::Unavailable, Prediction{});
+        return id;
+    }
+
+    // 2. Arm the hedge
+    if (m_options.hedge) {
+        const Clock::time_point due =
+            call->started + std::chrono::nanoseconds(m_hedge_delay_ns.load());
+        bool earliest = false;
+        {
+            std::lock_guard<std::mutex> lock(m_timer_mutex);
+            earliest = m_hedges.empty() || due < m_hedges.top().due;
+            m_hedges.push(HedgeTimer{due, call});
+        }
+        if (earliest) {
+            m_timer_cv.notify_one();
+        }
+    }
+    return id;
+}
+
+std::future<PredictResponse> InferenceClient::predict(const uint8_t* pixels, uint16_t width,
+                                                      uint16_t height,
+                                                      const PredictOptions& options) {
+    auto promise = std::make_shared<std::promise<PredictResponse>>();
+    std::future<PredictResponse> future = promise->get_future();
+    predict_async(pixels, width, height,
+                  [promise](const PredictResponse& response) { promise->set_value(response); },
+                  options);
+    return future;
+}
+
+bool InferenceClient::send_attempt(const std::shared_ptr<Call>& call, Connection& connection) {
+    const uint64_t id = m_next_attempt.fetch_add(1, std::memory_order_relaxed);
+    const Clock::time_point now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        if (connection.closed.load()) {
+            return false;
+        }
+        const size_t offset = connection.outbox.size();
+        connection.outbox.insert(connection.outbox.end(), call->frame.begin(), call->frame.end());
+        std::memcpy(connection.outbox.data() + offset + offsetof(WireHeader, request_id), &id,
+                    sizeof(id));
+        if (connection.queued++ == 0) {
+            connection.first_queued = now;
+        }
+        connection.pending.emplace(id, call);
+        connection.outstanding.fetch_add(1, std::memory_order_relaxed);
+        // Recorded before the writer can send it, so a reply always finds it
+        std::lock_guard<std::mutex> call_lock(call->mutex);
+        call->attempts.push_back(Call::Attempt{&connection, id, now, true});
+    }
+    connection.cv.notify_one();
+    return true;
+}
+
+InferenceClient::Connection* InferenceClient::pick(size_t avoid, const Connection* exclude) {
+    Connection* best = nullptr;
+    Connection* fallback = nullptr; // On the replica to avoid
+    const size_t count = m_connections.size();
+    const size_t first = m_rotation.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        Connection& candidate = *m_connections[(first + i) % count];
+        if (&candidate == exclude || candidate.closed.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        Connection*& slot = candidate.replica == avoid ? fallback : best;
+        if (slot == nullptr || candidate.outstanding.load(std::memory_order_relaxed) <
+                                   slot->outstanding.load(std::memory_order_relaxed)) {
+            slot = &candidate;
+        }
+    }
+    return best != nullptr ? best : fallback;
+}
+
+void InferenceClient::complete(const std::shared_ptr<Call>& call, uint64_t attempt_id,
+                               const PredictResponse& response, Clock::time_point now) {
+    Clock::time_point sent = now;
+    bool by_hedge = false;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        for (size_t i = 0; i < call->attempts.size(); ++i) {
+            Call::Attempt& attempt = call->attempts[i];
+            if (attempt.id == attempt_id) {
+                attempt.live = false;
+                sent = attempt.sent;
+                by_hedge = i > 0;
+            }
+        }
+    }
+    record_attempt(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent).count()));
+    if (!finish(*call, response.status, response.prediction)) {
+        m_wasted.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_completed.fetch_add(1, std::memory_order_relaxed);
+    if (by_hedge) {
+        m_hedge_wins.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The slower copy is no longer wanted
+    std::vector<Call::Attempt> losers;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        for (Call::Attempt& attempt : call->attempts) {
+            if (attempt.live) {
+                attempt.live = false;
+                losers.push_back(attempt);
+            }
+        }
+    }
+    for (const Call::Attempt& loser : losers) {
+        withdraw(*loser.connection, loser.id);
+    }
+}
+
+void InferenceClient::abandon(const std::shared_ptr<Call>& call, uint64_t attempt_id,
+                              size_t replica) {
+    // A copy was lost with its connection. If no other copy is on its way,
+    // send one more elsewhere; inference is idempotent
+    bool retry = false;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        bool live = false;
+        for (Call::Attempt& attempt : call->attempts) {
+            if (attempt.id == attempt_id) {
+                attempt.live = false;
+            }
+            live = live || attempt.live;
+        }
+        if (live || call->finished.load()) {
+            return;
+        }
+        retry = !call->retried && !m_stopping.load();
+        call->retried = true;
+    }
+    if (retry) {
+        Connection* connection = pick(replica, nullptr);
+        if (connection != nullptr && send_attempt(call, *connection)) {
+            return;
+        }
+    }
+    if (finish(*call, WireStatus::Unavailable, Prediction{})) {
+        m_unavailable.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool InferenceClient::finish(Call& call, WireStatus status, const Prediction& prediction) {
+    if (call.finished.exchange(true)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_latency_mutex);
+        m_latency.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - call.started)
+                .count()));
+    }
+    PredictResponse response;
+    response.request_id = call.id;
+    response.status = status;
+    response.prediction = prediction;
+    call.done(response);
+    return true;
+}
+
+void InferenceClient::withdraw(Connection& connection, uint64_t attempt_id) {
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        if (connection.pending.erase(attempt_id) == 0) {
+            return;
+        }
+        connection.outstanding.fetch_sub(1, std::memory_order_relaxed);
+        if (m_options.cancel_losers && !connection.closed.load()) {
+            append_cancel(connection.outbox, attempt_id);
+            if (connection.queued++ == 0) {
+                connection.first_queued = Clock::now();
+            }
+            queued = true;
+        }
+    }
+    if (queued) {
+        m_cancels.fetch_add(1, std::memory_order_relaxed);
+        connection.cv.notify_one();
+    }
+}
+
+void InferenceClient::record_attempt(uint64_t latency_ns) {
+    if (!m_options.hedge) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_delay_mutex);
+    m_window.record(latency_ns);
+    // Refreshed every 256 samples, from a window that restarts every
+    // HEDGE_WINDOW so the delay follows the load
+    const uint64_t count = m_window.count();
+    if (count < m_options.hedge_warmup || (count % 256 != 0 && count < HEDGE_WINDOW)) {
+        return;
+    }
+    const int64_t delay = static_cast<int64_t>(
+        m_window.value_at_percentile(m_options.hedge_percentile));
+    m_hedge_delay_ns.store(std::max(delay, to_ns(m_options.hedge_min_delay)));
+    if (count >= HEDGE_WINDOW) {
+        m_window.reset();
+    }
+}
+
+void InferenceClient::open(Connection& connection) {
+    // Only while closed with no threads: nothing else touches the socket
+    connection.socket = std::make_unique<ClientConnection>(
+        connection.address.host, connection.address.port, m_options.connect_timeout);
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        connection.outbox.clear();
+        connection.queued = 0;
+        connection.closed.store(false);
+    }
+    connection.reader = std::thread(&InferenceClient::reader_loop, this, std::ref(connection));
+    connection.writer = std::thread(&InferenceClient::writer_loop, this, std::ref(connection));
+}
+
+void InferenceClient::reader_loop(Connection& connection) {
+    std::vector<PredictResponse> responses;
+    try {
+        while (!connection.closed.load()) {
+            responses.clear();
+            if (connection.socket->read_responses(responses, READ_POLL) == 0) {
+                continue;
+            }
+            const Clock::time_point now = Clock::now();
+            for (const PredictResponse& response : responses) {
+                std::shared_ptr<Call> call;
+                {
+                    std::lock_guard<std::mutex> lock(connection.mutex);
+                    auto it = connection.pending.find(response.request_id);
+                    if (it != connection.pending.end()) {
+                        call = std::move(it->second);
+                        connection.pending.erase(it);
+                        connection.outstanding.fetch_sub(1, std::memory_order_relaxed);
+                    }
+                }
+                if (call == nullptr) {
+                    // A withdrawn copy the server had already started
+                    m_wasted.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                complete(call, response.request_id, response, now);
+            }
+        }
+    } catch (const std::exception& e) {
+        if (!m_stopping.load()) {
+            std::cerr << "InferenceClient: lost connection to " << connection.address.name()
+                      << ": " << e.what() << std::endl;
+        }
+    }
+
+    std::unordered_map<uint64_t, std::shared_ptr<Call>> stranded;
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        connection.closed.store(true);
+        stranded.swap(connection.pending);
+        connection.outstanding.store(0);
+        connection.outbox.clear();
+        connection.queued = 0;
+    }
+    connection.cv.notify_all();
+    for (const auto& [id, call] : stranded) {
+        abandon(call, id, connection.replica);
+    }
+}
+
+void InferenceClient::writer_loop(Connection& connection) {
+    std::vector<uint8_t> batch;
+    while (true) {
+        size_t frames = 0;
+        {
+            std::unique_lock<std::mutex> lock(connection.mutex);
+            connection.cv.wait(lock, [&connection] {
+                return connection.closed.load() || connection.queued > 0;
+            });
+            if (connection.closed.load()) {
+                return;
+            }
+            if (m_options.batch_window.count() > 0 && connection.queued < m_options.max_batch) {
+                // Client-side batching: later requests get a moment to share this write
+                connection.cv.wait_until(
+                    lock, connection.first_queued + m_options.batch_window, [&] {
+                        return connection.closed.load() ||
+                               connection.queued >= m_options.max_batch;
+                    });
+                if (connection.closed.load()) {
+                    return;
+                }
+            }
+            batch.swap(connection.outbox);
+            frames = connection.queued;
+            connection.queued = 0;
+        }
+        try {
+            connection.socket->send_frames(batch);
+        } catch (const std::exception&) {
+            connection.socket->shutdown(); // The reader closes the connection
+            return;
+        }
+        m_writes.fetch_add(1, std::memory_order_relaxed);
+        m_frames.fetch_add(frames, std::memory_order_relaxed);
+        batch.clear();
+    }
+}
+
+void InferenceClient::timer_loop() {
+    Clock::time_point next_reconnect = Clock::now() + m_options.reconnect_interval;
+    std::vector<std::shared_ptr<Call>> due;
+    std::unique_lock<std::mutex> lock(m_timer_mutex);
+    while (!m_stopping.load()) {
+        const Clock::time_point wake =
+            m_hedges.empty() ? next_reconnect : std::min(next_reconnect, m_hedges.top().due);
+        m_timer_cv.wait_until(lock, wake);
+        if (m_stopping.load()) {
+            break;
+        }
+        const Clock::time_point now = Clock::now();
+        while (!m_hedges.empty() && m_hedges.top().due <= now) {
+            if (std::shared_ptr<Call> call = m_hedges.top().call.lock()) {
+                due.push_back(std::move(call));
+            }
+            m_hedges.pop();
+        }
+        lock.unlock();
+        for (const std::shared_ptr<Call>& call : due) {
+            hedge(call);
+        }
+        due.clear();
+        if (now >= next_reconnect) {
+            reconnect();
+            next_reconnect = now + m_options.reconnect_interval;
+        }
+        lock.lock();
+    }
+}
+
+void InferenceClient::hedge(const std::shared_ptr<Call>& call) {
+    if (call->finished.load()) {
+        return;
+    }
+    const Connection* original = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        if (call->attempts.size() != 1 || !call->attempts.front().live) {
+            return;
+        }
+        original = call->attempts.front().connection;
+    }
+    // The budget holds over the client's lifetime, so a slow cluster gets
+    // at most hedge_budget more load, however slow it gets
+    const double allowed =
+        m_options.hedge_budget * static_cast<double>(m_requests.load(std::memory_order_relaxed));
+    if (static_cast<double>(m_hedged.load(std::memory_order_relaxed) + 1) > allowed) {
+        m_hedges_denied.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Connection* connection = pick(original->replica, original);
+    if (connection != nullptr && send_attempt(call, *connection)) {
+        m_hedged.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void InferenceClient::reconnect() {
+    for (const auto& connection : m_connections) {
+        if (!connection->closed.load() || m_stopping.load()) {
+            continue;
+        }
+        if (connection->writer.joinable()) {
+            connection->writer.join();
+        }
+        if (connection->reader.joinable()) {
+            connection->reader.join();
+        }
+        try {
+            open(*connection);
+            std::cerr << "InferenceClient: reconnected to " << connection->address.name()
+                      << std::endl;
+        } catch (const std::exception&) {
+            // Still down; tried again next interval
+        }
+    }
+}
+
+InferenceClientStats InferenceClient::stats() const {
+    InferenceClientStats s;
+    s.requests = m_requests.load();
+    s.completed = m_completed.load();
+    s.unavailable = m_unavailable.load();
+    s.hedged = m_hedged.load();
+    s.hedge_wins = m_hedge_wins.load();
+    s.hedges_denied = m_hedges_denied.load();
+    s.cancels = m_cancels.load();
+    s.wasted = m_wasted.load();
+    s.writes = m_writes.load();
+    s.frames = m_frames.load();
+    s.hedge_delay_us = static_cast<double>(m_hedge_delay_ns.load()) / 1000.0;
+    std::lock_guard<std::mutex> lock(m_latency_mutex);
+    s.p50_us = static_cast<double>(m_latency.value_at_percentile(50.0)) / 1000.0;
+    s.p99_us = static_cast<double>(m_latency.value_at_percentile(99.0)) / 1000.0;
+    s.p999_us = static_cast<double>(m_latency.value_at_percentile(99.9)) / 1000.0;
+    return s;
+}
+
+std::chrono::microseconds InferenceClient::hedge_delay() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::nanoseconds(m_hedge_delay_ns.load()));
+}
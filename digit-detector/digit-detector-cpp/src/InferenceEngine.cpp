@@ -1,9 +1,133 @@
 #include "InferenceEngine.h"
+#include "Augmentation.h"
+#include "NativeModel.h"
+#include "ScratchArena.h"
+#include <caffe2/serialize/inline_container.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_set>
 #include <vector>
 
+namespace {
+
+/// Interpreter stack of the calling thread, reused across passes and engines
+thread_local torch::jit::Stack t_stack;
+
+constexpr size_t FROZEN_ALIGNMENT = 64; ///< Cache line, as the CPU allocator would give
+
+/**
+ * @brief The read-only mapping behind frozen weights; every frozen tensor
+ * holds a reference, so it is unmapped with the last of them.
+ */
+struct FrozenPages {
+    void* base = MAP_FAILED;
+    size_t size = 0;
+
+    ~FrozenPages() {
+        if (base != MAP_FAILED) {
+            ::munmap(base, size);
+        }
+    }
+};
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+bool freezable(const at::Tensor& tensor) {
+    return tensor.defined() && tensor.device().is_cpu() && tensor.layout() == at::kStrided &&
+           !tensor.is_quantized() && tensor.is_contiguous() && tensor.numel() > 0;
+}
+
+/// Extra file in which digit-train records the backend a QAT model was packed for
+const char* const QUANTIZED_ENGINE_RECORD = "extra/quantized_engine";
+
+/// The quantized backend the first quantized model selected; it is process-wide
+std::mutex g_quantized_engine_mutex;
+std::string g_quantized_engine;
+
+std::string quantized_engine_name(at::QEngine engine) {
+    switch (engine) {
+    case at::QEngine::FBGEMM:
+        return "fbgemm";
+    case at::QEngine::QNNPACK:
+        return "qnnpack";
+    default:
+        return "none";
+    }
+}
+
+/**
+ * @brief The backend recorded in a model archive, or empty.
+ */
+std::string recorded_quantized_engine(const std::string& model_path) {
+    try {
+        caffe2::serialize::PyTorchStreamReader reader(model_path);
+        if (!reader.hasRecord(QUANTIZED_ENGINE_RECORD)) {
+            return "";
+        }
+        const auto record = reader.getRecord(QUANTIZED_ENGINE_RECORD);
+        return std::string(static_cast<const char*>(std::get<0>(record).get()),
+                           std::get<1>(record));
+    } catch (const c10::Error&) {
+        return ""; // Not an archive at all; torch::jit::load says so
+    }
+}
+
+/**
+ * @brief Makes name the process's quantized backend.
+ * @throws std::runtime_error if LibTorch lacks it, or an earlier model chose another.
+ */
+void select_quantized_engine(const std::string& name) {
+    at::QEngine engine;
+    if (name == "fbgemm") {
+        engine = at::QEngine::FBGEMM;
+    } else if (name == "qnnpack") {
+        engine = at::QEngine::QNNPACK;
+    } else {
+        throw std::runtime_error("InferenceEngine: unknown quantized engine '" + name + "'");
+    }
+    const auto& supported = at::globalContext().supportedQEngines();
+    if (std::find(supported.begin(), supported.end(), engine) == supported.end()) {
+        throw std::runtime_error("InferenceEngine: this LibTorch has no " + name +
+                                 " quantized engine");
+    }
+    std::lock_guard<std::mutex> lock(g_quantized_engine_mutex);
+    if (!g_quantized_engine.empty() && g_quantized_engine != name) {
+        throw std::runtime_error("InferenceEngine: a " + name + " model cannot share a " +
+                                 "process with the " + g_quantized_engine + " models loaded");
+    }
+    at::globalContext().setQEngine(engine);
+    g_quantized_engine = name;
+}
+
+/**
+ * @brief True if any submodule is one of torch's quantized modules.
+ */
+bool has_quantized_modules(const torch::jit::script::Module& model) {
+    for (const auto& child : model.named_modules()) {
+        const auto name = child.value.type()->name();
+        if (name && name->qualifiedName().find(".quantized.") != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
 InferenceEngine::InferenceEngine(const std::string& model_path) {
+    // A quantized model's weights are repacked for the quantized backend
+    // as they load, so the backend they were exported for comes first
+    m_quantized_engine = recorded_quantized_engine(model_path);
+    if (!m_quantized_engine.empty()) {
+        select_quantized_engine(m_quantized_engine);
+    }
     try {
         // Load the TorchScript model from disk
         // Explicitly map to CPU
@@ -13,38 +137,343 @@ InferenceEngine::InferenceEngine(const std::string& model_path) {
         // This disables dropout and batch normalization training behavior
         m_model.eval();
 
+        // Shared by every caller, so nothing may record gradients into it
+        for (at::Tensor parameter : m_model.parameters()) {
+            parameter.requires_grad_(false);
+        }
+        m_forward = m_model.get_method("forward");
+
+        // Quantized without a record: whatever backend LibTorch defaults to
+        if (m_quantized_engine.empty() && has_quantized_modules(m_model)) {
+            m_quantized_engine = quantized_engine_name(at::globalContext().qEngine());
+        }
+
         std::cout << "InferenceEngine: Model loaded successfully from "
                   << model_path << std::endl;
+        if (quantized()) {
+            std::cout << "InferenceEngine: int8 model on the " << m_quantized_engine
+                      << " quantized engine" << std::endl;
+        }
     } catch (const c10::Error& e) {
         // If loading fails, log the error and throw
         std::cerr << "Error loading model: " << e.what() << std::endl;
         throw std::runtime_error("Failed to load LibTorch model: " + model_path);
     }
+    warm_up();
+}
+
+void InferenceEngine::warm_up() {
+    try {
+        const torch::Tensor input = torch::zeros({1, 1, 28, 28});
+        for (int i = 0; i < WARMUP_RUNS; ++i) {
+            predict_batch(input);
+        }
+    } catch (const c10::Error& e) {
+        std::cerr << "InferenceEngine: warm-up skipped: " << e.what() << std::endl;
+    }
+}
+
+InferenceEngine::~InferenceEngine() {
+    std::deque<AsyncJob> abandoned;
+    {
+        std::lock_guard<std::mutex> lock(m_async_mutex);
+        m_async_stopping = true;
+        abandoned.swap(m_async_queue);
+    }
+    m_async_cv.notify_all();
+    if (m_executor.joinable()) {
+        m_executor.join();
+    }
+    for (AsyncJob& job : abandoned) {
+        job.done(std::make_exception_ptr(PredictCancelled()), Prediction{});
+    }
 }
 
 Prediction InferenceEngine::predict(const torch::Tensor& input_tensor) {
-    // 1. Prepare input for the model
-    // The forward() method expects a vector of IValue
-    std::vector<torch::jit::IValue> inputs;
-    inputs.push_back(input_tensor);
+    // A single input is a batch of one
+    return predict_batch(input_tensor).front();
+}
+
+std::future<Prediction> InferenceEngine::predict_async(torch::Tensor input_tensor,
+                                                       CancellationToken token) {
+    auto promise = std::make_shared<std::promise<Prediction>>();
+    std::future<Prediction> future = promise->get_future();
+    predict_async(
+        std::move(input_tensor),
+        [promise](std::exception_ptr error, const Prediction& prediction) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(prediction);
+            }
+        },
+        std::move(token));
+    return future;
+}
+
+void InferenceEngine::predict_async(torch::Tensor input_tensor, PredictCallback callback,
+                                    CancellationToken token) {
+    if (token.cancelled()) {
+        callback(std::make_exception_ptr(PredictCancelled()), Prediction{});
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_async_mutex);
+        if (!m_executor.joinable()) {
+            m_executor = std::thread(&InferenceEngine::executor_loop, this);
+        }
+        m_async_queue.push_back(
+            AsyncJob{std::move(input_tensor), std::move(callback), std::move(token)});
+    }
+    m_async_cv.notify_one();
+}
+
+void InferenceEngine::executor_loop() {
+    std::vector<AsyncJob> jobs;
+    std::vector<torch::Tensor> inputs;
+    while (true) {
+        // 1. Take whatever queued up while the last batch ran
+        {
+            std::unique_lock<std::mutex> lock(m_async_mutex);
+            m_async_cv.wait(lock, [this] { return m_async_stopping || !m_async_queue.empty(); });
+            if (m_async_stopping) {
+                return; // The destructor cancels what is left
+            }
+            while (!m_async_queue.empty() && jobs.size() < ASYNC_MAX_BATCH) {
+                jobs.push_back(std::move(m_async_queue.front()));
+                m_async_queue.pop_front();
+            }
+        }
+
+        // 2. Cancelled requests never reach the model
+        size_t live = 0;
+        for (AsyncJob& job : jobs) {
+            if (job.token.cancelled()) {
+                job.done(std::make_exception_ptr(PredictCancelled()), Prediction{});
+                job.done = nullptr;
+            } else {
+                inputs.push_back(job.input);
+                ++live;
+            }
+        }
+
+        // 3. One forward pass for all of them
+        if (live > 0) {
+            std::vector<Prediction> predictions;
+            std::exception_ptr error;
+            try {
+                predictions = predict_batch(inputs.size() == 1 ? inputs.front()
+                                                               : torch::cat(inputs, 0));
+            } catch (...) {
+                error = std::current_exception();
+            }
+            size_t row = 0;
+            for (AsyncJob& job : jobs) {
+                if (!job.done) {
+                    continue;
+                }
+                if (error) {
+                    job.done(error, Prediction{});
+                } else {
+                    job.done(nullptr, predictions[row]);
+                }
+                row += static_cast<size_t>(job.input.size(0));
+            }
+        }
+        jobs.clear();
+        inputs.clear();
+    }
+}
+
+std::vector<Prediction> InferenceEngine::predict_batch(const torch::Tensor& input_batch) {
+    // Thread-local: no autograd bookkeeping on the shared weights
+    c10::InferenceMode inference_mode;
+    // Activations come from this thread's arena and go back in one reset;
+    // the predictions are plain values, so nothing in it is needed after
+    ArenaScope scratch;
+
+    if (m_tta.empty()) {
+        return postprocess(forward(input_batch));
+    }
+
+    // 1. K variants of every input, row n * K + k, through one pass
+    const int64_t rows = input_batch.size(0);
+    const int64_t variants = static_cast<int64_t>(m_tta.size());
+    const at::Tensor logits = forward(m_augmenter->expand(input_batch, m_tta));
+
+    // 2. Each input's variants averaged in probability space
+    return predictions(torch::softmax(logits, 1).view({rows, variants, -1}).mean(1));
+}
+
+at::Tensor InferenceEngine::forward(const torch::Tensor& input_batch) {
+    if (m_native) {
+        return m_native->forward(input_batch);
+    }
+
+    // 1. Prepare input for the model on this thread's stack
+    torch::jit::Stack& stack = t_stack;
+    stack.clear();
+    stack.emplace_back(input_batch);
 
     // 2. Run forward pass
-    // Output is a tensor of logits (raw scores), shape [1, 10]
-    at::Tensor logits = m_model.forward(inputs).toTensor();
+    // Output is a tensor of logits (raw scores), shape [N, 10]
+    m_forward->run(stack);
+    at::Tensor logits = stack.back().toTensor();
+    stack.clear();
+    return logits;
+}
 
-    // 3. Convert logits to probabilities using softmax
-    at::Tensor probabilities = torch::softmax(logits, 1);
+std::vector<Prediction> InferenceEngine::postprocess(const at::Tensor& logits) {
+    // Convert logits to probabilities using softmax
+    return predictions(torch::softmax(logits, 1));
+}
 
-    // 4. Get the maximum probability and its index
+std::vector<Prediction> InferenceEngine::predictions(const at::Tensor& probabilities) {
+    // 1. Get the maximum probability and its index for every row
     // torch::max returns a tuple of (values, indices)
     auto max_result = torch::max(probabilities, 1);
-    at::Tensor max_confidence_tensor = std::get<0>(max_result);
-    at::Tensor max_index_tensor = std::get<1>(max_result);
+    at::Tensor max_confidence_tensor = std::get<0>(max_result).contiguous();
+    at::Tensor max_index_tensor = std::get<1>(max_result).contiguous();
+
+    // 2. Extract scalar values without a per-row item() round trip
+    const int64_t rows = max_confidence_tensor.size(0);
+    const float* confidences = max_confidence_tensor.data_ptr<float>();
+    const int64_t* indices = max_index_tensor.data_ptr<int64_t>();
+
+    std::vector<Prediction> predictions(static_cast<size_t>(rows));
+    for (int64_t i = 0; i < rows; ++i) {
+        predictions[i].digit = static_cast<int>(indices[i]);
+        predictions[i].confidence = confidences[i];
+    }
+    return predictions;
+}
+
+size_t InferenceEngine::weight_bytes() const {
+    size_t total = 0;
+    for (const at::Tensor& parameter : m_model.parameters()) {
+        total += parameter.numel() * parameter.element_size();
+    }
+    for (const at::Tensor& buffer : m_model.buffers()) {
+        total += buffer.numel() * buffer.element_size();
+    }
+    return total;
+}
+
+size_t InferenceEngine::freeze_weights() {
+    if (m_frozen) {
+        return m_frozen_bytes;
+    }
 
-    // 5. Extract scalar values from tensors
-    float confidence = max_confidence_tensor.item<float>();
-    int digit = max_index_tensor.item<int>();
+    // 1. Collect each tensor once (a submodule may be reachable twice)
+    std::vector<at::Tensor> tensors;
+    std::unordered_set<const void*> seen;
+    auto collect = [&](const at::Tensor& tensor) {
+        if (freezable(tensor) && seen.insert(tensor.unsafeGetTensorImpl()).second) {
+            tensors.push_back(tensor);
+        }
+    };
+    for (const at::Tensor& parameter : m_model.parameters()) {
+        collect(parameter);
+    }
+    for (const at::Tensor& buffer : m_model.buffers()) {
+        collect(buffer);
+    }
+
+    // 2. Lay them out back to back in one anonymous mapping, which shares
+    // no page with the heap
+    std::vector<size_t> offsets;
+    size_t total = 0;
+    for (const at::Tensor& tensor : tensors) {
+        offsets.push_back(total);
+        total += round_up(tensor.nbytes(), FROZEN_ALIGNMENT);
+    }
+    if (total == 0) {
+        m_frozen = true;
+        return 0;
+    }
+    auto pages = std::make_shared<FrozenPages>();
+    pages->size = round_up(total, static_cast<size_t>(::sysconf(_SC_PAGESIZE)));
+    pages->base = ::mmap(nullptr, pages->size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages->base == MAP_FAILED) {
+        throw std::runtime_error("InferenceEngine: cannot map " + std::to_string(pages->size) +
+                                 " bytes for frozen weights");
+    }
+
+    // 3. Copy each tensor and swap the copy in under the module's own
+    // TensorImpl, so the graph sees it; the old storage is freed
+    char* base = static_cast<char*>(pages->base);
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        at::Tensor& tensor = tensors[i];
+        std::memcpy(base + offsets[i], tensor.data_ptr(), tensor.nbytes());
+        tensor.set_data(torch::from_blob(base + offsets[i], tensor.sizes(), tensor.strides(),
+                                         [pages](void*) {}, tensor.options()));
+    }
+
+    // 4. From here on a write to a weight is a fault, not a private copy
+    if (::mprotect(pages->base, pages->size, PROT_READ) != 0) {
+        throw std::runtime_error("InferenceEngine: cannot write-protect frozen weights");
+    }
+    m_frozen = true;
+    m_frozen_bytes = total;
+    std::cout << "InferenceEngine: froze " << tensors.size() << " tensors (" << total
+              << " bytes) on read-only pages" << std::endl;
+    return total;
+}
+
+torch::jit::script::Module InferenceEngine::submodule(const std::string& name) const {
+    for (const auto& child : m_model.named_children()) {
+        if (child.name == name) {
+            return child.value;
+        }
+    }
+    throw std::runtime_error("InferenceEngine: the model has no submodule '" + name + "'");
+}
+
+void InferenceEngine::use_kernels(const KernelOptions& options) {
+    if (!options.enabled()) {
+        m_native.reset();
+        return;
+    }
+    if (quantized()) {
+        throw std::runtime_error("InferenceEngine: layer kernels take fp32 weights, and this "
+                                 "model is quantized");
+    }
+    auto native = std::make_unique<NativeModel>(*this, options);
+
+    // Same inputs through both, to see what the narrower weights cost
+    c10::InferenceMode inference_mode;
+    const torch::Tensor input = torch::rand({KERNEL_CHECK_BATCH, 1, 28, 28});
+    torch::jit::Stack stack{input};
+    m_forward->run(stack);
+    const at::Tensor reference = stack.back().toTensor();
+    const at::Tensor logits = native->forward(input);
+    const float error = (logits - reference).abs().max().item<float>();
+    std::cout << "InferenceEngine: layer kernels in use, max logit error vs TorchScript "
+              << error << " on " << KERNEL_CHECK_BATCH << " random inputs" << std::endl;
+    m_native = std::move(native);
+}
+
+void InferenceEngine::use_tta(size_t variants) {
+    if (variants <= 1) {
+        m_tta.clear();
+        m_augmenter.reset();
+        return;
+    }
+    if (variants > Augmenter::max_tta_variants()) {
+        throw std::invalid_argument("InferenceEngine: at most " +
+                                    std::to_string(Augmenter::max_tta_variants()) +
+                                    " test-time augmentation variants");
+    }
+    m_augmenter = std::make_unique<Augmenter>();
+    m_tta = Augmenter::tta_variants(variants);
+    std::cout << "InferenceEngine: test-time augmentation, " << variants
+              << " variants per input averaged (" << Augmenter::isa() << ")" << std::endl;
+
+    // The graph now sees batches K times larger; let it settle on them
+    warm_up();
+}
 
-    // 6. Return the result
-    return {digit, confidence};
+size_t InferenceEngine::tta_variants() const {
+    return m_tta.empty() ? 1 : m_tta.size();
 }
@@ -0,0 +1,299 @@
+#include "InferenceServer.h"
+#include "InferenceEngine.h"
+#include "ModelScheduler.h"
+#include "NativeModel.h"
+#include "PerfStats.h"
+#include "ScratchArena.h"
+#include "WorkStealingPool.h"
+
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+WireStatus wire_status(RequestStatus status) {
+    switch (status) {
+    case RequestStatus::Ok:
+        return WireStatus::Ok;
+    case RequestStatus::QueueFull:
+    case RequestStatus::Overloaded:
+        return WireStatus::Overloaded;
+    case RequestStatus::Failed:
+    case RequestStatus::Cancelled:
+        break;
+    }
+    return WireStatus::InternalError;
+}
+
+std::vector<std::shared_ptr<ServedModel>> load_models(const std::vector<ModelConfig>& models) {
+    std::vector<std::shared_ptr<ServedModel>> loaded;
+    for (const ModelConfig& model : models) {
+        loaded.push_back(std::make_shared<ServedModel>(model));
+    }
+    return loaded;
+}
+
+} // namespace
+
+InferenceServer::InferenceServer(const std::vector<ModelConfig>& models,
+                                 InferenceServerOptions options)
+    : InferenceServer(load_models(models), std::move(options))
+{
+}
+
+InferenceServer::InferenceServer(const std::vector<std::shared_ptr<ServedModel>>& models,
+                                 InferenceServerOptions options)
+    : m_options(std::move(options))
+{
+    if (models.empty()) {
+        throw std::invalid_argument("InferenceServer: at least one model is required");
+    }
+    for (const auto& model : models) {
+        m_registry.add(model);
+    }
+    // Each model runs at most one forward pass at a time, so that bounds
+    // the concurrency the budget can hand out
+    size_t max_batch = 1;
+    for (const auto& model : models) {
+        max_batch = std::max<size_t>(max_batch, model->config().max_batch);
+    }
+    m_budget = std::make_unique<ThreadBudget>(
+        m_options.threads, static_cast<uint32_t>(models.size()), max_batch);
+    m_pool = std::make_unique<WorkStealingPool>(ExecutorConfig{
+        m_options.workers != 0 ? m_options.workers : m_budget->cores(), m_options.pin_workers});
+    m_scheduler = std::make_unique<ModelScheduler>(*m_pool, 0, m_budget.get());
+    m_io = IoEngine::create(m_options.io,
+                            [this](uint64_t connection_id, const WireHeader& header,
+                                   const uint8_t* payload) {
+                                on_frame(connection_id, header, payload);
+                            });
+
+    std::cout << "InferenceServer: listening on " << m_options.io.bind_address << ":"
+              << m_io->port() << " (" << m_io->name() << ", " << m_pool->size()
+              << " workers on " << m_pool->numa_nodes() << " NUMA nodes, "
+              << models.size() << " models)" << std::endl;
+    const ThreadSplit split = m_budget->split();
+    std::cout << "InferenceServer: " << split.cores << " cores: " << split.concurrency
+              << " passes x " << split.intra_op << " intra-op threads"
+              << (split.adaptive ? ", adapting to batch sizes" : "") << std::endl;
+}
+
+InferenceServer::~InferenceServer() {
+    stop();
+    // Finish the batches in flight while the engine can still take their
+    // last replies, then join the pool
+    m_scheduler.reset();
+    m_pool.reset();
+    m_budget.reset();
+}
+
+void InferenceServer::run() {
+    m_io->run();
+}
+
+void InferenceServer::stop() {
+    m_io->stop();
+}
+
+std::vector<ModelStats> InferenceServer::model_stats() const {
+    return m_scheduler->stats();
+}
+
+std::string InferenceServer::stats_json() const {
+    const IoEngineStats io = m_io->stats();
+    json doc;
+    doc["io_engine"] = m_io->name();
+    doc["io"] = {{"connections_accepted", io.connections_accepted},
+                 {"frames_received", io.frames_received},
+                 {"frames_sent", io.frames_sent},
+                 {"kernel_entries", io.kernel_entries}};
+    const ExecutorStats executor = m_pool->stats();
+    doc["workers"] = m_pool->size();
+    const ThreadSplit split = m_budget->split();
+    doc["thread_budget"] = {{"cores", split.cores},
+                            {"concurrency", split.concurrency},
+                            {"intra_op_threads", split.intra_op},
+                            {"interop_threads", split.interop},
+                            {"spare_cores", split.spare},
+                            {"adaptive", split.adaptive},
+                            {"mean_batch", split.mean_batch},
+                            {"batches", split.batches},
+                            {"changes", split.changes}};
+    doc["executor"] = {{"numa_nodes", m_pool->numa_nodes()},
+                       {"tasks", executor.executed},
+                       {"stolen", executor.stolen},
+                       {"stolen_remote", executor.stolen_remote},
+                       {"injected", executor.injected},
+                       {"parks", executor.parks}};
+
+    // Models that have not had a request yet still report their footprint
+    json models = json::object();
+    for (const auto& model : m_registry.models()) {
+        models[model->key()] = {{"weight", model->config().weight},
+                                {"weight_bytes", model->weight_bytes()},
+                                {"submitted", 0}};
+    }
+    size_t total_bytes = 0;
+    for (const ModelStats& s : m_scheduler->stats()) {
+        models[s.model] = {{"weight", s.weight},
+                           {"submitted", s.submitted},
+                           {"completed", s.completed},
+                           {"goodput", s.goodput},
+                           {"late", s.late},
+                           {"rejected", s.rejected},
+                           {"overloaded", s.overloaded},
+                           {"shed", s.shed},
+                           {"cancelled", s.cancelled},
+                           {"failed", s.failed},
+                           {"batches", s.batches},
+                           {"mean_batch", s.mean_batch},
+                           {"coalesced", s.coalesced},
+                           {"collapse_ratio", s.collapse_ratio},
+                           {"coalesced_p99_us", s.coalesced_p99_us},
+                           {"queue_depth", s.queue_depth},
+                           {"p50_us", s.p50_us},
+                           {"p99_us", s.p99_us},
+                           {"interactive_p99_us", s.interactive_p99_us},
+                           {"bulk_p99_us", s.bulk_p99_us},
+                           {"service_estimate_us", s.service_estimate_us},
+                           {"weight_bytes", s.weight_bytes},
+                           {"queued_bytes", s.queued_bytes}};
+        total_bytes += s.queued_bytes;
+    }
+    for (const auto& model : m_registry.models()) {
+        total_bytes += model->weight_bytes();
+        if (PipelineExecutor* pipeline = model->pipeline()) {
+            const PipelineStats p = pipeline->stats();
+            json stages = json::array();
+            for (const PipelineStageStats& stage : p.stages) {
+                stages.push_back({{"layers", stage.layers},
+                                  {"workers", stage.workers},
+                                  {"batches", stage.batches},
+                                  {"rows", stage.rows},
+                                  {"busy_s", stage.busy_seconds},
+                                  {"starved_s", stage.starved_seconds},
+                                  {"blocked_s", stage.blocked_seconds}});
+            }
+            models[model->key()]["pipeline"] = {{"batches", p.batches},
+                                                {"rows", p.rows},
+                                                {"submit_blocked_s", p.submit_blocked_seconds},
+                                                {"queued", p.queued},
+                                                {"stages", stages}};
+        }
+        if (const NativeModel* native = model->engine().native_model()) {
+            models[model->key()]["kernels"] = {{"layers", native->describe()},
+                                               {"pass_weight_bytes", native->weight_bytes()}};
+        }
+        if (model->engine().tta_variants() > 1) {
+            models[model->key()]["tta_variants"] = model->engine().tta_variants();
+        }
+        if (model->engine().quantized()) {
+            models[model->key()]["quantized_engine"] = model->engine().quantized_engine();
+        }
+    }
+    doc["models"] = std::move(models);
+    doc["model_memory_bytes"] = total_bytes;
+    // Under prefork, unique_bytes is what this worker adds to the machine
+    const MemoryFootprint memory = memory_footprint();
+    doc["process"] = {{"pid", ::getpid()},
+                      {"rss_bytes", memory.rss},
+                      {"pss_bytes", memory.pss},
+                      {"unique_bytes", memory.private_bytes},
+                      {"shared_bytes", memory.shared_bytes}};
+    if (ScratchArena::options().enabled) {
+        const ArenaStats arena = ScratchArena::stats();
+        doc["arena"] = {{"arena_allocations", arena.arena_allocations},
+                        {"arena_bytes", arena.arena_bytes},
+                        {"heap_allocations", arena.heap_allocations},
+                        {"heap_bytes", arena.heap_bytes},
+                        {"allocate_s", arena.allocate_seconds},
+                        {"free_s", arena.free_seconds},
+                        {"resets", arena.resets},
+                        {"chunks_mapped", arena.chunks_mapped},
+                        {"chunks_detached", arena.chunks_detached},
+                        {"mapped_bytes", arena.mapped_bytes}};
+    }
+    return doc.dump();
+}
+
+void InferenceServer::on_frame(uint64_t connection_id, const WireHeader& header,
+                               const uint8_t* payload) {
+    // Runs on the engine's loop thread: validate, copy out and get back to I/O
+    if (header.type == static_cast<uint8_t>(MessageType::StatsRequest)) {
+        std::vector<uint8_t> frame;
+        append_stats_response(frame, header.request_id, stats_json());
+        m_io->send(connection_id, std::move(frame));
+        return;
+    }
+    if (header.type == static_cast<uint8_t>(MessageType::Cancel)) {
+        cancel(connection_id, header.request_id);
+        return;
+    }
+
+    PredictRequestView view;
+    if (header.type != static_cast<uint8_t>(MessageType::PredictRequest) ||
+        !decode_predict_request(header, payload, view)) {
+        reply(connection_id, header.request_id, WireStatus::BadRequest, Prediction{});
+        return;
+    }
+    std::shared_ptr<ServedModel> model = m_registry.find(std::string(view.model));
+    if (!model) {
+        reply(connection_id, header.request_id, WireStatus::UnknownModel, Prediction{});
+        return;
+    }
+
+    InferenceRequest request;
+    request.width = view.width;
+    request.height = view.height;
+    request.priority = view.priority == 0 ? Priority::Interactive : Priority::Bulk;
+    if (view.deadline_us != 0) {
+        request.deadline =
+            InferenceRequest::Clock::now() + std::chrono::microseconds(view.deadline_us);
+    }
+    request.pixels.assign(view.pixels,
+                          view.pixels + static_cast<size_t>(view.width) * view.height);
+    const uint64_t request_id = header.request_id;
+    const bool cancellable = (header.flags & WIRE_FLAG_CANCELLABLE) != 0;
+    if (cancellable) {
+        CancellationSource source;
+        request.token = source.token();
+        std::lock_guard<std::mutex> lock(m_cancel_mutex);
+        m_cancellable[{connection_id, request_id}] = source;
+    }
+    request.done = [this, connection_id, request_id, cancellable](RequestStatus status,
+                                                                  const Prediction& prediction) {
+        if (cancellable) {
+            std::lock_guard<std::mutex> lock(m_cancel_mutex);
+            m_cancellable.erase({connection_id, request_id});
+        }
+        // The client has moved on from a cancelled request; nobody reads a reply
+        if (status != RequestStatus::Cancelled) {
+            reply(connection_id, request_id, wire_status(status), prediction);
+        }
+    };
+    m_scheduler->submit(model, std::move(request));
+}
+
+void InferenceServer::cancel(uint64_t connection_id, uint64_t request_id) {
+    std::lock_guard<std::mutex> lock(m_cancel_mutex);
+    auto it = m_cancellable.find({connection_id, request_id});
+    if (it != m_cancellable.end()) {
+        // The scheduler drops it when it next picks; a running batch is not stopped
+        it->second.cancel();
+        m_cancellable.erase(it);
+    }
+}
+
+void InferenceServer::reply(uint64_t connection_id, uint64_t request_id, WireStatus status,
+                            const Prediction& prediction) {
+    std::vector<uint8_t> frame;
+    frame.reserve(sizeof(WireHeader) + sizeof(PredictResponseBody));
+    append_predict_response(frame, request_id, status, prediction);
+    m_io->send(connection_id, std::move(frame));
+}
@@ -0,0 +1,139 @@
+#include "IoEngine.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <iostream>
+#include <stdexcept>
+
+// Engine factories, defined next to each implementation
+std::unique_ptr<IoEngine> create_epoll_engine(const IoEngineConfig& config,
+                                              IoEngine::FrameHandler handler);
+#ifdef DIGIT_HAVE_IO_URING
+std::unique_ptr<IoEngine> create_io_uring_engine(const IoEngineConfig& config,
+                                                 IoEngine::FrameHandler handler);
+#endif
+
+IoEngineKind parse_io_engine_kind(const std::string& name) {
+    if (name == "epoll") {
+        return IoEngineKind::Epoll;
+    }
+    if (name == "io_uring" || name == "uring") {
+        return IoEngineKind::IoUring;
+    }
+    throw std::invalid_argument("Unknown io_engine '" + name + "' (expected epoll or io_uring)");
+}
+
+std::unique_ptr<IoEngine> IoEngine::create(const IoEngineConfig& config, FrameHandler handler) {
+    if (config.kind == IoEngineKind::IoUring) {
+#ifdef DIGIT_HAVE_IO_URING
+        try {
+            return create_io_uring_engine(config, handler);
+        } catch (const std::exception& e) {
+            std::cerr << "IoEngine: io_uring unavailable (" << e.what()
+                      << "), falling back to epoll" << std::endl;
+        }
+#else
+        std::cerr << "IoEngine: built without io_uring support, falling back to epoll"
+                  << std::endl;
+#endif
+    }
+    return create_epoll_engine(config, std::move(handler));
+}
+
+IoEngine::IoEngine(const IoEngineConfig& config, FrameHandler handler)
+    : m_config(config), m_handler(std::move(handler))
+{
+    // A peer hanging up mid-write must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // 1. Create a non-blocking listening socket
+    m_listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0) {
+        throw std::runtime_error("IoEngine: socket() failed");
+    }
+    int one = 1;
+    ::setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // Each process of a prefork group has its own listening socket and
+    // the kernel spreads incoming connections across them
+    if (config.reuse_port &&
+        ::setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+        ::close(m_listen_fd);
+        throw std::runtime_error("IoEngine: SO_REUSEPORT is not supported");
+    }
+
+    // 2. Bind and listen
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    if (::inet_pton(AF_INET, config.bind_address.c_str(), &addr.sin_addr) != 1) {
+        ::close(m_listen_fd);
+        throw std::runtime_error("IoEngine: invalid bind address " + config.bind_address);
+    }
+    if (::bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(m_listen_fd, SOMAXCONN) != 0) {
+        ::close(m_listen_fd);
+        throw std::runtime_error("IoEngine: cannot listen on port " + std::to_string(config.port));
+    }
+
+    socklen_t len = sizeof(addr);
+    ::getsockname(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    m_port = ntohs(addr.sin_port);
+}
+
+IoEngine::~IoEngine() {
+    if (m_listen_fd >= 0) {
+        ::close(m_listen_fd);
+    }
+}
+
+void IoEngine::stop() {
+    m_running.store(false);
+    wake();
+}
+
+void IoEngine::send(uint64_t connection_id, std::vector<uint8_t> frame) {
+    if (std::this_thread::get_id() == m_loop_thread.load()) {
+        queue_frame(connection_id, std::move(frame));
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_remote_mutex);
+        m_remote_frames.emplace_back(connection_id, std::move(frame));
+    }
+    // Only the first sender after a drain pays for the wake-up
+    if (!m_wake_pending.exchange(true)) {
+        wake();
+    }
+}
+
+void IoEngine::drain_remote_frames() {
+    // Clear the flag before taking the list so a concurrent sender
+    // either lands in this batch or triggers a fresh wake-up.
+    m_wake_pending.store(false);
+    std::vector<std::pair<uint64_t, std::vector<uint8_t>>> frames;
+    {
+        std::lock_guard<std::mutex> lock(m_remote_mutex);
+        frames.swap(m_remote_frames);
+    }
+    for (auto& [connection_id, frame] : frames) {
+        queue_frame(connection_id, std::move(frame));
+    }
+}
+
+void IoEngine::enter_loop() {
+    m_loop_thread.store(std::this_thread::get_id());
+}
+
+IoEngineStats IoEngine::stats() const {
+    IoEngineStats s;
+    s.connections_accepted = m_connections_accepted.load();
+    s.frames_received = m_frames_received.load();
+    s.frames_sent = m_frames_sent.load();
+    s.kernel_entries = m_kernel_entries.load();
+    return s;
+}
@@ -0,0 +1,173 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+LatencyHistogram::LatencyHistogram(uint64_t highest_trackable_ns)
+    : m_highest_trackable(std::max<uint64_t>(highest_trackable_ns, SUB_BUCKET_COUNT))
+{
+    m_counts.assign(index_of(m_highest_trackable) + 1, 0);
+}
+
+size_t LatencyHistogram::index_of(uint64_t value) const {
+    if (value < SUB_BUCKET_COUNT) {
+        return static_cast<size_t>(value);
+    }
+    // Keep the top SUB_BUCKET_BITS bits; every power of two above the
+    // linear range contributes SUB_BUCKET_HALF buckets.
+    const int msb = 63 - __builtin_clzll(value);
+    const int shift = msb - (SUB_BUCKET_BITS - 1);
+    return static_cast<size_t>((shift + 1) * SUB_BUCKET_HALF +
+                               ((value >> shift) - SUB_BUCKET_HALF));
+}
+
+uint64_t LatencyHistogram::lowest_equivalent(size_t index) const {
+    if (index < SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const uint64_t shift = index / SUB_BUCKET_HALF - 1;
+    return (index % SUB_BUCKET_HALF + SUB_BUCKET_HALF) << shift;
+}
+
+uint64_t LatencyHistogram::highest_equivalent(size_t index) const {
+    if (index < SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const uint64_t shift = index / SUB_BUCKET_HALF - 1;
+    return lowest_equivalent(index) + (1ull << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value_ns, uint64_t count) {
+    const uint64_t value = std::min(value_ns, m_highest_trackable);
+    m_counts[index_of(value)] += count;
+    m_total += count;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    if (other.m_counts.size() > m_counts.size()) {
+        m_counts.resize(other.m_counts.size(), 0);
+        m_highest_trackable = other.m_highest_trackable;
+    }
+    for (size_t i = 0; i < other.m_counts.size(); ++i) {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_total += other.m_total;
+    if (other.m_total != 0) {
+        m_min = std::min(m_min, other.m_min);
+        m_max = std::max(m_max, other.m_max);
+    }
+}
+
+void LatencyHistogram::reset() {
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_total = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+}
+
+double LatencyHistogram::mean() const {
+    if (m_total == 0) {
+        return 0.0;
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < m_counts.size(); ++i) {
+        if (m_counts[i] != 0) {
+            const double mid = 0.5 * (static_cast<double>(lowest_equivalent(i)) +
+                                      static_cast<double>(highest_equivalent(i)));
+            sum += mid * static_cast<double>(m_counts[i]);
+        }
+    }
+    return sum / static_cast<double>(m_total);
+}
+
+double LatencyHistogram::stddev() const {
+    if (m_total == 0) {
+        return 0.0;
+    }
+    const double avg = mean();
+    double sum_sq = 0.0;
+    for (size_t i = 0; i < m_counts.size(); ++i) {
+        if (m_counts[i] != 0) {
+            const double mid = 0.5 * (static_cast<double>(lowest_equivalent(i)) +
+                                      static_cast<double>(highest_equivalent(i)));
+            sum_sq += (mid - avg) * (mid - avg) * static_cast<double>(m_counts[i]);
+        }
+    }
+    return std::sqrt(sum_sq / static_cast<double>(m_total));
+}
+
+uint64_t LatencyHistogram::value_at_percentile(double percentile) const {
+    if (m_total == 0) {
+        return 0;
+    }
+    const double clamped = std::min(std::max(percentile, 0.0), 100.0);
+    const uint64_t rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(m_total))));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size(); ++i) {
+        seen += m_counts[i];
+        if (seen >= rank) {
+            return std::min(highest_equivalent(i), m_max);
+        }
+    }
+    return m_max;
+}
+
+void LatencyHistogram::write_percentile_distribution(std::ostream& out,
+                                                     double unit_divisor) const {
+    char line[128];
+    std::snprintf(line, sizeof(line), "%12s %14s %10s %14s\n\n", "Value", "Percentile",
+                  "TotalCount", "1/(1-Percentile)");
+    out << line;
+
+    // Same iteration as HdrHistogram: 5 reporting ticks per halving of the
+    // distance to 100%, so the tail gets progressively finer resolution.
+    constexpr int TICKS_PER_HALF = 5;
+    uint64_t seen = 0;
+    size_t index = 0;
+    double percentile = 0.0;
+    for (int half = 0; m_total != 0; ++half) {
+        const double remaining = 100.0 / std::pow(2.0, half);
+        const double step = remaining / 2.0 / TICKS_PER_HALF;
+        bool done = false;
+        for (int tick = 0; tick < TICKS_PER_HALF && !done; ++tick) {
+            const uint64_t rank = std::max<uint64_t>(
+                1, static_cast<uint64_t>(std::ceil(percentile / 100.0 * m_total)));
+            while (index < m_counts.size() && seen + m_counts[index] < rank) {
+                seen += m_counts[index++];
+            }
+            const uint64_t cumulative = std::min(seen + m_counts[index], m_total);
+            const uint64_t value = std::min(highest_equivalent(index), m_max);
+            const double fraction = percentile / 100.0;
+            if (fraction < 1.0) {
+                std::snprintf(line, sizeof(line), "%12.3f %2.12f %10llu %14.2f\n",
+                              value / unit_divisor, fraction,
+                              static_cast<unsigned long long>(cumulative), 1.0 / (1.0 - fraction));
+                out << line;
+            }
+            percentile += step;
+            done = value >= m_max;
+        }
+        if (done || half > 40) {
+            break;
+        }
+    }
+    std::snprintf(line, sizeof(line), "%12.3f %2.12f %10llu\n", m_max / unit_divisor, 1.0,
+                  static_cast<unsigned long long>(m_total));
+    out << line;
+
+    std::snprintf(line, sizeof(line), "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+                  mean() / unit_divisor, stddev() / unit_divisor);
+    out << line;
+    std::snprintf(line, sizeof(line), "#[Max     = %12.3f, Total count    = %12llu]\n",
+                  m_max / unit_divisor, static_cast<unsigned long long>(m_total));
+    out << line;
+    std::snprintf(line, sizeof(line), "#[Buckets = %12zu, SubBuckets     = %12llu]\n",
+                  m_counts.size() / SUB_BUCKET_HALF,
+                  static_cast<unsigned long long>(SUB_BUCKET_COUNT));
+    out << line;
+}
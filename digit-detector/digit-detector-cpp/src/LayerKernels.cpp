@@ -0,0 +1,1242 @@
+#include "LayerKernels.h"
+
+// The vector kernels are x86 only; elsewhere every layer runs its scalar path
+#if defined(__x86_64__) || defined(__i386__)
+#define DIGIT_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define DIGIT_KERNELS_X86 0
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t ROW_ALIGNMENT = 32; ///< Weight rows padded to whole vdpbf16ps steps
+
+// ----------------------------------------------------------------------------
+// Conversions (packing and the scalar kernel)
+// ----------------------------------------------------------------------------
+
+uint32_t bits_of(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float from_bits(uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief fp32 to IEEE binary16, rounding to nearest even.
+ */
+uint16_t float_to_half(float value) {
+    const uint32_t x = bits_of(value);
+    const uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t mantissa = x & 0x7fffffu;
+    const int32_t biased = static_cast<int32_t>((x >> 23) & 0xffu);
+    if (biased == 0xff) {
+        return static_cast<uint16_t>(sign | 0x7c00u | (mantissa != 0 ? 0x200u : 0u));
+    }
+    const int32_t exponent = biased - 127 + 15;
+    if (exponent >= 0x1f) {
+        return static_cast<uint16_t>(sign | 0x7c00u); // Too large: infinity
+    }
+    if (exponent <= 0) {
+        // Subnormal half: the implicit bit joins the mantissa
+        if (exponent < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000u;
+        const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1u) != 0)) {
+            ++half;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    const uint32_t rest = mantissa & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u) != 0)) {
+        ++half; // A carry into the exponent is still the right answer
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+float half_to_float(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+    int32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ffu;
+    if (exponent == 0x1f) {
+        return from_bits(sign | 0x7f800000u | (mantissa << 13));
+    }
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            return from_bits(sign);
+        }
+        // Subnormal: normalize
+        exponent = 1;
+        while ((mantissa & 0x400u) == 0) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        mantissa &= 0x3ffu;
+    }
+    return from_bits(sign | (static_cast<uint32_t>(exponent + 112) << 23) | (mantissa << 13));
+}
+
+/**
+ * @brief fp32 to bf16, rounding to nearest even.
+ */
+uint16_t float_to_bf16(float value) {
+    const uint32_t x = bits_of(value);
+    if ((x & 0x7fffffffu) > 0x7f800000u) {
+        return static_cast<uint16_t>((x >> 16) | 0x40u); // Keep NaN a NaN
+    }
+    return static_cast<uint16_t>((x + 0x7fffu + ((x >> 16) & 1u)) >> 16);
+}
+
+float bf16_to_float(uint16_t value) {
+    return from_bits(static_cast<uint32_t>(value) << 16);
+}
+
+template <bool BF16>
+float widen_scalar(uint16_t value) {
+    return BF16 ? bf16_to_float(value) : half_to_float(value);
+}
+
+struct CpuFeatures {
+    bool avx2 = false; ///< With FMA and F16C
+    bool avx512_bf16 = false;
+};
+
+const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = [] {
+        CpuFeatures f;
+#if DIGIT_KERNELS_X86
+        __builtin_cpu_init();
+        f.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+                 __builtin_cpu_supports("f16c");
+        f.avx512_bf16 = __builtin_cpu_supports("avx512f") &&
+                        __builtin_cpu_supports("avx512bw") &&
+                        __builtin_cpu_supports("avx512bf16");
+#endif
+        return f;
+    }();
+    return features;
+}
+
+/**
+ * @brief Adds the bias, applies ReLU and stores an R x O block of sums.
+ */
+template <int R, int O>
+void store_block(const float (&sums)[R][O], const float* bias, float* out, size_t row_stride,
+                 size_t col_stride, bool relu) {
+    for (int r = 0; r < R; ++r) {
+        for (int o = 0; o < O; ++o) {
+            float value = sums[r][o] + bias[o];
+            if (relu && value < 0.0f) {
+                value = 0.0f;
+            }
+            out[r * row_stride + o * col_stride] = value;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Scalar
+// ----------------------------------------------------------------------------
+
+template <bool BF16>
+void linear_scalar(const float* x, size_t rows, size_t inputs, const uint16_t* w, size_t stride,
+                   size_t outputs, const float* bias, float* out, size_t row_stride,
+                   size_t col_stride, bool relu) {
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t o = 0; o < outputs; ++o) {
+            float sum[1][1] = {{0.0f}};
+            const uint16_t* row = w + o * stride;
+            for (size_t k = 0; k < inputs; ++k) {
+                sum[0][0] += widen_scalar<BF16>(row[k]) * x[r * inputs + k];
+            }
+            store_block<1, 1>(sum, bias + o, out + r * row_stride + o * col_stride, row_stride,
+                              col_stride, relu);
+        }
+    }
+}
+
+#if DIGIT_KERNELS_X86
+
+// ----------------------------------------------------------------------------
+// AVX2 + FMA + F16C: widen eight weights at a time, multiply in fp32
+// ----------------------------------------------------------------------------
+
+template <bool BF16>
+__attribute__((target("avx2,fma,f16c"))) inline __m256 widen8(const uint16_t* p) {
+    const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    if (BF16) {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(packed), 16));
+    }
+    return _mm256_cvtph_ps(packed);
+}
+
+__attribute__((target("avx2,fma"))) inline float sum8(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+/**
+ * @brief R rows of x against O weight rows; each widened weight vector
+ * is used R times.
+ */
+template <bool BF16, int R, int O>
+__attribute__((target("avx2,fma,f16c"))) void block_avx2(const float* x, size_t inputs,
+                                                         const uint16_t* w, size_t stride,
+                                                         float (&sums)[R][O]) {
+    __m256 acc[R][O];
+    for (int r = 0; r < R; ++r) {
+        for (int o = 0; o < O; ++o) {
+            acc[r][o] = _mm256_setzero_ps();
+        }
+    }
+    size_t k = 0;
+    for (; k + 8 <= inputs; k += 8) {
+        __m256 weights[O];
+        for (int o = 0; o < O; ++o) {
+            weights[o] = widen8<BF16>(w + o * stride + k);
+        }
+        for (int r = 0; r < R; ++r) {
+            const __m256 xv = _mm256_loadu_ps(x + r * inputs + k);
+            for (int o = 0; o < O; ++o) {
+                acc[r][o] = _mm256_fmadd_ps(weights[o], xv, acc[r][o]);
+            }
+        }
+    }
+    for (int r = 0; r < R; ++r) {
+        for (int o = 0; o < O; ++o) {
+            float sum = sum8(acc[r][o]);
+            for (size_t tail = k; tail < inputs; ++tail) {
+                sum += widen_scalar<BF16>(w[o * stride + tail]) * x[r * inputs + tail];
+            }
+            sums[r][o] = sum;
+        }
+    }
+}
+
+template <bool BF16, int R>
+__attribute__((target("avx2,fma,f16c"))) void rows_avx2(const float* x, size_t inputs,
+                                                        const uint16_t* w, size_t stride,
+                                                        size_t outputs, const float* bias,
+                                                        float* out, size_t row_stride,
+                                                        size_t col_stride, bool relu) {
+    size_t o = 0;
+    for (; o + 4 <= outputs; o += 4) {
+        float sums[R][4];
+        block_avx2<BF16, R, 4>(x, inputs, w + o * stride, stride, sums);
+        store_block<R, 4>(sums, bias + o, out + o * col_stride, row_stride, col_stride, relu);
+    }
+    for (; o < outputs; ++o) {
+        float sums[R][1];
+        block_avx2<BF16, R, 1>(x, inputs, w + o * stride, stride, sums);
+        store_block<R, 1>(sums, bias + o, out + o * col_stride, row_stride, col_stride, relu);
+    }
+}
+
+template <bool BF16>
+__attribute__((target("avx2,fma,f16c"))) void linear_avx2(const float* x, size_t rows,
+                                                          size_t inputs, const uint16_t* w,
+                                                          size_t stride, size_t outputs,
+                                                          const float* bias, float* out,
+                                                          size_t row_stride, size_t col_stride,
+                                                          bool relu) {
+    size_t r = 0;
+    for (; r + 2 <= rows; r += 2) {
+        rows_avx2<BF16, 2>(x + r * inputs, inputs, w, stride, outputs, bias,
+                           out + r * row_stride, row_stride, col_stride, relu);
+    }
+    if (r < rows) {
+        rows_avx2<BF16, 1>(x + r * inputs, inputs, w, stride, outputs, bias,
+                           out + r * row_stride, row_stride, col_stride, relu);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// AVX512-BF16: pairs of bf16 products summed into fp32 by vdpbf16ps
+// ----------------------------------------------------------------------------
+
+/// Activations rounded to bf16, [rows, stride], reused across calls
+thread_local std::vector<uint16_t> t_bf16_rows;
+
+__attribute__((target("avx512f"))) inline __mmask16 first_lanes(size_t available) {
+    return available >= 16 ? static_cast<__mmask16>(0xffff)
+                           : static_cast<__mmask16>((1u << available) - 1);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512bf16"))) void round_rows_bf16(
+    const float* x, size_t rows, size_t inputs, size_t stride, uint16_t* out) {
+    for (size_t r = 0; r < rows; ++r) {
+        const float* src = x + r * inputs;
+        uint16_t* dst = out + r * stride;
+        for (size_t k = 0; k < stride; k += 32) {
+            const size_t left = inputs > k ? inputs - k : 0;
+            const __m512 lo = _mm512_maskz_loadu_ps(first_lanes(left), src + k);
+            const __m512 hi =
+                _mm512_maskz_loadu_ps(first_lanes(left > 16 ? left - 16 : 0), src + k + 16);
+            const __m512bh packed = _mm512_cvtne2ps_pbh(hi, lo);
+            _mm512_storeu_si512(dst + k, (__m512i)packed);
+        }
+    }
+}
+
+/**
+ * @brief Horizontal sum through memory; GCC 12's _mm512_reduce_add_ps
+ * reads an uninitialized register and warns wherever it is inlined.
+ */
+__attribute__((target("avx512f"))) inline float sum16(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float sum = 0.0f;
+    for (float lane : lanes) {
+        sum += lane;
+    }
+    return sum;
+}
+
+template <int R, int O>
+__attribute__((target("avx512f,avx512bw,avx512bf16"))) void block_dot_bf16(
+    const uint16_t* x, const uint16_t* w, size_t stride, float (&sums)[R][O]) {
+    __m512 acc[R][O];
+    for (int r = 0; r < R; ++r) {
+        for (int o = 0; o < O; ++o) {
+            acc[r][o] = _mm512_setzero_ps();
+        }
+    }
+    for (size_t k = 0; k < stride; k += 32) {
+        __m512bh weights[O];
+        for (int o = 0; o < O; ++o) {
+            weights[o] = (__m512bh)_mm512_loadu_si512(w + o * stride + k);
+        }
+        for (int r = 0; r < R; ++r) {
+            const __m512bh xv = (__m512bh)_mm512_loadu_si512(x + r * stride + k);
+            for (int o = 0; o < O; ++o) {
+                acc[r][o] = _mm512_dpbf16_ps(acc[r][o], xv, weights[o]);
+            }
+        }
+    }
+    for (int r = 0; r < R; ++r) {
+        for (int o = 0; o < O; ++o) {
+            sums[r][o] = sum16(acc[r][o]);
+        }
+    }
+}
+
+template <int R>
+__attribute__((target("avx512f,avx512bw,avx512bf16"))) void rows_dot_bf16(
+    const uint16_t* x, const uint16_t* w, size_t stride, size_t outputs, const float* bias,
+    float* out, size_t row_stride, size_t col_stride, bool relu) {
+    size_t o = 0;
+    for (; o + 4 <= outputs; o += 4) {
+        float sums[R][4];
+        block_dot_bf16<R, 4>(x, w + o * stride, stride, sums);
+        store_block<R, 4>(sums, bias + o, out + o * col_stride, row_stride, col_stride, relu);
+    }
+    for (; o < outputs; ++o) {
+        float sums[R][1];
+        block_dot_bf16<R, 1>(x, w + o * stride, stride, sums);
+        store_block<R, 1>(sums, bias + o, out + o * col_stride, row_stride, col_stride, relu);
+    }
+}
+
+void linear_dot_bf16(const float* x, size_t rows, size_t inputs, const uint16_t* w,
+                     size_t stride, size_t outputs, const float* bias, float* out,
+                     size_t row_stride, size_t col_stride, bool relu) {
+    std::vector<uint16_t>& rounded = t_bf16_rows;
+    if (rounded.size() < rows * stride) {
+        rounded.resize(rows * stride);
+    }
+    round_rows_bf16(x, rows, inputs, stride, rounded.data());
+    size_t r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        rows_dot_bf16<4>(rounded.data() + r * stride, w, stride, outputs, bias,
+                         out + r * row_stride, row_stride, col_stride, relu);
+    }
+    for (; r < rows; ++r) {
+        rows_dot_bf16<1>(rounded.data() + r * stride, w, stride, outputs, bias,
+                         out + r * row_stride, row_stride, col_stride, relu);
+    }
+}
+
+#endif // DIGIT_KERNELS_X86
+
+/// im2col patches, [positions, in_channels * 9], reused across calls
+thread_local std::vector<float> t_columns;
+
+// ----------------------------------------------------------------------------
+// Winograd F(2x2, 3x3)
+//
+// Y = A^T [(G g G^T) . (B^T d B)] A for a 4x4 input tile d and 3x3 filter g:
+//
+//   B^T = | 1  0 -1  0 |   G = | 1    0    0  |   A^T = | 1  1  1  0 |
+//         | 0  1  1  0 |       | 1/2  1/2  1/2|         | 0  1 -1 -1 |
+//         | 0 -1  1  0 |       | 1/2 -1/2  1/2|
+//         | 0  1  0 -1 |       | 0    0    1  |
+//
+// Tiles are numbered image by image, row by row. Input tile (ty, tx)
+// starts at row 2 ty - 1, column 2 tx - 1; its columns 0 and 2 are the
+// even columns of the zero-padded row and 1 and 3 the odd ones, so with
+// each row split into its even and odd columns, element j of eight
+// neighbouring tiles is one contiguous load.
+// ----------------------------------------------------------------------------
+
+constexpr size_t WINOGRAD_TILES = 256;  ///< Tiles per pass through the buffers, roughly
+constexpr size_t WINOGRAD_BLOCK = 8;    ///< Output channels transformed back together
+constexpr size_t WINOGRAD_SPLIT_PAD = 9; ///< Past a split row, for the loads at tx + 1
+
+/// Transformed inputs, [16][in_channels][stride]
+thread_local std::vector<float> t_winograd_inputs;
+/// Products for one block of output channels, [16][WINOGRAD_BLOCK][stride]
+thread_local std::vector<float> t_winograd_products;
+/// One channel's padded rows split into even and odd columns
+thread_local std::vector<float> t_winograd_split;
+
+/**
+ * @brief Where the tiles of one pass live.
+ */
+struct WinogradPass {
+    size_t images;      ///< In this pass
+    size_t height;
+    size_t width;
+    size_t tile_rows;   ///< height / 2
+    size_t tile_cols;   ///< width / 2
+    size_t tiles;       ///< Per image
+    size_t stride;      ///< Of a [channel] row of tiles in the buffers
+    size_t split_cols;  ///< Of a split row
+};
+
+/**
+ * @brief Rows -1 .. height of one channel, zero padded, as even columns
+ * (padded column 2t, input column 2t - 1) then odd ones (input column 2t):
+ * [height + 2][2][split_cols].
+ */
+void split_columns(const float* plane, const WinogradPass& pass, float* split) {
+    std::fill(split, split + (pass.height + 2) * 2 * pass.split_cols, 0.0f);
+    for (size_t y = 0; y < pass.height; ++y) {
+        float* even = split + (y + 1) * 2 * pass.split_cols;
+        float* odd = even + pass.split_cols;
+        const float* row = plane + y * pass.width;
+        for (size_t t = 0; t < pass.tile_cols; ++t) {
+            even[t + 1] = row[2 * t + 1];
+            odd[t] = row[2 * t];
+        }
+    }
+}
+
+void filter_transform(const float* g, float* u, size_t step) {
+    // G g, then (G g) G^T
+    float gg[4][3];
+    for (int j = 0; j < 3; ++j) {
+        gg[0][j] = g[j];
+        gg[1][j] = 0.5f * (g[j] + g[3 + j] + g[6 + j]);
+        gg[2][j] = 0.5f * (g[j] - g[3 + j] + g[6 + j]);
+        gg[3][j] = g[6 + j];
+    }
+    for (int i = 0; i < 4; ++i) {
+        u[(i * 4 + 0) * step] = gg[i][0];
+        u[(i * 4 + 1) * step] = 0.5f * (gg[i][0] + gg[i][1] + gg[i][2]);
+        u[(i * 4 + 2) * step] = 0.5f * (gg[i][0] - gg[i][1] + gg[i][2]);
+        u[(i * 4 + 3) * step] = gg[i][2];
+    }
+}
+
+// --- Scalar ------------------------------------------------------------------
+
+void input_transform_scalar(const float* split, const WinogradPass& pass, float* v,
+                            size_t component_step) {
+    for (size_t ty = 0; ty < pass.tile_rows; ++ty) {
+        for (size_t tx = 0; tx < pass.tile_cols; ++tx) {
+            float t[4][4];
+            for (int i = 0; i < 4; ++i) {
+                const float* even = split + (2 * ty + i) * 2 * pass.split_cols;
+                const float* odd = even + pass.split_cols;
+                const float d0 = even[tx], d1 = odd[tx], d2 = even[tx + 1], d3 = odd[tx + 1];
+                t[i][0] = d0 - d2;
+                t[i][1] = d1 + d2;
+                t[i][2] = d2 - d1;
+                t[i][3] = d1 - d3;
+            }
+            float* dst = v + ty * pass.tile_cols + tx;
+            for (int j = 0; j < 4; ++j) {
+                dst[(0 * 4 + j) * component_step] = t[0][j] - t[2][j];
+                dst[(1 * 4 + j) * component_step] = t[1][j] + t[2][j];
+                dst[(2 * 4 + j) * component_step] = t[2][j] - t[1][j];
+                dst[(3 * 4 + j) * component_step] = t[1][j] - t[3][j];
+            }
+        }
+    }
+}
+
+void products_scalar(const float* u, const float* v, size_t outputs, size_t inputs,
+                     size_t out_channels, size_t stride, size_t columns, float* m) {
+    for (size_t k = 0; k < 16; ++k) {
+        for (size_t o = 0; o < outputs; ++o) {
+            float* row = m + (k * WINOGRAD_BLOCK + o) * stride;
+            std::fill(row, row + columns, 0.0f);
+            for (size_t c = 0; c < inputs; ++c) {
+                const float weight = u[(k * out_channels + o) * inputs + c];
+                const float* tiles = v + (k * inputs + c) * stride;
+                for (size_t p = 0; p < columns; ++p) {
+                    row[p] += weight * tiles[p];
+                }
+            }
+        }
+    }
+}
+
+void output_transform_scalar(const float* m, const WinogradPass& pass, float bias, bool relu,
+                             float* out, size_t component_step) {
+    for (size_t ty = 0; ty < pass.tile_rows; ++ty) {
+        for (size_t tx = 0; tx < pass.tile_cols; ++tx) {
+            const float* src = m + ty * pass.tile_cols + tx;
+            float s[2][4];
+            for (int j = 0; j < 4; ++j) {
+                const float m0 = src[(0 * 4 + j) * component_step];
+                const float m1 = src[(1 * 4 + j) * component_step];
+                const float m2 = src[(2 * 4 + j) * component_step];
+                const float m3 = src[(3 * 4 + j) * component_step];
+                s[0][j] = m0 + m1 + m2;
+                s[1][j] = m1 - m2 - m3;
+            }
+            for (int a = 0; a < 2; ++a) {
+                float y0 = s[a][0] + s[a][1] + s[a][2] + bias;
+                float y1 = s[a][1] - s[a][2] - s[a][3] + bias;
+                if (relu) {
+                    y0 = std::max(y0, 0.0f);
+                    y1 = std::max(y1, 0.0f);
+                }
+                float* row = out + (2 * ty + a) * pass.width + 2 * tx;
+                row[0] = y0;
+                row[1] = y1;
+            }
+        }
+    }
+}
+
+#if DIGIT_KERNELS_X86
+
+// --- AVX2 + FMA: eight tiles per vector --------------------------------------
+
+__attribute__((target("avx2,fma"))) inline __m256i lanes_below(size_t count) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count)),
+                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2,fma"))) void input_transform_avx2(const float* split,
+                                                             const WinogradPass& pass, float* v,
+                                                             size_t component_step) {
+    for (size_t ty = 0; ty < pass.tile_rows; ++ty) {
+        for (size_t tx = 0; tx < pass.tile_cols; tx += 8) {
+            __m256 t[4][4];
+            for (int i = 0; i < 4; ++i) {
+                const float* even = split + (2 * ty + i) * 2 * pass.split_cols + tx;
+                const float* odd = even + pass.split_cols;
+                const __m256 d0 = _mm256_loadu_ps(even);
+                const __m256 d1 = _mm256_loadu_ps(odd);
+                const __m256 d2 = _mm256_loadu_ps(even + 1);
+                const __m256 d3 = _mm256_loadu_ps(odd + 1);
+                t[i][0] = _mm256_sub_ps(d0, d2);
+                t[i][1] = _mm256_add_ps(d1, d2);
+                t[i][2] = _mm256_sub_ps(d2, d1);
+                t[i][3] = _mm256_sub_ps(d1, d3);
+            }
+            const __m256i mask = lanes_below(pass.tile_cols - tx);
+            float* dst = v + ty * pass.tile_cols + tx;
+            for (int j = 0; j < 4; ++j) {
+                _mm256_maskstore_ps(dst + (0 * 4 + j) * component_step, mask,
+                                    _mm256_sub_ps(t[0][j], t[2][j]));
+                _mm256_maskstore_ps(dst + (1 * 4 + j) * component_step, mask,
+                                    _mm256_add_ps(t[1][j], t[2][j]));
+                _mm256_maskstore_ps(dst + (2 * 4 + j) * component_step, mask,
+                                    _mm256_sub_ps(t[2][j], t[1][j]));
+                _mm256_maskstore_ps(dst + (3 * 4 + j) * component_step, mask,
+                                    _mm256_sub_ps(t[1][j], t[3][j]));
+            }
+        }
+    }
+}
+
+/**
+ * @brief R output channels by 16 tiles of one component's product.
+ */
+template <int R>
+__attribute__((target("avx2,fma"))) void products_block_avx2(const float* u, const float* v,
+                                                            size_t inputs, size_t stride,
+                                                            float* m) {
+    __m256 acc[R][2];
+    for (int r = 0; r < R; ++r) {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+    for (size_t c = 0; c < inputs; ++c) {
+        const __m256 v0 = _mm256_loadu_ps(v + c * stride);
+        const __m256 v1 = _mm256_loadu_ps(v + c * stride + 8);
+        for (int r = 0; r < R; ++r) {
+            const __m256 weight = _mm256_broadcast_ss(u + r * inputs + c);
+            acc[r][0] = _mm256_fmadd_ps(weight, v0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(weight, v1, acc[r][1]);
+        }
+    }
+    for (int r = 0; r < R; ++r) {
+        _mm256_storeu_ps(m + r * stride, acc[r][0]);
+        _mm256_storeu_ps(m + r * stride + 8, acc[r][1]);
+    }
+}
+
+__attribute__((target("avx2,fma"))) void products_avx2(const float* u, const float* v,
+                                                      size_t outputs, size_t inputs,
+                                                      size_t out_channels, size_t stride,
+                                                      size_t columns, float* m) {
+    for (size_t k = 0; k < 16; ++k) {
+        const float* uk = u + k * out_channels * inputs;
+        const float* vk = v + k * inputs * stride;
+        float* mk = m + k * WINOGRAD_BLOCK * stride;
+        for (size_t p = 0; p < columns; p += 16) {
+            size_t o = 0;
+            for (; o + 4 <= outputs; o += 4) {
+                products_block_avx2<4>(uk + o * inputs, vk + p, inputs, stride,
+                                       mk + o * stride + p);
+            }
+            for (; o < outputs; ++o) {
+                products_block_avx2<1>(uk + o * inputs, vk + p, inputs, stride,
+                                       mk + o * stride + p);
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2,fma"))) void output_transform_avx2(const float* m,
+                                                              const WinogradPass& pass,
+                                                              float bias, bool relu, float* out,
+                                                              size_t component_step) {
+    const __m256 bias_v = _mm256_set1_ps(bias);
+    const __m256 zero = _mm256_setzero_ps();
+    for (size_t ty = 0; ty < pass.tile_rows; ++ty) {
+        for (size_t tx = 0; tx < pass.tile_cols; tx += 8) {
+            const float* src = m + ty * pass.tile_cols + tx;
+            __m256 s[2][4];
+            for (int j = 0; j < 4; ++j) {
+                const __m256 m0 = _mm256_loadu_ps(src + (0 * 4 + j) * component_step);
+                const __m256 m1 = _mm256_loadu_ps(src + (1 * 4 + j) * component_step);
+                const __m256 m2 = _mm256_loadu_ps(src + (2 * 4 + j) * component_step);
+                const __m256 m3 = _mm256_loadu_ps(src + (3 * 4 + j) * component_step);
+                s[0][j] = _mm256_add_ps(_mm256_add_ps(m0, m1), m2);
+                s[1][j] = _mm256_sub_ps(_mm256_sub_ps(m1, m2), m3);
+            }
+            const size_t count = pass.tile_cols - tx;
+            const __m256i first = lanes_below(2 * count);
+            const __m256i second = lanes_below(count > 4 ? 2 * count - 8 : 0);
+            for (int a = 0; a < 2; ++a) {
+                __m256 y0 = _mm256_add_ps(_mm256_add_ps(s[a][0], s[a][1]),
+                                          _mm256_add_ps(s[a][2], bias_v));
+                __m256 y1 = _mm256_sub_ps(_mm256_sub_ps(s[a][1], s[a][2]),
+                                          _mm256_sub_ps(s[a][3], bias_v));
+                if (relu) {
+                    y0 = _mm256_max_ps(y0, zero);
+                    y1 = _mm256_max_ps(y1, zero);
+                }
+                // Tile t's two outputs go to columns 2t and 2t + 1
+                const __m256 lo = _mm256_unpacklo_ps(y0, y1);
+                const __m256 hi = _mm256_unpackhi_ps(y0, y1);
+                float* row = out + (2 * ty + a) * pass.width + 2 * tx;
+                _mm256_maskstore_ps(row, first, _mm256_permute2f128_ps(lo, hi, 0x20));
+                _mm256_maskstore_ps(row + 8, second, _mm256_permute2f128_ps(lo, hi, 0x31));
+            }
+        }
+    }
+}
+
+#endif // DIGIT_KERNELS_X86
+
+// ----------------------------------------------------------------------------
+// Block-sparse rows: each stored block is R weight rows by C inputs, C a
+// multiple of 8, so a block is R x C/8 vectors and pruned blocks cost
+// nothing. B input rows share every weight vector loaded.
+// ----------------------------------------------------------------------------
+
+constexpr char BSR_MAGIC[4] = {'B', 'S', 'R', '1'};
+
+struct BsrView {
+    const uint32_t* row_start;
+    const uint32_t* columns;
+    const float* values;
+    const float* bias;
+    size_t block_rows_count; ///< outputs / R
+    size_t block_cols;       ///< C
+    size_t inputs;
+};
+
+template <int R>
+void block_sparse_scalar(const BsrView& w, const float* x, size_t rows, float* out,
+                         size_t row_stride, size_t col_stride, bool relu) {
+    const size_t block = R * w.block_cols;
+    for (size_t r = 0; r < rows; ++r) {
+        const float* xr = x + r * w.inputs;
+        for (size_t br = 0; br < w.block_rows_count; ++br) {
+            float sums[1][R] = {};
+            for (uint32_t b = w.row_start[br]; b < w.row_start[br + 1]; ++b) {
+                const float* values = w.values + b * block;
+                const float* xb = xr + w.columns[b] * w.block_cols;
+                for (int i = 0; i < R; ++i) {
+                    for (size_t k = 0; k < w.block_cols; ++k) {
+                        sums[0][i] += values[i * w.block_cols + k] * xb[k];
+                    }
+                }
+            }
+            store_block<1, R>(sums, w.bias + br * R, out + r * row_stride + br * R * col_stride,
+                              row_stride, col_stride, relu);
+        }
+    }
+}
+
+#if DIGIT_KERNELS_X86
+
+/**
+ * @brief B input rows against every block row.
+ */
+template <int B, int R>
+__attribute__((target("avx2,fma"))) void block_sparse_rows_avx2(const BsrView& w,
+                                                                const float* x, float* out,
+                                                                size_t row_stride,
+                                                                size_t col_stride, bool relu) {
+    const size_t block = R * w.block_cols;
+    for (size_t br = 0; br < w.block_rows_count; ++br) {
+        __m256 acc[B][R];
+        for (int b = 0; b < B; ++b) {
+            for (int i = 0; i < R; ++i) {
+                acc[b][i] = _mm256_setzero_ps();
+            }
+        }
+        for (uint32_t s = w.row_start[br]; s < w.row_start[br + 1]; ++s) {
+            const float* values = w.values + s * block;
+            const float* xb = x + w.columns[s] * w.block_cols;
+            for (size_t k = 0; k < w.block_cols; k += 8) {
+                __m256 weights[R];
+                for (int i = 0; i < R; ++i) {
+                    weights[i] = _mm256_loadu_ps(values + i * w.block_cols + k);
+                }
+                for (int b = 0; b < B; ++b) {
+                    const __m256 xv = _mm256_loadu_ps(xb + b * w.inputs + k);
+                    for (int i = 0; i < R; ++i) {
+                        acc[b][i] = _mm256_fmadd_ps(weights[i], xv, acc[b][i]);
+                    }
+                }
+            }
+        }
+        float sums[B][R];
+        for (int b = 0; b < B; ++b) {
+            for (int i = 0; i < R; ++i) {
+                sums[b][i] = sum8(acc[b][i]);
+            }
+        }
+        store_block<B, R>(sums, w.bias + br * R, out + br * R * col_stride, row_stride,
+                          col_stride, relu);
+    }
+}
+
+template <int R>
+__attribute__((target("avx2,fma"))) void block_sparse_avx2(const BsrView& w, const float* x,
+                                                           size_t rows, float* out,
+                                                           size_t row_stride,
+                                                           size_t col_stride, bool relu) {
+    // Four block rows' accumulators for two input rows, or two or one for four
+    constexpr int B = R == 4 ? 2 : 4;
+    size_t r = 0;
+    for (; r + B <= rows; r += B) {
+        block_sparse_rows_avx2<B, R>(w, x + r * w.inputs, out + r * row_stride, row_stride,
+                                     col_stride, relu);
+    }
+    for (; r < rows; ++r) {
+        block_sparse_rows_avx2<1, R>(w, x + r * w.inputs, out + r * row_stride, row_stride,
+                                     col_stride, relu);
+    }
+}
+
+#endif // DIGIT_KERNELS_X86
+
+template <int R>
+void block_sparse(bool avx2, const BsrView& w, const float* x, size_t rows, float* out,
+                  size_t row_stride, size_t col_stride, bool relu) {
+#if DIGIT_KERNELS_X86
+    if (avx2) {
+        block_sparse_avx2<R>(w, x, rows, out, row_stride, col_stride, relu);
+        return;
+    }
+#else
+    (void)avx2;
+#endif
+    block_sparse_scalar<R>(w, x, rows, out, row_stride, col_stride, relu);
+}
+
+/**
+ * @brief Reads count little-endian 32-bit values.
+ */
+template <typename T>
+void read_le32(std::istream& in, T* values, size_t count, const std::string& path) {
+    static_assert(sizeof(T) == 4, "32-bit values only");
+    std::vector<unsigned char> bytes(count * 4);
+    if (!in.read(reinterpret_cast<char*>(bytes.data()),
+                 static_cast<std::streamsize>(bytes.size()))) {
+        throw std::runtime_error("Truncated block-sparse weights: " + path);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char* b = bytes.data() + i * 4;
+        const uint32_t word = uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) |
+                              (uint32_t(b[3]) << 24);
+        std::memcpy(values + i, &word, 4);
+    }
+}
+
+} // namespace
+
+WeightPrecision parse_weight_precision(const std::string& name) {
+    if (name == "fp32") {
+        return WeightPrecision::Fp32;
+    }
+    if (name == "fp16") {
+        return WeightPrecision::Fp16;
+    }
+    if (name == "bf16") {
+        return WeightPrecision::Bf16;
+    }
+    throw std::invalid_argument("Unknown weight precision '" + name +
+                                "' (expected fp32, fp16 or bf16)");
+}
+
+std::string to_string(WeightPrecision precision) {
+    switch (precision) {
+    case WeightPrecision::Fp16:
+        return "fp16";
+    case WeightPrecision::Bf16:
+        return "bf16";
+    default:
+        return "fp32";
+    }
+}
+
+std::string kernel_isa(WeightPrecision precision) {
+    const CpuFeatures& cpu = cpu_features();
+    switch (precision) {
+    case WeightPrecision::Fp16:
+        return cpu.avx2 ? "avx2+fma+f16c" : "scalar";
+    case WeightPrecision::Bf16:
+        return cpu.avx512_bf16 ? "avx512_bf16" : cpu.avx2 ? "avx2+fma" : "scalar";
+    default:
+        return "libtorch";
+    }
+}
+
+ConvAlgorithm parse_conv_algorithm(const std::string& name) {
+    if (name == "direct") {
+        return ConvAlgorithm::Direct;
+    }
+    if (name == "im2col") {
+        return ConvAlgorithm::Im2col;
+    }
+    if (name == "winograd") {
+        return ConvAlgorithm::Winograd;
+    }
+    throw std::invalid_argument("Unknown conv algorithm '" + name +
+                                "' (expected direct, im2col or winograd)");
+}
+
+std::string to_string(ConvAlgorithm algorithm) {
+    switch (algorithm) {
+    case ConvAlgorithm::Im2col:
+        return "im2col";
+    case ConvAlgorithm::Winograd:
+        return "winograd";
+    default:
+        return "direct";
+    }
+}
+
+bool KernelOptions::enabled() const {
+    return std::any_of(precision.begin(), precision.end(),
+                       [](const auto& entry) { return entry.second != WeightPrecision::Fp32; }) ||
+           std::any_of(conv_algorithm.begin(), conv_algorithm.end(),
+                       [](const auto& entry) { return entry.second != ConvAlgorithm::Direct; }) ||
+           !block_sparse.empty();
+}
+
+PackedLinear::PackedLinear(const float* weight, const float* bias, size_t outputs,
+                           size_t inputs, WeightPrecision precision)
+    : m_outputs(outputs),
+      m_inputs(inputs),
+      m_stride((inputs + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT),
+      m_precision(precision),
+      m_dot_bf16(precision == WeightPrecision::Bf16 && cpu_features().avx512_bf16),
+      m_avx2(cpu_features().avx2),
+      m_weights(outputs * m_stride, 0),
+      m_bias(outputs, 0.0f) {
+    if (precision == WeightPrecision::Fp32) {
+        throw std::invalid_argument("PackedLinear: fp32 weights are not packed");
+    }
+    if (outputs == 0 || inputs == 0) {
+        throw std::invalid_argument("PackedLinear: empty weight matrix");
+    }
+    for (size_t o = 0; o < outputs; ++o) {
+        for (size_t k = 0; k < inputs; ++k) {
+            const float value = weight[o * inputs + k];
+            m_weights[o * m_stride + k] = precision == WeightPrecision::Bf16
+                                              ? float_to_bf16(value)
+                                              : float_to_half(value);
+        }
+    }
+    if (bias != nullptr) {
+        std::copy(bias, bias + outputs, m_bias.begin());
+    }
+}
+
+void PackedLinear::run(const float* x, size_t rows, float* out, size_t row_stride,
+                       size_t col_stride, bool relu) const {
+    const bool bf16 = m_precision == WeightPrecision::Bf16;
+#if DIGIT_KERNELS_X86
+    if (m_dot_bf16) {
+        linear_dot_bf16(x, rows, m_inputs, m_weights.data(), m_stride, m_outputs, m_bias.data(),
+                        out, row_stride, col_stride, relu);
+        return;
+    }
+    if (m_avx2) {
+        (bf16 ? linear_avx2<true> : linear_avx2<false>)(x, rows, m_inputs, m_weights.data(),
+                                                        m_stride, m_outputs, m_bias.data(), out,
+                                                        row_stride, col_stride, relu);
+        return;
+    }
+#endif
+    (bf16 ? linear_scalar<true> : linear_scalar<false>)(x, rows, m_inputs, m_weights.data(),
+                                                        m_stride, m_outputs, m_bias.data(), out,
+                                                        row_stride, col_stride, relu);
+}
+
+void im2col_3x3(const float* image, size_t channels, size_t height, size_t width,
+                float* columns) {
+    const size_t positions = height * width;
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t xx = 0; xx < width; ++xx) {
+            float* row = columns + (y * width + xx) * channels * 9;
+            for (size_t c = 0; c < channels; ++c) {
+                const float* plane = image + c * positions;
+                for (int ky = -1; ky <= 1; ++ky) {
+                    for (int kx = -1; kx <= 1; ++kx) {
+                        const long iy = static_cast<long>(y) + ky;
+                        const long ix = static_cast<long>(xx) + kx;
+                        const bool inside = iy >= 0 && ix >= 0 &&
+                                            iy < static_cast<long>(height) &&
+                                            ix < static_cast<long>(width);
+                        *row++ = inside ? plane[iy * static_cast<long>(width) + ix] : 0.0f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+PackedConv3x3::PackedConv3x3(const float* weight, const float* bias, size_t out_channels,
+                             size_t in_channels, WeightPrecision precision)
+    : m_in_channels(in_channels),
+      m_linear(weight, bias, out_channels, in_channels * 9, precision) {}
+
+void PackedConv3x3::run(const float* x, size_t batch, size_t height, size_t width, float* out,
+                        bool relu) const {
+    const size_t positions = height * width;
+    const size_t patch = m_in_channels * 9;
+    std::vector<float>& columns = t_columns;
+    if (columns.size() < positions * patch) {
+        columns.resize(positions * patch);
+    }
+    for (size_t b = 0; b < batch; ++b) {
+        // 1. One row per output position
+        im2col_3x3(x + b * m_in_channels * positions, m_in_channels, height, width,
+                   columns.data());
+
+        // 2. Positions against filters, written back channel-major
+        m_linear.run(columns.data(), positions, out + b * m_linear.outputs() * positions, 1,
+                     positions, relu);
+    }
+}
+
+WinogradConv3x3::WinogradConv3x3(const float* weight, const float* bias, size_t out_channels,
+                                 size_t in_channels)
+    : m_out_channels(out_channels),
+      m_in_channels(in_channels),
+      m_avx2(cpu_features().avx2),
+      m_filters(16 * out_channels * in_channels),
+      m_bias(out_channels, 0.0f) {
+    if (out_channels == 0 || in_channels == 0) {
+        throw std::invalid_argument("WinogradConv3x3: empty filter bank");
+    }
+    const size_t step = out_channels * in_channels;
+    for (size_t o = 0; o < out_channels; ++o) {
+        for (size_t c = 0; c < in_channels; ++c) {
+            filter_transform(weight + (o * in_channels + c) * 9,
+                             m_filters.data() + o * in_channels + c, step);
+        }
+    }
+    if (bias != nullptr) {
+        std::copy(bias, bias + out_channels, m_bias.begin());
+    }
+}
+
+std::string WinogradConv3x3::isa() {
+    return cpu_features().avx2 ? "avx2+fma" : "scalar";
+}
+
+void WinogradConv3x3::run(const float* x, size_t batch, size_t height, size_t width, float* out,
+                          bool relu) const {
+    if (height % 2 != 0 || width % 2 != 0) {
+        throw std::invalid_argument("WinogradConv3x3: height and width must be even");
+    }
+    WinogradPass pass;
+    pass.height = height;
+    pass.width = width;
+    pass.tile_rows = height / 2;
+    pass.tile_cols = width / 2;
+    pass.tiles = pass.tile_rows * pass.tile_cols;
+    pass.split_cols = pass.tile_cols + WINOGRAD_SPLIT_PAD;
+    const size_t per_pass = std::max<size_t>(1, WINOGRAD_TILES / pass.tiles);
+    const size_t plane = height * width;
+
+    for (size_t first = 0; first < batch; first += per_pass) {
+        pass.images = std::min(per_pass, batch - first);
+        const size_t columns = (pass.images * pass.tiles + 15) / 16 * 16;
+        pass.stride = columns + 16; // Room for the last row's eight-tile loads
+
+        std::vector<float>& inputs = t_winograd_inputs;
+        std::vector<float>& products = t_winograd_products;
+        std::vector<float>& split = t_winograd_split;
+        if (inputs.size() < 16 * m_in_channels * pass.stride) {
+            inputs.resize(16 * m_in_channels * pass.stride);
+        }
+        if (products.size() < 16 * WINOGRAD_BLOCK * pass.stride) {
+            products.resize(16 * WINOGRAD_BLOCK * pass.stride);
+        }
+        if (split.size() < (height + 2) * 2 * pass.split_cols) {
+            split.resize((height + 2) * 2 * pass.split_cols);
+        }
+
+        // 1. B^T d B for every tile of every input channel
+        for (size_t i = 0; i < pass.images; ++i) {
+            for (size_t c = 0; c < m_in_channels; ++c) {
+                split_columns(x + ((first + i) * m_in_channels + c) * plane, pass, split.data());
+                float* v = inputs.data() + c * pass.stride + i * pass.tiles;
+#if DIGIT_KERNELS_X86
+                if (m_avx2) {
+                    input_transform_avx2(split.data(), pass, v, m_in_channels * pass.stride);
+                    continue;
+                }
+#endif
+                input_transform_scalar(split.data(), pass, v, m_in_channels * pass.stride);
+            }
+        }
+
+        for (size_t block = 0; block < m_out_channels; block += WINOGRAD_BLOCK) {
+            const size_t outputs = std::min(WINOGRAD_BLOCK, m_out_channels - block);
+
+            // 2. The 16 elementwise products, each a sum over input channels
+            const float* u = m_filters.data() + block * m_in_channels;
+            bool multiplied = false;
+#if DIGIT_KERNELS_X86
+            if (m_avx2) {
+                products_avx2(u, inputs.data(), outputs, m_in_channels, m_out_channels,
+                              pass.stride, columns, products.data());
+                multiplied = true;
+            }
+#endif
+            if (!multiplied) {
+                products_scalar(u, inputs.data(), outputs, m_in_channels, m_out_channels,
+                                pass.stride, columns, products.data());
+            }
+
+            // 3. A^T m A back into 2x2 outputs, with the bias and ReLU
+            for (size_t i = 0; i < pass.images; ++i) {
+                for (size_t o = 0; o < outputs; ++o) {
+                    const float* m = products.data() + o * pass.stride + i * pass.tiles;
+                    float* y = out + ((first + i) * m_out_channels + block + o) * plane;
+#if DIGIT_KERNELS_X86
+                    if (m_avx2) {
+                        output_transform_avx2(m, pass, m_bias[block + o], relu, y,
+                                              WINOGRAD_BLOCK * pass.stride);
+                        continue;
+                    }
+#endif
+                    output_transform_scalar(m, pass, m_bias[block + o], relu, y,
+                                            WINOGRAD_BLOCK * pass.stride);
+                }
+            }
+        }
+    }
+}
+
+BlockSparseLinear::BlockSparseLinear(const float* weight, const float* bias, size_t outputs,
+                                     size_t inputs, size_t block_rows, size_t block_cols)
+    : m_outputs(outputs),
+      m_inputs(inputs),
+      m_block_rows(block_rows),
+      m_block_cols(block_cols),
+      m_avx2(cpu_features().avx2),
+      m_bias(outputs, 0.0f) {
+    check_shape();
+    m_row_start.push_back(0);
+    for (size_t br = 0; br < outputs / block_rows; ++br) {
+        for (size_t bc = 0; bc < inputs / block_cols; ++bc) {
+            // 1. Keep the block if any weight in it survived
+            bool kept = false;
+            for (size_t i = 0; i < block_rows && !kept; ++i) {
+                const float* row = weight + (br * block_rows + i) * inputs + bc * block_cols;
+                kept = std::any_of(row, row + block_cols, [](float v) { return v != 0.0f; });
+            }
+            if (!kept) {
+                continue;
+            }
+
+            // 2. Its values, row by row
+            m_columns.push_back(static_cast<uint32_t>(bc));
+            for (size_t i = 0; i < block_rows; ++i) {
+                const float* row = weight + (br * block_rows + i) * inputs + bc * block_cols;
+                m_values.insert(m_values.end(), row, row + block_cols);
+            }
+        }
+        m_row_start.push_back(static_cast<uint32_t>(m_columns.size()));
+    }
+    if (bias != nullptr) {
+        std::copy(bias, bias + outputs, m_bias.begin());
+    }
+}
+
+BlockSparseLinear BlockSparseLinear::read(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Could not open block-sparse weights: " + path);
+    }
+
+    // 1. Header
+    char magic[4];
+    if (!in.read(magic, 4) || !std::equal(magic, magic + 4, BSR_MAGIC)) {
+        throw std::runtime_error("Not a block-sparse weight file: " + path);
+    }
+    uint32_t header[5];
+    read_le32(in, header, 5, path);
+    BlockSparseLinear layer;
+    layer.m_outputs = header[0];
+    layer.m_inputs = header[1];
+    layer.m_block_rows = header[2];
+    layer.m_block_cols = header[3];
+    layer.m_avx2 = cpu_features().avx2;
+    layer.check_shape();
+    const size_t blocks = header[4];
+    const size_t block_rows_count = layer.m_outputs / layer.m_block_rows;
+    const size_t block_cols_count = layer.m_inputs / layer.m_block_cols;
+    if (blocks > block_rows_count * block_cols_count) {
+        throw std::runtime_error("More blocks than the matrix holds: " + path);
+    }
+
+    // 2. Indices, which must describe each block row's blocks in order
+    layer.m_row_start.resize(block_rows_count + 1);
+    layer.m_columns.resize(blocks);
+    read_le32(in, layer.m_row_start.data(), layer.m_row_start.size(), path);
+    read_le32(in, layer.m_columns.data(), blocks, path);
+    if (layer.m_row_start.front() != 0 || layer.m_row_start.back() != blocks) {
+        throw std::runtime_error("Block row offsets do not cover the blocks: " + path);
+    }
+    for (size_t br = 0; br < block_rows_count; ++br) {
+        const uint32_t begin = layer.m_row_start[br];
+        const uint32_t end = layer.m_row_start[br + 1];
+        if (end < begin) {
+            throw std::runtime_error("Block row offsets go backwards: " + path);
+        }
+        for (uint32_t b = begin; b < end; ++b) {
+            if (layer.m_columns[b] >= block_cols_count ||
+                (b > begin && layer.m_columns[b] <= layer.m_columns[b - 1])) {
+                throw std::runtime_error("Block columns out of range or order: " + path);
+            }
+        }
+    }
+
+    // 3. Values and bias
+    layer.m_values.resize(blocks * layer.m_block_rows * layer.m_block_cols);
+    layer.m_bias.resize(layer.m_outputs);
+    read_le32(in, layer.m_values.data(), layer.m_values.size(), path);
+    read_le32(in, layer.m_bias.data(), layer.m_bias.size(), path);
+    return layer;
+}
+
+void BlockSparseLinear::check_shape() const {
+    if (m_block_rows != 1 && m_block_rows != 2 && m_block_rows != 4) {
+        throw std::invalid_argument("BlockSparseLinear: block rows must be 1, 2 or 4");
+    }
+    if (m_block_cols == 0 || m_block_cols % 8 != 0) {
+        throw std::invalid_argument("BlockSparseLinear: block columns must be a multiple of 8");
+    }
+    if (m_outputs == 0 || m_inputs == 0 || m_outputs % m_block_rows != 0 ||
+        m_inputs % m_block_cols != 0) {
+        throw std::invalid_argument("BlockSparseLinear: " + std::to_string(m_outputs) + "x" +
+                                    std::to_string(m_inputs) + " is not whole " +
+                                    std::to_string(m_block_rows) + "x" +
+                                    std::to_string(m_block_cols) + " blocks");
+    }
+}
+
+void BlockSparseLinear::run(const float* x, size_t rows, float* out, size_t row_stride,
+                            size_t col_stride, bool relu) const {
+    const BsrView w{m_row_start.data(), m_columns.data(), m_values.data(), m_bias.data(),
+                    m_outputs / m_block_rows, m_block_cols, m_inputs};
+    switch (m_block_rows) {
+    case 4:
+        block_sparse<4>(m_avx2, w, x, rows, out, row_stride, col_stride, relu);
+        break;
+    case 2:
+        block_sparse<2>(m_avx2, w, x, rows, out, row_stride, col_stride, relu);
+        break;
+    default:
+        block_sparse<1>(m_avx2, w, x, rows, out, row_stride, col_stride, relu);
+        break;
+    }
+}
+
+std::vector<float> BlockSparseLinear::dense() const {
+    std::vector<float> weight(m_outputs * m_inputs, 0.0f);
+    const size_t block = m_block_rows * m_block_cols;
+    for (size_t br = 0; br + 1 < m_row_start.size(); ++br) {
+        for (uint32_t b = m_row_start[br]; b < m_row_start[br + 1]; ++b) {
+            for (size_t i = 0; i < m_block_rows; ++i) {
+                const float* values = m_values.data() + b * block + i * m_block_cols;
+                std::copy(values, values + m_block_cols,
+                          weight.begin() + (br * m_block_rows + i) * m_inputs +
+                              m_columns[b] * m_block_cols);
+            }
+        }
+    }
+    return weight;
+}
+
+double BlockSparseLinear::density() const {
+    const size_t total = (m_outputs / m_block_rows) * (m_inputs / m_block_cols);
+    return static_cast<double>(blocks()) / static_cast<double>(total);
+}
+
+size_t BlockSparseLinear::weight_bytes() const {
+    return m_values.size() * sizeof(float) +
+           (m_row_start.size() + m_columns.size()) * sizeof(uint32_t);
+}
+
+std::string BlockSparseLinear::isa() {
+    return cpu_features().avx2 ? "avx2+fma" : "scalar";
+}
@@ -0,0 +1,161 @@
+#include "MnistIdx.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint32_t IDX3_MAGIC = 0x00000803; ///< unsigned byte, 3 dimensions
+constexpr uint32_t IDX1_MAGIC = 0x00000801; ///< unsigned byte, 1 dimension
+
+uint32_t read_be32(std::istream& in, const std::string& path) {
+    unsigned char bytes[4];
+    if (!in.read(reinterpret_cast<char*>(bytes), 4)) {
+        throw std::runtime_error("Truncated IDX header: " + path);
+    }
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+           (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+uint32_t be32_at(const void* base, size_t offset) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(base) + offset;
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+           (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+} // namespace
+
+MnistSet load_mnist_idx(const std::string& images_path, const std::string& labels_path,
+                        size_t limit) {
+    MnistSet set;
+
+    // 1. Images: magic, count, rows, cols, then count*rows*cols bytes
+    std::ifstream images(images_path, std::ios::binary);
+    if (!images.is_open()) {
+        throw std::runtime_error("Could not open IDX file: " + images_path);
+    }
+    if (read_be32(images, images_path) != IDX3_MAGIC) {
+        throw std::runtime_error("Not an idx3 image file: " + images_path);
+    }
+    set.count = read_be32(images, images_path);
+    set.rows = read_be32(images, images_path);
+    set.cols = read_be32(images, images_path);
+    if (limit != 0 && limit < set.count) {
+        set.count = static_cast<uint32_t>(limit);
+    }
+    set.pixels.resize(static_cast<size_t>(set.count) * set.image_bytes());
+    if (!images.read(reinterpret_cast<char*>(set.pixels.data()),
+                     static_cast<std::streamsize>(set.pixels.size()))) {
+        throw std::runtime_error("Truncated IDX image data: " + images_path);
+    }
+
+    // 2. Labels (optional): magic, count, then one byte per image
+    if (!labels_path.empty()) {
+        std::ifstream labels(labels_path, std::ios::binary);
+        if (!labels.is_open()) {
+            throw std::runtime_error("Could not open IDX file: " + labels_path);
+        }
+        if (read_be32(labels, labels_path) != IDX1_MAGIC) {
+            throw std::runtime_error("Not an idx1 label file: " + labels_path);
+        }
+        if (read_be32(labels, labels_path) < set.count) {
+            throw std::runtime_error("Label file has fewer entries than images: " + labels_path);
+        }
+        set.labels.resize(set.count);
+        if (!labels.read(reinterpret_cast<char*>(set.labels.data()),
+                         static_cast<std::streamsize>(set.labels.size()))) {
+            throw std::runtime_error("Truncated IDX label data: " + labels_path);
+        }
+    }
+    return set;
+}
+
+std::string mnist_labels_path_for(const std::string& images_path) {
+    const std::string from = "images-idx3-ubyte";
+    const size_t pos = images_path.rfind(from);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    std::string labels_path = images_path;
+    labels_path.replace(pos, from.size(), "labels-idx1-ubyte");
+    return labels_path;
+}
+
+MappedMnist::Mapping MappedMnist::map_file(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open IDX file: " + path);
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size < 8) {
+        ::close(fd);
+        throw std::runtime_error("Truncated IDX header: " + path);
+    }
+    Mapping mapping;
+    mapping.size = static_cast<size_t>(st.st_size);
+    mapping.base = ::mmap(nullptr, mapping.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping.base == MAP_FAILED) {
+        throw std::runtime_error("Could not map IDX file: " + path);
+    }
+    // Shuffled batches touch the whole file every epoch; read it ahead
+    ::madvise(mapping.base, mapping.size, MADV_WILLNEED);
+    return mapping;
+}
+
+MappedMnist::MappedMnist(const std::string& images_path, const std::string& labels_path) {
+    try {
+        // 1. Images: magic, count, rows, cols, then count*rows*cols bytes
+        m_images = map_file(images_path);
+        if (be32_at(m_images.base, 0) != IDX3_MAGIC) {
+            throw std::runtime_error("Not an idx3 image file: " + images_path);
+        }
+        if (m_images.size < 16) {
+            throw std::runtime_error("Truncated IDX header: " + images_path);
+        }
+        m_count = be32_at(m_images.base, 4);
+        m_rows = be32_at(m_images.base, 8);
+        m_cols = be32_at(m_images.base, 12);
+        if (m_images.size - 16 < static_cast<size_t>(m_count) * image_bytes()) {
+            throw std::runtime_error("Truncated IDX image data: " + images_path);
+        }
+        m_pixels = static_cast<const uint8_t*>(m_images.base) + 16;
+
+        // 2. Labels (optional): magic, count, then one byte per image
+        if (!labels_path.empty()) {
+            m_label_file = map_file(labels_path);
+            if (be32_at(m_label_file.base, 0) != IDX1_MAGIC) {
+                throw std::runtime_error("Not an idx1 label file: " + labels_path);
+            }
+            if (be32_at(m_label_file.base, 4) < m_count) {
+                throw std::runtime_error("Label file has fewer entries than images: " +
+                                         labels_path);
+            }
+            if (m_label_file.size - 8 < m_count) {
+                throw std::runtime_error("Truncated IDX label data: " + labels_path);
+            }
+            m_labels = static_cast<const uint8_t*>(m_label_file.base) + 8;
+        }
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+MappedMnist::~MappedMnist() {
+    unmap();
+}
+
+void MappedMnist::unmap() {
+    for (Mapping* mapping : {&m_images, &m_label_file}) {
+        if (mapping->base != nullptr) {
+            ::munmap(mapping->base, mapping->size);
+            mapping->base = nullptr;
+        }
+    }
+}
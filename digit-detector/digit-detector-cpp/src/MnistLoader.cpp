@@ -0,0 +1,169 @@
+#include "MnistLoader.h"
+#include "ImageProcessor.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+// (x / 255 - mean) / std as one multiply-add
+constexpr float PIXEL_SCALE =
+    static_cast<float>(1.0 / (255.0 * ImageProcessor::MNIST_STD));
+constexpr float PIXEL_OFFSET =
+    static_cast<float>(-ImageProcessor::MNIST_MEAN / ImageProcessor::MNIST_STD);
+
+size_t count_batches(const MappedMnist& set, const LoaderOptions& options) {
+    if (options.batch_size <= 0 || options.workers <= 0 || options.prefetch == 0) {
+        throw std::invalid_argument(
+            "MnistBatchLoader: batch_size, workers and prefetch must be positive");
+    }
+    if (options.augment.enabled() &&
+        (set.rows() != Augmenter::SIDE || set.cols() != Augmenter::SIDE)) {
+        throw std::invalid_argument("MnistBatchLoader: augmentation needs 28x28 images");
+    }
+    const size_t batch = static_cast<size_t>(options.batch_size);
+    return options.drop_last ? set.count() / batch : (set.count() + batch - 1) / batch;
+}
+
+} // namespace
+
+MnistBatchLoader::MnistBatchLoader(const MappedMnist& set, LoaderOptions options)
+    : m_set(set), m_options(options), m_batches(count_batches(set, options)),
+      m_augmenter(options.augment), m_order(set.count()),
+      m_slots(options.prefetch), m_ready(options.prefetch, false)
+{
+    std::iota(m_order.begin(), m_order.end(), 0u);
+}
+
+MnistBatchLoader::~MnistBatchLoader() {
+    stop();
+}
+
+void MnistBatchLoader::start_epoch(uint64_t epoch) {
+    stop();
+    m_epoch = epoch;
+
+    // 1. The epoch's order, from the seed alone
+    std::iota(m_order.begin(), m_order.end(), 0u);
+    if (m_options.shuffle) {
+        std::mt19937_64 rng(m_options.seed + epoch);
+        std::shuffle(m_order.begin(), m_order.end(), rng);
+    }
+
+    // 2. Empty ring, fresh workers
+    m_next_claim = 0;
+    m_consumed = 0;
+    m_stopping = false;
+    m_error = nullptr;
+    std::fill(m_ready.begin(), m_ready.end(), false);
+    for (MnistBatch& slot : m_slots) {
+        slot = MnistBatch();
+    }
+    for (int i = 0; i < m_options.workers; ++i) {
+        m_workers.emplace_back(&MnistBatchLoader::work, this);
+    }
+}
+
+bool MnistBatchLoader::next(MnistBatch& batch) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_workers.empty()) {
+        throw std::logic_error("MnistBatchLoader: next() before start_epoch()");
+    }
+    if (m_consumed >= m_batches) {
+        return false;
+    }
+    const size_t slot = m_consumed % m_slots.size();
+    m_ready_cv.wait(lock, [&] { return m_ready[slot] || m_error; });
+    if (!m_ready[slot]) {
+        std::rethrow_exception(m_error);
+    }
+    batch = std::move(m_slots[slot]);
+    m_slots[slot] = MnistBatch();
+    m_ready[slot] = false;
+    ++m_consumed;
+    lock.unlock();
+    m_space_cv.notify_all();
+    return true;
+}
+
+void MnistBatchLoader::work() {
+    for (;;) {
+        // 1. Claim the next batch once its slot has been consumed
+        size_t index = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_space_cv.wait(lock, [&] {
+                return m_stopping || m_next_claim >= m_batches ||
+                       m_next_claim < m_consumed + m_slots.size();
+            });
+            if (m_stopping || m_next_claim >= m_batches) {
+                return;
+            }
+            index = m_next_claim++;
+        }
+
+        // 2. Assemble it outside the lock and publish it
+        try {
+            MnistBatch batch = assemble(index);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_slots[index % m_slots.size()] = std::move(batch);
+            m_ready[index % m_slots.size()] = true;
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error) {
+                m_error = std::current_exception();
+            }
+            m_stopping = true;
+        }
+        m_ready_cv.notify_all();
+        m_space_cv.notify_all();
+    }
+}
+
+void MnistBatchLoader::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_space_cv.notify_all();
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+    m_workers.clear();
+}
+
+MnistBatch MnistBatchLoader::assemble(size_t index) const {
+    const size_t batch = static_cast<size_t>(m_options.batch_size);
+    const size_t begin = index * batch;
+    const size_t rows = std::min(batch, static_cast<size_t>(m_set.count()) - begin);
+    const size_t pixels = m_set.image_bytes();
+
+    MnistBatch out;
+    out.images = torch::empty({static_cast<int64_t>(rows), 1, static_cast<int64_t>(m_set.rows()),
+                               static_cast<int64_t>(m_set.cols())},
+                              torch::kFloat32);
+    float* images = out.images.data_ptr<float>();
+    for (size_t i = 0; i < rows; ++i) {
+        // Contiguous uint8 in, contiguous float out: vectorized by the compiler
+        const uint8_t* src = m_set.image(m_order[begin + i]);
+        float* dst = images + i * pixels;
+        for (size_t p = 0; p < pixels; ++p) {
+            dst[p] = static_cast<float>(src[p]) * PIXEL_SCALE + PIXEL_OFFSET;
+        }
+    }
+    if (m_options.augment.enabled()) {
+        // A seed per (seed + epoch, batch), as the shuffle is per seed + epoch
+        const uint64_t seed = (m_options.seed + m_epoch) * m_batches + index;
+        m_augmenter.augment(images, images, rows, seed);
+    }
+    if (m_set.has_labels()) {
+        out.labels = torch::empty({static_cast<int64_t>(rows)}, torch::kInt64);
+        int64_t* labels = out.labels.data_ptr<int64_t>();
+        for (size_t i = 0; i < rows; ++i) {
+            labels[i] = m_set.label(m_order[begin + i]);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,81 @@
+#include "ModelRegistry.h"
+#include "InferenceEngine.h"
+
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+ServedModel::ServedModel(ModelConfig config)
+    : m_config(std::move(config))
+{
+    if (m_config.weight <= 0.0) {
+        throw std::invalid_argument("Model " + key() + ": weight must be positive");
+    }
+    if (m_config.max_batch == 0) {
+        throw std::invalid_argument("Model " + key() + ": max_batch must be at least 1");
+    }
+    if (m_config.tta_variants > 1 && !m_config.pipeline.stages.empty()) {
+        // Pipeline stages run the layers themselves, past predict_batch()
+        throw std::invalid_argument("Model " + key() +
+                                    ": tta_variants does not combine with a pipeline");
+    }
+    if (!m_config.pipeline.stages.empty()) {
+        // As for PreforkServer: workers forked from a process that has
+        // started LibTorch's intra-op pool can hang in their first layer
+        at::set_num_threads(1);
+    }
+    m_engine = std::make_unique<InferenceEngine>(m_config.model_path);
+    m_engine->use_kernels(m_config.kernels);
+    m_engine->use_tta(m_config.tta_variants);
+    m_weight_bytes = m_engine->weight_bytes();
+    if (!m_config.pipeline.stages.empty()) {
+        m_pipeline = std::make_unique<PipelineExecutor>(*m_engine, m_config.pipeline);
+    }
+}
+
+ServedModel::~ServedModel() = default;
+
+std::shared_ptr<ServedModel> ModelRegistry::add(const ModelConfig& config) {
+    // Load outside the lock; it is the slow part
+    return add(std::make_shared<ServedModel>(config));
+}
+
+std::shared_ptr<ServedModel> ModelRegistry::add(std::shared_ptr<ServedModel> model) {
+    const ModelConfig& config = model->config();
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    const auto key = std::make_pair(config.name, config.version);
+    if (m_models.count(key) != 0) {
+        throw std::invalid_argument("Model " + model->key() + " is already registered");
+    }
+    m_models[key] = model;
+    m_latest[config.name] = model;
+    if (!m_default) {
+        m_default = model;
+    }
+    std::cout << "ModelRegistry: registered " << model->key() << " (" << model->weight_bytes()
+              << " bytes of weights, weight " << config.weight << ")" << std::endl;
+    return model;
+}
+
+std::shared_ptr<ServedModel> ModelRegistry::find(const std::string& spec) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    if (spec.empty()) {
+        return m_default;
+    }
+    const size_t colon = spec.find(':');
+    if (colon == std::string::npos) {
+        auto it = m_latest.find(spec);
+        return it == m_latest.end() ? nullptr : it->second;
+    }
+    auto it = m_models.find({spec.substr(0, colon), spec.substr(colon + 1)});
+    return it == m_models.end() ? nullptr : it->second;
+}
+
+std::vector<std::shared_ptr<ServedModel>> ModelRegistry::models() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    std::vector<std::shared_ptr<ServedModel>> result;
+    for (const auto& [key, model] : m_models) {
+        result.push_back(model);
+    }
+    return result;
+}
@@ -0,0 +1,556 @@
+#include "ModelScheduler.h"
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+size_t class_index(Priority priority) {
+    return priority == Priority::Bulk ? 1 : 0;
+}
+
+/**
+ * @brief 64-bit key of a preprocessed input: a multiply-xorshift over its
+ * bytes, 8 at a time. Equal keys are confirmed byte for byte before two
+ * requests share a row.
+ */
+uint64_t input_key(const torch::Tensor& input) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(input.data_ptr<float>());
+    const size_t size = static_cast<size_t>(input.numel()) * sizeof(float);
+    uint64_t hash = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool same_input(const torch::Tensor& a, const torch::Tensor& b) {
+    return a.numel() == b.numel() &&
+           std::memcmp(a.data_ptr<float>(), b.data_ptr<float>(),
+                       static_cast<size_t>(a.numel()) * sizeof(float)) == 0;
+}
+
+Clock::time_point add_ns(Clock::time_point t, double ns) {
+    return t + std::chrono::duration_cast<Clock::duration>(
+                   std::chrono::duration<double, std::nano>(ns));
+}
+
+} // namespace
+
+struct ModelScheduler::Flight {
+    torch::Tensor input;          ///< [1, 1, 28, 28], contiguous
+    uint64_t key = 0;
+    size_t class_index = 0;
+    Order order;                  ///< Position in its class queue while queued
+    bool registered = false;      ///< Owns the key's slot in ModelQueue::flights
+    bool running = false;
+    std::vector<Pending> waiters; ///< The first one's request made the flight
+};
+
+ModelScheduler::ModelScheduler(WorkStealingPool& pool, uint32_t max_batches,
+                               ThreadBudget* budget)
+    : m_pool(pool),
+      m_budget(budget),
+      m_max_running(max_batches == 0 ? static_cast<uint32_t>(pool.size()) : max_batches)
+{
+    m_timer = std::thread(&ModelScheduler::timer_loop, this);
+}
+
+ModelScheduler::~ModelScheduler() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopping = true;
+    m_cv.notify_all();
+    // Batch tasks already on the pool still reference this scheduler
+    m_cv.wait(lock, [this] { return m_tasks == 0; });
+    lock.unlock();
+    m_timer.join();
+
+    for (auto& [key, queue] : m_queues) {
+        for (Pending& waiter : queue->raw) {
+            waiter.request.done(RequestStatus::Failed, Prediction{});
+        }
+        for (ClassQueue& pending : queue->classes) {
+            for (auto& [order, flight] : pending) {
+                for (Pending& waiter : flight->waiters) {
+                    waiter.request.done(RequestStatus::Failed, Prediction{});
+                }
+            }
+        }
+    }
+}
+
+bool ModelScheduler::submit(const std::shared_ptr<ServedModel>& model,
+                            InferenceRequest request) {
+    const ModelConfig& config = model->config();
+    RequestStatus refusal = RequestStatus::QueueFull;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto& slot = m_queues[model.get()];
+        if (!slot) {
+            slot = std::make_unique<ModelQueue>();
+            slot->model = model;
+        }
+        ModelQueue& queue = *slot;
+        ++queue.submitted;
+
+        const Clock::time_point now = Clock::now();
+        if (request.deadline == Clock::time_point::max() && config.deadline.count() > 0) {
+            request.deadline = now + config.deadline;
+        }
+
+        if (queue.size >= config.max_queue) {
+            ++queue.rejected;
+        } else if (!admissible(queue, request.priority, request.deadline, now)) {
+            ++queue.overloaded;
+            refusal = RequestStatus::Overloaded;
+        } else {
+            queue.queued_bytes += request.pixels.size();
+            ++queue.size;
+            queue.raw.push_back(Pending{std::move(request), now});
+            std::vector<std::shared_ptr<Pending>> ready = take_raw(queue);
+            lock.unlock();
+            post_prepares(queue, std::move(ready));
+            return true;
+        }
+    }
+    request.done(refusal, Prediction{});
+    return false;
+}
+
+std::vector<std::shared_ptr<ModelScheduler::Pending>> ModelScheduler::take_raw(ModelQueue& queue) {
+    const size_t window =
+        std::max<size_t>(2 * queue.model->config().max_batch, m_pool.size());
+    std::vector<std::shared_ptr<Pending>> ready;
+    while (!queue.raw.empty() && queue.preparing < window) {
+        ready.push_back(std::make_shared<Pending>(std::move(queue.raw.front())));
+        queue.raw.pop_front();
+        ++queue.preparing;
+        ++m_tasks;
+    }
+    return ready;
+}
+
+void ModelScheduler::post_prepares(ModelQueue& queue,
+                                   std::vector<std::shared_ptr<Pending>> pending) {
+    ModelQueue* target = &queue;
+    for (std::shared_ptr<Pending>& entry : pending) {
+        m_pool.submit([this, target, entry] { prepare(*target, std::move(*entry)); });
+    }
+}
+
+void ModelScheduler::prepare(ModelQueue& queue, Pending pending) {
+    // 1. Preprocess on this worker; a bad image fails only its own request
+    thread_local ImageProcessor processor;
+    InferenceRequest& request = pending.request;
+    auto flight = std::make_shared<Flight>();
+    bool ok = false;
+    try {
+        cv::Mat image(request.height, request.width, CV_8UC1, request.pixels.data());
+        flight->input = processor.process(image).contiguous();
+        ok = true;
+    } catch (const std::exception& e) {
+        std::cerr << "ModelScheduler: " << queue.model->key()
+                  << ": preprocessing failed: " << e.what() << std::endl;
+    }
+    const size_t pixel_bytes = request.pixels.size();
+    std::vector<uint8_t>().swap(request.pixels);
+    if (ok && queue.model->config().coalesce) {
+        flight->key = input_key(flight->input);
+    }
+
+    // 2. Queue it, or join an identical flight
+    std::unique_lock<std::mutex> lock(m_mutex);
+    queue.queued_bytes -= pixel_bytes;
+    --queue.preparing;
+    std::vector<std::shared_ptr<Pending>> ready = take_raw(queue);
+    if (ok) {
+        flight->class_index = class_index(request.priority);
+        flight->waiters.push_back(std::move(pending));
+        enqueue(queue, std::move(flight));
+    } else {
+        --queue.size;
+        ++queue.failed;
+    }
+    lock.unlock();
+    if (!ok) {
+        request.done(RequestStatus::Failed, Prediction{});
+    }
+    post_prepares(queue, std::move(ready));
+    lock.lock();
+    dispatch(lock);
+    if (--m_tasks == 0 && m_stopping) {
+        m_cv.notify_all();
+    }
+}
+
+void ModelScheduler::enqueue(ModelQueue& queue, std::shared_ptr<Flight> flight) {
+    const size_t c = flight->class_index;
+    ClassQueue& pending = queue.classes[c];
+    Pending& waiter = flight->waiters.front();
+    const bool coalesce = queue.model->config().coalesce;
+
+    if (coalesce) {
+        auto it = queue.flights[c].find(flight->key);
+        if (it != queue.flights[c].end() && same_input(it->second->input, flight->input)) {
+            Flight& existing = *it->second;
+            if (existing.running) {
+                // Answered by the batch in flight; no longer waiting in the queue
+                --queue.size;
+            } else if (waiter.request.deadline < existing.order.first) {
+                // Earliest deadline first still holds for the joiner
+                auto node = pending.extract(existing.order);
+                existing.order.first = waiter.request.deadline;
+                node.key() = existing.order;
+                pending.insert(std::move(node));
+            }
+            existing.waiters.push_back(std::move(waiter));
+            return;
+        }
+    }
+
+    flight->order = std::make_pair(waiter.request.deadline, m_sequence++);
+    if (coalesce) {
+        // A key taken by different bytes stays with its owner; this one runs alone
+        flight->registered = queue.flights[c].emplace(flight->key, flight).second;
+    }
+    pending.emplace(flight->order, std::move(flight));
+}
+
+uint32_t ModelScheduler::max_running() const {
+    return m_budget != nullptr ? m_budget->concurrency() : m_max_running;
+}
+
+bool ModelScheduler::admissible(const ModelQueue& queue, Priority priority,
+                                Clock::time_point deadline, Clock::time_point now) const {
+    if (deadline == Clock::time_point::max() || !queue.service.ready()) {
+        return true;
+    }
+    const ModelConfig& config = queue.model->config();
+
+    // 1. Work that runs before this request: its own class and everything
+    // not yet preprocessed (counted in full, which is exact when every
+    // request carries the same budget and conservative otherwise),
+    // everything interactive if it is bulk, and whatever is left of the
+    // batch in flight
+    size_t ahead = queue.classes[class_index(priority)].size() + queue.raw.size() +
+                   queue.preparing;
+    if (priority == Priority::Bulk) {
+        ahead += queue.classes[class_index(Priority::Interactive)].size();
+    }
+    const size_t full_batches = ahead / config.max_batch;
+    const size_t last_batch = ahead % config.max_batch + 1;
+    double wait_ns = static_cast<double>(full_batches) *
+                         queue.service.estimate_ns(config.max_batch) +
+                     queue.service.estimate_ns(last_batch);
+    if (queue.busy) {
+        const std::chrono::duration<double, std::nano> elapsed = now - queue.inflight_start;
+        wait_ns += std::max(0.0, queue.service.estimate_ns(queue.inflight) - elapsed.count());
+    }
+
+    // 2. Other backlogged models get their weighted share of the batch slots
+    double active_weight = config.weight;
+    for (const auto& [key, other] : m_queues) {
+        if (other.get() != &queue && (other->busy || other->size > 0)) {
+            active_weight += other->model->config().weight;
+        }
+    }
+    const double share =
+        std::min(1.0, static_cast<double>(max_running()) * config.weight / active_weight);
+
+    return add_ns(now, wait_ns / share) <= deadline;
+}
+
+void ModelScheduler::timer_loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        const Clock::time_point wake = m_timer_wake;
+        if (wake == Clock::time_point::max()) {
+            m_cv.wait(lock);
+        } else if (Clock::now() < wake) {
+            m_cv.wait_until(lock, wake);
+        } else {
+            m_timer_wake = Clock::time_point::max();
+            dispatch(lock);
+        }
+    }
+}
+
+void ModelScheduler::dispatch(std::unique_lock<std::mutex>& lock) {
+    std::vector<Pending> shed;
+    while (!m_stopping && m_running < max_running()) {
+        // 1. Interactive before bulk; among ready queues of a class, the
+        // smallest fair-queuing stamp
+        const Clock::time_point now = Clock::now();
+        Clock::time_point wake = Clock::time_point::max();
+        ModelQueue* pick = nullptr;
+        size_t pick_class = 0;
+        double pick_stamp = 0.0;
+        for (size_t c = 0; c < CLASS_COUNT && pick == nullptr; ++c) {
+            for (auto& [key, queue] : m_queues) {
+                const ClassQueue& pending = queue->classes[c];
+                if (queue->busy || pending.empty()) {
+                    continue;
+                }
+                const ModelConfig& config = queue->model->config();
+                const size_t n = std::min<size_t>(pending.size(), config.max_batch);
+                if (pending.size() < config.max_batch) {
+                    const Flight& head = *pending.begin()->second;
+                    Clock::time_point due = head.waiters.front().enqueued + config.batch_delay;
+                    if (queue->preparing > 0 || !queue->raw.empty()) {
+                        // More is already admitted and on its way; each
+                        // arrival picks again, so only a deadline needs the timer
+                        due = Clock::time_point::max();
+                    }
+                    if (head.order.first != Clock::time_point::max()) {
+                        // Start early rather than wait past the point of no return
+                        due = std::min(due, add_ns(head.order.first,
+                                                   -queue->service.estimate_ns(n)));
+                    }
+                    if (now < due) {
+                        wake = std::min(wake, due);
+                        continue;
+                    }
+                }
+                // The start is fixed once a model waits, or a heavier model
+                // advancing the virtual time would starve it
+                if (!queue->stamped) {
+                    queue->start_stamp = std::max(m_virtual_time, queue->last_finish);
+                    queue->stamped = true;
+                }
+                const double stamp = queue->start_stamp + static_cast<double>(n) / config.weight;
+                if (pick == nullptr || stamp < pick_stamp) {
+                    pick = queue.get();
+                    pick_class = c;
+                    pick_stamp = stamp;
+                }
+            }
+        }
+        if (pick == nullptr) {
+            // Nothing ready yet; a finishing batch or the timer picks again
+            if (wake < m_timer_wake) {
+                m_timer_wake = wake;
+                m_cv.notify_all();
+            }
+            return;
+        }
+
+        // 2. Shed heads that would finish past their deadline, then take a batch
+        ClassQueue& pending = pick->classes[pick_class];
+        const size_t max_batch = pick->model->config().max_batch;
+        const double batch_ns =
+            pick->service.estimate_ns(std::min<size_t>(pending.size(), max_batch));
+        const Clock::time_point finish = add_ns(now, batch_ns);
+        auto batch = std::make_shared<std::vector<std::shared_ptr<Flight>>>();
+        const size_t shed_before = shed.size();
+        while (!pending.empty() && batch->size() < max_batch) {
+            std::shared_ptr<Flight> flight = std::move(pending.extract(pending.begin()).mapped());
+            pick->size -= flight->waiters.size();
+            // Waiters are shed one by one; the row runs if anyone can still use it
+            auto hopeless = std::stable_partition(
+                flight->waiters.begin(), flight->waiters.end(), [&](const Pending& waiter) {
+                    return waiter.request.deadline >= finish && !waiter.request.token.cancelled();
+                });
+            std::move(hopeless, flight->waiters.end(), std::back_inserter(shed));
+            flight->waiters.erase(hopeless, flight->waiters.end());
+            if (flight->waiters.empty()) {
+                if (flight->registered) {
+                    pick->flights[pick_class].erase(flight->key);
+                }
+                continue;
+            }
+            flight->running = true;
+            batch->push_back(std::move(flight));
+        }
+        for (size_t i = shed_before; i < shed.size(); ++i) {
+            if (shed[i].request.token.cancelled()) {
+                ++pick->cancelled;
+            } else {
+                ++pick->shed;
+            }
+        }
+        if (!batch->empty()) {
+            pick->last_finish = pick->start_stamp +
+                                static_cast<double>(batch->size()) / pick->model->config().weight;
+            pick->stamped = false;
+            m_virtual_time = pick->last_finish;
+            pick->busy = true;
+            pick->inflight = batch->size();
+            pick->inflight_start = now;
+            ++m_running;
+            ++m_tasks;
+        }
+
+        lock.unlock();
+        for (Pending& entry : shed) {
+            entry.request.done(entry.request.token.cancelled() ? RequestStatus::Cancelled
+                                                               : RequestStatus::Overloaded,
+                               Prediction{});
+        }
+        shed.clear();
+        if (!batch->empty()) {
+            m_pool.submit([this, pick, batch] { run_batch(*pick, *batch); });
+        }
+        lock.lock();
+    }
+}
+
+void ModelScheduler::run_batch(ModelQueue& queue, std::vector<std::shared_ptr<Flight>>& batch) {
+    const Clock::time_point started = Clock::now();
+
+    // 1. One forward pass for the whole batch, one row per flight
+    std::vector<torch::Tensor> tensors;
+    tensors.reserve(batch.size());
+    for (const std::shared_ptr<Flight>& flight : batch) {
+        tensors.push_back(flight->input);
+    }
+    std::vector<Prediction> predictions;
+    bool ok = false;
+    try {
+        if (m_budget != nullptr) {
+            m_budget->prepare_thread();
+        }
+        const torch::Tensor input = torch::cat(tensors, 0);
+        if (PipelineExecutor* pipeline = queue.model->pipeline()) {
+            // The pipeline's workers run the layers; this thread only waits
+            const torch::Tensor rows = input.contiguous();
+            predictions = pipeline->predict_batch(rows.data_ptr<float>(),
+                                                  static_cast<size_t>(rows.size(0)));
+        } else {
+            predictions = queue.model->engine().predict_batch(input);
+        }
+        ok = true;
+    } catch (const std::exception& e) {
+        std::cerr << "ModelScheduler: " << queue.model->key()
+                  << ": batch of " << batch.size() << " failed: " << e.what() << std::endl;
+    }
+    const Clock::time_point finished = Clock::now();
+    if (m_budget != nullptr && ok) {
+        m_budget->record_batch(batch.size());
+    }
+
+    // 2. Close the flights, so nobody joins one whose result is already out
+    std::vector<std::vector<Pending>> waiters(batch.size());
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Flight& flight = *batch[i];
+            if (flight.registered) {
+                queue.flights[flight.class_index].erase(flight.key);
+            }
+            waiters[i].swap(flight.waiters);
+        }
+    }
+
+    // 3. Deliver, then account
+    for (size_t i = 0; i < batch.size(); ++i) {
+        for (Pending& waiter : waiters[i]) {
+            if (ok) {
+                waiter.request.done(RequestStatus::Ok, predictions[i]);
+            } else {
+                waiter.request.done(RequestStatus::Failed, Prediction{});
+            }
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++queue.batches;
+    queue.rows += batch.size();
+    if (ok) {
+        queue.service.record(batch.size(), static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count()));
+    }
+    for (const std::vector<Pending>& flight : waiters) {
+        if (!ok) {
+            queue.failed += flight.size();
+            continue;
+        }
+        queue.completed += flight.size();
+        queue.coalesced += flight.size() - 1;
+        for (size_t w = 0; w < flight.size(); ++w) {
+            const Pending& pending = flight[w];
+            if (finished <= pending.request.deadline) {
+                ++queue.goodput;
+            } else {
+                ++queue.late;
+            }
+            const uint64_t latency_ns = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(finished - pending.enqueued)
+                    .count());
+            queue.latency[class_index(pending.request.priority)].record(latency_ns);
+            if (w > 0) {
+                queue.coalesced_latency.record(latency_ns);
+            }
+        }
+    }
+
+    // 4. Free the slot; this model may already have its next batch waiting
+    queue.busy = false;
+    --m_running;
+    dispatch(lock);
+    if (--m_tasks == 0 && m_stopping) {
+        m_cv.notify_all();
+    }
+}
+
+std::vector<ModelStats> ModelScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<ModelStats> result;
+    for (const auto& [key, queue] : m_queues) {
+        const ModelConfig& config = queue->model->config();
+        LatencyHistogram all;
+        for (const LatencyHistogram& latency : queue->latency) {
+            all.merge(latency);
+        }
+        auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+
+        ModelStats s;
+        s.model = queue->model->key();
+        s.weight = config.weight;
+        s.submitted = queue->submitted;
+        s.completed = queue->completed;
+        s.goodput = queue->goodput;
+        s.late = queue->late;
+        s.rejected = queue->rejected;
+        s.overloaded = queue->overloaded;
+        s.shed = queue->shed;
+        s.cancelled = queue->cancelled;
+        s.failed = queue->failed;
+        s.batches = queue->batches;
+        s.mean_batch = queue->batches == 0 ? 0.0
+                                           : static_cast<double>(queue->rows) /
+                                                 static_cast<double>(queue->batches);
+        s.coalesced = queue->coalesced;
+        s.collapse_ratio = queue->completed == queue->coalesced
+                               ? 1.0
+                               : static_cast<double>(queue->completed) /
+                                     static_cast<double>(queue->completed - queue->coalesced);
+        s.coalesced_p99_us = us(queue->coalesced_latency.value_at_percentile(99.0));
+        s.queue_depth = queue->size;
+        s.p50_us = us(all.value_at_percentile(50.0));
+        s.p99_us = us(all.value_at_percentile(99.0));
+        s.interactive_p99_us = us(
+            queue->latency[class_index(Priority::Interactive)].value_at_percentile(99.0));
+        s.bulk_p99_us = us(queue->latency[class_index(Priority::Bulk)].value_at_percentile(99.0));
+        s.service_estimate_us = queue->service.estimate_ns(config.max_batch) / 1000.0;
+        s.weight_bytes = queue->model->weight_bytes();
+        s.queued_bytes = queue->queued_bytes;
+        result.push_back(std::move(s));
+    }
+    std::sort(result.begin(), result.end(),
+              [](const ModelStats& a, const ModelStats& b) { return a.model < b.model; });
+    return result;
+}
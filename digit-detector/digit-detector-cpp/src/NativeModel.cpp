@@ -0,0 +1,287 @@
+#include "NativeModel.h"
+#include "InferenceEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+const char* const LAYER_NAMES[] = {"conv1", "conv2", "fc1", "fc2"};
+
+/// Largest difference allowed between a .bsr file's kept weights and the model's
+constexpr float BLOCK_SPARSE_TOLERANCE = 1e-6f;
+
+} // namespace
+
+/**
+ * @brief One conv or linear layer: the model's fp32 weights, and a packed
+ * copy if the layer is stored in half precision or block-sparse.
+ */
+struct NativeModel::Layer {
+    std::string name;
+    WeightPrecision precision = WeightPrecision::Fp32;
+    ConvAlgorithm algorithm = ConvAlgorithm::Direct; ///< Conv layers only
+    at::Tensor weight;
+    at::Tensor bias;
+    std::unique_ptr<PackedConv3x3> packed_conv;
+    std::unique_ptr<WinogradConv3x3> winograd;
+    std::unique_ptr<PackedLinear> packed_linear;
+    std::unique_ptr<BlockSparseLinear> block_sparse;
+
+    size_t stored_bytes() const {
+        if (packed_conv) {
+            return packed_conv->weight_bytes();
+        }
+        if (winograd) {
+            return winograd->weight_bytes();
+        }
+        if (packed_linear) {
+            return packed_linear->weight_bytes();
+        }
+        if (block_sparse) {
+            return block_sparse->weight_bytes();
+        }
+        return static_cast<size_t>(weight.numel() * weight.element_size());
+    }
+};
+
+NativeModel::NativeModel(const InferenceEngine& engine, KernelOptions options)
+    : m_options(std::move(options)) {
+    for (const auto& entry : m_options.precision) {
+        if (std::find(std::begin(LAYER_NAMES), std::end(LAYER_NAMES), entry.first) ==
+            std::end(LAYER_NAMES)) {
+            throw std::invalid_argument("NativeModel: no layer named '" + entry.first +
+                                        "' (expected conv1, conv2, fc1 or fc2)");
+        }
+    }
+    for (const auto& entry : m_options.conv_algorithm) {
+        if (entry.first != "conv1" && entry.first != "conv2") {
+            throw std::invalid_argument("NativeModel: no conv layer named '" + entry.first +
+                                        "' (expected conv1 or conv2)");
+        }
+    }
+    for (const auto& entry : m_options.block_sparse) {
+        if (entry.first != "fc1" && entry.first != "fc2") {
+            throw std::invalid_argument("NativeModel: no linear layer named '" + entry.first +
+                                        "' (expected fc1 or fc2)");
+        }
+    }
+
+    // 1. Take each layer's weights, checking the shapes DigitRecognizer has
+    auto load = [&](const std::string& name, std::vector<int64_t> shape) {
+        auto layer = std::make_unique<Layer>();
+        layer->name = name;
+        const torch::jit::script::Module module = engine.submodule(name);
+        layer->weight = module.attr("weight").toTensor().contiguous();
+        layer->bias = module.attr("bias").toTensor().contiguous();
+        if (layer->weight.sizes().vec() != shape ||
+            layer->weight.scalar_type() != torch::kFloat32) {
+            throw std::runtime_error("NativeModel: " + name +
+                                     " does not have DigitRecognizer's shape; is it one?");
+        }
+        auto it = m_options.precision.find(name);
+        layer->precision = it == m_options.precision.end() ? WeightPrecision::Fp32 : it->second;
+        return layer;
+    };
+    m_conv1 = load("conv1", {32, 1, 3, 3});
+    m_conv2 = load("conv2", {64, 32, 3, 3});
+    m_fc1 = load("fc1", {128, 64 * 7 * 7});
+    m_fc2 = load("fc2", {10, 128});
+
+    // 2. Pack the half-precision ones, and transform Winograd filters
+    for (Layer* layer : {m_conv1.get(), m_conv2.get()}) {
+        const bool fp32 = layer->precision == WeightPrecision::Fp32;
+        auto it = m_options.conv_algorithm.find(layer->name);
+        layer->algorithm = it != m_options.conv_algorithm.end() ? it->second
+                           : fp32                               ? ConvAlgorithm::Direct
+                                                                : ConvAlgorithm::Im2col;
+        if (!fp32 && layer->algorithm != ConvAlgorithm::Im2col) {
+            throw std::invalid_argument("NativeModel: " + layer->name + " in " +
+                                        to_string(layer->precision) + " runs im2col only, not " +
+                                        to_string(layer->algorithm));
+        }
+        const size_t out_channels = static_cast<size_t>(layer->weight.size(0));
+        const size_t in_channels = static_cast<size_t>(layer->weight.size(1));
+        if (!fp32) {
+            layer->packed_conv = std::make_unique<PackedConv3x3>(
+                layer->weight.data_ptr<float>(), layer->bias.data_ptr<float>(), out_channels,
+                in_channels, layer->precision);
+        } else if (layer->algorithm == ConvAlgorithm::Winograd) {
+            layer->winograd = std::make_unique<WinogradConv3x3>(
+                layer->weight.data_ptr<float>(), layer->bias.data_ptr<float>(), out_channels,
+                in_channels);
+        }
+    }
+    for (Layer* layer : {m_fc1.get(), m_fc2.get()}) {
+        auto sparse = m_options.block_sparse.find(layer->name);
+        if (sparse != m_options.block_sparse.end()) {
+            if (layer->precision != WeightPrecision::Fp32) {
+                throw std::invalid_argument("NativeModel: " + layer->name +
+                                            " is block-sparse, which is fp32 only");
+            }
+            layer->block_sparse =
+                std::make_unique<BlockSparseLinear>(BlockSparseLinear::read(sparse->second));
+            check_block_sparse(*layer, sparse->second);
+        } else if (layer->precision != WeightPrecision::Fp32) {
+            layer->packed_linear = std::make_unique<PackedLinear>(
+                layer->weight.data_ptr<float>(), layer->bias.data_ptr<float>(),
+                static_cast<size_t>(layer->weight.size(0)),
+                static_cast<size_t>(layer->weight.size(1)), layer->precision);
+        }
+    }
+    std::cout << "NativeModel: " << describe() << ", " << weight_bytes()
+              << " bytes of weights per pass" << std::endl;
+}
+
+NativeModel::~NativeModel() = default;
+
+at::Tensor NativeModel::forward(const at::Tensor& input) const {
+    // Same layers as DigitRecognizer.forward(); ReLU is fused into the
+    // packed kernels, and max-pooling commutes with it
+    at::Tensor x = input.contiguous();
+    x = torch::max_pool2d(conv(*m_conv1, x), {2, 2});
+    x = torch::max_pool2d(conv(*m_conv2, x), {2, 2});
+    x = x.reshape({x.size(0), -1});
+    x = linear(*m_fc1, x, true);
+    return linear(*m_fc2, x, false);
+}
+
+at::Tensor NativeModel::conv(const Layer& layer, const at::Tensor& x) const {
+    if (layer.algorithm == ConvAlgorithm::Direct) {
+        return torch::relu(
+            torch::conv2d(x, layer.weight, layer.bias, /*stride=*/{1, 1}, /*padding=*/{1, 1}));
+    }
+    const at::Tensor in = x.contiguous();
+    const int64_t batch = in.size(0);
+    const int64_t height = in.size(2);
+    const int64_t width = in.size(3);
+    const int64_t out_channels = layer.weight.size(0);
+    at::Tensor out = torch::empty({batch, out_channels, height, width}, torch::kFloat32);
+    if (layer.packed_conv || layer.winograd) {
+        const auto run = [&](const auto& kernel) {
+            kernel.run(in.data_ptr<float>(), static_cast<size_t>(batch),
+                       static_cast<size_t>(height), static_cast<size_t>(width),
+                       out.data_ptr<float>(), true);
+        };
+        if (layer.winograd) {
+            run(*layer.winograd);
+        } else {
+            run(*layer.packed_conv);
+        }
+        return out;
+    }
+
+    // fp32 im2col: each image's patches as rows, then one GEMM on
+    // LibTorch's BLAS with the bias folded in
+    const int64_t in_channels = layer.weight.size(1);
+    const int64_t positions = height * width;
+    const at::Tensor filters = layer.weight.reshape({out_channels, in_channels * 9});
+    const at::Tensor bias = layer.bias.reshape({out_channels, 1});
+    at::Tensor columns = torch::empty({positions, in_channels * 9}, torch::kFloat32);
+    for (int64_t b = 0; b < batch; ++b) {
+        im2col_3x3(in.data_ptr<float>() + b * in_channels * positions,
+                   static_cast<size_t>(in_channels), static_cast<size_t>(height),
+                   static_cast<size_t>(width), columns.data_ptr<float>());
+        at::Tensor image = out[b].view({out_channels, positions});
+        torch::addmm_out(image, bias, filters, columns.t());
+    }
+    return torch::relu_(out);
+}
+
+at::Tensor NativeModel::linear(const Layer& layer, const at::Tensor& x, bool relu) const {
+    if (!layer.packed_linear && !layer.block_sparse) {
+        at::Tensor y = torch::linear(x, layer.weight, layer.bias);
+        return relu ? torch::relu(y) : y;
+    }
+    const at::Tensor in = x.contiguous();
+    const int64_t rows = in.size(0);
+    const int64_t outputs = layer.weight.size(0);
+    at::Tensor out = torch::empty({rows, outputs}, torch::kFloat32);
+    const auto run = [&](const auto& kernel) {
+        kernel.run(in.data_ptr<float>(), static_cast<size_t>(rows), out.data_ptr<float>(),
+                   static_cast<size_t>(outputs), 1, relu);
+    };
+    if (layer.block_sparse) {
+        run(*layer.block_sparse);
+    } else {
+        run(*layer.packed_linear);
+    }
+    return out;
+}
+
+void NativeModel::check_block_sparse(const Layer& layer, const std::string& path) const {
+    // The .bsr must be this model's weights with the pruned blocks left
+    // out: a file from another checkpoint would quietly change the answers
+    const BlockSparseLinear& sparse = *layer.block_sparse;
+    if (sparse.outputs() != static_cast<size_t>(layer.weight.size(0)) ||
+        sparse.inputs() != static_cast<size_t>(layer.weight.size(1))) {
+        throw std::runtime_error("NativeModel: " + path + " is not shaped like " + layer.name);
+    }
+    const std::vector<float> dense = sparse.dense();
+    const float* weight = layer.weight.data_ptr<float>();
+    const float* bias = layer.bias.data_ptr<float>();
+    float error = 0.0f;
+    for (size_t i = 0; i < dense.size(); ++i) {
+        error = std::max(error, std::abs(dense[i] - weight[i]));
+    }
+    for (size_t o = 0; o < sparse.outputs(); ++o) {
+        error = std::max(error, std::abs(sparse.bias()[o] - bias[o]));
+    }
+    if (error > BLOCK_SPARSE_TOLERANCE) {
+        throw std::runtime_error("NativeModel: " + path + " differs from the model's " +
+                                 layer.name + " weights by up to " + std::to_string(error) +
+                                 "; was it pruned from another checkpoint?");
+    }
+}
+
+at::Tensor NativeModel::run_layer(const std::string& name, const at::Tensor& input) const {
+    if (name == "conv1") {
+        return conv(*m_conv1, input);
+    }
+    if (name == "conv2") {
+        return conv(*m_conv2, input);
+    }
+    if (name == "fc1") {
+        return linear(*m_fc1, input, true);
+    }
+    if (name == "fc2") {
+        return linear(*m_fc2, input, false);
+    }
+    throw std::invalid_argument("NativeModel: no layer named '" + name + "'");
+}
+
+size_t NativeModel::weight_bytes() const {
+    size_t total = 0;
+    for (const Layer* layer : {m_conv1.get(), m_conv2.get(), m_fc1.get(), m_fc2.get()}) {
+        total += layer->stored_bytes() +
+                 static_cast<size_t>(layer->bias.numel() * layer->bias.element_size());
+    }
+    return total;
+}
+
+std::string NativeModel::describe() const {
+    std::string text;
+    for (const Layer* layer : {m_conv1.get(), m_conv2.get(), m_fc1.get(), m_fc2.get()}) {
+        if (!text.empty()) {
+            text += ", ";
+        }
+        text += layer->name + " " + to_string(layer->precision);
+        if (layer == m_conv1.get() || layer == m_conv2.get()) {
+            text += " " + to_string(layer->algorithm);
+        }
+        if (layer->block_sparse) {
+            const BlockSparseLinear& sparse = *layer->block_sparse;
+            text += " block-sparse " + std::to_string(sparse.block_rows()) + "x" +
+                    std::to_string(sparse.block_cols()) + " (" +
+                    std::to_string(static_cast<int>(100.0 * sparse.density() + 0.5)) +
+                    "% dense, " + BlockSparseLinear::isa() + ")";
+        } else if (layer->precision != WeightPrecision::Fp32) {
+            text += " (" + kernel_isa(layer->precision) + ")";
+        } else if (layer->winograd) {
+            text += " (" + WinogradConv3x3::isa() + ")";
+        }
+    }
+    return text;
+}
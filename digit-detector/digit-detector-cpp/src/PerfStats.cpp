@@ -0,0 +1,176 @@
+#include "PerfStats.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+MannWhitneyResult mann_whitney_u(const std::vector<double>& a, const std::vector<double>& b) {
+    MannWhitneyResult result;
+    const size_t n1 = a.size();
+    const size_t n2 = b.size();
+    if (n1 == 0 || n2 == 0) {
+        return result;
+    }
+
+    // 1. Rank the pooled sample; ties share the average of their ranks
+    std::vector<std::pair<double, int>> pooled;
+    pooled.reserve(n1 + n2);
+    for (double v : a) {
+        pooled.emplace_back(v, 0);
+    }
+    for (double v : b) {
+        pooled.emplace_back(v, 1);
+    }
+    std::sort(pooled.begin(), pooled.end());
+
+    const double n = static_cast<double>(n1 + n2);
+    double rank_sum_a = 0.0;
+    double tie_term = 0.0; // sum(t^3 - t) over tie groups
+    for (size_t i = 0; i < pooled.size();) {
+        size_t j = i;
+        while (j < pooled.size() && pooled[j].first == pooled[i].first) {
+            ++j;
+        }
+        const double average_rank = (static_cast<double>(i + 1) + static_cast<double>(j)) / 2.0;
+        for (size_t k = i; k < j; ++k) {
+            if (pooled[k].second == 0) {
+                rank_sum_a += average_rank;
+            }
+        }
+        const double t = static_cast<double>(j - i);
+        tie_term += t * t * t - t;
+        i = j;
+    }
+
+    // 2. U and its normal approximation
+    const double dn1 = static_cast<double>(n1);
+    const double dn2 = static_cast<double>(n2);
+    result.u = rank_sum_a - dn1 * (dn1 + 1.0) / 2.0;
+    const double mean_u = dn1 * dn2 / 2.0;
+    const double variance = dn1 * dn2 / 12.0 * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+    if (variance <= 0.0) {
+        return result; // Every value identical: no evidence of a difference
+    }
+    const double distance = std::max(0.0, std::fabs(result.u - mean_u) - 0.5);
+    result.z = std::copysign(distance / std::sqrt(variance), result.u - mean_u);
+    result.p_value = std::erfc(std::fabs(result.z) / std::sqrt(2.0));
+    return result;
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    const size_t mid = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(mid),
+                     values.end());
+    if (values.size() % 2 == 1) {
+        return values[mid];
+    }
+    const double upper = values[mid];
+    const double lower =
+        *std::max_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(mid));
+    return (lower + upper) / 2.0;
+}
+
+std::string cpu_model() {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) == 0) {
+            const size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                return line.substr(line.find_first_not_of(' ', colon + 1));
+            }
+        }
+    }
+    return "unknown";
+}
+
+std::string machine_class() {
+    if (const char* overridden = std::getenv("DIGIT_PERF_MACHINE_CLASS")) {
+        if (*overridden != '\0') {
+            return overridden;
+        }
+    }
+
+    // Lower-case the model name and collapse everything else into dashes
+    std::string name;
+    for (char c : cpu_model()) {
+        if (std::isalnum(static_cast<unsigned char>(c))) {
+            name += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        } else if (!name.empty() && name.back() != '-') {
+            name += '-';
+        }
+    }
+    if (!name.empty() && name.back() == '-') {
+        name.pop_back();
+    }
+    return name + "-" + std::to_string(::sysconf(_SC_NPROCESSORS_ONLN)) + "c";
+}
+
+size_t resident_bytes() {
+    // Second field of statm: resident pages
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    if (!(statm >> total_pages >> resident_pages)) {
+        return 0;
+    }
+    return resident_pages * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+size_t thread_count() {
+    DIR* dir = ::opendir("/proc/self/task");
+    if (dir == nullptr) {
+        return 0;
+    }
+    size_t count = 0;
+    while (const dirent* entry = ::readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            ++count;
+        }
+    }
+    ::closedir(dir);
+    return count;
+}
+
+MemoryFootprint memory_footprint(int pid) {
+    const std::string dir = pid == 0 ? "/proc/self" : "/proc/" + std::to_string(pid);
+    // smaps_rollup is pre-summed; smaps has the same fields once per mapping
+    std::ifstream smaps(dir + "/smaps_rollup");
+    if (!smaps.is_open()) {
+        smaps.open(dir + "/smaps");
+    }
+    MemoryFootprint footprint;
+    std::string field;
+    size_t kilobytes = 0;
+    while (smaps >> field) {
+        if (field.empty() || field.back() != ':' || !(smaps >> kilobytes)) {
+            // A mapping's header line, or a non-numeric field such as VmFlags
+            smaps.clear();
+            smaps.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            continue;
+        }
+        const size_t bytes = kilobytes * 1024;
+        if (field == "Rss:") {
+            footprint.rss += bytes;
+        } else if (field == "Pss:") {
+            footprint.pss += bytes;
+        } else if (field == "Private_Clean:" || field == "Private_Dirty:") {
+            footprint.private_bytes += bytes;
+        } else if (field == "Shared_Clean:" || field == "Shared_Dirty:") {
+            footprint.shared_bytes += bytes;
+        }
+        smaps.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return footprint;
+}
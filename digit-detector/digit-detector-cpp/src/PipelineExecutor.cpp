@@ -0,0 +1,685 @@
+#include "PipelineExecutor.h"
+#include "InferenceEngine.h"
+#include "PerfStats.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t MAX_DEPTH = 64;
+constexpr size_t MAX_STAGES = 3; ///< One per layer at most
+constexpr size_t SLOT_ALIGNMENT = 64;
+constexpr uint32_t NO_SLOT = static_cast<uint32_t>(-1);
+constexpr float CHECK_TOLERANCE = 1e-4f; ///< Staged vs whole-model confidence
+
+/**
+ * @brief A layer of DigitRecognizer as a pipeline sees it.
+ */
+struct LayerSpec {
+    const char* name;
+    int64_t input_shape[3]; ///< Per row
+    size_t output_floats;   ///< Per row
+};
+
+const LayerSpec LAYERS[] = {
+    {"conv1", {1, 28, 28}, 32 * 14 * 14},
+    {"conv2", {32, 14, 14}, 64 * 7 * 7},
+    {"fc", {64, 7, 7}, 10},
+};
+constexpr size_t LAYER_COUNT = sizeof(LAYERS) / sizeof(LAYERS[0]);
+
+/**
+ * @brief Precedes each slot's rows.
+ */
+struct SlotHeader {
+    uint64_t ticket;
+    uint32_t rows;
+    uint32_t failed; ///< A stage threw; error says why and the rows are garbage
+    char error[240];
+};
+static_assert(sizeof(SlotHeader) % SLOT_ALIGNMENT == 0, "rows must stay aligned");
+
+/**
+ * @brief A bounded queue between two stages: queue_depth slots, each
+ * either free (the producer may fill it) or ready (the consumer may take
+ * it). Lives in the shared region. The semaphores count the slots of each
+ * kind, and the mutex guards the two lists only for the moment it takes
+ * to push or pop an index. Neither can be wedged by a process that dies:
+ * the mutex is robust, and sem_post() never waits for a waiter. A
+ * process-shared condition variable, by contrast, can block its next
+ * signaller forever once a waiter has been killed.
+ */
+struct Queue {
+    pthread_mutex_t mutex;
+    sem_t ready_slots;
+    sem_t free_slots;
+    uint32_t ready[MAX_DEPTH]; ///< Ring, oldest first
+    uint32_t ready_head;
+    uint32_t ready_count;
+    uint32_t free_list[MAX_DEPTH]; ///< Stack
+    uint32_t free_count;
+    size_t row_floats;
+    size_t slot_bytes;
+    size_t offset; ///< Of slot 0 from the start of the region
+};
+
+struct StageCounters {
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> rows{0};
+    std::atomic<uint64_t> busy_ns{0};
+    std::atomic<uint64_t> starved_ns{0};
+    std::atomic<uint64_t> blocked_ns{0};
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the counters are shared between processes");
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+uint64_t nanoseconds(Clock::duration duration) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+void lock(pthread_mutex_t* mutex) {
+    if (::pthread_mutex_lock(mutex) == EOWNERDEAD) {
+        // The lists are only changed in whole under the lock, so they are
+        // intact; the slot the dead process held is lost
+        ::pthread_mutex_consistent(mutex);
+    }
+}
+
+/**
+ * @brief Takes a ready slot (or a free one), waiting as long as it takes.
+ * @return NO_SLOT once give_up() returns true; it is asked every poll interval.
+ */
+template <class GiveUp>
+uint32_t take(Queue& queue, bool ready, std::chrono::milliseconds poll, GiveUp give_up) {
+    sem_t* available = ready ? &queue.ready_slots : &queue.free_slots;
+    while (::sem_trywait(available) != 0) {
+        if (give_up()) {
+            return NO_SLOT;
+        }
+        // Realtime, as sem_timedwait() wants; a clock step only stretches one poll
+        timespec deadline{};
+        ::clock_gettime(CLOCK_REALTIME, &deadline);
+        const long nanos = deadline.tv_nsec + static_cast<long>(poll.count()) * 1000000L;
+        deadline.tv_sec += nanos / 1000000000L;
+        deadline.tv_nsec = nanos % 1000000000L;
+        if (::sem_timedwait(available, &deadline) == 0) {
+            break;
+        }
+    }
+    lock(&queue.mutex);
+    uint32_t slot;
+    if (ready) {
+        slot = queue.ready[queue.ready_head];
+        queue.ready_head = (queue.ready_head + 1) % MAX_DEPTH;
+        --queue.ready_count;
+    } else {
+        slot = queue.free_list[--queue.free_count];
+    }
+    ::pthread_mutex_unlock(&queue.mutex);
+    return slot;
+}
+
+/**
+ * @brief Returns a slot as ready (or free), for one waiter to take.
+ */
+void give(Queue& queue, bool ready, uint32_t slot) {
+    lock(&queue.mutex);
+    if (ready) {
+        queue.ready[(queue.ready_head + queue.ready_count) % MAX_DEPTH] = slot;
+        ++queue.ready_count;
+    } else {
+        queue.free_list[queue.free_count++] = slot;
+    }
+    ::pthread_mutex_unlock(&queue.mutex);
+    ::sem_post(ready ? &queue.ready_slots : &queue.free_slots);
+}
+
+void set_error(SlotHeader& header, const char* message) {
+    header.failed = 1;
+    std::strncpy(header.error, message, sizeof(header.error) - 1);
+    header.error[sizeof(header.error) - 1] = '\0';
+}
+
+/**
+ * @brief Confines this process to worker index's run of the stage's cores.
+ */
+void pin(const PipelineStageOptions& stage, uint32_t index) {
+    if (stage.cores.empty()) {
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (uint32_t k = 0; k < stage.threads; ++k) {
+        const size_t position = static_cast<size_t>(index) * stage.threads + k;
+        CPU_SET(stage.cores[position % stage.cores.size()], &cpus);
+    }
+    if (::sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        std::cerr << "PipelineExecutor: worker " << index << " could not be pinned" << std::endl;
+    }
+}
+
+std::string layer_names(size_t first, size_t last) {
+    std::string names;
+    for (size_t layer = first; layer <= last; ++layer) {
+        names += (names.empty() ? "" : "+") + std::string(LAYERS[layer].name);
+    }
+    return names;
+}
+
+} // namespace
+
+/**
+ * @brief The shared region's fixed part; the slots follow it.
+ */
+struct PipelineExecutor::Region {
+    std::atomic<bool> stopping{false};
+    StageCounters stages[MAX_STAGES];
+    Queue queues[MAX_STAGES + 1]; ///< queues[s] feeds stage s; the last feeds the collector
+
+    SlotHeader& header(size_t queue, uint32_t slot) {
+        char* base = reinterpret_cast<char*>(this) + queues[queue].offset;
+        return *reinterpret_cast<SlotHeader*>(base + slot * queues[queue].slot_bytes);
+    }
+
+    float* rows(size_t queue, uint32_t slot) {
+        return reinterpret_cast<float*>(&header(queue, slot) + 1);
+    }
+};
+
+/**
+ * @brief The model's submodules, and how DigitRecognizer.forward() chains them.
+ */
+struct PipelineExecutor::Layers {
+    torch::jit::script::Module conv1;
+    torch::jit::script::Module conv2;
+    torch::jit::script::Module pool;
+    torch::jit::script::Module fc1;
+    torch::jit::script::Module fc2;
+
+    explicit Layers(const InferenceEngine& engine)
+        : conv1(engine.submodule("conv1")), conv2(engine.submodule("conv2")),
+          pool(engine.submodule("pool")), fc1(engine.submodule("fc1")),
+          fc2(engine.submodule("fc2"))
+    {
+    }
+
+    at::Tensor run(size_t layer, const at::Tensor& input) {
+        switch (layer) {
+        case 0:
+            return forward(pool, torch::relu(forward(conv1, input)));
+        case 1:
+            return forward(pool, torch::relu(forward(conv2, input)));
+        default:
+            return forward(fc2, torch::relu(forward(fc1, input.reshape({input.size(0), -1}))));
+        }
+    }
+
+    static at::Tensor forward(torch::jit::script::Module& module, const at::Tensor& input) {
+        return module.forward({input}).toTensor();
+    }
+};
+
+PipelineExecutor::PipelineExecutor(InferenceEngine& engine, PipelineOptions options)
+    : m_options(std::move(options))
+{
+    // 1. The stages must cover the layers once, in order
+    if (m_options.stages.empty() || m_options.stages.size() > MAX_STAGES) {
+        throw std::invalid_argument("PipelineExecutor: between 1 and 3 stages are required");
+    }
+    if (m_options.queue_depth == 0 || m_options.queue_depth > MAX_DEPTH) {
+        throw std::invalid_argument("PipelineExecutor: queue_depth must be between 1 and " +
+                                    std::to_string(MAX_DEPTH));
+    }
+    if (m_options.max_batch == 0) {
+        throw std::invalid_argument("PipelineExecutor: max_batch must be at least 1");
+    }
+    size_t next = 0;
+    for (const PipelineStageOptions& stage : m_options.stages) {
+        if (stage.layers.empty() || stage.workers == 0 || stage.threads == 0) {
+            throw std::invalid_argument(
+                "PipelineExecutor: every stage needs layers, a worker and a thread");
+        }
+        m_first_layer.push_back(next);
+        for (const std::string& name : stage.layers) {
+            if (next >= LAYER_COUNT || name != LAYERS[next].name) {
+                throw std::invalid_argument("PipelineExecutor: expected layer '" +
+                                            std::string(next < LAYER_COUNT ? LAYERS[next].name
+                                                                           : "(none)") +
+                                            "', got '" + name + "'");
+            }
+            ++next;
+        }
+        m_last_layer.push_back(next - 1);
+    }
+    if (next != LAYER_COUNT) {
+        throw std::invalid_argument("PipelineExecutor: the stages stop before layer '" +
+                                    std::string(LAYERS[next].name) + "'");
+    }
+
+    // 2. The layers chained by hand must give what forward() gives. An int8
+    // model's layers pass quantized tensors, which the stages cannot
+    if (engine.quantized()) {
+        throw std::invalid_argument("PipelineExecutor: quantized models run whole, not staged");
+    }
+    m_layers = std::make_unique<Layers>(engine);
+    {
+        c10::InferenceMode inference_mode;
+        const at::Tensor input = torch::rand({4, 1, 28, 28});
+        at::Tensor staged = input;
+        for (size_t layer = 0; layer < LAYER_COUNT; ++layer) {
+            staged = m_layers->run(layer, staged);
+        }
+        const std::vector<Prediction> expected = engine.predict_batch(input);
+        const std::vector<Prediction> actual = InferenceEngine::postprocess(staged);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            if (actual.size() != expected.size() || actual[i].digit != expected[i].digit ||
+                std::fabs(actual[i].confidence - expected[i].confidence) > CHECK_TOLERANCE) {
+                throw std::runtime_error("PipelineExecutor: the model's layers do not add up "
+                                         "to its forward(); is it a DigitRecognizer?");
+            }
+        }
+    }
+    engine.freeze_weights();
+
+    // 3. Lay out the queues: queue 0 holds inputs, queue s + 1 what stage s produced
+    const size_t queues = m_options.stages.size() + 1;
+    size_t offset = round_up(sizeof(Region), SLOT_ALIGNMENT);
+    std::vector<size_t> row_floats(queues), slot_bytes(queues), offsets(queues);
+    for (size_t q = 0; q < queues; ++q) {
+        row_floats[q] = q == 0 ? INPUT_FLOATS : LAYERS[m_last_layer[q - 1]].output_floats;
+        slot_bytes[q] = round_up(sizeof(SlotHeader) + m_options.max_batch * row_floats[q] *
+                                                          sizeof(float),
+                                 SLOT_ALIGNMENT);
+        offsets[q] = offset;
+        offset += slot_bytes[q] * m_options.queue_depth;
+    }
+    m_region_bytes = round_up(offset, static_cast<size_t>(::sysconf(_SC_PAGESIZE)));
+    void* memory = ::mmap(nullptr, m_region_bytes, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("PipelineExecutor: cannot map " +
+                                 std::to_string(m_region_bytes) + " bytes of queues");
+    }
+    m_region = new (memory) Region();
+
+    pthread_mutexattr_t mutex_attr;
+    ::pthread_mutexattr_init(&mutex_attr);
+    ::pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    ::pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    for (size_t q = 0; q < queues; ++q) {
+        Queue& queue = m_region->queues[q];
+        ::pthread_mutex_init(&queue.mutex, &mutex_attr);
+        ::sem_init(&queue.ready_slots, 1, 0);
+        ::sem_init(&queue.free_slots, 1, m_options.queue_depth);
+        queue.ready_head = 0;
+        queue.ready_count = 0;
+        queue.free_count = m_options.queue_depth;
+        for (uint32_t slot = 0; slot < m_options.queue_depth; ++slot) {
+            queue.free_list[slot] = m_options.queue_depth - 1 - slot;
+        }
+        queue.row_floats = row_floats[q];
+        queue.slot_bytes = slot_bytes[q];
+        queue.offset = offsets[q];
+    }
+    ::pthread_mutexattr_destroy(&mutex_attr);
+
+    // 4. Fork the workers, stage by stage
+    const size_t threads = thread_count();
+    if (threads > 1) {
+        std::cerr << "PipelineExecutor: forking with " << threads
+                  << " threads running; the workers inherit none of them" << std::endl;
+    }
+    m_parent_pid = ::getpid();
+    for (size_t stage = 0; stage < m_options.stages.size(); ++stage) {
+        for (uint32_t index = 0; index < m_options.stages[stage].workers; ++index) {
+            // Buffered output would otherwise be printed by parent and child alike
+            std::cout.flush();
+            std::cerr.flush();
+            const pid_t pid = ::fork();
+            if (pid == 0) {
+                worker_main(stage, index);
+            }
+            if (pid < 0) {
+                m_region->stopping.store(true);
+                for (int started : m_pids) {
+                    ::kill(started, SIGKILL);
+                    ::waitpid(started, nullptr, 0);
+                }
+                ::munmap(m_region, m_region_bytes);
+                throw std::runtime_error("PipelineExecutor: fork() failed");
+            }
+            m_pids.push_back(pid);
+            m_stage_of.push_back(stage);
+        }
+    }
+    m_collector = std::thread(&PipelineExecutor::collector_loop, this);
+
+    std::string placement;
+    for (size_t stage = 0; stage < m_options.stages.size(); ++stage) {
+        placement += (stage == 0 ? "" : " | ") +
+                     layer_names(m_first_layer[stage], m_last_layer[stage]) + " x" +
+                     std::to_string(m_options.stages[stage].workers);
+    }
+    std::cout << "PipelineExecutor: " << placement << ", queues of " << m_options.queue_depth
+              << " x " << m_options.max_batch << " rows (" << m_region_bytes << " bytes shared)"
+              << std::endl;
+}
+
+PipelineExecutor::~PipelineExecutor() {
+    // 1. Workers, the collector and callers in submit() notice within a poll interval
+    m_stopping.store(true);
+    m_region->stopping.store(true);
+    if (m_collector.joinable()) {
+        m_collector.join();
+    }
+    fail("PipelineExecutor: stopped");
+
+    // 2. Give the workers a moment to leave on their own
+    const Clock::time_point give_up = Clock::now() + std::chrono::seconds(2);
+    for (int& pid : m_pids) {
+        while (pid != 0 && ::waitpid(pid, nullptr, WNOHANG) == 0) {
+            if (Clock::now() >= give_up) {
+                ::kill(pid, SIGKILL);
+                ::waitpid(pid, nullptr, 0);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        pid = 0;
+    }
+    ::munmap(m_region, m_region_bytes);
+}
+
+void PipelineExecutor::worker_main(size_t stage, uint32_t index) {
+    // 1. Die with the parent, and leave Ctrl-C to it
+    ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (::getppid() != m_parent_pid) {
+        ::_exit(0);
+    }
+    std::signal(SIGINT, SIG_IGN);
+    std::signal(SIGHUP, SIG_IGN);
+    std::signal(SIGTERM, SIG_DFL);
+    const PipelineStageOptions& placement = m_options.stages[stage];
+    pin(placement, index);
+    at::set_num_threads(static_cast<int>(placement.threads));
+    c10::InferenceMode inference_mode;
+
+    Region& region = *m_region;
+    StageCounters& counters = region.stages[stage];
+    Queue& in = region.queues[stage];
+    Queue& out = region.queues[stage + 1];
+    const size_t first = m_first_layer[stage];
+    const size_t last = m_last_layer[stage];
+    const int64_t* shape = LAYERS[first].input_shape;
+    auto give_up = [&] { return region.stopping.load() || ::getppid() != m_parent_pid; };
+
+    while (true) {
+        // 2. A batch to work on, then room for what it becomes; waiting for
+        // the second is back-pressure from the next stage
+        const Clock::time_point waiting = Clock::now();
+        const uint32_t in_slot = take(in, true, POLL_INTERVAL, give_up);
+        if (in_slot == NO_SLOT) {
+            break;
+        }
+        const Clock::time_point taken = Clock::now();
+        const uint32_t out_slot = take(out, false, POLL_INTERVAL, give_up);
+        if (out_slot == NO_SLOT) {
+            break;
+        }
+        const Clock::time_point started = Clock::now();
+
+        // 3. Run the layers on the input slot in place, copy the result out
+        const SlotHeader& source = region.header(stage, in_slot);
+        SlotHeader& target = region.header(stage + 1, out_slot);
+        target.ticket = source.ticket;
+        target.rows = source.rows;
+        target.failed = 0;
+        if (source.failed) {
+            set_error(target, source.error);
+        } else {
+            try {
+                const auto rows = static_cast<int64_t>(source.rows);
+                at::Tensor x = torch::from_blob(region.rows(stage, in_slot),
+                                                {rows, shape[0], shape[1], shape[2]});
+                for (size_t layer = first; layer <= last; ++layer) {
+                    x = m_layers->run(layer, x);
+                }
+                x = x.contiguous();
+                std::memcpy(region.rows(stage + 1, out_slot), x.data_ptr<float>(),
+                            source.rows * out.row_floats * sizeof(float));
+            } catch (const std::exception& e) {
+                set_error(target, e.what());
+            }
+        }
+        const Clock::time_point finished = Clock::now();
+        const uint32_t rows = source.rows;
+        give(in, false, in_slot);
+        give(out, true, out_slot);
+
+        counters.batches.fetch_add(1, std::memory_order_relaxed);
+        counters.rows.fetch_add(rows, std::memory_order_relaxed);
+        counters.starved_ns.fetch_add(nanoseconds(taken - waiting), std::memory_order_relaxed);
+        counters.blocked_ns.fetch_add(nanoseconds(started - taken), std::memory_order_relaxed);
+        counters.busy_ns.fetch_add(nanoseconds(finished - started), std::memory_order_relaxed);
+    }
+    ::_exit(0);
+}
+
+void PipelineExecutor::submit(const float* inputs, size_t rows, PipelineCallback done) {
+    if (rows == 0 || rows > m_options.max_batch) {
+        throw std::invalid_argument("PipelineExecutor: a batch holds 1 to " +
+                                    std::to_string(m_options.max_batch) + " rows, not " +
+                                    std::to_string(rows));
+    }
+    // 1. Register first: fail() then answers the batch however far it got
+    uint64_t ticket = 0;
+    std::string failure;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_failure.empty()) {
+            ticket = m_next_ticket++;
+            m_pending.emplace(ticket, std::move(done));
+        } else {
+            failure = m_failure;
+        }
+    }
+    if (ticket == 0) {
+        done(std::make_exception_ptr(std::runtime_error(failure)), {});
+        return;
+    }
+
+    // 2. A free input slot; while there is none the pipeline is full and
+    // the caller waits
+    Queue& in = m_region->queues[0];
+    const Clock::time_point waiting = Clock::now();
+    const uint32_t slot = take(in, false, POLL_INTERVAL, [this] { return m_failed.load(); });
+    if (slot == NO_SLOT) {
+        return;
+    }
+    m_submit_blocked_ns.fetch_add(nanoseconds(Clock::now() - waiting), std::memory_order_relaxed);
+
+    SlotHeader& header = m_region->header(0, slot);
+    header.ticket = ticket;
+    header.rows = static_cast<uint32_t>(rows);
+    header.failed = 0;
+    std::memcpy(m_region->rows(0, slot), inputs, rows * INPUT_FLOATS * sizeof(float));
+    give(in, true, slot);
+}
+
+std::future<std::vector<Prediction>> PipelineExecutor::submit(const float* inputs, size_t rows) {
+    auto promise = std::make_shared<std::promise<std::vector<Prediction>>>();
+    std::future<std::vector<Prediction>> future = promise->get_future();
+    submit(inputs, rows,
+           [promise](std::exception_ptr error, const std::vector<Prediction>& predictions) {
+               if (error) {
+                   promise->set_exception(error);
+               } else {
+                   promise->set_value(predictions);
+               }
+           });
+    return future;
+}
+
+std::vector<Prediction> PipelineExecutor::predict_batch(const float* inputs, size_t rows) {
+    // 1. Every chunk goes in before the first is waited for, so they overlap
+    std::vector<std::future<std::vector<Prediction>>> chunks;
+    for (size_t row = 0; row < rows; row += m_options.max_batch) {
+        const size_t count = std::min<size_t>(m_options.max_batch, rows - row);
+        chunks.push_back(submit(inputs + row * INPUT_FLOATS, count));
+    }
+
+    // 2. Results in input order
+    std::vector<Prediction> predictions;
+    predictions.reserve(rows);
+    for (auto& chunk : chunks) {
+        const std::vector<Prediction> part = chunk.get();
+        predictions.insert(predictions.end(), part.begin(), part.end());
+    }
+    return predictions;
+}
+
+void PipelineExecutor::collector_loop() {
+    const size_t last = m_options.stages.size();
+    Queue& out = m_region->queues[last];
+    std::string exited;
+    auto give_up = [&] {
+        if (m_stopping.load()) {
+            return true;
+        }
+        exited = reap_workers();
+        return !exited.empty();
+    };
+    while (true) {
+        const uint32_t slot = take(out, true, POLL_INTERVAL, give_up);
+        if (slot == NO_SLOT) {
+            if (!exited.empty()) {
+                fail("PipelineExecutor: " + exited);
+            }
+            return;
+        }
+
+        // 1. Logits to predictions, then the slot is free again
+        const SlotHeader& header = m_region->header(last, slot);
+        const uint64_t ticket = header.ticket;
+        const uint32_t rows = header.rows;
+        std::exception_ptr error;
+        std::vector<Prediction> predictions;
+        if (header.failed) {
+            error = std::make_exception_ptr(
+                std::runtime_error(std::string("PipelineExecutor: ") + header.error));
+        } else {
+            try {
+                predictions = InferenceEngine::postprocess(
+                    torch::from_blob(m_region->rows(last, slot),
+                                     {static_cast<int64_t>(rows),
+                                      static_cast<int64_t>(out.row_floats)}));
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        give(out, false, slot);
+
+        // 2. Answer the batch
+        PipelineCallback done;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_pending.find(ticket);
+            if (it != m_pending.end()) {
+                done = std::move(it->second);
+                m_pending.erase(it);
+            }
+        }
+        m_batches.fetch_add(1, std::memory_order_relaxed);
+        m_rows.fetch_add(rows, std::memory_order_relaxed);
+        if (done) {
+            done(error, predictions);
+        }
+    }
+}
+
+std::string PipelineExecutor::reap_workers() {
+    for (size_t i = 0; i < m_pids.size(); ++i) {
+        int status = 0;
+        if (m_pids[i] != 0 && ::waitpid(m_pids[i], &status, WNOHANG) == m_pids[i]) {
+            const size_t stage = m_stage_of[i];
+            std::string how = WIFSIGNALED(status)
+                                  ? "was killed by signal " + std::to_string(WTERMSIG(status))
+                                  : "exited with status " + std::to_string(WEXITSTATUS(status));
+            m_pids[i] = 0;
+            return "worker " + std::to_string(i) + " (" +
+                   layer_names(m_first_layer[stage], m_last_layer[stage]) + ") " + how;
+        }
+    }
+    return "";
+}
+
+void PipelineExecutor::fail(const std::string& reason) {
+    std::map<uint64_t, PipelineCallback> pending;
+    std::string failure;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_failure.empty()) {
+            m_failure = reason;
+            if (!m_stopping.load()) {
+                std::cerr << reason << "; the pipeline has stopped" << std::endl;
+            }
+        }
+        failure = m_failure;
+        pending.swap(m_pending);
+    }
+    // Callers waiting in submit() for a slot give up at their next poll
+    m_failed.store(true);
+    const auto error = std::make_exception_ptr(std::runtime_error(failure));
+    for (auto& [ticket, done] : pending) {
+        done(error, {});
+    }
+}
+
+PipelineStats PipelineExecutor::stats() const {
+    PipelineStats stats;
+    stats.batches = m_batches.load();
+    stats.rows = m_rows.load();
+    stats.submit_blocked_seconds = static_cast<double>(m_submit_blocked_ns.load()) / 1e9;
+    for (size_t stage = 0; stage < m_options.stages.size(); ++stage) {
+        const StageCounters& counters = m_region->stages[stage];
+        PipelineStageStats s;
+        s.layers = layer_names(m_first_layer[stage], m_last_layer[stage]);
+        s.workers = m_options.stages[stage].workers;
+        s.batches = counters.batches.load();
+        s.rows = counters.rows.load();
+        s.busy_seconds = static_cast<double>(counters.busy_ns.load()) / 1e9;
+        s.starved_seconds = static_cast<double>(counters.starved_ns.load()) / 1e9;
+        s.blocked_seconds = static_cast<double>(counters.blocked_ns.load()) / 1e9;
+        stats.stages.push_back(std::move(s));
+    }
+    for (size_t q = 0; q <= m_options.stages.size(); ++q) {
+        Queue& queue = m_region->queues[q];
+        lock(&queue.mutex);
+        stats.queued.push_back(queue.ready_count);
+        ::pthread_mutex_unlock(&queue.mutex);
+    }
+    return stats;
+}
@@ -0,0 +1,328 @@
+#include "PreforkServer.h"
+#include "InferenceEngine.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+
+// The worker's server, for its signal handler; a worker has exactly one
+std::atomic<InferenceServer*> g_worker_server{nullptr};
+std::atomic<bool> g_worker_stop{false};
+
+void stop_worker(int) {
+    g_worker_stop.store(true);
+    if (InferenceServer* server = g_worker_server.load()) {
+        server->stop();
+    }
+}
+
+/**
+ * @brief Binds (without listening) a SO_REUSEPORT socket, so an ephemeral
+ * port is resolved once and no other program can take the port while
+ * workers restart.
+ */
+int reserve_port(const IoEngineConfig& io, uint16_t& port) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("PreforkServer: socket() failed");
+    }
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("PreforkServer: SO_REUSEPORT is not supported");
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(io.port);
+    if (::inet_pton(AF_INET, io.bind_address.c_str(), &addr.sin_addr) != 1) {
+        ::close(fd);
+        throw std::runtime_error("PreforkServer: invalid bind address " + io.bind_address);
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("PreforkServer: cannot bind port " + std::to_string(io.port));
+    }
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/**
+ * @brief Restricts this process to worker index's share of the allowed CPUs.
+ */
+void confine_to_slice(uint32_t index, uint32_t workers) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        return;
+    }
+    const size_t size = std::max<size_t>(1, cpus.size() / workers);
+    const size_t first = (static_cast<size_t>(index) * size) % cpus.size();
+    cpu_set_t slice;
+    CPU_ZERO(&slice);
+    for (size_t k = 0; k < size; ++k) {
+        CPU_SET(cpus[(first + k) % cpus.size()], &slice);
+    }
+    if (::sched_setaffinity(0, sizeof(slice), &slice) != 0) {
+        std::cerr << "PreforkServer: worker " << index << " could not be confined to its CPUs"
+                  << std::endl;
+    }
+}
+
+} // namespace
+
+PreforkServer::PreforkServer(const std::vector<ModelConfig>& models, PreforkOptions options)
+    : m_options(std::move(options))
+{
+    if (models.empty()) {
+        throw std::invalid_argument("PreforkServer: at least one model is required");
+    }
+    for (const ModelConfig& config : models) {
+        // The pipeline's collector would be a thread of the parent only
+        if (!config.pipeline.stages.empty()) {
+            throw std::invalid_argument("PreforkServer: model " + config.name + ":" +
+                                        config.version + " has a pipeline; the two "
+                                        "cannot be combined");
+        }
+    }
+    const uint32_t cores = ThreadBudget::available_cores();
+    if (m_options.workers == 0) {
+        m_options.workers = cores;
+    }
+    ThreadBudgetConfig& threads = m_options.server.threads;
+    if (threads.cores == 0) {
+        threads.cores = std::max(1u, cores / m_options.workers);
+    }
+
+    // 1. Load with one intra-op thread: the warm-up passes then run inline
+    // and LibTorch starts no thread pool that the workers would lack
+    at::set_num_threads(1);
+    for (const ModelConfig& config : models) {
+        auto model = std::make_shared<ServedModel>(config);
+        m_frozen_bytes += model->engine().freeze_weights();
+        m_models.push_back(std::move(model));
+    }
+
+    // 2. Claim the port the workers will share
+    m_port_fd = reserve_port(m_options.server.io, m_port);
+
+    // 3. Counters the workers hand back on exit
+    void* slots = ::mmap(nullptr, sizeof(WorkerSlot) * m_options.workers,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        ::close(m_port_fd);
+        throw std::runtime_error("PreforkServer: cannot map the worker counters");
+    }
+    m_slots = static_cast<WorkerSlot*>(slots);
+    for (uint32_t i = 0; i < m_options.workers; ++i) {
+        new (&m_slots[i]) WorkerSlot();
+    }
+    m_workers.resize(m_options.workers);
+    m_parent_pid = ::getpid();
+}
+
+PreforkServer::~PreforkServer() {
+    shutdown();
+    if (m_slots != nullptr) {
+        ::munmap(m_slots, sizeof(WorkerSlot) * m_options.workers);
+    }
+    if (m_port_fd >= 0) {
+        ::close(m_port_fd);
+    }
+}
+
+void PreforkServer::start() {
+    if (m_started) {
+        return;
+    }
+    m_started = true;
+    for (uint32_t i = 0; i < m_options.workers; ++i) {
+        spawn(i);
+    }
+    std::cout << "PreforkServer: " << m_options.workers << " workers on port " << m_port
+              << " sharing " << m_frozen_bytes << " bytes of frozen weights, "
+              << m_options.server.threads.cores << " cores each" << std::endl;
+}
+
+void PreforkServer::spawn(uint32_t index) {
+    // fork() copies only the calling thread; any other (a LibTorch pool,
+    // say) is simply missing in the child, along with the locks it held
+    const size_t threads = thread_count();
+    if (threads > 1) {
+        std::cerr << "PreforkServer: forking with " << threads
+                  << " threads running; the worker inherits none of them" << std::endl;
+    }
+    // Buffered output would otherwise be printed by parent and child alike
+    std::cout.flush();
+    std::cerr.flush();
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error("PreforkServer: fork() failed");
+    }
+    if (pid == 0) {
+        worker_main(index);
+    }
+    m_workers[index].pid = pid;
+    m_workers[index].started = std::chrono::steady_clock::now();
+}
+
+void PreforkServer::worker_main(uint32_t index) {
+    int code = 0;
+    try {
+        // 1. Die with the parent, and leave Ctrl-C to it: it stops the workers
+        ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (::getppid() != m_parent_pid) {
+            ::_exit(1); // The parent died before the line above
+        }
+        std::signal(SIGINT, SIG_IGN);
+        std::signal(SIGTERM, stop_worker);
+        ::close(m_port_fd);
+        if (m_options.pin_processes) {
+            confine_to_slice(index, m_options.workers);
+        }
+
+        // 2. Everything with threads is built here, after the fork
+        InferenceServerOptions options = m_options.server;
+        options.io.port = m_port;
+        options.io.reuse_port = true;
+        InferenceServer server(m_models, options);
+        g_worker_server.store(&server);
+        if (g_worker_stop.load()) {
+            server.stop(); // SIGTERM arrived while the server was being built
+        }
+        if (m_options.ready_fd >= 0) {
+            const pid_t pid = ::getpid();
+            if (::write(m_options.ready_fd, &pid, sizeof(pid)) != sizeof(pid)) {
+                std::cerr << "PreforkServer: worker " << index << " could not report ready"
+                          << std::endl;
+            }
+        }
+        server.run();
+        g_worker_server.store(nullptr);
+
+        // 3. Leave the counters where the parent can read them
+        const IoEngineStats stats = server.io_stats();
+        m_slots[index].responses.fetch_add(stats.frames_sent);
+        m_slots[index].connections.fetch_add(stats.connections_accepted);
+        std::cout << "PreforkServer: worker " << index << " (pid " << ::getpid() << ") sent "
+                  << stats.frames_sent << " responses over " << stats.connections_accepted
+                  << " connections" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "PreforkServer: worker " << index << " failed: " << e.what() << std::endl;
+        code = 1;
+    }
+    // Skip the parent's static destructors and atexit handlers
+    std::cout.flush();
+    std::cerr.flush();
+    ::_exit(code);
+}
+
+void PreforkServer::run() {
+    start();
+    // Polls, so a stop() from a signal handler installed with SA_RESTART
+    // is seen as promptly as one without
+    while (!m_stopping.load()) {
+        int status = 0;
+        const pid_t pid = ::waitpid(-1, &status, WNOHANG);
+        if (pid <= 0) {
+            std::this_thread::sleep_for(SUPERVISE_INTERVAL);
+            continue;
+        }
+        auto it = std::find_if(m_workers.begin(), m_workers.end(),
+                               [pid](const Worker& worker) { return worker.pid == pid; });
+        if (it == m_workers.end()) {
+            continue;
+        }
+        const uint32_t index = static_cast<uint32_t>(it - m_workers.begin());
+        it->pid = 0;
+        if (m_stopping.load()) {
+            break;
+        }
+        std::cerr << "PreforkServer: worker " << index << " (pid " << pid << ") "
+                  << (WIFSIGNALED(status) ? "killed by signal " : "exited with status ")
+                  << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status))
+                  << ", restarting" << std::endl;
+        // A worker that dies young would otherwise be restarted in a tight loop
+        if (std::chrono::steady_clock::now() - it->started < RESTART_BACKOFF) {
+            std::this_thread::sleep_for(RESTART_BACKOFF);
+        }
+        if (!m_stopping.load()) {
+            ++it->restarts;
+            spawn(index);
+        }
+    }
+    shutdown();
+}
+
+void PreforkServer::stop() {
+    m_stopping.store(true);
+}
+
+void PreforkServer::shutdown() {
+    m_stopping.store(true);
+    // 1. Memory first: it can only be read while the workers are alive
+    for (Worker& worker : m_workers) {
+        if (worker.pid != 0) {
+            worker.final_memory = memory_footprint(worker.pid);
+        }
+    }
+    // 2. Each worker finishes its batches in flight, then exits
+    for (const Worker& worker : m_workers) {
+        if (worker.pid != 0) {
+            ::kill(worker.pid, SIGTERM);
+        }
+    }
+    for (Worker& worker : m_workers) {
+        if (worker.pid == 0) {
+            continue;
+        }
+        int status = 0;
+        while (::waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        worker.pid = 0;
+    }
+}
+
+std::vector<PreforkWorkerStats> PreforkServer::worker_stats() const {
+    std::vector<PreforkWorkerStats> stats;
+    for (uint32_t i = 0; i < m_workers.size(); ++i) {
+        const Worker& worker = m_workers[i];
+        PreforkWorkerStats s;
+        s.index = i;
+        s.pid = worker.pid;
+        s.restarts = worker.restarts;
+        s.responses = m_slots[i].responses.load();
+        s.connections = m_slots[i].connections.load();
+        s.memory = worker.pid != 0 ? memory_footprint(worker.pid) : worker.final_memory;
+        stats.push_back(s);
+    }
+    return stats;
+}
@@ -0,0 +1,131 @@
+#include "Protocol.h"
+
+#include <cstring>
+
+namespace {
+
+void append_header(std::vector<uint8_t>& out, const WireHeader& header) {
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&header);
+    out.insert(out.end(), bytes, bytes + sizeof(header));
+}
+
+} // namespace
+
+void append_predict_request(std::vector<uint8_t>& out, uint64_t request_id,
+                            const uint8_t* pixels, uint16_t width, uint16_t height,
+                            const PredictOptions& options) {
+    const std::string_view model = options.model;
+    const size_t pixel_bytes = static_cast<size_t>(width) * height;
+
+    WireHeader header;
+    header.type = static_cast<uint8_t>(MessageType::PredictRequest);
+    header.payload_len =
+        static_cast<uint32_t>(sizeof(PredictRequestHeader) + model.size() + pixel_bytes);
+    header.request_id = request_id;
+    append_header(out, header);
+
+    PredictRequestHeader body;
+    body.width = width;
+    body.height = height;
+    body.model_len = static_cast<uint16_t>(model.size());
+    body.priority = options.priority;
+    body.deadline_us = options.deadline_us;
+    const auto* body_bytes = reinterpret_cast<const uint8_t*>(&body);
+    out.insert(out.end(), body_bytes, body_bytes + sizeof(body));
+    out.insert(out.end(), model.begin(), model.end());
+    out.insert(out.end(), pixels, pixels + pixel_bytes);
+}
+
+void append_predict_response(std::vector<uint8_t>& out, uint64_t request_id,
+                             WireStatus status, const Prediction& prediction) {
+    WireHeader header;
+    header.type = static_cast<uint8_t>(MessageType::PredictResponse);
+    header.status = static_cast<uint8_t>(status);
+    header.payload_len = sizeof(PredictResponseBody);
+    header.request_id = request_id;
+    append_header(out, header);
+
+    PredictResponseBody body;
+    body.digit = prediction.digit;
+    body.confidence = prediction.confidence;
+    const auto* body_bytes = reinterpret_cast<const uint8_t*>(&body);
+    out.insert(out.end(), body_bytes, body_bytes + sizeof(body));
+}
+
+void append_cancel(std::vector<uint8_t>& out, uint64_t request_id) {
+    WireHeader header;
+    header.type = static_cast<uint8_t>(MessageType::Cancel);
+    header.request_id = request_id;
+    append_header(out, header);
+}
+
+void append_stats_request(std::vector<uint8_t>& out, uint64_t request_id) {
+    WireHeader header;
+    header.type = static_cast<uint8_t>(MessageType::StatsRequest);
+    header.request_id = request_id;
+    append_header(out, header);
+}
+
+void append_stats_response(std::vector<uint8_t>& out, uint64_t request_id,
+                           const std::string& json_text) {
+    WireHeader header;
+    header.type = static_cast<uint8_t>(MessageType::StatsResponse);
+    header.payload_len = static_cast<uint32_t>(json_text.size());
+    header.request_id = request_id;
+    append_header(out, header);
+    out.insert(out.end(), json_text.begin(), json_text.end());
+}
+
+bool decode_predict_request(const WireHeader& header, const uint8_t* payload,
+                            PredictRequestView& out) {
+    if (header.payload_len < sizeof(PredictRequestHeader)) {
+        return false;
+    }
+    PredictRequestHeader body;
+    std::memcpy(&body, payload, sizeof(body));
+    const size_t pixel_bytes = static_cast<size_t>(body.width) * body.height;
+    if (pixel_bytes == 0 || header.payload_len != sizeof(body) + body.model_len + pixel_bytes) {
+        return false;
+    }
+    out.width = body.width;
+    out.height = body.height;
+    out.model = std::string_view(reinterpret_cast<const char*>(payload + sizeof(body)),
+                                 body.model_len);
+    out.priority = body.priority;
+    out.deadline_us = body.deadline_us;
+    out.pixels = payload + sizeof(body) + body.model_len;
+    return true;
+}
+
+bool decode_predict_response(const WireHeader& header, const uint8_t* payload,
+                             Prediction& out) {
+    if (header.payload_len != sizeof(PredictResponseBody)) {
+        return false;
+    }
+    PredictResponseBody body;
+    std::memcpy(&body, payload, sizeof(body));
+    out.digit = body.digit;
+    out.confidence = body.confidence;
+    return true;
+}
+
+ParseResult parse_frames(
+    const uint8_t* data, size_t length,
+    const std::function<void(const WireHeader&, const uint8_t*)>& on_frame) {
+    ParseResult result;
+    while (length - result.consumed >= sizeof(WireHeader)) {
+        WireHeader header;
+        std::memcpy(&header, data + result.consumed, sizeof(header));
+        if (header.magic != WIRE_MAGIC || header.payload_len > WIRE_MAX_PAYLOAD) {
+            result.error = true;
+            break;
+        }
+        const size_t frame_len = sizeof(header) + header.payload_len;
+        if (length - result.consumed < frame_len) {
+            break; // Incomplete frame; wait for more bytes
+        }
+        on_frame(header, data + result.consumed + sizeof(header));
+        result.consumed += frame_len;
+    }
+    return result;
+}
@@ -0,0 +1,711 @@
+#include "Router.h"
+#include "ClientConnection.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto READ_POLL = std::chrono::milliseconds(100); ///< How often a reader checks for stop
+
+uint64_t elapsed_ns(Clock::time_point since, Clock::time_point now) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count());
+}
+
+const char* policy_name(RoutingPolicy policy) {
+    return policy == RoutingPolicy::ConsistentHash ? "consistent_hash" : "least_outstanding";
+}
+
+} // namespace
+
+RoutingPolicy parse_routing_policy(const std::string& name) {
+    if (name == "consistent_hash" || name == "hash") {
+        return RoutingPolicy::ConsistentHash;
+    }
+    if (name == "least_outstanding" || name == "least") {
+        return RoutingPolicy::LeastOutstanding;
+    }
+    throw std::invalid_argument("Unknown routing policy '" + name +
+                                "' (expected consistent_hash or least_outstanding)");
+}
+
+/**
+ * @brief One pipelined connection to a backend, with a writer thread that
+ * batches queued frames into one send and a reader that relays replies.
+ */
+struct Router::Link {
+    std::unique_ptr<ClientConnection> connection;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<uint8_t> outbox;                          ///< Frames for the writer
+    std::unordered_map<uint64_t, PendingRequest> pending; ///< By router id
+    bool closed = false;                                  ///< Takes no new requests
+    std::atomic<bool> stopping{false};
+    std::thread reader;
+    std::thread writer;
+};
+
+struct Router::Backend {
+    explicit Backend(BackendAddress where) : address(std::move(where)), name(address.name()) {}
+
+    BackendAddress address;
+    std::string name;
+    std::vector<std::unique_ptr<Link>> links; ///< Replaced under Router::m_mutex
+    bool healthy = false;                     ///< In the ring; guarded by Router::m_mutex
+    uint32_t failures = 0;                    ///< Consecutive failed checks; health thread only
+    std::atomic<size_t> next_link{0};
+
+    std::atomic<int64_t> outstanding{0};
+    std::atomic<uint64_t> forwarded{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> retried{0};
+
+    std::mutex latency_mutex;
+    LatencyHistogram latency;
+    std::mutex stats_mutex;
+    std::string last_stats; ///< The backend's StatsResponse from the last health check
+};
+
+Router::Router(const std::vector<BackendAddress>& backends, RouterOptions options)
+    : m_options(std::move(options)),
+      m_ring(m_options.virtual_nodes)
+{
+    if (m_options.connections_per_backend == 0 || m_options.eject_after_failures == 0) {
+        throw std::invalid_argument(
+            "Router: connections_per_backend and eject_after_failures must be at least 1");
+    }
+    for (const BackendAddress& address : backends) {
+        m_backends.emplace(address.name(), std::make_shared<Backend>(address));
+    }
+    m_io = IoEngine::create(m_options.io,
+                            [this](uint64_t connection_id, const WireHeader& header,
+                                   const uint8_t* payload) {
+                                on_frame(connection_id, header, payload);
+                            });
+    m_health = std::thread(&Router::health_loop, this);
+
+    std::cout << "Router: listening on " << m_options.io.bind_address << ":" << m_io->port()
+              << " (" << m_io->name() << ", " << policy_name(m_options.policy) << ", "
+              << backends.size() << " backends)" << std::endl;
+}
+
+Router::~Router() {
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(m_health_mutex);
+        m_stopping.store(true);
+    }
+    m_health_cv.notify_all();
+    if (m_health.joinable()) {
+        m_health.join();
+    }
+    // What the links still hold is answered with an error
+    std::vector<std::shared_ptr<Backend>> backends;
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        for (auto& [name, backend] : m_backends) {
+            backends.push_back(std::move(backend));
+        }
+        m_backends.clear();
+        m_healthy.clear();
+    }
+    for (const auto& backend : backends) {
+        for (const auto& link : backend->links) {
+            close_link(*link);
+        }
+    }
+}
+
+void Router::run() {
+    m_io->run();
+}
+
+void Router::stop() {
+    m_io->stop();
+}
+
+void Router::on_frame(uint64_t connection_id, const WireHeader& header, const uint8_t* payload) {
+    // Runs on the engine's loop thread: hash, hand to a link and get back to I/O
+    if (header.type == static_cast<uint8_t>(MessageType::StatsRequest)) {
+        std::vector<uint8_t> frame;
+        append_stats_response(frame, header.request_id, stats_json());
+        m_io->send(connection_id, std::move(frame));
+        return;
+    }
+    if (header.type == static_cast<uint8_t>(MessageType::Cancel)) {
+        return; // Not forwarded: the backend knows the request by the router's id only
+    }
+
+    PendingRequest request;
+    request.connection_id = connection_id;
+    request.request_id = header.request_id;
+    request.received = Clock::now();
+    PredictRequestView view;
+    if (header.type != static_cast<uint8_t>(MessageType::PredictRequest) ||
+        !decode_predict_request(header, payload, view)) {
+        reply(request, WireStatus::BadRequest, Prediction{});
+        return;
+    }
+    m_requests.fetch_add(1, std::memory_order_relaxed);
+
+    // 1. Model and pixels decide the answer, so they decide the backend;
+    // priority and deadline do not
+    const uint64_t shape = (static_cast<uint64_t>(view.width) << 16) | view.height;
+    request.key = hash_bytes(view.pixels, static_cast<size_t>(view.width) * view.height,
+                             hash_bytes(view.model.data(), view.model.size(), shape));
+
+    // 2. Forwarded as received; dispatch() swaps in the router's id
+    const auto* header_bytes = reinterpret_cast<const uint8_t*>(&header);
+    request.frame.reserve(sizeof(WireHeader) + header.payload_len);
+    request.frame.assign(header_bytes, header_bytes + sizeof(WireHeader));
+    request.frame.insert(request.frame.end(), payload, payload + header.payload_len);
+    dispatch(std::move(request), nullptr);
+}
+
+void Router::dispatch(PendingRequest request, const Backend* exclude) {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    Backend* backend = choose(request.key, exclude);
+    Link* link = nullptr;
+    if (backend != nullptr) {
+        // Round-robin over the backend's connections, skipping lost ones
+        const size_t count = backend->links.size();
+        const size_t first = backend->next_link.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < count && link == nullptr; ++i) {
+            Link& candidate = *backend->links[(first + i) % count];
+            std::lock_guard<std::mutex> guard(candidate.mutex);
+            if (candidate.closed) {
+                continue;
+            }
+            const uint64_t id = m_next_id.fetch_add(1, std::memory_order_relaxed);
+            std::memcpy(request.frame.data() + offsetof(WireHeader, request_id), &id, sizeof(id));
+            request.forwarded = Clock::now();
+            backend->outstanding.fetch_add(1, std::memory_order_relaxed);
+            backend->forwarded.fetch_add(1, std::memory_order_relaxed);
+            candidate.outbox.insert(candidate.outbox.end(), request.frame.begin(),
+                                    request.frame.end());
+            candidate.pending.emplace(id, std::move(request));
+            link = &candidate;
+        }
+    }
+    lock.unlock();
+    if (link == nullptr) {
+        m_unavailable.fetch_add(1, std::memory_order_relaxed);
+        reply(request, WireStatus::Unavailable, Prediction{});
+        return;
+    }
+    link->cv.notify_one();
+}
+
+Router::Backend* Router::choose(uint64_t key, const Backend* exclude) {
+    if (m_healthy.empty()) {
+        return nullptr;
+    }
+    if (m_options.policy == RoutingPolicy::LeastOutstanding) {
+        // Rotate the starting point so ties do not all land on the first backend
+        const size_t count = m_healthy.size();
+        const size_t first = m_rotation.fetch_add(1, std::memory_order_relaxed) % count;
+        Backend* best = nullptr;
+        for (size_t i = 0; i < count; ++i) {
+            Backend* candidate = m_healthy[(first + i) % count];
+            if (candidate != exclude &&
+                (best == nullptr || candidate->outstanding.load(std::memory_order_relaxed) <
+                                        best->outstanding.load(std::memory_order_relaxed))) {
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    // Consistent hashing with bounded loads: a backend takes new keys only
+    // while it has less than load_bound x the mean in flight, so a hot key
+    // spills to the next backend on the ring instead of swamping its own
+    int64_t limit = std::numeric_limits<int64_t>::max();
+    if (m_options.load_bound > 0.0) {
+        int64_t total = 0;
+        for (const Backend* backend : m_healthy) {
+            total += std::max<int64_t>(0, backend->outstanding.load(std::memory_order_relaxed));
+        }
+        limit = static_cast<int64_t>(std::ceil(m_options.load_bound *
+                                               static_cast<double>(total + 1) /
+                                               static_cast<double>(m_healthy.size())));
+    }
+    Backend* chosen = nullptr;
+    Backend* owner = nullptr;
+    m_ring.walk(key, [&](const std::string& name) {
+        auto it = m_backends.find(name);
+        if (it == m_backends.end() || it->second.get() == exclude) {
+            return false;
+        }
+        Backend* candidate = it->second.get();
+        if (owner == nullptr) {
+            owner = candidate;
+        }
+        if (candidate->outstanding.load(std::memory_order_relaxed) < limit) {
+            chosen = candidate;
+            return true;
+        }
+        return false;
+    });
+    return chosen != nullptr ? chosen : owner;
+}
+
+void Router::reply(const PendingRequest& request, WireStatus status,
+                   const Prediction& prediction) {
+    std::vector<uint8_t> frame;
+    frame.reserve(sizeof(WireHeader) + sizeof(PredictResponseBody));
+    append_predict_response(frame, request.request_id, status, prediction);
+    m_io->send(request.connection_id, std::move(frame));
+    std::lock_guard<std::mutex> lock(m_latency_mutex);
+    m_latency.record(elapsed_ns(request.received, Clock::now()));
+}
+
+void Router::reader_loop(Backend& backend, Link& link) {
+    std::vector<PredictResponse> responses;
+    try {
+        while (!link.stopping.load()) {
+            responses.clear();
+            if (link.connection->read_responses(responses, READ_POLL) == 0) {
+                continue;
+            }
+            const Clock::time_point now = Clock::now();
+            for (const PredictResponse& response : responses) {
+                PendingRequest request;
+                {
+                    std::lock_guard<std::mutex> lock(link.mutex);
+                    auto it = link.pending.find(response.request_id);
+                    if (it == link.pending.end()) {
+                        continue;
+                    }
+                    request = std::move(it->second);
+                    link.pending.erase(it);
+                }
+                backend.outstanding.fetch_sub(1, std::memory_order_relaxed);
+                if (response.status == WireStatus::Ok) {
+                    backend.completed.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    backend.failed.fetch_add(1, std::memory_order_relaxed);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(backend.latency_mutex);
+                    backend.latency.record(elapsed_ns(request.forwarded, now));
+                }
+                reply(request, response.status, response.prediction);
+            }
+        }
+    } catch (const std::exception& e) {
+        if (!link.stopping.load()) {
+            std::cerr << "Router: lost connection to " << backend.name << ": " << e.what()
+                      << std::endl;
+        }
+    }
+    fail_link(backend, link);
+}
+
+void Router::writer_loop(Link& link) {
+    std::vector<uint8_t> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(link.mutex);
+            link.cv.wait(lock, [&link] { return link.closed || !link.outbox.empty(); });
+            if (link.closed) {
+                return;
+            }
+            batch.swap(link.outbox);
+        }
+        // Everything queued since the last write goes out in one send
+        try {
+            link.connection->send_frames(batch);
+        } catch (const std::exception&) {
+            link.connection->shutdown(); // The reader fails the link
+            return;
+        }
+        batch.clear();
+    }
+}
+
+void Router::fail_link(Backend& backend, Link& link) {
+    std::unordered_map<uint64_t, PendingRequest> stranded;
+    {
+        std::lock_guard<std::mutex> lock(link.mutex);
+        link.closed = true;
+        stranded.swap(link.pending);
+        link.outbox.clear();
+    }
+    link.cv.notify_all();
+    for (auto& [id, request] : stranded) {
+        backend.outstanding.fetch_sub(1, std::memory_order_relaxed);
+        // Inference is idempotent, so one more try elsewhere is safe
+        if (request.retried || m_stopping.load()) {
+            backend.failed.fetch_add(1, std::memory_order_relaxed);
+            reply(request, WireStatus::InternalError, Prediction{});
+            continue;
+        }
+        request.retried = true;
+        backend.retried.fetch_add(1, std::memory_order_relaxed);
+        dispatch(std::move(request), &backend);
+    }
+}
+
+std::unique_ptr<Router::Link> Router::open_link(Backend& backend) {
+    auto link = std::make_unique<Link>();
+    link->connection = std::make_unique<ClientConnection>(
+        backend.address.host, backend.address.port, m_options.health_timeout);
+    link->reader = std::thread(&Router::reader_loop, this, std::ref(backend), std::ref(*link));
+    link->writer = std::thread(&Router::writer_loop, this, std::ref(*link));
+    return link;
+}
+
+void Router::close_link(Link& link) {
+    {
+        std::lock_guard<std::mutex> lock(link.mutex);
+        link.closed = true;
+    }
+    link.stopping.store(true);
+    link.cv.notify_all();
+    link.connection->shutdown();
+    if (link.writer.joinable()) {
+        link.writer.join();
+    }
+    if (link.reader.joinable()) {
+        link.reader.join();
+    }
+}
+
+void Router::health_loop() {
+    std::unique_lock<std::mutex> lock(m_health_mutex);
+    while (!m_stopping.load()) {
+        m_check_now = false;
+        lock.unlock();
+        std::vector<std::shared_ptr<Backend>> backends;
+        {
+            std::shared_lock<std::shared_mutex> table(m_mutex);
+            for (const auto& [name, backend] : m_backends) {
+                backends.push_back(backend);
+            }
+        }
+        for (const auto& backend : backends) {
+            if (m_stopping.load()) {
+                break;
+            }
+            check(backend);
+        }
+        lock.lock();
+        m_health_cv.wait_for(lock, m_options.health_interval,
+                             [this] { return m_stopping.load() || m_check_now; });
+    }
+}
+
+void Router::check(const std::shared_ptr<Backend>& backend) {
+    // 1. Probe on a connection of its own, so a backlog of predictions
+    // cannot make a live backend look dead
+    std::string stats;
+    try {
+        ClientConnection probe(backend->address.host, backend->address.port,
+                               m_options.health_timeout);
+        stats = probe.fetch_stats(m_options.health_timeout);
+    } catch (const std::exception& e) {
+        if (++backend->failures != m_options.eject_after_failures) {
+            return;
+        }
+        std::vector<std::unique_ptr<Link>> retired;
+        {
+            std::unique_lock<std::shared_mutex> lock(m_mutex);
+            if (m_backends.count(backend->name) == 0) {
+                return;
+            }
+            if (backend->healthy) {
+                backend->healthy = false;
+                std::cerr << "Router: ejecting " << backend->name << " after "
+                          << backend->failures << " failed health checks (" << e.what() << ")"
+                          << std::endl;
+                rebalance(backend->name, false);
+            }
+            retired.swap(backend->links);
+        }
+        // A backend that cannot answer a health check will not answer what
+        // it holds either: closing the links retries those elsewhere
+        for (const auto& link : retired) {
+            close_link(*link);
+        }
+        return;
+    }
+    backend->failures = 0;
+    {
+        std::lock_guard<std::mutex> lock(backend->stats_mutex);
+        backend->last_stats = std::move(stats);
+    }
+
+    // 2. Open the connections it lacks: all of them the first time, lost ones later
+    size_t missing = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        missing = m_options.connections_per_backend - backend->links.size();
+        for (const auto& link : backend->links) {
+            std::lock_guard<std::mutex> guard(link->mutex);
+            missing += link->closed ? 1 : 0;
+        }
+        if (missing == 0 && backend->healthy) {
+            return;
+        }
+    }
+    std::vector<std::unique_ptr<Link>> fresh;
+    try {
+        for (size_t i = 0; i < missing; ++i) {
+            fresh.push_back(open_link(*backend));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Router: cannot connect to " << backend->name << ": " << e.what()
+                  << std::endl;
+        for (const auto& link : fresh) {
+            close_link(*link);
+        }
+        return;
+    }
+
+    // 3. Swap them in and, if it was out, put the backend back on the ring
+    std::vector<std::unique_ptr<Link>> retired;
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        if (m_backends.count(backend->name) == 0) {
+            retired = std::move(fresh); // Removed while we were connecting
+        } else {
+            for (auto& link : backend->links) {
+                bool closed = false;
+                {
+                    std::lock_guard<std::mutex> guard(link->mutex);
+                    closed = link->closed;
+                }
+                if (closed && !fresh.empty()) {
+                    retired.push_back(std::move(link));
+                    link = std::move(fresh.back());
+                    fresh.pop_back();
+                }
+            }
+            while (!fresh.empty() &&
+                   backend->links.size() < m_options.connections_per_backend) {
+                backend->links.push_back(std::move(fresh.back()));
+                fresh.pop_back();
+            }
+            if (!backend->healthy) {
+                backend->healthy = true;
+                rebalance(backend->name, true);
+            }
+        }
+    }
+    for (auto& link : fresh) {
+        retired.push_back(std::move(link));
+    }
+    for (const auto& link : retired) {
+        close_link(*link);
+    }
+}
+
+void Router::rebalance(const std::string& name, bool join) {
+    // The owners of a fixed sample of keys before and after: about 1/N of
+    // them should move, which is the point of consistent hashing
+    std::vector<std::string> before(BALANCE_PROBES);
+    for (size_t i = 0; i < BALANCE_PROBES; ++i) {
+        before[i] = m_ring.owner(hash_bytes(&i, sizeof(i)));
+    }
+    if (join) {
+        m_ring.add(name);
+    } else {
+        m_ring.remove(name);
+    }
+    size_t moved = 0;
+    for (size_t i = 0; i < BALANCE_PROBES; ++i) {
+        moved += m_ring.owner(hash_bytes(&i, sizeof(i))) != before[i] ? 1 : 0;
+    }
+
+    m_healthy.clear();
+    for (const auto& [member, backend] : m_backends) {
+        if (backend->healthy) {
+            m_healthy.push_back(backend.get());
+        }
+    }
+    const double share = static_cast<double>(moved) / static_cast<double>(BALANCE_PROBES);
+    m_rebalances.fetch_add(1);
+    m_last_moved.store(share);
+    std::cout << "Router: " << name << (join ? " joined" : " left") << ", "
+              << m_healthy.size() << " backends in rotation, " << share * 100.0
+              << "% of keys moved" << std::endl;
+}
+
+void Router::add_backend(const BackendAddress& address) {
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        if (!m_backends.emplace(address.name(), std::make_shared<Backend>(address)).second) {
+            return;
+        }
+    }
+    std::cout << "Router: added " << address.name() << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(m_health_mutex);
+        m_check_now = true;
+    }
+    m_health_cv.notify_all();
+}
+
+void Router::remove_backend(const std::string& name) {
+    std::shared_ptr<Backend> backend;
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        auto it = m_backends.find(name);
+        if (it == m_backends.end()) {
+            return;
+        }
+        backend = it->second;
+        m_backends.erase(it);
+        if (backend->healthy) {
+            backend->healthy = false;
+            rebalance(name, false);
+        }
+    }
+    std::cout << "Router: removed " << name << std::endl;
+    // Outside the lock: the readers retry what they held on other backends
+    for (const auto& link : backend->links) {
+        close_link(*link);
+    }
+}
+
+void Router::set_backends(const std::vector<BackendAddress>& backends) {
+    std::set<std::string> wanted;
+    for (const BackendAddress& address : backends) {
+        wanted.insert(address.name());
+    }
+    std::vector<std::string> gone;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        for (const auto& [name, backend] : m_backends) {
+            if (wanted.count(name) == 0) {
+                gone.push_back(name);
+            }
+        }
+    }
+    for (const std::string& name : gone) {
+        remove_backend(name);
+    }
+    for (const BackendAddress& address : backends) {
+        add_backend(address);
+    }
+}
+
+size_t Router::healthy_backends() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_healthy.size();
+}
+
+std::vector<BackendStats> Router::backend_stats() const {
+    std::vector<BackendStats> stats;
+    uint64_t total = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        for (const auto& [name, backend] : m_backends) {
+            BackendStats s;
+            s.name = name;
+            s.healthy = backend->healthy;
+            s.outstanding = backend->outstanding.load();
+            s.forwarded = backend->forwarded.load();
+            s.completed = backend->completed.load();
+            s.failed = backend->failed.load();
+            s.retried = backend->retried.load();
+            {
+                std::lock_guard<std::mutex> guard(backend->latency_mutex);
+                s.p50_us = static_cast<double>(backend->latency.value_at_percentile(50.0)) / 1000.0;
+                s.p99_us = static_cast<double>(backend->latency.value_at_percentile(99.0)) / 1000.0;
+            }
+            total += s.forwarded;
+            stats.push_back(s);
+        }
+    }
+    for (BackendStats& s : stats) {
+        s.share = total > 0 ? static_cast<double>(s.forwarded) / static_cast<double>(total) : 0.0;
+    }
+    std::sort(stats.begin(), stats.end(),
+              [](const BackendStats& a, const BackendStats& b) { return a.name < b.name; });
+    return stats;
+}
+
+std::string Router::stats_json() const {
+    json doc;
+    const IoEngineStats io = m_io->stats();
+    {
+        std::lock_guard<std::mutex> lock(m_latency_mutex);
+        const double p50_us = static_cast<double>(m_latency.value_at_percentile(50.0)) / 1000.0;
+        const double p99_us = static_cast<double>(m_latency.value_at_percentile(99.0)) / 1000.0;
+        doc["router"] = {{"policy", policy_name(m_options.policy)},
+                         {"requests", m_requests.load()},
+                         {"unavailable", m_unavailable.load()},
+                         {"healthy_backends", healthy_backends()},
+                         {"rebalances", m_rebalances.load()},
+                         {"last_moved_fraction", m_last_moved.load()},
+                         {"connections_accepted", io.connections_accepted},
+                         {"p50_us", p50_us},
+                         {"p99_us", p99_us}};
+    }
+
+    // 1. The router's view of each backend
+    json backends = json::object();
+    for (const BackendStats& s : backend_stats()) {
+        backends[s.name] = {{"healthy", s.healthy},
+                            {"outstanding", s.outstanding},
+                            {"forwarded", s.forwarded},
+                            {"completed", s.completed},
+                            {"failed", s.failed},
+                            {"retried", s.retried},
+                            {"share", s.share},
+                            {"p50_us", s.p50_us},
+                            {"p99_us", s.p99_us}};
+    }
+
+    // 2. Each backend's own metrics as of its last health check, summed per
+    // model; percentiles cannot be summed, so the worst one is reported
+    json models = json::object();
+    uint64_t unique_bytes = 0;
+    std::vector<std::pair<std::string, std::string>> reports;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        for (const auto& [name, backend] : m_backends) {
+            std::lock_guard<std::mutex> guard(backend->stats_mutex);
+            reports.emplace_back(name, backend->last_stats);
+        }
+    }
+    for (const auto& [name, text] : reports) {
+        const json report = json::parse(text, nullptr, false);
+        if (report.is_discarded()) {
+            continue;
+        }
+        if (report.contains("process")) {
+            unique_bytes += report["process"].value("unique_bytes", uint64_t{0});
+        }
+        const json served = report.value("models", json::object());
+        for (const auto& [model, m] : served.items()) {
+            json& sum = models[model];
+            if (sum.is_null()) {
+                sum = json::object();
+            }
+            for (const char* field : {"submitted", "completed", "goodput", "late", "rejected",
+                                      "overloaded", "shed", "failed", "batches", "coalesced"}) {
+                sum[field] = sum.value(field, uint64_t{0}) + m.value(field, uint64_t{0});
+            }
+            sum["p99_us_max"] = std::max(sum.value("p99_us_max", 0.0), m.value("p99_us", 0.0));
+        }
+    }
+    doc["backends"] = std::move(backends);
+    doc["aggregate"] = {{"models", std::move(models)}, {"unique_bytes", unique_bytes}};
+    return doc.dump();
+}
@@ -0,0 +1,442 @@
+#include "ScratchArena.h"
+
+#include <c10/core/CPUAllocator.h>
+#include <opencv2/core.hpp>
+#include <torch/version.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+// LibTorch 2.3 dropped the const from Allocator::allocate() and made
+// copy_data() pure virtual
+#if TORCH_VERSION_MAJOR > 2 || (TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 3)
+#define SCRATCH_ARENA_ALLOCATE_CONST
+#define SCRATCH_ARENA_COPY_DATA 1
+#else
+#define SCRATCH_ARENA_ALLOCATE_CONST const
+#endif
+
+/**
+ * @brief A mapping the arena bumps through. The header sits in the first
+ * cache line; data starts after it.
+ */
+struct ScratchArena::Chunk {
+    std::atomic<uint32_t> refs{1}; ///< The arena's own, plus one per live block
+    size_t mapped = 0;             ///< Bytes of the mapping, header included
+    size_t size = 0;               ///< Usable bytes
+
+    char* data() { return reinterpret_cast<char*>(this) + HEADER; }
+
+    static constexpr size_t HEADER = 64;
+};
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t ALIGNMENT = 64; ///< As LibTorch's own CPU allocator gives
+
+/**
+ * @brief One thread's counters. Written by their thread only, except for
+ * frees, which count where they happen.
+ */
+struct Counters {
+    std::atomic<uint64_t> arena_allocations{0};
+    std::atomic<uint64_t> arena_bytes{0};
+    std::atomic<uint64_t> heap_allocations{0};
+    std::atomic<uint64_t> heap_bytes{0};
+    std::atomic<uint64_t> allocate_ns{0};
+    std::atomic<uint64_t> free_ns{0};
+    std::atomic<uint64_t> resets{0};
+    std::atomic<uint64_t> chunks_mapped{0};
+    std::atomic<uint64_t> chunks_detached{0};
+};
+
+std::atomic<bool> g_enabled{false};
+std::atomic<bool> g_profile{false};
+std::atomic<size_t> g_chunk_bytes{ArenaOptions{}.chunk_bytes};
+std::atomic<size_t> g_max_bytes{ArenaOptions{}.max_bytes};
+std::atomic<size_t> g_mapped_bytes{0};
+
+std::mutex g_mutex;
+bool g_installed = false;
+/// Every thread's counters; never freed, so exited threads still count
+std::vector<std::unique_ptr<Counters>> g_counters;
+
+thread_local Counters* t_counters = nullptr;
+thread_local ScratchArena* t_active = nullptr;
+thread_local uint32_t t_depth = 0;
+
+Counters& counters() {
+    if (t_counters == nullptr) {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_counters.push_back(std::make_unique<Counters>());
+        t_counters = g_counters.back().get();
+    }
+    return *t_counters;
+}
+
+uint64_t since(Clock::time_point start) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+size_t page_size() {
+    static const size_t size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+void count_free(Clock::time_point start) {
+    counters().free_ns.fetch_add(since(start), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Deleter of tensors in the arena: the context is the chunk.
+ */
+void release_tensor(void* chunk) {
+    if (g_profile.load(std::memory_order_relaxed)) {
+        const Clock::time_point start = Clock::now();
+        ScratchArena::release(static_cast<ScratchArena::Chunk*>(chunk));
+        count_free(start);
+        return;
+    }
+    ScratchArena::release(static_cast<ScratchArena::Chunk*>(chunk));
+}
+
+c10::DeleterFnPtr g_heap_free = nullptr; ///< The replaced allocator's, when it has a raw one
+
+/**
+ * @brief Deleter of heap tensors while profiling: times the real one.
+ */
+void timed_heap_free(void* context) {
+    const Clock::time_point start = Clock::now();
+    g_heap_free(context);
+    count_free(start);
+}
+
+/**
+ * @class TorchArenaAllocator
+ * @brief LibTorch's CPU allocator while installed: the arena inside a
+ * scope, the allocator it replaced outside.
+ */
+class TorchArenaAllocator final : public c10::Allocator {
+public:
+    explicit TorchArenaAllocator(c10::Allocator* heap) : m_heap(heap) {
+        g_heap_free = heap->raw_deleter();
+    }
+
+    c10::DataPtr allocate(size_t bytes) SCRATCH_ARENA_ALLOCATE_CONST override {
+        const bool profile = g_profile.load(std::memory_order_relaxed);
+        const Clock::time_point start = profile ? Clock::now() : Clock::time_point{};
+        Counters& c = counters();
+
+        // 1. The arena, if a scope is open and the request fits
+        ScratchArena* arena = bytes > 0 ? ScratchArena::active() : nullptr;
+        ScratchArena::Chunk* chunk = nullptr;
+        void* data = arena != nullptr ? arena->allocate(bytes, &chunk) : nullptr;
+        if (data != nullptr) {
+            c.arena_allocations.fetch_add(1, std::memory_order_relaxed);
+            c.arena_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            c10::DataPtr result(data, chunk, &release_tensor, c10::Device(c10::DeviceType::CPU));
+            if (profile) {
+                c.allocate_ns.fetch_add(since(start), std::memory_order_relaxed);
+            }
+            return result;
+        }
+
+        // 2. Otherwise the heap; while profiling its frees are timed too
+        c10::DataPtr result = m_heap->allocate(bytes);
+        c.heap_allocations.fetch_add(1, std::memory_order_relaxed);
+        c.heap_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (profile) {
+            if (g_heap_free != nullptr && result.get_deleter() == g_heap_free) {
+                void* pointer = result.get();
+                const c10::Device device = result.device();
+                void* context = result.release_context();
+                result = c10::DataPtr(pointer, context, &timed_heap_free, device);
+            }
+            c.allocate_ns.fetch_add(since(start), std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    c10::DeleterFnPtr raw_deleter() const override {
+        return nullptr; // Arena blocks need their chunk as the context
+    }
+
+#ifdef SCRATCH_ARENA_COPY_DATA
+    void copy_data(void* dest, const void* src, size_t count) const override {
+        default_copy_data(dest, src, count);
+    }
+#endif
+
+private:
+    c10::Allocator* m_heap;
+};
+
+/**
+ * @class MatArenaAllocator
+ * @brief OpenCV's default Mat allocator while installed. An arena buffer
+ * carries its UMatData in front of the pixels and its chunk in userdata.
+ */
+class MatArenaAllocator final : public cv::MatAllocator {
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        const bool profile = g_profile.load(std::memory_order_relaxed);
+        const Clock::time_point start = profile ? Clock::now() : Clock::time_point{};
+        Counters& c = counters();
+
+        // 1. Steps and size as cv::Mat's own allocator works them out
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; --i) {
+            if (step != nullptr) {
+                if (data0 != nullptr && step[i] != CV_AUTOSTEP) {
+                    total = step[i];
+                } else {
+                    step[i] = total;
+                }
+            }
+            total *= static_cast<size_t>(sizes[i]);
+        }
+
+        // 2. The arena, unless the caller brought its own buffer
+        ScratchArena* arena = data0 == nullptr ? ScratchArena::active() : nullptr;
+        ScratchArena::Chunk* chunk = nullptr;
+        const size_t header = round_up(sizeof(cv::UMatData), ALIGNMENT);
+        void* block = arena != nullptr ? arena->allocate(header + total, &chunk) : nullptr;
+        cv::UMatData* u;
+        if (block != nullptr) {
+            u = new (block) cv::UMatData(this);
+            u->data = u->origdata = static_cast<uchar*>(block) + header;
+            u->size = total;
+            u->userdata = chunk;
+            c.arena_allocations.fetch_add(1, std::memory_order_relaxed);
+            c.arena_bytes.fetch_add(total, std::memory_order_relaxed);
+        } else {
+            // 3. The heap; the Mat still comes back here to be freed
+            u = heap()->allocate(dims, sizes, type, data0, step, flags, usage);
+            u->currAllocator = u->prevAllocator = this;
+            if (data0 == nullptr) {
+                c.heap_allocations.fetch_add(1, std::memory_order_relaxed);
+                c.heap_bytes.fetch_add(total, std::memory_order_relaxed);
+            }
+        }
+        if (profile) {
+            c.allocate_ns.fetch_add(since(start), std::memory_order_relaxed);
+        }
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const override {
+        return u != nullptr;
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if (u == nullptr) {
+            return;
+        }
+        const bool profile = g_profile.load(std::memory_order_relaxed);
+        const Clock::time_point start = profile ? Clock::now() : Clock::time_point{};
+        if (auto* chunk = static_cast<ScratchArena::Chunk*>(u->userdata)) {
+            u->~UMatData();
+            ScratchArena::release(chunk);
+        } else {
+            heap()->deallocate(u);
+        }
+        if (profile) {
+            count_free(start);
+        }
+    }
+
+private:
+    static cv::MatAllocator* heap() { return cv::Mat::getStdAllocator(); }
+};
+
+} // namespace
+
+void ScratchArena::configure(const ArenaOptions& options) {
+    if (options.chunk_bytes == 0 || options.chunk_bytes > options.max_bytes) {
+        throw std::invalid_argument("ScratchArena: chunk_bytes must be in (0, max_bytes]");
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_chunk_bytes.store(options.chunk_bytes);
+    g_max_bytes.store(options.max_bytes);
+    g_profile.store(options.profile);
+    g_enabled.store(options.enabled);
+    if (!g_installed && (options.enabled || options.profile)) {
+        // Never freed: tensors and Mats may outlive main()
+        c10::SetAllocator(c10::DeviceType::CPU, new TorchArenaAllocator(c10::GetCPUAllocator()));
+        cv::Mat::setDefaultAllocator(new MatArenaAllocator());
+        g_installed = true;
+        std::cout << "ScratchArena: installed for tensors and Mats (" << (options.chunk_bytes >> 10)
+                  << " KiB chunks, " << (options.max_bytes >> 20) << " MiB per thread)"
+                  << std::endl;
+    }
+}
+
+ArenaOptions ScratchArena::options() {
+    ArenaOptions options;
+    options.enabled = g_enabled.load();
+    options.chunk_bytes = g_chunk_bytes.load();
+    options.max_bytes = g_max_bytes.load();
+    options.profile = g_profile.load();
+    return options;
+}
+
+ArenaStats ScratchArena::stats() {
+    ArenaStats stats;
+    uint64_t allocate_ns = 0;
+    uint64_t free_ns = 0;
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (const auto& c : g_counters) {
+        stats.arena_allocations += c->arena_allocations.load(std::memory_order_relaxed);
+        stats.arena_bytes += c->arena_bytes.load(std::memory_order_relaxed);
+        stats.heap_allocations += c->heap_allocations.load(std::memory_order_relaxed);
+        stats.heap_bytes += c->heap_bytes.load(std::memory_order_relaxed);
+        allocate_ns += c->allocate_ns.load(std::memory_order_relaxed);
+        free_ns += c->free_ns.load(std::memory_order_relaxed);
+        stats.resets += c->resets.load(std::memory_order_relaxed);
+        stats.chunks_mapped += c->chunks_mapped.load(std::memory_order_relaxed);
+        stats.chunks_detached += c->chunks_detached.load(std::memory_order_relaxed);
+    }
+    stats.allocate_seconds = static_cast<double>(allocate_ns) / 1e9;
+    stats.free_seconds = static_cast<double>(free_ns) / 1e9;
+    stats.mapped_bytes = g_mapped_bytes.load();
+    return stats;
+}
+
+ScratchArena* ScratchArena::active() {
+    return t_active;
+}
+
+ScratchArena& ScratchArena::local() {
+    thread_local ScratchArena arena;
+    return arena;
+}
+
+ScratchArena::~ScratchArena() {
+    for (Chunk* chunk : m_chunks) {
+        release(chunk);
+    }
+}
+
+void* ScratchArena::allocate(size_t bytes, Chunk** chunk) {
+    bytes = round_up(std::max<size_t>(bytes, 1), ALIGNMENT);
+
+    // 1. Bump the current chunk: the common case
+    if (!m_chunks.empty() && m_offset + bytes <= m_chunks.back()->size) {
+        Chunk* current = m_chunks.back();
+        void* data = current->data() + m_offset;
+        m_offset += bytes;
+        m_request_bytes += bytes;
+        current->refs.fetch_add(1, std::memory_order_relaxed);
+        *chunk = current;
+        return data;
+    }
+
+    // 2. Map another, as large as the largest request so far, within the limit
+    if (m_next_chunk_bytes == 0) {
+        m_next_chunk_bytes = g_chunk_bytes.load(std::memory_order_relaxed);
+    }
+    const size_t mapped =
+        round_up(std::max(m_next_chunk_bytes, bytes) + Chunk::HEADER, page_size());
+    if (m_mapped_bytes + mapped > g_max_bytes.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    void* base =
+        ::mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+    Chunk* fresh = new (base) Chunk();
+    fresh->mapped = mapped;
+    fresh->size = mapped - Chunk::HEADER;
+    m_chunks.push_back(fresh);
+    m_mapped_bytes += mapped;
+    g_mapped_bytes.fetch_add(mapped, std::memory_order_relaxed);
+    counters().chunks_mapped.fetch_add(1, std::memory_order_relaxed);
+
+    m_offset = bytes;
+    m_request_bytes += bytes;
+    fresh->refs.fetch_add(1, std::memory_order_relaxed);
+    *chunk = fresh;
+    return fresh->data();
+}
+
+void ScratchArena::release(Chunk* chunk) {
+    if (chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        const size_t mapped = chunk->mapped;
+        chunk->~Chunk();
+        ::munmap(chunk, mapped);
+        g_mapped_bytes.fetch_sub(mapped, std::memory_order_relaxed);
+    }
+}
+
+void ScratchArena::reset() {
+    Counters& c = counters();
+    c.resets.fetch_add(1, std::memory_order_relaxed);
+
+    // 1. One chunk that nothing points into any more: rewind it
+    if (m_chunks.empty()) {
+        return;
+    }
+    if (m_chunks.size() == 1 && m_chunks.front()->refs.load(std::memory_order_acquire) == 1) {
+        m_offset = 0;
+        m_request_bytes = 0;
+        return;
+    }
+
+    // 2. Otherwise let the chunks go (to whatever still points into them),
+    // and size the next one for a request like this one
+    const size_t largest = round_up(m_request_bytes + Chunk::HEADER, page_size()) - Chunk::HEADER;
+    m_next_chunk_bytes = std::min(std::max(m_next_chunk_bytes, largest),
+                                  g_max_bytes.load(std::memory_order_relaxed) - Chunk::HEADER);
+    for (Chunk* chunk : m_chunks) {
+        if (chunk->refs.load(std::memory_order_acquire) != 1) {
+            c.chunks_detached.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_mapped_bytes -= chunk->mapped;
+        release(chunk);
+    }
+    m_chunks.clear();
+    m_offset = 0;
+    m_request_bytes = 0;
+}
+
+ArenaScope::ArenaScope() {
+    if (t_depth > 0) {
+        ++t_depth;
+        m_open = true;
+        return;
+    }
+    if (!g_enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    t_active = &ScratchArena::local();
+    t_depth = 1;
+    m_open = true;
+}
+
+ArenaScope::~ArenaScope() {
+    if (!m_open || --t_depth > 0) {
+        return;
+    }
+    ScratchArena* arena = t_active;
+    t_active = nullptr;
+    arena->reset();
+}
@@ -0,0 +1,51 @@
+#include "ServiceTimeEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+ServiceTimeEstimator::ServiceTimeEstimator(double decay, double margin)
+    : m_decay(decay), m_margin(margin) {}
+
+void ServiceTimeEstimator::record(size_t batch_size, uint64_t duration_ns) {
+    const double x = static_cast<double>(batch_size);
+    const double y = static_cast<double>(duration_ns);
+
+    // Residual against the fit so far, before this sample moves it
+    if (m_samples > 0) {
+        const double residual = y - mean_ns(batch_size);
+        m_residual_sq = m_decay * m_residual_sq + (1.0 - m_decay) * residual * residual;
+    }
+
+    m_w = m_decay * m_w + 1.0;
+    m_x = m_decay * m_x + x;
+    m_y = m_decay * m_y + y;
+    m_xx = m_decay * m_xx + x * x;
+    m_xy = m_decay * m_xy + x * y;
+    ++m_samples;
+}
+
+double ServiceTimeEstimator::mean_ns(size_t batch_size) const {
+    if (m_w <= 0.0) {
+        return 0.0;
+    }
+    const double n = static_cast<double>(batch_size);
+    const double x_bar = m_x / m_w;
+    const double y_bar = m_y / m_w;
+    const double var_x = m_xx / m_w - x_bar * x_bar;
+
+    // Batches all of one size say nothing about the slope; assume the
+    // cost scales with size above the observed one and does not shrink below
+    if (var_x < 0.25) {
+        return y_bar * std::max(1.0, n / std::max(1.0, x_bar));
+    }
+    const double per_item = std::max(0.0, (m_xy / m_w - x_bar * y_bar) / var_x);
+    const double fixed = std::max(0.0, y_bar - per_item * x_bar);
+    return fixed + per_item * n;
+}
+
+double ServiceTimeEstimator::estimate_ns(size_t batch_size) const {
+    if (!ready()) {
+        return 0.0;
+    }
+    return mean_ns(batch_size) + m_margin * std::sqrt(m_residual_sq);
+}
@@ -0,0 +1,126 @@
+#include "ThreadBudget.h"
+
+#include <torch/script.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+/// Shared by every budget, so a thread never mistakes one budget's split for another's
+std::atomic<uint64_t> g_generation{0};
+
+/// Generation of the split last applied on this thread
+thread_local uint64_t t_applied_generation = 0;
+
+} // namespace
+
+uint32_t ThreadBudget::available_cores() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        return static_cast<uint32_t>(std::max(1, CPU_COUNT(&set)));
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ThreadBudget::ThreadBudget(ThreadBudgetConfig config, uint32_t max_concurrency, size_t max_batch)
+    : m_config(config),
+      m_cores(config.cores != 0 ? config.cores : available_cores()),
+      m_max_concurrency(max_concurrency)
+{
+    if (max_concurrency == 0 || config.items_per_thread == 0) {
+        throw std::invalid_argument(
+            "ThreadBudget: max_concurrency and items_per_thread must be at least 1");
+    }
+
+    // Only possible before LibTorch has started its inter-op pool
+    if (config.interop_threads != 0) {
+        try {
+            at::set_num_interop_threads(static_cast<int>(config.interop_threads));
+        } catch (const std::exception& e) {
+            std::cerr << "ThreadBudget: keeping the existing inter-op pool: " << e.what()
+                      << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    apply(compute(static_cast<double>(std::max<size_t>(1, max_batch))));
+    m_split.mean_batch = 0.0;
+}
+
+ThreadSplit ThreadBudget::compute(double mean_batch) const {
+    ThreadSplit s;
+    s.cores = m_cores;
+    s.interop = m_config.interop_threads;
+    s.adaptive = m_config.intra_op_threads == 0;
+    s.mean_batch = mean_batch;
+
+    // 1. Intra-op threads a pass can use: fixed, or one per items_per_thread rows
+    uint32_t wanted = m_config.intra_op_threads;
+    if (wanted == 0) {
+        wanted = static_cast<uint32_t>(
+            (mean_batch + m_config.items_per_thread - 1) / m_config.items_per_thread);
+    }
+    wanted = std::clamp<uint32_t>(wanted, 1, m_cores);
+
+    // 2. As many such passes as fit, capped by how many can ever run at
+    // once; never more threads per pass than it can use
+    s.concurrency = std::clamp<uint32_t>(m_cores / wanted, 1, m_max_concurrency);
+    s.intra_op = std::max<uint32_t>(1, std::min(wanted, m_cores / s.concurrency));
+    s.spare = m_cores - std::min(m_cores, s.concurrency * s.intra_op);
+    return s;
+}
+
+void ThreadBudget::apply(const ThreadSplit& split) {
+    const bool intra_changed = split.intra_op != m_split.intra_op || m_split.cores == 0;
+    const uint64_t batches = m_split.batches;
+    const uint64_t changes = m_split.changes;
+    m_split = split;
+    m_split.batches = batches;
+    m_split.changes = changes;
+
+    m_concurrency.store(split.concurrency, std::memory_order_relaxed);
+    if (intra_changed) {
+        m_intra_op.store(split.intra_op, std::memory_order_relaxed);
+        m_generation.store(g_generation.fetch_add(1, std::memory_order_relaxed) + 1,
+                           std::memory_order_release);
+    }
+}
+
+ThreadSplit ThreadBudget::split() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_split;
+}
+
+void ThreadBudget::prepare_thread() const {
+    const uint64_t generation = m_generation.load(std::memory_order_acquire);
+    if (t_applied_generation != generation) {
+        at::set_num_threads(static_cast<int>(m_intra_op.load(std::memory_order_relaxed)));
+        t_applied_generation = generation;
+    }
+}
+
+void ThreadBudget::record_batch(size_t batch_size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_batch_sum = DECAY * m_batch_sum + static_cast<double>(batch_size);
+    m_batch_weight = DECAY * m_batch_weight + 1.0;
+    const double mean = m_batch_sum / m_batch_weight;
+    m_split.mean_batch = mean;
+    ++m_split.batches;
+
+    if (m_config.intra_op_threads != 0 || m_split.batches % REBALANCE_INTERVAL != 0) {
+        return;
+    }
+    const ThreadSplit next = compute(mean);
+    if (next.concurrency != m_split.concurrency || next.intra_op != m_split.intra_op) {
+        std::cout << "ThreadBudget: mean batch " << mean << ": " << next.concurrency
+                  << " passes x " << next.intra_op << " intra-op threads (was "
+                  << m_split.concurrency << " x " << m_split.intra_op << ")" << std::endl;
+        apply(next);
+        ++m_split.changes;
+    }
+}
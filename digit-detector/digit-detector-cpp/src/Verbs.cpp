@@ -0,0 +1,546 @@
+#include "Verbs.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+/**
+ * @brief On-the-wire header preceding every work request payload.
+ * Host byte order: the emulation only ever talks to the local machine.
+ */
+struct FrameHeader {
+    uint8_t opcode;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint32_t imm_data;
+    uint32_t rkey;
+    uint64_t remote_addr;
+};
+static_assert(sizeof(FrameHeader) == 24, "FrameHeader must be packed to 24 bytes");
+
+std::atomic<uint32_t> g_next_qp_num{1};
+
+void set_nodelay(int fd) {
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * @brief Writes an entire iovec array, resuming after partial writes.
+ */
+bool write_all(int fd, std::vector<iovec>& iov) {
+    size_t index = 0;
+    while (index < iov.size()) {
+        msghdr msg{};
+        msg.msg_iov = &iov[index];
+        msg.msg_iovlen = std::min<size_t>(iov.size() - index, IOV_MAX);
+
+        ssize_t written = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // Skip fully written entries, then trim the partially written one
+        size_t remaining = static_cast<size_t>(written);
+        while (index < iov.size() && remaining >= iov[index].iov_len) {
+            remaining -= iov[index].iov_len;
+            ++index;
+        }
+        if (index < iov.size()) {
+            iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + remaining;
+            iov[index].iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+const char* wc_status_str(WcStatus status) {
+    switch (status) {
+        case WcStatus::Success: return "success";
+        case WcStatus::LocalLengthError: return "local length error";
+        case WcStatus::LocalProtectionError: return "local protection error";
+        case WcStatus::RemoteAccessError: return "remote access error";
+        case WcStatus::FlushError: return "work request flushed";
+        case WcStatus::TransportError: return "transport error";
+    }
+    return "unknown";
+}
+
+// --- MemoryRegion ---
+
+Sge MemoryRegion::sge(size_t offset, uint32_t length) const {
+    if (offset + length > m_length) {
+        throw std::out_of_range("MemoryRegion::sge: range exceeds region");
+    }
+    return {m_addr + offset, length, m_lkey};
+}
+
+bool MemoryRegion::contains(uint64_t addr, size_t length) const {
+    return addr >= m_addr && length <= m_length && addr - m_addr <= m_length - length;
+}
+
+// --- ProtectionDomain ---
+
+std::shared_ptr<MemoryRegion> ProtectionDomain::register_memory(void* addr, size_t length,
+                                                                uint32_t access) {
+    if (addr == nullptr || length == 0) {
+        throw std::invalid_argument("ProtectionDomain: cannot register an empty buffer");
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    // lkey and rkey are deliberately different values so that a peer
+    // can never use a local key it happened to observe.
+    uint32_t lkey = m_next_key++;
+    uint32_t rkey = m_next_key++;
+    std::shared_ptr<MemoryRegion> mr(new MemoryRegion(
+        reinterpret_cast<uint64_t>(addr), length, lkey, rkey, access));
+    m_by_lkey[lkey] = mr;
+    if (access & VERBS_ACCESS_REMOTE_WRITE) {
+        m_by_rkey[rkey] = mr;
+    }
+    return mr;
+}
+
+void ProtectionDomain::deregister_memory(const std::shared_ptr<MemoryRegion>& mr) {
+    if (!mr) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_by_lkey.erase(mr->lkey());
+    m_by_rkey.erase(mr->rkey());
+}
+
+bool ProtectionDomain::check_local(const Sge& sge, bool needs_write) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_by_lkey.find(sge.lkey);
+    if (it == m_by_lkey.end()) {
+        return false;
+    }
+    if (needs_write && !(it->second->access() & VERBS_ACCESS_LOCAL_WRITE)) {
+        return false;
+    }
+    return it->second->contains(sge.addr, sge.length);
+}
+
+bool ProtectionDomain::check_remote_write(uint32_t rkey, uint64_t addr, size_t length) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_by_rkey.find(rkey);
+    return it != m_by_rkey.end() && it->second->contains(addr, length);
+}
+
+// --- CompletionQueue ---
+
+CompletionQueue::CompletionQueue(size_t capacity) : m_capacity(capacity) {}
+
+void CompletionQueue::set_moderation(size_t count, std::chrono::microseconds period) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_moderation_count = std::max<size_t>(count, 1);
+    m_moderation_period = period;
+}
+
+void CompletionQueue::push(const WorkCompletion& wc) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_entries.size() >= m_capacity) {
+            m_overrun = true;
+            return;
+        }
+        if (m_entries.empty()) {
+            m_oldest = std::chrono::steady_clock::now();
+        }
+        m_entries.push_back(wc);
+        if (m_entries.size() < m_moderation_count) {
+            return; // Coalesce: the waiter's timer covers the period bound
+        }
+    }
+    m_cv.notify_one();
+}
+
+int CompletionQueue::drain_locked(WorkCompletion* wc, int max_entries) {
+    if (m_overrun) {
+        throw std::runtime_error("CompletionQueue: overrun, completions were lost");
+    }
+    int count = 0;
+    while (count < max_entries && !m_entries.empty()) {
+        wc[count++] = m_entries.front();
+        m_entries.pop_front();
+    }
+    if (!m_entries.empty()) {
+        m_oldest = std::chrono::steady_clock::now();
+    }
+    return count;
+}
+
+int CompletionQueue::poll(WorkCompletion* wc, int max_entries) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return drain_locked(wc, max_entries);
+}
+
+int CompletionQueue::wait(WorkCompletion* wc, int max_entries,
+                          std::chrono::microseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        const auto now = std::chrono::steady_clock::now();
+        if (m_entries.size() >= m_moderation_count || m_overrun) {
+            return drain_locked(wc, max_entries);
+        }
+        if (!m_entries.empty() && now - m_oldest >= m_moderation_period) {
+            return drain_locked(wc, max_entries);
+        }
+        if (now >= deadline) {
+            return drain_locked(wc, max_entries);
+        }
+
+        auto wake = deadline;
+        if (!m_entries.empty()) {
+            wake = std::min(wake, m_oldest + m_moderation_period);
+        }
+        m_cv.wait_until(lock, wake);
+    }
+}
+
+// --- QueuePair ---
+
+QueuePair::QueuePair(ProtectionDomain& pd, CompletionQueue& send_cq, CompletionQueue& recv_cq,
+                     QpCaps caps)
+    : m_pd(pd),
+      m_send_cq(send_cq),
+      m_recv_cq(recv_cq),
+      m_caps(caps),
+      m_qp_num(g_next_qp_num.fetch_add(1))
+{
+}
+
+QueuePair::~QueuePair() {
+    disconnect();
+    if (m_progress.joinable()) {
+        m_progress.join();
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void QueuePair::connect(const std::string& host, uint16_t port) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    const std::string service = std::to_string(port);
+    if (::getaddrinfo(host.c_str(), service.c_str(), &hints, &result) != 0 || !result) {
+        throw std::runtime_error("QueuePair: cannot resolve " + host);
+    }
+
+    int fd = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (fd < 0 || ::connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+        ::freeaddrinfo(result);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("QueuePair: cannot connect to " + host + ":" + service);
+    }
+    ::freeaddrinfo(result);
+
+    attach(fd);
+}
+
+void QueuePair::attach(int fd) {
+    if (m_fd >= 0) {
+        throw std::logic_error("QueuePair: already connected");
+    }
+    m_fd = fd;
+    set_nodelay(m_fd);
+    start();
+}
+
+void QueuePair::start() {
+    m_progress = std::thread(&QueuePair::progress_loop, this);
+}
+
+bool QueuePair::post_send(const SendWr* wrs, size_t count) {
+    // 1. Validate the whole chain before anything touches the wire
+    WcStatus failure = WcStatus::Success;
+    if (is_error() || m_fd < 0) {
+        failure = WcStatus::FlushError;
+    } else if (count > m_caps.max_send_wr) {
+        failure = WcStatus::LocalProtectionError;
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            if (wrs[i].sge.length > 0 && !m_pd.check_local(wrs[i].sge, false)) {
+                failure = WcStatus::LocalProtectionError;
+                break;
+            }
+        }
+    }
+
+    // 2. Build one gather list: header, payload, header, payload, ...
+    // Payload iovecs point straight at the registered buffers.
+    std::vector<FrameHeader> headers(count);
+    std::vector<iovec> iov;
+    if (failure == WcStatus::Success) {
+        iov.reserve(count * 2);
+        for (size_t i = 0; i < count; ++i) {
+            FrameHeader& h = headers[i];
+            std::memset(&h, 0, sizeof(h));
+            h.opcode = static_cast<uint8_t>(wrs[i].opcode);
+            h.length = wrs[i].sge.length;
+            h.imm_data = wrs[i].imm_data;
+            h.rkey = wrs[i].rkey;
+            h.remote_addr = wrs[i].remote_addr;
+            iov.push_back({&h, sizeof(h)});
+            if (h.length > 0) {
+                iov.push_back({reinterpret_cast<void*>(wrs[i].sge.addr), h.length});
+            }
+        }
+
+        // 3. Ring the doorbell: one gather-write for the whole chain
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        if (!write_all(m_fd, iov)) {
+            failure = WcStatus::TransportError;
+        }
+    }
+
+    if (failure == WcStatus::TransportError) {
+        to_error("send failed");
+    }
+
+    // 4. Report completions for signaled WRs only
+    for (size_t i = 0; i < count; ++i) {
+        if (!wrs[i].signaled && failure == WcStatus::Success) {
+            continue;
+        }
+        WorkCompletion wc;
+        wc.wr_id = wrs[i].wr_id;
+        wc.status = failure;
+        wc.opcode = wrs[i].opcode == WrOpcode::Send ? WcOpcode::Send : WcOpcode::RdmaWrite;
+        wc.qp_num = m_qp_num;
+        m_send_cq.push(wc);
+    }
+    return failure == WcStatus::Success;
+}
+
+bool QueuePair::post_recv(const RecvWr* wrs, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (wrs[i].sge.length > 0 && !m_pd.check_local(wrs[i].sge, true)) {
+            return false;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_recv_mutex);
+        if (m_recv_queue.size() + count > m_caps.max_recv_wr) {
+            return false;
+        }
+        m_recv_queue.insert(m_recv_queue.end(), wrs, wrs + count);
+    }
+    m_recv_cv.notify_one();
+    return true;
+}
+
+void QueuePair::disconnect() {
+    m_error.store(true, std::memory_order_release);
+    if (m_fd >= 0) {
+        ::shutdown(m_fd, SHUT_RDWR);
+    }
+    m_recv_cv.notify_all();
+}
+
+void QueuePair::to_error(const char* reason) {
+    if (!m_error.exchange(true)) {
+        std::cerr << "QueuePair " << m_qp_num << ": entering error state (" << reason << ")"
+                  << std::endl;
+    }
+    disconnect();
+}
+
+void QueuePair::flush_recvs() {
+    std::deque<RecvWr> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_recv_mutex);
+        pending.swap(m_recv_queue);
+    }
+    for (const RecvWr& rw : pending) {
+        WorkCompletion wc;
+        wc.wr_id = rw.wr_id;
+        wc.status = WcStatus::FlushError;
+        wc.opcode = WcOpcode::Recv;
+        wc.qp_num = m_qp_num;
+        m_recv_cq.push(wc);
+    }
+}
+
+bool QueuePair::take_recv(RecvWr& out) {
+    // An empty receive queue is the RNR condition. A real RC QP would
+    // NAK and retry; blocking the responder has the same effect.
+    std::unique_lock<std::mutex> lock(m_recv_mutex);
+    m_recv_cv.wait(lock, [this] { return !m_recv_queue.empty() || is_error(); });
+    if (m_recv_queue.empty()) {
+        return false;
+    }
+    out = m_recv_queue.front();
+    m_recv_queue.pop_front();
+    return true;
+}
+
+bool QueuePair::read_exact(void* dst, size_t length) {
+    char* p = static_cast<char*>(dst);
+    while (length > 0) {
+        ssize_t n = ::recv(m_fd, p, length, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool QueuePair::discard(size_t length) {
+    char scratch[4096];
+    while (length > 0) {
+        size_t chunk = std::min(length, sizeof(scratch));
+        if (!read_exact(scratch, chunk)) {
+            return false;
+        }
+        length -= chunk;
+    }
+    return true;
+}
+
+void QueuePair::progress_loop() {
+    FrameHeader h;
+    while (read_exact(&h, sizeof(h))) {
+        const auto opcode = static_cast<WrOpcode>(h.opcode);
+
+        if (opcode == WrOpcode::Send) {
+            // Two-sided: the payload lands in the next posted receive
+            RecvWr rw;
+            if (!take_recv(rw)) {
+                break;
+            }
+            WorkCompletion wc;
+            wc.wr_id = rw.wr_id;
+            wc.opcode = WcOpcode::Recv;
+            wc.qp_num = m_qp_num;
+            wc.byte_len = h.length;
+            if (h.length > rw.sge.length) {
+                wc.status = WcStatus::LocalLengthError;
+                m_recv_cq.push(wc);
+                discard(h.length);
+                to_error("message larger than receive buffer");
+                break;
+            }
+            if (!read_exact(reinterpret_cast<void*>(rw.sge.addr), h.length)) {
+                wc.status = WcStatus::TransportError;
+                m_recv_cq.push(wc);
+                break;
+            }
+            m_recv_cq.push(wc);
+        } else if (opcode == WrOpcode::RdmaWrite || opcode == WrOpcode::RdmaWriteWithImm) {
+            // One-sided: validate the rkey, then read straight into place
+            if (!m_pd.check_remote_write(h.rkey, h.remote_addr, h.length)) {
+                discard(h.length);
+                to_error("remote access violation");
+                break;
+            }
+            if (!read_exact(reinterpret_cast<void*>(h.remote_addr), h.length)) {
+                break;
+            }
+            if (opcode == WrOpcode::RdmaWriteWithImm) {
+                RecvWr rw;
+                if (!take_recv(rw)) {
+                    break;
+                }
+                WorkCompletion wc;
+                wc.wr_id = rw.wr_id;
+                wc.opcode = WcOpcode::RecvRdmaWithImm;
+                wc.qp_num = m_qp_num;
+                wc.byte_len = h.length;
+                wc.imm_data = h.imm_data;
+                wc.has_imm = true;
+                m_recv_cq.push(wc);
+            }
+        } else {
+            to_error("unknown opcode on the wire");
+            break;
+        }
+    }
+
+    to_error("connection closed");
+    flush_recvs();
+}
+
+// --- VerbsListener ---
+
+VerbsListener::VerbsListener(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("VerbsListener: socket() failed");
+    }
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, 128) != 0) {
+        ::close(fd);
+        throw std::runtime_error("VerbsListener: cannot listen on port " + std::to_string(port));
+    }
+
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    m_port = ntohs(addr.sin_port);
+    m_fd.store(fd);
+}
+
+VerbsListener::~VerbsListener() {
+    close();
+}
+
+int VerbsListener::accept() {
+    int listen_fd;
+    while ((listen_fd = m_fd.load()) >= 0) {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd >= 0) {
+            return fd;
+        }
+        if (errno != EINTR) {
+            break;
+        }
+    }
+    return -1;
+}
+
+void VerbsListener::close() {
+    int fd = m_fd.exchange(-1);
+    if (fd >= 0) {
+        ::shutdown(fd, SHUT_RDWR);
+        ::close(fd);
+    }
+}
@@ -0,0 +1,128 @@
+#include "VerbsInference.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+VerbsInferenceClient::VerbsInferenceClient(const std::string& host, uint16_t port,
+                                           uint32_t depth)
+    : m_send_cq(depth + 1),
+      m_recv_cq(depth + 1),
+      m_requests(depth),
+      m_results(depth),
+      m_request_mr(m_pd.register_memory(m_requests.data(),
+                                         m_requests.size() * sizeof(VerbsInferRequest), 0)),
+      m_result_mr(m_pd.register_memory(m_results.data(),
+                                        m_results.size() * sizeof(VerbsInferResult),
+                                        VERBS_ACCESS_LOCAL_WRITE | VERBS_ACCESS_REMOTE_WRITE)),
+      m_qp(m_pd, m_send_cq, m_recv_cq, QpCaps{depth, depth}),
+      m_busy(depth, 0)
+{
+    // 1. Every in-flight request needs a receive for its write-with-immediate.
+    // The payload goes to the result slot, so the receives carry no buffer.
+    std::vector<RecvWr> recvs(depth);
+    for (uint32_t slot = 0; slot < depth; ++slot) {
+        recvs[slot].wr_id = slot;
+        m_free_slots.push_back(depth - 1 - slot);
+    }
+    m_qp.post_recv(recvs.data(), recvs.size());
+
+    // 2. Connect last so the server never sees us without receives posted
+    m_qp.connect(host, port);
+}
+
+uint64_t VerbsInferenceClient::submit(const uint8_t* pixels) {
+    if (m_free_slots.empty()) {
+        return 0;
+    }
+    const uint32_t slot = m_free_slots.back();
+
+    // Fill the registered request slot; the SEND gathers straight from it
+    VerbsInferRequest& request = m_requests[slot];
+    request.request_id = m_next_request_id++;
+    request.result_addr = m_result_mr->addr() + slot * sizeof(VerbsInferResult);
+    request.result_rkey = m_result_mr->rkey();
+    request.tag = slot;
+    std::memcpy(request.pixels, pixels, VERBS_IMAGE_BYTES);
+
+    SendWr wr;
+    wr.wr_id = slot;
+    wr.opcode = WrOpcode::Send;
+    wr.sge = m_request_mr->sge(slot * sizeof(VerbsInferRequest), sizeof(VerbsInferRequest));
+    wr.signaled = false; // Failures still complete; success needs no CQE
+    if (!m_qp.post_send(&wr, 1)) {
+        throw std::runtime_error("VerbsInferenceClient: send failed");
+    }
+
+    m_free_slots.pop_back();
+    m_busy[slot] = 1;
+    ++m_in_flight;
+    return request.request_id;
+}
+
+size_t VerbsInferenceClient::poll(std::vector<std::pair<uint64_t, Prediction>>& out,
+                                  std::chrono::microseconds timeout) {
+    WorkCompletion send_wc[8];
+    if (m_send_cq.poll(send_wc, 8) > 0) {
+        throw std::runtime_error(std::string("VerbsInferenceClient: send completed with ") +
+                                 wc_status_str(send_wc[0].status));
+    }
+
+    WorkCompletion wc[64];
+    const int count = m_recv_cq.wait(wc, 64, timeout);
+
+    std::vector<RecvWr> reposts;
+    size_t collected = 0;
+    for (int i = 0; i < count; ++i) {
+        if (wc[i].status != WcStatus::Success || !wc[i].has_imm) {
+            throw std::runtime_error(std::string("VerbsInferenceClient: receive completed with ") +
+                                     wc_status_str(wc[i].status));
+        }
+        // The receive was consumed either way; it carries no buffer
+        RecvWr rw;
+        rw.wr_id = wc[i].wr_id;
+        reposts.push_back(rw);
+
+        // The immediate names the slot the server wrote into; the peer
+        // supplies it, so it must name a slot that is actually in flight
+        const uint32_t slot = wc[i].imm_data;
+        if (slot >= m_results.size() || !m_busy[slot]) {
+            ++m_bad_completions;
+            continue;
+        }
+        const VerbsInferResult& result = m_results[slot];
+        out.emplace_back(result.request_id, Prediction{result.digit, result.confidence});
+
+        m_busy[slot] = 0;
+        m_free_slots.push_back(slot);
+        --m_in_flight;
+        ++collected;
+    }
+    if (!reposts.empty()) {
+        m_qp.post_recv(reposts.data(), reposts.size());
+    }
+    return collected;
+}
+
+Prediction VerbsInferenceClient::infer(const uint8_t* pixels) {
+    if (m_in_flight != 0) {
+        throw std::logic_error("VerbsInferenceClient::infer: pipelined requests in flight");
+    }
+    const uint64_t id = submit(pixels);
+
+    std::vector<std::pair<uint64_t, Prediction>> results;
+    const uint64_t bad_before = m_bad_completions;
+    while (results.empty()) {
+        poll(results, std::chrono::seconds(1));
+        if (m_bad_completions != bad_before) {
+            throw std::runtime_error("VerbsInferenceClient: response names no request in flight");
+        }
+        if (m_qp.is_error()) {
+            throw std::runtime_error("VerbsInferenceClient: connection lost");
+        }
+    }
+    if (results.front().first != id) {
+        throw std::runtime_error("VerbsInferenceClient: unexpected response id");
+    }
+    return results.front().second;
+}
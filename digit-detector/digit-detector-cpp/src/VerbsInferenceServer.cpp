@@ -0,0 +1,220 @@
+#include "VerbsInference.h"
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "ScratchArena.h"
+
+#include <iostream>
+#include <stdexcept>
+
+VerbsInferenceServer::VerbsInferenceServer(const std::string& model_path, uint16_t port,
+                                           VerbsServerOptions options)
+    : m_options(options),
+      m_send_cq(1 << 16),
+      m_recv_cq(1 << 16),
+      m_listener(port)
+{
+    m_processor = std::make_unique<ImageProcessor>();
+    m_engine = std::make_unique<InferenceEngine>(model_path);
+
+    // Coalesce receive completions: wake the service loop once a full
+    // batch is pending or the oldest request has waited batch_delay.
+    m_recv_cq.set_moderation(m_options.max_batch, m_options.batch_delay);
+
+    std::cout << "VerbsInferenceServer: listening on 127.0.0.1:" << m_listener.port()
+              << std::endl;
+}
+
+VerbsInferenceServer::~VerbsInferenceServer() {
+    stop();
+    if (m_acceptor.joinable()) {
+        m_acceptor.join();
+    }
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    m_connections.clear();
+}
+
+void VerbsInferenceServer::stop() {
+    m_running.store(false);
+    m_listener.close(); // Unblocks accept()
+}
+
+void VerbsInferenceServer::run() {
+    m_running.store(true);
+    m_acceptor = std::thread(&VerbsInferenceServer::accept_loop, this);
+
+    std::vector<WorkCompletion> wc(m_options.max_batch);
+    while (m_running.load()) {
+        // 1. Wait for a (moderated) batch of incoming requests
+        int count = m_recv_cq.wait(wc.data(), static_cast<int>(wc.size()),
+                                   std::chrono::milliseconds(50));
+        if (count > 0) {
+            handle_completions(wc.data(), count);
+        }
+
+        // 2. Drain send completions; only failures are interesting
+        WorkCompletion send_wc[16];
+        int sent;
+        while ((sent = m_send_cq.poll(send_wc, 16)) > 0) {
+            for (int i = 0; i < sent; ++i) {
+                if (send_wc[i].status != WcStatus::Success) {
+                    std::cerr << "VerbsInferenceServer: write to QP " << send_wc[i].qp_num
+                              << " failed: " << wc_status_str(send_wc[i].status) << std::endl;
+                }
+            }
+        }
+
+        // 3. Drop clients whose QP went to error
+        reap_connections();
+    }
+
+    if (m_acceptor.joinable()) {
+        m_acceptor.join();
+    }
+}
+
+void VerbsInferenceServer::accept_loop() {
+    while (m_running.load()) {
+        int fd = m_listener.accept();
+        if (fd < 0) {
+            break;
+        }
+
+        auto conn = std::make_unique<Connection>();
+        conn->requests.resize(m_options.recv_depth);
+        conn->results.resize(m_options.recv_depth);
+        conn->request_mr = m_pd.register_memory(
+            conn->requests.data(), conn->requests.size() * sizeof(VerbsInferRequest),
+            VERBS_ACCESS_LOCAL_WRITE);
+        conn->result_mr = m_pd.register_memory(
+            conn->results.data(), conn->results.size() * sizeof(VerbsInferResult), 0);
+
+        QpCaps caps;
+        caps.max_recv_wr = m_options.recv_depth;
+        caps.max_send_wr = m_options.recv_depth;
+        conn->qp = std::make_unique<QueuePair>(m_pd, m_send_cq, m_recv_cq, caps);
+
+        // Pre-post one receive per slot; wr_id is the slot index
+        std::vector<RecvWr> recvs(m_options.recv_depth);
+        for (uint32_t slot = 0; slot < m_options.recv_depth; ++slot) {
+            recvs[slot].wr_id = slot;
+            recvs[slot].sge = conn->request_mr->sge(slot * sizeof(VerbsInferRequest),
+                                                    sizeof(VerbsInferRequest));
+        }
+        conn->qp->post_recv(recvs.data(), recvs.size());
+
+        // Publish before attaching so the first completion finds the connection
+        QueuePair* qp = conn->qp.get();
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            m_connections[qp->qp_num()] = std::move(conn);
+        }
+        qp->attach(fd);
+        std::cout << "VerbsInferenceServer: client connected (QP " << qp->qp_num() << ")"
+                  << std::endl;
+    }
+}
+
+void VerbsInferenceServer::handle_completions(const WorkCompletion* wc, int count) {
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+
+    // A well-formed request from the batch, and where its answer goes
+    struct Pending {
+        uint32_t qp_num;
+        Connection* conn;
+        uint32_t slot;
+    };
+    std::vector<Pending> pending;
+    pending.reserve(static_cast<size_t>(count));
+
+    // Work requests accumulated per connection so each client gets one doorbell
+    std::unordered_map<uint32_t, std::vector<SendWr>> writes;
+    std::unordered_map<uint32_t, std::vector<RecvWr>> reposts;
+
+    // Everything the batch allocates comes from this thread's arena
+    ArenaScope scratch;
+    std::vector<torch::Tensor> inputs;
+    inputs.reserve(static_cast<size_t>(count));
+
+    for (int i = 0; i < count; ++i) {
+        if (wc[i].status != WcStatus::Success) {
+            continue; // Flushed receives; the connection is reaped later
+        }
+        auto it = m_connections.find(wc[i].qp_num);
+        if (it == m_connections.end()) {
+            continue;
+        }
+        Connection& conn = *it->second;
+        const auto slot = static_cast<uint32_t>(wc[i].wr_id);
+
+        if (wc[i].byte_len == sizeof(VerbsInferRequest)) {
+            // 1. Wrap the receive slot in place; process() does the only copy
+            cv::Mat image(VERBS_IMAGE_SIZE, VERBS_IMAGE_SIZE, CV_8UC1,
+                          const_cast<uint8_t*>(conn.requests[slot].pixels));
+            inputs.push_back(m_processor->process(image));
+            pending.push_back({wc[i].qp_num, &conn, slot});
+        } else {
+            std::cerr << "VerbsInferenceServer: dropping malformed request on QP "
+                      << wc[i].qp_num << std::endl;
+        }
+
+        // 2. The slot is reposted once its answer has been staged
+        RecvWr rw;
+        rw.wr_id = slot;
+        rw.sge = conn.request_mr->sge(slot * sizeof(VerbsInferRequest),
+                                      sizeof(VerbsInferRequest));
+        reposts[wc[i].qp_num].push_back(rw);
+    }
+
+    // 3. The moderated batch through the model in one forward pass
+    std::vector<Prediction> predictions;
+    if (!inputs.empty()) {
+        predictions = m_engine->predict_batch(inputs.size() == 1 ? inputs.front()
+                                                                 : torch::cat(inputs, 0));
+    }
+
+    // 4. Stage each answer and queue a one-sided write into its client
+    for (size_t i = 0; i < pending.size(); ++i) {
+        Connection& conn = *pending[i].conn;
+        const uint32_t slot = pending[i].slot;
+        const VerbsInferRequest& request = conn.requests[slot];
+        VerbsInferResult& result = conn.results[slot];
+        result.request_id = request.request_id;
+        result.digit = predictions[i].digit;
+        result.confidence = predictions[i].confidence;
+
+        SendWr wr;
+        wr.wr_id = slot;
+        wr.opcode = WrOpcode::RdmaWriteWithImm;
+        wr.sge = conn.result_mr->sge(slot * sizeof(VerbsInferResult),
+                                     sizeof(VerbsInferResult));
+        wr.signaled = false;
+        wr.imm_data = request.tag;
+        wr.remote_addr = request.result_addr;
+        wr.rkey = request.result_rkey;
+        writes[pending[i].qp_num].push_back(wr);
+    }
+
+    // 5. One doorbell per client; only the last write is signaled
+    for (auto& [qp_num, chain] : writes) {
+        chain.back().signaled = true;
+        m_connections[qp_num]->qp->post_send(chain.data(), chain.size());
+    }
+    for (auto& [qp_num, recvs] : reposts) {
+        m_connections[qp_num]->qp->post_recv(recvs.data(), recvs.size());
+    }
+}
+
+void VerbsInferenceServer::reap_connections() {
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    for (auto it = m_connections.begin(); it != m_connections.end();) {
+        if (it->second->qp->is_error()) {
+            std::cout << "VerbsInferenceServer: client disconnected (QP " << it->first << ")"
+                      << std::endl;
+            m_pd.deregister_memory(it->second->request_mr);
+            m_pd.deregister_memory(it->second->result_mr);
+            it = m_connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
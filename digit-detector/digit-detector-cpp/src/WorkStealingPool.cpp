@@ -0,0 +1,470 @@
+#include "WorkStealingPool.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+namespace {
+
+constexpr unsigned SPIN_ROUNDS = 64;  ///< Failed searches before a worker parks
+constexpr size_t CHUNKS_PER_WORKER = 4; ///< parallel_for over-decomposition, for balance
+/// Local tasks between forced looks at the injection queue; prime, so it
+/// does not fall into step with periodic work
+constexpr uint32_t INJECTION_CHECK_INTERVAL = 61;
+
+thread_local const WorkStealingPool* t_pool = nullptr;
+thread_local int t_worker = -1;
+
+/**
+ * @brief Parses a sysfs CPU list such as "0-3,8,10-11".
+ */
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || !std::isdigit(static_cast<unsigned char>(range[0]))) {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief CPUs this process may run on, in ascending order.
+ */
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if (cpus.empty()) {
+        const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < count; ++cpu) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief Maps each CPU to its NUMA node from sysfs; empty without NUMA support.
+ */
+std::map<int, int> cpu_nodes() {
+    namespace fs = std::filesystem;
+    std::map<int, int> nodes;
+    std::error_code error;
+    for (fs::directory_iterator it("/sys/devices/system/node", error), end;
+         !error && it != end; it.increment(error)) {
+        const std::string name = it->path().filename().string();
+        if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+            !std::isdigit(static_cast<unsigned char>(name[4]))) {
+            continue;
+        }
+        std::ifstream in(it->path() / "cpulist");
+        std::string list;
+        std::getline(in, list);
+        const int node = std::stoi(name.substr(4));
+        for (int cpu : parse_cpu_list(list)) {
+            nodes[cpu] = node;
+        }
+    }
+    return nodes;
+}
+
+void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        std::cerr << "WorkStealingPool: could not pin to CPU " << cpu << " (error " << rc
+                  << ")" << std::endl;
+    }
+}
+
+} // namespace
+
+bool WorkStealingDeque::push(void* item) {
+    const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    const int64_t top = m_top.load(std::memory_order_acquire);
+    if (bottom - top >= CAPACITY) {
+        return false;
+    }
+    m_items[bottom & (CAPACITY - 1)].store(item, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void* WorkStealingDeque::pop() {
+    const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    void* item = m_items[bottom & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // Last item: race the thieves for it
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+            item = nullptr;
+        }
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+}
+
+void* WorkStealingDeque::steal() {
+    int64_t top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return nullptr;
+    }
+    void* item = m_items[top & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return item;
+}
+
+bool WorkStealingDeque::empty() const {
+    return m_top.load(std::memory_order_acquire) >= m_bottom.load(std::memory_order_acquire);
+}
+
+WorkStealingPool::WorkStealingPool(ExecutorConfig config)
+    : m_pin(config.pin)
+{
+    const std::vector<int> cpus = allowed_cpus();
+    const std::map<int, int> nodes = cpu_nodes();
+    const size_t count = config.threads == 0 ? cpus.size() : config.threads;
+
+    // 1. Worker i runs on the i-th allowed CPU (wrapping if there are more
+    // workers than CPUs), so consecutive workers share a node
+    std::set<int> used_nodes;
+    for (size_t i = 0; i < count; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->cpu = cpus[i % cpus.size()];
+        const auto node = nodes.find(worker->cpu);
+        worker->node = node == nodes.end() ? 0 : node->second;
+        used_nodes.insert(worker->node);
+        m_workers.push_back(std::move(worker));
+    }
+    m_node_count = used_nodes.size();
+
+    // 2. Victims: same node first, then the rest, each starting after
+    // the thief so thieves do not all hit worker 0
+    for (size_t i = 0; i < count; ++i) {
+        Worker& worker = *m_workers[i];
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t k = 1; k < count; ++k) {
+                const size_t victim = (i + k) % count;
+                const bool local = m_workers[victim]->node == worker.node;
+                if (local == (pass == 0)) {
+                    worker.victims.push_back(victim);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        m_workers[i]->thread = std::thread(&WorkStealingPool::worker_loop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_park_mutex);
+        m_stopping.store(true, std::memory_order_seq_cst);
+    }
+    m_park_cv.notify_all();
+    for (auto& worker : m_workers) {
+        worker->thread.join();
+    }
+    // Only reachable if a task was submitted from outside during shutdown
+    for (Job* job : m_injected) {
+        delete job;
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    enqueue(new Job{std::move(task)});
+}
+
+void WorkStealingPool::enqueue(Job* job) {
+    // Counted before it becomes visible, so a worker that sees zero can
+    // safely park or, during shutdown, exit
+    m_queued.fetch_add(1, std::memory_order_seq_cst);
+    const int self = current_worker();
+    if (self < 0 || !m_workers[self]->deque.push(job)) {
+        std::lock_guard<std::mutex> lock(m_inject_mutex);
+        m_injected.push_back(job);
+        if (self < 0) {
+            m_injected_total.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (m_sleepers.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(m_park_mutex);
+        m_park_cv.notify_one();
+    }
+}
+
+WorkStealingPool::Job* WorkStealingPool::take(int self) {
+    auto take_injected = [this]() -> Job* {
+        std::lock_guard<std::mutex> lock(m_inject_mutex);
+        if (m_injected.empty()) {
+            return nullptr;
+        }
+        Job* front = m_injected.front();
+        m_injected.pop_front();
+        return front;
+    };
+
+    Job* job = nullptr;
+    if (self >= 0) {
+        Worker& worker = *m_workers[self];
+        if (++worker.takes % INJECTION_CHECK_INTERVAL == 0) {
+            job = take_injected();
+        }
+        if (job == nullptr) {
+            job = static_cast<Job*>(worker.deque.pop());
+        }
+    }
+    if (job == nullptr) {
+        job = take_injected();
+    }
+    if (job == nullptr) {
+        // Outside the pool there is no locality to prefer
+        const size_t candidates = self >= 0 ? m_workers[self]->victims.size() : m_workers.size();
+        for (size_t k = 0; k < candidates; ++k) {
+            const size_t victim = self >= 0 ? m_workers[self]->victims[k] : k;
+            job = static_cast<Job*>(m_workers[victim]->deque.steal());
+            if (job != nullptr) {
+                if (self >= 0) {
+                    Worker& thief = *m_workers[self];
+                    thief.stolen.fetch_add(1, std::memory_order_relaxed);
+                    if (m_workers[victim]->node != thief.node) {
+                        thief.stolen_remote.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                break;
+            }
+        }
+    }
+    if (job != nullptr) {
+        m_queued.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    return job;
+}
+
+void WorkStealingPool::execute(Job* job) {
+    std::unique_ptr<Job> owned(job);
+    try {
+        owned->fn();
+    } catch (const std::exception& e) {
+        std::cerr << "WorkStealingPool: task failed: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "WorkStealingPool: task failed with an unknown exception" << std::endl;
+    }
+    const int self = current_worker();
+    if (self >= 0) {
+        m_workers[self]->executed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void WorkStealingPool::worker_loop(size_t index) {
+    t_pool = this;
+    t_worker = static_cast<int>(index);
+    if (m_pin) {
+        pin_to_cpu(m_workers[index]->cpu);
+    }
+
+    unsigned idle = 0;
+    for (;;) {
+        if (Job* job = take(static_cast<int>(index))) {
+            execute(job);
+            idle = 0;
+            continue;
+        }
+        if (m_stopping.load(std::memory_order_seq_cst) &&
+            m_queued.load(std::memory_order_seq_cst) == 0) {
+            break;
+        }
+        if (++idle < SPIN_ROUNDS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Announce the sleep before the last look, pairing with enqueue()'s
+        // count-then-check, so a submission cannot slip between them
+        std::unique_lock<std::mutex> lock(m_park_mutex);
+        m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+        if (m_queued.load(std::memory_order_seq_cst) <= 0 &&
+            !m_stopping.load(std::memory_order_seq_cst)) {
+            m_parks.fetch_add(1, std::memory_order_relaxed);
+            m_park_cv.wait(lock, [this] {
+                return m_queued.load(std::memory_order_seq_cst) > 0 ||
+                       m_stopping.load(std::memory_order_seq_cst);
+            });
+        }
+        m_sleepers.fetch_sub(1, std::memory_order_seq_cst);
+        idle = 0;
+    }
+    t_pool = nullptr;
+    t_worker = -1;
+}
+
+bool WorkStealingPool::run_one() {
+    Job* job = take(current_worker());
+    if (job == nullptr) {
+        return false;
+    }
+    execute(job);
+    return true;
+}
+
+int WorkStealingPool::current_worker() const {
+    return t_pool == this ? t_worker : -1;
+}
+
+void WorkStealingPool::parallel_for(size_t begin, size_t end, size_t grain,
+                                    const std::function<void(size_t)>& body) {
+    if (begin >= end) {
+        return;
+    }
+    grain = std::max<size_t>(1, grain);
+    const size_t count = end - begin;
+    const size_t chunks =
+        std::min((count + grain - 1) / grain, m_workers.size() * CHUNKS_PER_WORKER);
+    if (chunks <= 1) {
+        for (size_t i = begin; i < end; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    // The caller keeps the first chunk; the others go on this thread's
+    // deque (or the injection queue) for idle workers to steal
+    const size_t chunk = (count + chunks - 1) / chunks;
+    TaskGroup group(*this);
+    for (size_t lo = begin + chunk; lo < end; lo += chunk) {
+        const size_t hi = std::min(end, lo + chunk);
+        group.run([&body, lo, hi] {
+            for (size_t i = lo; i < hi; ++i) {
+                body(i);
+            }
+        });
+    }
+    std::exception_ptr error;
+    try {
+        for (size_t i = begin; i < std::min(end, begin + chunk); ++i) {
+            body(i);
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    // Wait even after a failure: the other chunks still reference body
+    try {
+        group.wait();
+    } catch (...) {
+        if (!error) {
+            error = std::current_exception();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+ExecutorStats WorkStealingPool::stats() const {
+    ExecutorStats s;
+    for (const auto& worker : m_workers) {
+        s.executed += worker->executed.load(std::memory_order_relaxed);
+        s.stolen += worker->stolen.load(std::memory_order_relaxed);
+        s.stolen_remote += worker->stolen_remote.load(std::memory_order_relaxed);
+    }
+    s.injected = m_injected_total.load(std::memory_order_relaxed);
+    s.parks = m_parks.load(std::memory_order_relaxed);
+    return s;
+}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+    }
+}
+
+void TaskGroup::run(WorkStealingPool::Task task) {
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    m_pool.submit([this, task = std::move(task)] {
+        std::exception_ptr error;
+        try {
+            task();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // Under the mutex, so wait() cannot return and destroy the group
+        // while this is still touching it
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (error && !m_error) {
+            m_error = error;
+        }
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_cv.notify_all();
+        }
+    });
+}
+
+void TaskGroup::wait() {
+    // Help with queued work (ours or anyone's) rather than block a core;
+    // sleep only once there is nothing left to help with
+    unsigned idle = 0;
+    while (m_pending.load(std::memory_order_acquire) != 0) {
+        if (m_pool.run_one()) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < SPIN_ROUNDS) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait_for(lock, std::chrono::microseconds(100), [this] {
+            return m_pending.load(std::memory_order_acquire) == 0;
+        });
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
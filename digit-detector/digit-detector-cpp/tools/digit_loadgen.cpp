@@ -0,0 +1,708 @@
+#include "ClientConnection.h"
+#include "ImageProcessor.h"
+#include "InferenceEngine.h"
+#include "LatencyHistogram.h"
+#include "MnistIdx.h"
+#include "ScratchArena.h"
+#include "VerbsInference.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @file digit_loadgen.cpp
+ * @brief Open-loop load generator for the inference path.
+ *
+ * Usage: digit_loadgen --target inprocess|tcp|verbs [options]
+ *
+ * Requests are issued on a precomputed schedule (Poisson or constant
+ * arrivals) whether or not earlier ones have completed. Latency is
+ * measured from each request's *intended* send time, so time spent
+ * queued behind a slow server -- or behind the generator itself -- is
+ * counted instead of silently omitted (coordinated omission).
+ *
+ * Inputs are MNIST test images from the IDX files, or a directory of
+ * recorded canvas images. Results are written as an HdrHistogram
+ * percentile distribution (.hgrm) and a JSON summary.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// ----------------------------------------------------------------------------
+// Inputs
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief One replayable input: grayscale pixels plus an optional label.
+ */
+struct Sample {
+    std::vector<uint8_t> pixels;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    int label = -1;
+};
+
+std::vector<Sample> load_mnist_samples(const std::string& images_path) {
+    const std::string labels_path = mnist_labels_path_for(images_path);
+    const bool have_labels = !labels_path.empty() && std::ifstream(labels_path).good();
+    MnistSet set = load_mnist_idx(images_path, have_labels ? labels_path : "");
+
+    std::vector<Sample> samples(set.count);
+    for (uint32_t i = 0; i < set.count; ++i) {
+        samples[i].pixels.assign(set.image(i), set.image(i) + set.image_bytes());
+        samples[i].width = static_cast<uint16_t>(set.cols);
+        samples[i].height = static_cast<uint16_t>(set.rows);
+        samples[i].label = have_labels ? set.labels[i] : -1;
+    }
+    return samples;
+}
+
+std::vector<Sample> load_canvas_samples(const std::string& directory) {
+    std::vector<std::filesystem::path> paths;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        const std::string ext = entry.path().extension().string();
+        if (ext == ".png" || ext == ".jpg" || ext == ".bmp" || ext == ".pgm") {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<Sample> samples;
+    for (const auto& path : paths) {
+        cv::Mat image = cv::imread(path.string(), cv::IMREAD_GRAYSCALE);
+        if (image.empty() || !image.isContinuous()) {
+            continue;
+        }
+        Sample sample;
+        sample.pixels.assign(image.data, image.data + image.total());
+        sample.width = static_cast<uint16_t>(image.cols);
+        sample.height = static_cast<uint16_t>(image.rows);
+        // Recorded canvases may be named "<label>_<anything>.png"
+        const std::string stem = path.stem().string();
+        if (stem.size() > 1 && std::isdigit(static_cast<unsigned char>(stem[0])) &&
+            stem[1] == '_') {
+            sample.label = stem[0] - '0';
+        }
+        samples.push_back(std::move(sample));
+    }
+    if (samples.empty()) {
+        throw std::runtime_error("No canvas images found in " + directory);
+    }
+    return samples;
+}
+
+/**
+ * @brief Shrinks samples to 28x28, for transports with a fixed image size.
+ */
+void shrink_to_mnist(std::vector<Sample>& samples) {
+    for (Sample& sample : samples) {
+        if (sample.width == VERBS_IMAGE_SIZE && sample.height == VERBS_IMAGE_SIZE) {
+            continue;
+        }
+        cv::Mat image(sample.height, sample.width, CV_8UC1, sample.pixels.data());
+        cv::Mat small;
+        cv::resize(image, small, cv::Size(VERBS_IMAGE_SIZE, VERBS_IMAGE_SIZE), 0, 0,
+                   cv::INTER_AREA);
+        sample.pixels.assign(small.data, small.data + small.total());
+        sample.width = sample.height = VERBS_IMAGE_SIZE;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Targets
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Something requests can be fired at without waiting for answers.
+ */
+class LoadTarget {
+public:
+    using Completion =
+        std::function<void(uint64_t id, WireStatus status, const Prediction& prediction)>;
+
+    virtual ~LoadTarget() = default;
+    virtual void start(Completion on_complete) = 0;
+    /// Must not wait for the response; may block on back-pressure.
+    virtual void issue(uint64_t id, const Sample& sample) = 0;
+    virtual void stop() = 0;
+};
+
+/**
+ * @brief Calls InferenceEngine directly from a pool of worker threads.
+ */
+class InProcessTarget : public LoadTarget {
+public:
+    InProcessTarget(const std::string& model_path, int workers)
+        : m_engine(model_path), m_worker_count(workers) {}
+
+    void start(Completion on_complete) override {
+        m_on_complete = std::move(on_complete);
+        for (int i = 0; i < m_worker_count; ++i) {
+            m_workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    void issue(uint64_t id, const Sample& sample) override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.emplace_back(id, &sample);
+        }
+        m_cv.notify_one();
+    }
+
+    void stop() override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        for (auto& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+private:
+    void worker_loop() {
+        ImageProcessor processor;
+        while (true) {
+            std::pair<uint64_t, const Sample*> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+                if (m_stopping) {
+                    return; // Whatever is still queued counts as timed out
+                }
+                job = m_queue.front();
+                m_queue.pop_front();
+            }
+            const Sample& sample = *job.second;
+            Prediction prediction;
+            {
+                ArenaScope scratch;
+                cv::Mat image(sample.height, sample.width, CV_8UC1,
+                              const_cast<uint8_t*>(sample.pixels.data()));
+                torch::Tensor tensor = processor.process(image);
+                prediction = m_engine.predict(tensor);
+            }
+            m_on_complete(job.first, WireStatus::Ok, prediction);
+        }
+    }
+
+    InferenceEngine m_engine;
+    int m_worker_count;
+    Completion m_on_complete;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<uint64_t, const Sample*>> m_queue;
+    bool m_stopping = false;
+    std::vector<std::thread> m_workers;
+};
+
+/**
+ * @brief digit_server over TCP: requests are spread round-robin over
+ * several pipelined connections, each with its own reader thread.
+ */
+class TcpTarget : public LoadTarget {
+public:
+    TcpTarget(const std::string& host, uint16_t port, int connections, std::string model,
+              uint8_t priority, uint32_t deadline_us)
+        : m_model(std::move(model)) {
+        m_request_options.model = m_model;
+        m_request_options.priority = priority;
+        m_request_options.deadline_us = deadline_us;
+        for (int i = 0; i < connections; ++i) {
+            m_connections.push_back(std::make_unique<ClientConnection>(host, port));
+        }
+    }
+
+    void start(Completion on_complete) override {
+        m_on_complete = std::move(on_complete);
+        for (auto& conn : m_connections) {
+            m_readers.emplace_back([this, c = conn.get()] { reader_loop(*c); });
+        }
+    }
+
+    void issue(uint64_t id, const Sample& sample) override {
+        ClientConnection& conn = *m_connections[id % m_connections.size()];
+        conn.send_predict(id, sample.pixels.data(), sample.width, sample.height,
+                          m_request_options);
+    }
+
+    void stop() override {
+        m_running.store(false);
+        for (auto& conn : m_connections) {
+            conn->shutdown();
+        }
+        for (auto& reader : m_readers) {
+            reader.join();
+        }
+    }
+
+private:
+    void reader_loop(ClientConnection& conn) {
+        std::vector<PredictResponse> responses;
+        try {
+            while (m_running.load()) {
+                responses.clear();
+                conn.read_responses(responses, std::chrono::milliseconds(100));
+                for (const PredictResponse& r : responses) {
+                    m_on_complete(r.request_id, r.status, r.prediction);
+                }
+            }
+        } catch (const std::exception& e) {
+            if (m_running.load()) {
+                std::cerr << "digit_loadgen: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    std::string m_model;
+    PredictOptions m_request_options; ///< Views m_model
+    std::vector<std::unique_ptr<ClientConnection>> m_connections;
+    std::vector<std::thread> m_readers;
+    std::atomic<bool> m_running{true};
+    Completion m_on_complete;
+};
+
+/**
+ * @brief digit_verbs_server: one driver thread owns the (single-threaded)
+ * verbs client and feeds it from a hand-off queue.
+ */
+class VerbsTarget : public LoadTarget {
+public:
+    VerbsTarget(const std::string& host, uint16_t port, uint32_t depth)
+        : m_client(host, port, depth) {}
+
+    void start(Completion on_complete) override {
+        m_on_complete = std::move(on_complete);
+        m_driver = std::thread([this] { driver_loop(); });
+    }
+
+    void issue(uint64_t id, const Sample& sample) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.emplace_back(id, &sample);
+    }
+
+    void stop() override {
+        m_running.store(false);
+        m_driver.join();
+    }
+
+private:
+    void driver_loop() {
+        std::unordered_map<uint64_t, uint64_t> ids; // verbs request id -> loadgen id
+        std::vector<std::pair<uint64_t, Prediction>> results;
+        std::deque<std::pair<uint64_t, const Sample*>> local;
+        try {
+            while (m_running.load()) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    while (!m_pending.empty()) {
+                        local.push_back(m_pending.front());
+                        m_pending.pop_front();
+                    }
+                }
+                // Requests wait here while every slot is in flight; the
+                // wait is part of their measured latency.
+                while (!local.empty()) {
+                    const uint64_t verbs_id = m_client.submit(local.front().second->pixels.data());
+                    if (verbs_id == 0) {
+                        break;
+                    }
+                    ids[verbs_id] = local.front().first;
+                    local.pop_front();
+                }
+                results.clear();
+                m_client.poll(results, std::chrono::microseconds(200));
+                for (const auto& [verbs_id, prediction] : results) {
+                    auto it = ids.find(verbs_id);
+                    if (it != ids.end()) {
+                        m_on_complete(it->second, WireStatus::Ok, prediction);
+                        ids.erase(it);
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "digit_loadgen: " << e.what() << std::endl;
+        }
+    }
+
+    VerbsInferenceClient m_client;
+    std::thread m_driver;
+    std::atomic<bool> m_running{true};
+    std::mutex m_mutex;
+    std::deque<std::pair<uint64_t, const Sample*>> m_pending;
+    Completion m_on_complete;
+};
+
+// ----------------------------------------------------------------------------
+// Schedule and measurement
+// ----------------------------------------------------------------------------
+
+struct LoadgenOptions {
+    std::string target = "inprocess";
+    std::string config_path = "configs/config.json";
+    std::string images_path;
+    std::string canvas_dir;
+    std::string host = "127.0.0.1";
+    uint16_t port = 0;
+    double rate = 1000.0;
+    double duration_s = 10.0;
+    double warmup_s = 1.0;
+    double drain_s = 5.0;
+    bool poisson = true;
+    int connections = 4;
+    std::string model; ///< Empty for the server's default
+    std::string priority = "interactive";
+    uint32_t deadline_us = 0; ///< 0: no deadline; goodput counts every success
+    double duplicates = 0.0;  ///< Share of requests that repeat the previous input
+    int workers = 1;
+    uint32_t seed = 1;
+    std::string hgrm_path;
+    std::string json_path;
+};
+
+/**
+ * @brief Intended send offsets (ns from start) for the whole run.
+ */
+std::vector<uint64_t> build_schedule(const LoadgenOptions& options) {
+    std::vector<uint64_t> offsets;
+    offsets.reserve(static_cast<size_t>(options.rate * options.duration_s * 1.1) + 16);
+    std::mt19937_64 rng(options.seed);
+    std::exponential_distribution<double> gap(options.rate);
+    const double end_s = options.duration_s;
+    double t = 0.0;
+    while (true) {
+        t += options.poisson ? gap(rng) : 1.0 / options.rate;
+        if (t >= end_s) {
+            break;
+        }
+        offsets.push_back(static_cast<uint64_t>(t * 1e9));
+    }
+    return offsets;
+}
+
+/**
+ * @brief Which sample each request sends: the next one in turn, or with
+ * probability `duplicates` the same one as the request before it, like a
+ * retry or a canvas broadcast to several sessions.
+ */
+std::vector<size_t> build_inputs(const LoadgenOptions& options, size_t requests,
+                                 size_t samples) {
+    std::vector<size_t> inputs(requests);
+    std::mt19937_64 rng(options.seed ^ 0x5eedull);
+    std::bernoulli_distribution repeat(options.duplicates);
+    size_t next = 0;
+    for (size_t id = 0; id < requests; ++id) {
+        inputs[id] = id > 0 && repeat(rng) ? inputs[id - 1] : next++ % samples;
+    }
+    return inputs;
+}
+
+/**
+ * @brief Thread-safe sink for completions.
+ */
+struct Recorder {
+    std::mutex mutex;
+    LatencyHistogram latency;  ///< Completion minus intended send time
+    LatencyHistogram send_lag; ///< Actual minus intended send time
+    std::vector<uint8_t> done; ///< Guards against duplicate completions
+    uint64_t measured = 0;
+    uint64_t completed = 0;
+    uint64_t measured_completed = 0; ///< Completions of requests past the warm-up
+    uint64_t errors = 0;
+    uint64_t overloaded = 0;   ///< Refused or shed by the server
+    uint64_t goodput = 0;      ///< Successes within the deadline
+    uint64_t labelled = 0;
+    uint64_t correct = 0;
+};
+
+json histogram_summary(const LatencyHistogram& h) {
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    return json{{"count", h.count()},
+                {"min", us(h.min())},
+                {"mean", h.mean() / 1000.0},
+                {"p50", us(h.value_at_percentile(50.0))},
+                {"p90", us(h.value_at_percentile(90.0))},
+                {"p99", us(h.value_at_percentile(99.0))},
+                {"p99_9", us(h.value_at_percentile(99.9))},
+                {"p99_99", us(h.value_at_percentile(99.99))},
+                {"max", us(h.max())}};
+}
+
+void print_usage() {
+    std::cerr
+        << "Usage: digit_loadgen --target inprocess|tcp|verbs [options]\n"
+           "  --images PATH        MNIST idx3 images (labels are picked up alongside)\n"
+           "  --canvases DIR       Directory of recorded canvas images instead\n"
+           "  --rate R             Target requests/s (default 1000)\n"
+           "  --duration S         Length of the schedule in seconds (default 10)\n"
+           "  --warmup S           Leading seconds excluded from stats (default 1)\n"
+           "  --arrival poisson|constant\n"
+           "  --config PATH        Config with model_path and arena (inprocess target)\n"
+           "  --workers N          Inference threads (inprocess target)\n"
+           "  --host H --port P    Server address (tcp/verbs targets)\n"
+           "  --connections N      Pipelined connections (tcp target)\n"
+           "  --model NAME[:VER]   Model to request (tcp target; default: server's)\n"
+           "  --priority interactive|bulk  Scheduling class (tcp target)\n"
+           "  --deadline-us N      Per-request deadline; also the goodput cutoff\n"
+           "  --duplicates F       Share of requests repeating the previous input (0-1)\n"
+           "  --seed N             Arrival process seed\n"
+           "  --hgrm PATH          Write the HdrHistogram percentile distribution\n"
+           "  --json PATH          Write the JSON summary (default: stdout)\n";
+}
+
+LoadgenOptions parse_args(int argc, char** argv) {
+    LoadgenOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--target") o.target = next();
+        else if (arg == "--images") o.images_path = next();
+        else if (arg == "--canvases") o.canvas_dir = next();
+        else if (arg == "--rate") o.rate = std::stod(next());
+        else if (arg == "--duration") o.duration_s = std::stod(next());
+        else if (arg == "--warmup") o.warmup_s = std::stod(next());
+        else if (arg == "--drain") o.drain_s = std::stod(next());
+        else if (arg == "--arrival") o.poisson = next() != "constant";
+        else if (arg == "--config") o.config_path = next();
+        else if (arg == "--workers") o.workers = std::stoi(next());
+        else if (arg == "--host") o.host = next();
+        else if (arg == "--port") o.port = static_cast<uint16_t>(std::stoi(next()));
+        else if (arg == "--connections") o.connections = std::stoi(next());
+        else if (arg == "--model") o.model = next();
+        else if (arg == "--priority") o.priority = next();
+        else if (arg == "--deadline-us") o.deadline_us = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--duplicates") o.duplicates = std::stod(next());
+        else if (arg == "--seed") o.seed = static_cast<uint32_t>(std::stoul(next()));
+        else if (arg == "--hgrm") o.hgrm_path = next();
+        else if (arg == "--json") o.json_path = next();
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.images_path.empty() == o.canvas_dir.empty()) {
+        throw std::invalid_argument("Exactly one of --images or --canvases is required");
+    }
+    if (o.rate <= 0.0 || o.duration_s <= 0.0) {
+        throw std::invalid_argument("--rate and --duration must be positive");
+    }
+    if (o.duplicates < 0.0 || o.duplicates > 1.0) {
+        throw std::invalid_argument("--duplicates must be between 0 and 1");
+    }
+    return o;
+}
+
+std::unique_ptr<LoadTarget> make_target(const LoadgenOptions& o, std::vector<Sample>& samples) {
+    if (o.target == "inprocess") {
+        std::ifstream config_file(o.config_path);
+        if (!config_file.is_open()) {
+            throw std::runtime_error("Could not open config file: " + o.config_path);
+        }
+        json config;
+        config_file >> config;
+        const json arena = config.value("arena", json::object());
+        ArenaOptions arena_options;
+        arena_options.enabled = arena.value("enabled", arena_options.enabled);
+        arena_options.chunk_bytes = arena.value("chunk_kb", arena_options.chunk_bytes >> 10) << 10;
+        arena_options.max_bytes = arena.value("max_mb", arena_options.max_bytes >> 20) << 20;
+        ScratchArena::configure(arena_options);
+        return std::make_unique<InProcessTarget>(config.at("model_path").get<std::string>(),
+                                                 std::max(1, o.workers));
+    }
+    if (o.target == "tcp") {
+        return std::make_unique<TcpTarget>(o.host, o.port != 0 ? o.port : 9000,
+                                           std::max(1, o.connections), o.model,
+                                           o.priority == "bulk" ? 1 : 0, o.deadline_us);
+    }
+    if (o.target == "verbs") {
+        shrink_to_mnist(samples); // The verbs request carries exactly 28x28 pixels
+        return std::make_unique<VerbsTarget>(o.host, o.port != 0 ? o.port : 18515, 64);
+    }
+    throw std::invalid_argument("Unknown target '" + o.target + "'");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    LoadgenOptions options;
+    try {
+        options = parse_args(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "digit_loadgen: " << e.what() << std::endl;
+        print_usage();
+        return 1;
+    }
+
+    try {
+        // 1. Inputs, target and schedule are all prepared before the clock starts
+        std::vector<Sample> samples = options.images_path.empty()
+                                          ? load_canvas_samples(options.canvas_dir)
+                                          : load_mnist_samples(options.images_path);
+        std::unique_ptr<LoadTarget> target = make_target(options, samples);
+        const std::vector<uint64_t> schedule = build_schedule(options);
+        const std::vector<size_t> inputs = build_inputs(options, schedule.size(), samples.size());
+        const uint64_t warmup_ns = static_cast<uint64_t>(options.warmup_s * 1e9);
+
+        Recorder recorder;
+        recorder.done.assign(schedule.size(), 0);
+        Clock::time_point start;
+
+        const uint64_t deadline_ns = static_cast<uint64_t>(options.deadline_us) * 1000;
+        target->start([&](uint64_t id, WireStatus status, const Prediction& prediction) {
+            const Clock::time_point now = Clock::now();
+            std::lock_guard<std::mutex> lock(recorder.mutex);
+            if (id >= schedule.size() || recorder.done[id]) {
+                return;
+            }
+            recorder.done[id] = 1;
+            ++recorder.completed;
+            if (schedule[id] < warmup_ns) {
+                return;
+            }
+            ++recorder.measured_completed;
+            if (status == WireStatus::Overloaded) {
+                // A fast refusal is not a fast answer; keep it out of the latency
+                ++recorder.overloaded;
+                return;
+            }
+            const auto intended = start + std::chrono::nanoseconds(schedule[id]);
+            const uint64_t latency_ns = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - intended).count());
+            recorder.latency.record(latency_ns);
+            if (status != WireStatus::Ok) {
+                ++recorder.errors;
+                return;
+            }
+            if (deadline_ns == 0 || latency_ns <= deadline_ns) {
+                ++recorder.goodput;
+            }
+            const int label = samples[inputs[id]].label;
+            if (label >= 0) {
+                ++recorder.labelled;
+                recorder.correct += prediction.digit == label ? 1 : 0;
+            }
+        });
+
+        // 2. Fire on schedule. Falling behind never skips a request: late
+        // sends still carry their original intended time.
+        std::cerr << "digit_loadgen: " << schedule.size() << " requests at " << options.rate
+                  << "/s (" << (options.poisson ? "poisson" : "constant") << ") against "
+                  << options.target << std::endl;
+        start = Clock::now();
+        for (uint64_t id = 0; id < schedule.size(); ++id) {
+            const auto intended = start + std::chrono::nanoseconds(schedule[id]);
+            // Sleep most of the gap, spin the last stretch for accuracy
+            std::this_thread::sleep_until(intended - std::chrono::microseconds(100));
+            while (Clock::now() < intended) {
+            }
+            const auto lag = Clock::now() - intended;
+            target->issue(id, samples[inputs[id]]);
+            if (schedule[id] >= warmup_ns) {
+                std::lock_guard<std::mutex> lock(recorder.mutex);
+                ++recorder.measured;
+                recorder.send_lag.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(lag).count()));
+            }
+        }
+
+        // 3. Give stragglers a bounded time to finish, then stop
+        const auto drain_deadline =
+            Clock::now() + std::chrono::milliseconds(static_cast<int64_t>(options.drain_s * 1000));
+        while (Clock::now() < drain_deadline) {
+            {
+                std::lock_guard<std::mutex> lock(recorder.mutex);
+                if (recorder.completed == schedule.size()) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        const Clock::time_point end = Clock::now();
+        target->stop();
+
+        // 4. Report. Requests that never finished are recorded as having
+        // waited until the end of the run rather than dropped from the tail.
+        // Like the latency, every count below leaves out the warm-up.
+        std::lock_guard<std::mutex> lock(recorder.mutex);
+        uint64_t timeouts = 0;
+        for (uint64_t id = 0; id < schedule.size(); ++id) {
+            if (!recorder.done[id] && schedule[id] >= warmup_ns) {
+                ++timeouts;
+                const auto intended = start + std::chrono::nanoseconds(schedule[id]);
+                recorder.latency.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - intended).count()));
+            }
+        }
+        json summary;
+        summary["target"] = options.target;
+        summary["arrival"] = options.poisson ? "poisson" : "constant";
+        summary["input"] = options.images_path.empty() ? options.canvas_dir : options.images_path;
+        summary["target_rate"] = options.rate;
+        summary["duration_s"] = options.duration_s;
+        summary["warmup_s"] = options.warmup_s;
+        summary["seed"] = options.seed;
+        summary["scheduled"] = schedule.size();
+        summary["measured"] = recorder.measured;
+        summary["completed"] = recorder.measured_completed;
+        summary["errors"] = recorder.errors;
+        summary["overloaded"] = recorder.overloaded;
+        summary["deadline_us"] = options.deadline_us;
+        summary["duplicates"] = options.duplicates;
+        const double measured_s = std::max(1e-9, options.duration_s - options.warmup_s);
+        summary["goodput_rate"] = static_cast<double>(recorder.goodput) / measured_s;
+        summary["timeouts"] = timeouts;
+        summary["achieved_rate"] =
+            static_cast<double>(recorder.measured_completed) / measured_s;
+        if (recorder.labelled > 0) {
+            summary["accuracy"] =
+                static_cast<double>(recorder.correct) / static_cast<double>(recorder.labelled);
+        }
+        summary["latency_us"] = histogram_summary(recorder.latency);
+        summary["send_lag_us"] = histogram_summary(recorder.send_lag);
+
+        if (!options.hgrm_path.empty()) {
+            std::ofstream hgrm(options.hgrm_path);
+            recorder.latency.write_percentile_distribution(hgrm, 1000.0);
+        }
+        if (options.json_path.empty()) {
+            std::cout << summary.dump(2) << std::endl;
+        } else {
+            std::ofstream(options.json_path) << summary.dump(2) << std::endl;
+        }
+        if (timeouts > 0) {
+            std::cerr << "digit_loadgen: " << timeouts << " requests never completed" << std::endl;
+        }
+
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
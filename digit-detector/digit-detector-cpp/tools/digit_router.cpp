@@ -0,0 +1,169 @@
+#include "Router.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file digit_router.cpp
+ * @brief Entry point for the router in front of several digit_server processes.
+ *
+ * Usage: digit_router [config_path] [--backend host:port]... [--policy hash|least]
+ *                     [--port N]
+ * Reads the "router" section of the config:
+ * {port, bind_address, io_engine, policy, virtual_nodes, load_bound,
+ * connections_per_backend, health_interval_ms, health_timeout_ms,
+ * eject_after_failures, backends: ["host:port", ...]}. --backend flags
+ * replace "router.backends".
+ *
+ * SIGHUP re-reads the config and adds and removes backends to match
+ * "router.backends"; keys move only to and from the backends that changed.
+ * On exit each backend's share of the traffic and its latency are printed.
+ */
+
+namespace {
+Router* g_router = nullptr;
+std::atomic<bool> g_reload{false};
+
+void handle_signal(int) {
+    if (g_router) {
+        g_router->stop();
+    }
+}
+
+void handle_hangup(int) {
+    g_reload.store(true);
+}
+
+json load_config(const std::string& path) {
+    std::ifstream config_file(path);
+    if (!config_file.is_open()) {
+        throw std::runtime_error("Could not open config file: " + path);
+    }
+    json config;
+    config_file >> config;
+    return config;
+}
+
+std::vector<BackendAddress> parse_backends(const json& router) {
+    std::vector<BackendAddress> backends;
+    for (const json& entry : router.value("backends", json::array())) {
+        backends.push_back(parse_backend_address(entry.get<std::string>()));
+    }
+    return backends;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string config_path = "configs/config.json";
+    std::vector<std::string> backend_overrides;
+    std::string policy_override;
+    std::optional<uint16_t> port_override;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--backend" && i + 1 < argc) {
+            backend_overrides.push_back(argv[++i]);
+        } else if (arg == "--policy" && i + 1 < argc) {
+            policy_override = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            port_override = static_cast<uint16_t>(std::stoul(argv[++i]));
+        } else {
+            config_path = arg;
+        }
+    }
+
+    try {
+        // 1. Load configuration
+        const json config = load_config(config_path);
+        const json section = config.value("router", json::object());
+        RouterOptions options;
+        IoEngineConfig& io = options.io;
+        io.port = port_override ? *port_override : section.value("port", uint16_t{9100});
+        io.bind_address = section.value("bind_address", io.bind_address);
+        io.kind = parse_io_engine_kind(section.value("io_engine", std::string("epoll")));
+        options.policy = parse_routing_policy(
+            policy_override.empty() ? section.value("policy", std::string("consistent_hash"))
+                                    : policy_override);
+        options.virtual_nodes = section.value("virtual_nodes", options.virtual_nodes);
+        options.load_bound = section.value("load_bound", options.load_bound);
+        options.connections_per_backend =
+            section.value("connections_per_backend", options.connections_per_backend);
+        options.health_interval = std::chrono::milliseconds(
+            section.value("health_interval_ms", options.health_interval.count()));
+        options.health_timeout = std::chrono::milliseconds(
+            section.value("health_timeout_ms", options.health_timeout.count()));
+        options.eject_after_failures =
+            section.value("eject_after_failures", options.eject_after_failures);
+
+        std::vector<BackendAddress> backends;
+        for (const std::string& spec : backend_overrides) {
+            backends.push_back(parse_backend_address(spec));
+        }
+        if (backend_overrides.empty()) {
+            backends = parse_backends(section);
+        }
+        if (backends.empty()) {
+            throw std::runtime_error("No backends: set 'router.backends' or pass --backend");
+        }
+
+        // 2. Route until interrupted; SIGHUP is picked up by a polling thread,
+        // since a handler may not take the router's locks
+        Router router(backends, options);
+        g_router = &router;
+        std::signal(SIGINT, handle_signal);
+        std::signal(SIGTERM, handle_signal);
+        std::signal(SIGHUP, handle_hangup);
+        std::atomic<bool> done{false};
+        std::thread reloader([&] {
+            while (!done.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (!g_reload.exchange(false)) {
+                    continue;
+                }
+                if (!backend_overrides.empty()) {
+                    std::cerr << "Router: backends were given with --backend; ignoring SIGHUP"
+                              << std::endl;
+                    continue;
+                }
+                try {
+                    router.set_backends(parse_backends(
+                        load_config(config_path).value("router", json::object())));
+                } catch (const std::exception& e) {
+                    std::cerr << "Router: reload failed, keeping the current backends: "
+                              << e.what() << std::endl;
+                }
+            }
+        });
+        router.run();
+        done.store(true);
+        reloader.join();
+        g_router = nullptr;
+
+        // 3. Report how the traffic was spread
+        std::printf("%-21s %7s %10s %10s %7s %7s %7s %10s %10s\n", "backend", "healthy",
+                    "forwarded", "completed", "failed", "retried", "share", "p50 us", "p99 us");
+        for (const BackendStats& s : router.backend_stats()) {
+            std::printf("%-21s %7s %10llu %10llu %7llu %7llu %6.1f%% %10.1f %10.1f\n",
+                        s.name.c_str(), s.healthy ? "yes" : "no",
+                        static_cast<unsigned long long>(s.forwarded),
+                        static_cast<unsigned long long>(s.completed),
+                        static_cast<unsigned long long>(s.failed),
+                        static_cast<unsigned long long>(s.retried), s.share * 100.0, s.p50_us,
+                        s.p99_us);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,390 @@
+#include "Autotuner.h"
+#include "InferenceServer.h"
+#include "ModelScheduler.h"
+#include "PerfStats.h"
+#include "PreforkServer.h"
+#include "ScratchArena.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @file digit_server.cpp
+ * @brief Entry point for the TCP inference service.
+ *
+ * Usage: digit_server [config_path] [--io-engine epoll|io_uring] [--sqpoll]
+ *                     [--autotune] [--retune] [--prefork N]
+ * Reads the optional "server" section of the config; command line flags
+ * override the config. Models come from "server.models", an array of
+ * {name, version, model_path, weight, max_batch, batch_delay_us,
+ * max_queue, deadline_us, coalesce, pipeline, precision, conv_algorithm,
+ * block_sparse, tta_variants};
+ * without it the top-level "model_path" is served as digit:1. A model's
+ * "pipeline" {enabled, queue_depth, max_batch, stages: [{layers, workers,
+ * threads, cores}]} runs its batches on a PipelineExecutor. Its
+ * "precision", e.g. {"fc1": "bf16"}, stores those layers' weights as fp16
+ * or bf16 and runs them on the kernels of LayerKernels.h; its
+ * "conv_algorithm", e.g. {"conv2": "winograd"}, picks direct, im2col or
+ * winograd per conv layer; its "block_sparse", e.g. {"fc1":
+ * "models/digit_model_s90.fc1.bsr"}, runs a pruned linear layer from the
+ * .bsr file digit-prune wrote alongside the model. Its "tta_variants"
+ * (default 1, off) averages that many augmented copies of every input;
+ * a batch of max_batch requests then runs max_batch * tta_variants rows.
+ *
+ * With --autotune (or "server.autotune.enabled") each model's max_batch
+ * and batch_delay_us, and the intra-op threads of the first model, come
+ * from the autotune cache; a model with no entry for this CPU, core count
+ * and model file is tuned first and the result stored. --retune tunes
+ * even when an entry exists.
+ *
+ * With --prefork N (or "server.prefork.enabled") the models are loaded
+ * once and served by N forked worker processes that share the weights
+ * and the port; N 0 (or "server.prefork.workers" 0) means one per core.
+ * "server.prefork.pin_processes" confines each worker to its share of the
+ * CPUs. On exit each worker's unique and shared memory is printed.
+ *
+ * "arena" {enabled, chunk_kb, max_mb, profile} gives every thread a
+ * scratch arena for preprocessing temporaries and activations.
+ */
+
+namespace {
+InferenceServer* g_server = nullptr;
+PreforkServer* g_prefork = nullptr;
+
+void handle_signal(int) {
+    if (g_server) {
+        g_server->stop();
+    }
+    if (g_prefork) {
+        g_prefork->stop();
+    }
+}
+
+ArenaOptions parse_arena(const json& section) {
+    ArenaOptions arena;
+    arena.enabled = section.value("enabled", arena.enabled);
+    arena.chunk_bytes = section.value("chunk_kb", arena.chunk_bytes >> 10) << 10;
+    arena.max_bytes = section.value("max_mb", arena.max_bytes >> 20) << 20;
+    arena.profile = section.value("profile", arena.profile);
+    return arena;
+}
+
+PipelineOptions parse_pipeline(const json& section) {
+    PipelineOptions pipeline;
+    if (!section.value("enabled", false)) {
+        return pipeline;
+    }
+    pipeline.queue_depth = section.value("queue_depth", pipeline.queue_depth);
+    pipeline.max_batch = section.value("max_batch", pipeline.max_batch);
+    for (const json& entry : section.value("stages", json::array())) {
+        PipelineStageOptions stage;
+        stage.layers = entry.at("layers").get<std::vector<std::string>>();
+        stage.workers = entry.value("workers", stage.workers);
+        stage.threads = entry.value("threads", stage.threads);
+        stage.cores = entry.value("cores", stage.cores);
+        pipeline.stages.push_back(stage);
+    }
+    return pipeline;
+}
+
+KernelOptions parse_kernels(const json& section) {
+    KernelOptions kernels;
+    for (const auto& entry : section.value("precision", json::object()).items()) {
+        kernels.precision[entry.key()] = parse_weight_precision(entry.value().get<std::string>());
+    }
+    for (const auto& entry : section.value("conv_algorithm", json::object()).items()) {
+        kernels.conv_algorithm[entry.key()] =
+            parse_conv_algorithm(entry.value().get<std::string>());
+    }
+    for (const auto& entry : section.value("block_sparse", json::object()).items()) {
+        kernels.block_sparse[entry.key()] = entry.value().get<std::string>();
+    }
+    return kernels;
+}
+
+std::vector<ModelConfig> parse_models(const json& config, const json& server) {
+    std::vector<ModelConfig> models;
+    if (!server.contains("models")) {
+        if (!config.contains("model_path")) {
+            throw std::runtime_error("Config has neither 'server.models' nor 'model_path'");
+        }
+        ModelConfig model;
+        model.model_path = config["model_path"];
+        model.kernels = parse_kernels(config);
+        model.tta_variants = config.value("tta_variants", model.tta_variants);
+        models.push_back(model);
+        return models;
+    }
+    for (const json& entry : server["models"]) {
+        ModelConfig model;
+        model.name = entry.value("name", model.name);
+        model.version = entry.value("version", model.version);
+        model.model_path = entry.at("model_path").get<std::string>();
+        model.weight = entry.value("weight", model.weight);
+        model.max_batch = entry.value("max_batch", model.max_batch);
+        model.batch_delay = std::chrono::microseconds(entry.value("batch_delay_us", 0));
+        model.max_queue = entry.value("max_queue", model.max_queue);
+        model.deadline = std::chrono::microseconds(entry.value("deadline_us", 0));
+        model.coalesce = entry.value("coalesce", model.coalesce);
+        model.pipeline = parse_pipeline(entry.value("pipeline", json::object()));
+        model.kernels = parse_kernels(entry);
+        model.tta_variants = entry.value("tta_variants", model.tta_variants);
+        models.push_back(model);
+    }
+    return models;
+}
+
+/**
+ * @brief Replaces the models' batching settings and the intra-op threads
+ * with cached or freshly tuned values.
+ */
+void apply_autotune(const json& section, bool retune, std::vector<ModelConfig>& models,
+                    ThreadBudgetConfig& threads) {
+    AutotuneOptions options;
+    options.seconds = section.value("seconds", options.seconds);
+    options.slo_p99_us = section.value("slo_p99_us", options.slo_p99_us);
+    options.inputs = section.value("inputs", options.inputs);
+    options.cores = threads.cores != 0 ? threads.cores : ThreadBudget::available_cores();
+    const std::string cache = section.value("cache", std::string("autotune.json"));
+    const std::string cpu = cpu_model();
+
+    for (size_t i = 0; i < models.size(); ++i) {
+        ModelConfig& model = models[i];
+        const std::string hash = model_file_hash(model.model_path);
+        const std::string config_hash = model_config_hash(model);
+        std::optional<AutotuneResult> result;
+        if (!retune) {
+            result = load_autotune_result(cache, cpu, hash, config_hash, options.cores);
+        }
+        if (result) {
+            std::cout << "Autotune: " << model.name << ":" << model.version << " reusing "
+                      << result->tuned_at << " result from " << cache << std::endl;
+        } else {
+            std::cout << "Autotune: tuning " << model.name << ":" << model.version << " for "
+                      << options.seconds << " s on " << options.cores << " cores" << std::endl;
+            result = autotune(model, options);
+            save_autotune_result(cache, *result);
+        }
+        std::cout << "Autotune: " << model.name << ":" << model.version << " -> "
+                  << result->intra_op_threads << " intra-op threads, max_batch "
+                  << result->max_batch << ", batch_delay " << result->batch_delay_us
+                  << " us (" << result->throughput << " req/s, p99 " << result->p99_us
+                  << " us" << (result->met_slo ? "" : ", SLO missed") << ")" << std::endl;
+
+        model.max_batch = result->max_batch;
+        model.batch_delay = std::chrono::microseconds(result->batch_delay_us);
+        if (i == 0 && threads.intra_op_threads == 0) {
+            threads.intra_op_threads = result->intra_op_threads;
+        }
+    }
+}
+
+/**
+ * @brief Runs apply_autotune() in a child process, so that tuning's
+ * threads never exist in a parent that is about to fork workers; the
+ * parent then reads the result from the cache.
+ */
+void apply_autotune_in_child(const json& section, bool retune, std::vector<ModelConfig>& models,
+                             ThreadBudgetConfig& threads) {
+    std::cout.flush();
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error("Could not fork the autotuner");
+    }
+    if (pid == 0) {
+        int code = 0;
+        try {
+            std::vector<ModelConfig> scratch = models;
+            ThreadBudgetConfig scratch_threads = threads;
+            apply_autotune(section, retune, scratch, scratch_threads);
+        } catch (const std::exception& e) {
+            std::cerr << "Autotune: " << e.what() << std::endl;
+            code = 1;
+        }
+        std::cout.flush();
+        ::_exit(code);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("Autotuning failed");
+    }
+    apply_autotune(section, false, models, threads);
+}
+
+void print_prefork_report(const PreforkServer& server) {
+    constexpr double MB = 1024.0 * 1024.0;
+    std::printf("%-6s %8s %10s %11s %9s %9s %9s %9s\n", "worker", "restarts", "responses",
+                "connections", "RSS MB", "PSS MB", "unique MB", "shared MB");
+    MemoryFootprint total;
+    uint64_t responses = 0;
+    for (const PreforkWorkerStats& s : server.worker_stats()) {
+        std::printf("%-6u %8u %10llu %11llu %9.1f %9.1f %9.1f %9.1f\n", s.index, s.restarts,
+                    static_cast<unsigned long long>(s.responses),
+                    static_cast<unsigned long long>(s.connections),
+                    static_cast<double>(s.memory.rss) / MB, static_cast<double>(s.memory.pss) / MB,
+                    static_cast<double>(s.memory.private_bytes) / MB,
+                    static_cast<double>(s.memory.shared_bytes) / MB);
+        total.rss += s.memory.rss;
+        total.pss += s.memory.pss;
+        total.private_bytes += s.memory.private_bytes;
+        responses += s.responses;
+    }
+    // PSS splits every shared page among its users, so workers + parent is the real total
+    const MemoryFootprint parent = memory_footprint();
+    std::printf("Prefork: %llu responses from %u workers; RSS sums to %.1f MB, PSS with the "
+                "parent to %.1f MB, %.1f MB of it unique to workers; %.1f MB of weights shared\n",
+                static_cast<unsigned long long>(responses), server.workers(),
+                static_cast<double>(total.rss) / MB,
+                static_cast<double>(total.pss + parent.pss) / MB,
+                static_cast<double>(total.private_bytes) / MB,
+                static_cast<double>(server.frozen_bytes()) / MB);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string config_path = "configs/config.json";
+    std::string io_engine_override;
+    bool sqpoll_override = false;
+    bool autotune_flag = false;
+    bool retune = false;
+    std::optional<uint32_t> prefork_override;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--io-engine" && i + 1 < argc) {
+            io_engine_override = argv[++i];
+        } else if (arg == "--sqpoll") {
+            sqpoll_override = true;
+        } else if (arg == "--autotune") {
+            autotune_flag = true;
+        } else if (arg == "--retune") {
+            autotune_flag = true;
+            retune = true;
+        } else if (arg == "--prefork" && i + 1 < argc) {
+            prefork_override = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else {
+            config_path = arg;
+        }
+    }
+
+    try {
+        // 1. Load configuration
+        std::ifstream config_file(config_path);
+        if (!config_file.is_open()) {
+            throw std::runtime_error("Could not open config file: " + config_path);
+        }
+        json config;
+        config_file >> config;
+
+        const json server = config.value("server", json::object());
+        ScratchArena::configure(parse_arena(config.value("arena", json::object())));
+        std::vector<ModelConfig> models = parse_models(config, server);
+        InferenceServerOptions options;
+        options.workers = server.value("workers", options.workers);
+        options.pin_workers = server.value("pin_workers", options.pin_workers);
+        const json budget = server.value("thread_budget", json::object());
+        ThreadBudgetConfig& threads = options.threads;
+        threads.cores = budget.value("cores", threads.cores);
+        threads.intra_op_threads = budget.value("intra_op_threads", threads.intra_op_threads);
+        threads.interop_threads = budget.value("interop_threads", threads.interop_threads);
+        threads.items_per_thread = budget.value("items_per_thread", threads.items_per_thread);
+
+        // Prefork workers split the cores, and are tuned for their share
+        const json prefork = server.value("prefork", json::object());
+        const bool use_prefork = prefork_override || prefork.value("enabled", false);
+        PreforkOptions prefork_options;
+        if (use_prefork) {
+            prefork_options.workers =
+                prefork_override ? *prefork_override : prefork.value("workers", 0u);
+            if (prefork_options.workers == 0) {
+                prefork_options.workers = ThreadBudget::available_cores();
+            }
+            prefork_options.pin_processes = prefork.value("pin_processes", false);
+            if (threads.cores == 0) {
+                threads.cores =
+                    std::max(1u, ThreadBudget::available_cores() / prefork_options.workers);
+            }
+        }
+
+        const json autotune = server.value("autotune", json::object());
+        if (autotune_flag || autotune.value("enabled", false)) {
+            if (use_prefork) {
+                apply_autotune_in_child(autotune, retune, models, threads);
+            } else {
+                apply_autotune(autotune, retune, models, threads);
+            }
+        }
+
+        IoEngineConfig& io = options.io;
+        io.port = server.value("port", io.port);
+        io.bind_address = server.value("bind_address", io.bind_address);
+        io.kind = parse_io_engine_kind(
+            io_engine_override.empty() ? server.value("io_engine", std::string("epoll"))
+                                       : io_engine_override);
+        io.sqpoll = sqpoll_override || server.value("sqpoll", io.sqpoll);
+        io.sqpoll_idle_ms = server.value("sqpoll_idle_ms", io.sqpoll_idle_ms);
+        io.ring_entries = server.value("ring_entries", io.ring_entries);
+        io.recv_buffers = server.value("recv_buffers", io.recv_buffers);
+        io.recv_buffer_size = server.value("recv_buffer_size", io.recv_buffer_size);
+
+        // 2. Start the service and run until interrupted
+        std::signal(SIGINT, handle_signal);
+        std::signal(SIGTERM, handle_signal);
+        if (use_prefork) {
+            prefork_options.server = options;
+            PreforkServer prefork_server(models, prefork_options);
+            g_prefork = &prefork_server;
+            prefork_server.run();
+            g_prefork = nullptr;
+            print_prefork_report(prefork_server);
+            return 0;
+        }
+        InferenceServer inference_server(models, options);
+        g_server = &inference_server;
+        inference_server.run();
+        g_server = nullptr;
+
+        const ThreadSplit split = inference_server.thread_split();
+        std::cout << "Thread budget: " << split.cores << " cores = " << split.concurrency
+                  << " passes x " << split.intra_op << " intra-op threads + " << split.spare
+                  << " spare (mean batch " << split.mean_batch << ", " << split.changes
+                  << " changes)" << std::endl;
+        const IoEngineStats stats = inference_server.io_stats();
+        std::cout << "Served " << stats.frames_sent << " responses over "
+                  << stats.connections_accepted << " connections with "
+                  << stats.kernel_entries << " kernel entries" << std::endl;
+        std::printf("%-16s %6s %10s %10s %9s %9s %7s %9s %8s %10s %10s %10s\n", "model",
+                    "weight", "completed", "goodput", "refused", "shed", "failed", "avg batch",
+                    "collapse", "p50 us", "p99 us", "weights");
+        for (const ModelStats& s : inference_server.model_stats()) {
+            std::printf("%-16s %6.2f %10llu %10llu %9llu %9llu %7llu %9.1f %7.2fx %10.1f %10.1f "
+                        "%9zuK\n",
+                        s.model.c_str(), s.weight,
+                        static_cast<unsigned long long>(s.completed),
+                        static_cast<unsigned long long>(s.goodput),
+                        static_cast<unsigned long long>(s.rejected + s.overloaded),
+                        static_cast<unsigned long long>(s.shed),
+                        static_cast<unsigned long long>(s.failed), s.mean_batch,
+                        s.collapse_ratio, s.p50_us,
+                        s.p99_us, s.weight_bytes / 1024);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
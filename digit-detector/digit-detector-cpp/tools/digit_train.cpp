@@ -0,0 +1,231 @@
+#include "DigitRecognizer.h"
+#include "MnistIdx.h"
+#include "MnistLoader.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/**
+ * @file digit_train.cpp
+ * @brief Trains DigitRecognizer on MNIST without Python and saves it as
+ * TorchScript the server loads.
+ *
+ * Usage: digit_train [--data DIR] [--epochs N] [--lr LR] [--batch-size B]
+ *                    [--workers W] [--prefetch P] [--threads T] [--seed S]
+ *                    [--out PATH] [--json PATH]
+ *                    [--rotate DEG] [--scale S] [--shear DEG] [--translate PX]
+ *                    [--elastic PX] [--elastic-sigma PX] [--thickness P]
+ *
+ * The defaults are digit-train's: 10 epochs of Adam at 1e-3 on batches of
+ * 64, cross-entropy loss, the same initialization. Batches come from
+ * MnistBatchLoader over the mapped IDX files in DIR (default
+ * data/MNIST/raw, where torchvision downloads them), W worker threads
+ * (default 2) keeping P batches (default 8) ready. T intra-op threads for
+ * the model, default LibTorch's. Each epoch reports its loss, wall time,
+ * images per second, time the loop waited for data and t10k accuracy;
+ * --json writes the same per epoch, for comparison with digit-train.
+ *
+ * The augmentation flags, all off by default, have the loader workers warp
+ * every training batch on the fly (Augmenter): rotation within +-DEG,
+ * scale within 1 +- S, shear within +-DEG, shifts within +-PX, elastic
+ * displacement up to PX smoothed over --elastic-sigma (default 4), and
+ * strokes thickened or thinned with probability P. The test set is never
+ * augmented.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t EVAL_BATCH = 1000;
+constexpr int LOG_EVERY = 100; ///< Steps between loss lines, as digit-train
+
+struct TrainOptions {
+    std::string data = "data/MNIST/raw";
+    int epochs = 10;
+    double lr = 1e-3;
+    LoaderOptions loader;
+    int threads = 0;
+    std::string out = "models/digit_model.ts";
+    std::string json_path;
+};
+
+TrainOptions parse_args(int argc, char** argv) {
+    TrainOptions o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--data") o.data = next();
+        else if (arg == "--epochs") o.epochs = std::stoi(next());
+        else if (arg == "--lr") o.lr = std::stod(next());
+        else if (arg == "--batch-size") o.loader.batch_size = std::stoll(next());
+        else if (arg == "--workers") o.loader.workers = std::stoi(next());
+        else if (arg == "--prefetch") o.loader.prefetch = std::stoul(next());
+        else if (arg == "--threads") o.threads = std::stoi(next());
+        else if (arg == "--seed") o.loader.seed = std::stoull(next());
+        else if (arg == "--out") o.out = next();
+        else if (arg == "--json") o.json_path = next();
+        else if (arg == "--rotate") o.loader.augment.max_rotation_deg = std::stof(next());
+        else if (arg == "--scale") o.loader.augment.max_scale = std::stof(next());
+        else if (arg == "--shear") o.loader.augment.max_shear_deg = std::stof(next());
+        else if (arg == "--translate") o.loader.augment.max_translate = std::stof(next());
+        else if (arg == "--elastic") o.loader.augment.elastic_alpha = std::stof(next());
+        else if (arg == "--elastic-sigma") o.loader.augment.elastic_sigma = std::stof(next());
+        else if (arg == "--thickness") o.loader.augment.thickness_probability = std::stof(next());
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    if (o.epochs <= 0 || o.lr <= 0.0 || o.threads < 0) {
+        throw std::invalid_argument("--epochs and --lr must be positive, --threads not negative");
+    }
+    return o;
+}
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * @brief Share of the set the model classifies correctly.
+ */
+double accuracy(DigitRecognizer& model, MnistBatchLoader& loader) {
+    torch::NoGradGuard no_grad;
+    model->eval();
+    int64_t correct = 0;
+    int64_t total = 0;
+    loader.start_epoch(0);
+    MnistBatch batch;
+    while (loader.next(batch)) {
+        correct += model->forward(batch.images).argmax(1).eq(batch.labels).sum().item<int64_t>();
+        total += batch.labels.size(0);
+    }
+    return static_cast<double>(correct) / static_cast<double>(total);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const TrainOptions options = parse_args(argc, argv);
+        if (options.threads > 0) {
+            at::set_num_threads(options.threads);
+        }
+        torch::manual_seed(options.loader.seed);
+
+        // 1. Mapped train and test sets
+        const std::filesystem::path data(options.data);
+        const MappedMnist train_set((data / "train-images-idx3-ubyte").string(),
+                                    (data / "train-labels-idx1-ubyte").string());
+        const MappedMnist test_set((data / "t10k-images-idx3-ubyte").string(),
+                                   (data / "t10k-labels-idx1-ubyte").string());
+        if (train_set.rows() != 28 || train_set.cols() != 28 || test_set.rows() != 28 ||
+            test_set.cols() != 28) {
+            throw std::runtime_error("Expected 28x28 images in " + options.data);
+        }
+        MnistBatchLoader train_loader(train_set, options.loader);
+        LoaderOptions eval_options = options.loader;
+        eval_options.batch_size = EVAL_BATCH;
+        eval_options.shuffle = false;
+        eval_options.augment = AugmentOptions();
+        MnistBatchLoader test_loader(test_set, eval_options);
+
+        DigitRecognizer model;
+        torch::optim::Adam optimizer(model->parameters(), torch::optim::AdamOptions(options.lr));
+        std::cout << "digit_train: " << train_set.count() << " training images, "
+                  << train_loader.batches() << " batches of " << options.loader.batch_size
+                  << ", " << options.loader.workers << " loader worker(s), "
+                  << at::get_num_threads() << " intra-op thread(s)" << std::endl;
+        if (options.loader.augment.enabled()) {
+            std::cout << "digit_train: augmenting training batches (" << Augmenter::isa() << ")"
+                      << std::endl;
+        }
+
+        // 2. Train, timing each epoch and the time spent waiting for batches
+        json report;
+        report["batch_size"] = options.loader.batch_size;
+        report["workers"] = options.loader.workers;
+        report["threads"] = at::get_num_threads();
+        const AugmentOptions& augment = options.loader.augment;
+        report["augment"] = {{"rotation_deg", augment.max_rotation_deg},
+                             {"scale", augment.max_scale},
+                             {"shear_deg", augment.max_shear_deg},
+                             {"translate", augment.max_translate},
+                             {"elastic_alpha", augment.elastic_alpha},
+                             {"elastic_sigma", augment.elastic_sigma},
+                             {"thickness_probability", augment.thickness_probability}};
+        report["epochs"] = json::array();
+        for (int epoch = 0; epoch < options.epochs; ++epoch) {
+            model->train();
+            train_loader.start_epoch(static_cast<uint64_t>(epoch));
+            const Clock::time_point start = Clock::now();
+            double waited = 0.0;
+            double running_loss = 0.0;
+            int64_t step = 0;
+            MnistBatch batch;
+            for (;;) {
+                const Clock::time_point wait_start = Clock::now();
+                if (!train_loader.next(batch)) {
+                    break;
+                }
+                waited += seconds_since(wait_start);
+
+                optimizer.zero_grad();
+                at::Tensor loss =
+                    torch::nn::functional::cross_entropy(model->forward(batch.images),
+                                                         batch.labels);
+                loss.backward();
+                optimizer.step();
+
+                const double value = loss.item<double>();
+                running_loss += value;
+                if (step % LOG_EVERY == 0) {
+                    std::printf("[Epoch %d/%d] Step %04lld  Loss: %.4f\n", epoch + 1,
+                                options.epochs, static_cast<long long>(step), value);
+                }
+                ++step;
+            }
+            const double seconds = seconds_since(start);
+            const double test_accuracy = accuracy(model, test_loader);
+            const double avg_loss = running_loss / static_cast<double>(step);
+            const double images_per_second = train_set.count() / seconds;
+            std::printf("Epoch %d avg loss: %.4f (%.1f s, %.0f images/s, %.2f s waiting for "
+                        "data, test accuracy %.2f%%)\n",
+                        epoch + 1, avg_loss, seconds, images_per_second, waited,
+                        100.0 * test_accuracy);
+            report["epochs"].push_back({{"epoch", epoch + 1},
+                                        {"avg_loss", avg_loss},
+                                        {"seconds", seconds},
+                                        {"images_per_second", images_per_second},
+                                        {"data_wait_seconds", waited},
+                                        {"test_accuracy", test_accuracy}});
+        }
+
+        // 3. TorchScript for InferenceEngine
+        const std::filesystem::path out(options.out);
+        if (out.has_parent_path()) {
+            std::filesystem::create_directories(out.parent_path());
+        }
+        model->eval();
+        save_torchscript(model, options.out);
+        std::cout << "Saved TorchScript: " << options.out << std::endl;
+
+        if (!options.json_path.empty()) {
+            std::ofstream(options.json_path) << report.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "VerbsInference.h"
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+/**
+ * @file digit_verbs_client.cpp
+ * @brief Sends an image to digit_verbs_server and reports latency.
+ *
+ * Usage: digit_verbs_client <image> [count] [host] [port]
+ * The image is converted to 28x28 grayscale on the client, then sent
+ * `count` times with up to 64 requests in flight.
+ */
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: digit_verbs_client <image> [count] [host] [port]" << std::endl;
+        return 1;
+    }
+    const std::string image_path = argv[1];
+    const int count = argc > 2 ? std::stoi(argv[2]) : 1;
+    const std::string host = argc > 3 ? argv[3] : "127.0.0.1";
+    const uint16_t port = static_cast<uint16_t>(argc > 4 ? std::stoi(argv[4]) : 18515);
+    if (count <= 0) {
+        std::cerr << "digit_verbs_client: count must be positive" << std::endl;
+        return 1;
+    }
+
+    try {
+        // 1. Load and shrink the image to the wire format
+        cv::Mat image = cv::imread(image_path, cv::IMREAD_GRAYSCALE);
+        if (image.empty()) {
+            throw std::runtime_error("Could not read image: " + image_path);
+        }
+        cv::Mat pixels;
+        cv::resize(image, pixels, cv::Size(VERBS_IMAGE_SIZE, VERBS_IMAGE_SIZE), 0, 0,
+                   cv::INTER_LINEAR);
+        if (!pixels.isContinuous()) {
+            pixels = pixels.clone();
+        }
+
+        // 2. Pipeline `count` requests through the server
+        VerbsInferenceClient client(host, port, 64);
+        std::vector<std::pair<uint64_t, Prediction>> results;
+        int sent = 0;
+        const auto start = std::chrono::steady_clock::now();
+        while (static_cast<int>(results.size()) < count) {
+            while (sent < count && client.submit(pixels.data) != 0) {
+                ++sent;
+            }
+            client.poll(results, std::chrono::seconds(1));
+            if (client.bad_completions() > 0) {
+                // The requests those completions were meant to answer never will be
+                throw std::runtime_error("Server answered a request not in flight");
+            }
+        }
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        // 3. Report
+        const Prediction& last = results.back().second;
+        std::cout << "Predicted digit: " << last.digit << " (" << last.confidence << ")"
+                  << std::endl;
+        std::cout << count << " requests in " << elapsed.count() << " ms ("
+                  << elapsed.count() / count << " ms/request)" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "ScratchArena.h"
+#include "VerbsInference.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/**
+ * @file digit_verbs_server.cpp
+ * @brief Entry point for the verbs-emulation inference service.
+ *
+ * Usage: digit_verbs_server [config_path]
+ * Reads "model_path" and the optional "verbs" and "arena" sections of the
+ * config.
+ */
+
+namespace {
+VerbsInferenceServer* g_server = nullptr;
+
+void handle_signal(int) {
+    if (g_server) {
+        g_server->stop();
+    }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::string config_path = argc > 1 ? argv[1] : "configs/config.json";
+
+    try {
+        // 1. Load configuration
+        std::ifstream config_file(config_path);
+        if (!config_file.is_open()) {
+            throw std::runtime_error("Could not open config file: " + config_path);
+        }
+        json config;
+        config_file >> config;
+        if (!config.contains("model_path")) {
+            throw std::runtime_error("Config missing 'model_path'");
+        }
+
+        const json verbs = config.value("verbs", json::object());
+        VerbsServerOptions options;
+        options.recv_depth = verbs.value("recv_depth", options.recv_depth);
+        options.max_batch = verbs.value("max_batch", options.max_batch);
+        options.batch_delay = std::chrono::microseconds(
+            verbs.value("batch_delay_us", static_cast<int>(options.batch_delay.count())));
+        const uint16_t port = verbs.value("port", 18515);
+
+        const json arena = config.value("arena", json::object());
+        ArenaOptions arena_options;
+        arena_options.enabled = arena.value("enabled", arena_options.enabled);
+        arena_options.chunk_bytes = arena.value("chunk_kb", arena_options.chunk_bytes >> 10) << 10;
+        arena_options.max_bytes = arena.value("max_mb", arena_options.max_bytes >> 20) << 20;
+        ScratchArena::configure(arena_options);
+
+        // 2. Start the service and run until interrupted
+        VerbsInferenceServer server(config["model_path"], port, options);
+        g_server = &server;
+        std::signal(SIGINT, handle_signal);
+        std::signal(SIGTERM, handle_signal);
+        server.run();
+        g_server = nullptr;
+
+    } catch (const std::exception& e) {
+        std::cerr << "CRITICAL ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
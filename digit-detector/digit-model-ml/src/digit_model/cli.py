@@ -7,6 +7,8 @@ from . import train as train_module
 from . import eval as eval_module
 from . import predict as predict_module
 from . import benchmark as benchmark_module
+from . import prune as prune_module
+from . import distill as distill_module
 
 
 def train_cli() -> None:
@@ -30,6 +32,20 @@ def train_cli() -> None:
         "--device", type=str, default=None,
         choices=["cpu", "cuda"], help="Device to train on"
     )
+    parser.add_argument(
+        "--qat", action="store_true",
+        help="Also export an int8 model trained quantization-aware"
+    )
+    parser.add_argument("--qat-epochs", type=int, default=2, help="QAT epochs")
+    parser.add_argument("--qat-lr", type=float, default=1e-4, help="QAT learning rate")
+    parser.add_argument(
+        "--qat-backend", type=str, default="fbgemm", choices=["fbgemm", "qnnpack"],
+        help="Quantized backend the int8 weights are packed for"
+    )
+    parser.add_argument(
+        "--qat-torchscript-name", type=str, default="digit_model_int8.ts",
+        help="int8 TorchScript filename"
+    )
     
     args = parser.parse_args()
     
@@ -41,6 +57,11 @@ def train_cli() -> None:
         checkpoint_name=args.checkpoint_name,
         torchscript_name=args.torchscript_name,
         device=args.device,
+        qat=args.qat,
+        qat_epochs=args.qat_epochs,
+        qat_lr=args.qat_lr,
+        qat_backend=args.qat_backend,
+        qat_torchscript_name=args.qat_torchscript_name,
     )
 
 
@@ -88,11 +109,151 @@ def predict_cli() -> None:
     )
 
 
+def prune_cli() -> None:
+    """CLI entry point for block-sparse pruning."""
+    parser = argparse.ArgumentParser(
+        description="Prune fc1 in blocks and fine-tune, exporting .bsr weights"
+    )
+    parser.add_argument(
+        "--checkpoint", type=str, default="models/digit_model.pth",
+        help="Dense checkpoint to prune"
+    )
+    parser.add_argument(
+        "--sparsities", type=str, default="0.5,0.7,0.8,0.9,0.95",
+        help="Comma-separated shares of fc1's blocks to prune"
+    )
+    parser.add_argument("--block-rows", type=int, default=4, help="Rows per block")
+    parser.add_argument(
+        "--block-cols", type=int, default=16, help="Columns per block"
+    )
+    parser.add_argument(
+        "--epochs", type=int, default=1,
+        help="Fine-tuning epochs after each pruning step"
+    )
+    parser.add_argument("--lr", type=float, default=1e-4, help="Learning rate")
+    parser.add_argument("--batch-size", type=int, default=64, help="Batch size")
+    parser.add_argument(
+        "--out-dir", type=str, default="models", help="Output directory"
+    )
+    parser.add_argument(
+        "--stem", type=str, default="digit_model", help="Prefix of exported files"
+    )
+    parser.add_argument(
+        "--device", type=str, default=None,
+        choices=["cpu", "cuda"], help="Device to train on"
+    )
+
+    args = parser.parse_args()
+
+    prune_module.prune(
+        checkpoint_path=args.checkpoint,
+        sparsities=[float(s) for s in args.sparsities.split(",")],
+        block_rows=args.block_rows,
+        block_cols=args.block_cols,
+        epochs=args.epochs,
+        lr=args.lr,
+        batch_size=args.batch_size,
+        out_dir=args.out_dir,
+        stem=args.stem,
+        device=args.device,
+    )
+
+
+def distill_cli() -> None:
+    """CLI entry point for distillation into latency-budgeted students."""
+    parser = argparse.ArgumentParser(
+        description="Distill the model into smaller students, picked by C++ latency"
+    )
+    parser.add_argument(
+        "--checkpoint", type=str, default="models/digit_model.pth",
+        help="Teacher checkpoint"
+    )
+    parser.add_argument(
+        "--teacher-torchscript", type=str, default="models/digit_model.ts",
+        help="Teacher TorchScript, timed for reference"
+    )
+    parser.add_argument(
+        "--students", type=str,
+        default=",".join(
+            "x".join(str(w) for w in widths)
+            for widths in distill_module.DEFAULT_STUDENTS
+        ),
+        help="Comma-separated candidate widths, each conv1xconv2xhidden"
+    )
+    parser.add_argument(
+        "--latency-budget-us", type=float, default=None,
+        help="C++ p50 budget in microseconds"
+    )
+    parser.add_argument(
+        "--bench", type=str, default=distill_module.DEFAULT_BENCH,
+        help="Path to the digit_latency_bench binary"
+    )
+    parser.add_argument(
+        "--bench-batch", type=int, default=1, help="Batch size to time"
+    )
+    parser.add_argument(
+        "--bench-runs", type=int, default=2000, help="Timed passes per model"
+    )
+    parser.add_argument(
+        "--bench-threads", type=int, default=1, help="Intra-op threads to time on"
+    )
+    parser.add_argument(
+        "--epochs", type=int, default=5, help="Distillation epochs per student"
+    )
+    parser.add_argument("--lr", type=float, default=1e-3, help="Learning rate")
+    parser.add_argument(
+        "--temperature", type=float, default=4.0, help="Distillation temperature"
+    )
+    parser.add_argument(
+        "--alpha", type=float, default=0.7,
+        help="Weight of the teacher's soft targets against the labels"
+    )
+    parser.add_argument("--batch-size", type=int, default=64, help="Batch size")
+    parser.add_argument(
+        "--out-dir", type=str, default="models/students", help="Output directory"
+    )
+    parser.add_argument(
+        "--deploy", type=str, default=None,
+        help="Copy the selected student's TorchScript here, "
+             "e.g. models/digit_model.ts"
+    )
+    parser.add_argument(
+        "--device", type=str, default=None,
+        choices=["cpu", "cuda"], help="Device to train on"
+    )
+
+    args = parser.parse_args()
+
+    distill_module.distill(
+        checkpoint_path=args.checkpoint,
+        teacher_torchscript=args.teacher_torchscript,
+        students=[
+            tuple(int(w) for w in s.split("x")) for s in args.students.split(",")
+        ],
+        latency_budget_us=args.latency_budget_us,
+        bench=args.bench,
+        bench_batch=args.bench_batch,
+        bench_runs=args.bench_runs,
+        bench_threads=args.bench_threads,
+        epochs=args.epochs,
+        lr=args.lr,
+        temperature=args.temperature,
+        alpha=args.alpha,
+        batch_size=args.batch_size,
+        out_dir=args.out_dir,
+        deploy_path=args.deploy,
+        device=args.device,
+    )
+
+
 def benchmark_cli() -> None:
     """CLI entry point for benchmarking."""
     benchmark_module.main()
 
 
 if __name__ == "__main__":
-    print("Use 'digit-train', 'digit-eval', 'digit-predict', or 'digit-benchmark'")
+    print(
+        "Use 'digit-train', 'digit-eval', 'digit-predict', 'digit-prune', "
+        "'digit-distill', or 'digit-benchmark'"
+    )
     sys.exit(1)
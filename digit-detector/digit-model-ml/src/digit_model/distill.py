@@ -0,0 +1,368 @@
+"""Knowledge distillation into smaller students, picked by C++ latency."""
+
+import json
+import shutil
+import subprocess
+import tempfile
+from pathlib import Path
+from typing import Dict, List, Optional, Sequence, Tuple
+
+import torch
+import torch.nn as nn
+import torch.nn.functional as F
+from torch.optim import Adam
+from torch.utils.data import DataLoader
+
+from .data import get_dataloaders
+from .eval import accuracy
+from .model import DigitRecognizer, StudentRecognizer
+
+# Candidate (channels1, channels2, hidden) widths, smallest first;
+# DigitRecognizer is (32, 64, 128)
+DEFAULT_STUDENTS: Tuple[Tuple[int, int, int], ...] = (
+    (4, 8, 32),
+    (8, 16, 32),
+    (8, 16, 64),
+    (16, 32, 64),
+)
+
+# digit_detector's generic TorchScript latency bench, built next to this package
+DEFAULT_BENCH = "../digit-detector-cpp/build/digit_latency_bench"
+
+
+def distillation_loss(
+    student_logits: torch.Tensor,
+    teacher_logits: torch.Tensor,
+    targets: torch.Tensor,
+    temperature: float,
+    alpha: float,
+) -> torch.Tensor:
+    """
+    Hinton et al.'s loss: KL divergence to the teacher's softened output
+    plus cross-entropy on the labels.
+
+    The KL term is scaled by temperature**2 so its gradients keep their
+    size as the temperature changes.
+
+    Args:
+        student_logits: Tensor of shape (batch, 10)
+        teacher_logits: Tensor of shape (batch, 10)
+        targets: Labels of shape (batch,)
+        temperature: Softmax temperature of the KL term
+        alpha: Weight of the KL term; 1 - alpha weighs the cross-entropy
+
+    Returns:
+        Scalar loss
+    """
+    soft = F.kl_div(
+        F.log_softmax(student_logits / temperature, dim=1),
+        F.log_softmax(teacher_logits / temperature, dim=1),
+        reduction="batchmean",
+        log_target=True,
+    )
+    hard = F.cross_entropy(student_logits, targets)
+    return alpha * temperature * temperature * soft + (1.0 - alpha) * hard
+
+
+def student_name(widths: Sequence[int]) -> str:
+    """File stem of a student, e.g. 'student_8x16x32'."""
+    return "student_" + "x".join(str(w) for w in widths)
+
+
+def export_torchscript(model: nn.Module, path: Path) -> None:
+    """Move the model to the CPU, script it in eval mode and save it."""
+    model.eval()
+    torch.jit.script(model.cpu()).save(str(path))
+
+
+def measure_latency(
+    models: Sequence[str],
+    bench: str,
+    batch: int = 1,
+    runs: int = 2000,
+    threads: int = 1,
+    images: Optional[Path] = None,
+) -> Dict[str, float]:
+    """
+    p50 latency of each TorchScript model through digit_detector's
+    InferenceEngine, measured by digit_latency_bench.
+
+    All models are measured in one run of the bench, one after another,
+    so they see the same machine state.
+
+    Args:
+        models: TorchScript files taking (N, 1, 28, 28)
+        bench: Path to the digit_latency_bench binary
+        batch: Batch size per pass
+        runs: Timed passes per model
+        threads: Intra-op threads of the bench
+        images: t10k idx3 file to feed; random inputs if None
+
+    Returns:
+        p50 in microseconds, keyed by model path as given
+    """
+    if not Path(bench).is_file():
+        raise FileNotFoundError(
+            f"{bench} not found; build digit_latency_bench in digit-detector-cpp "
+            "or pass its path"
+        )
+    with tempfile.TemporaryDirectory() as tmp:
+        report_path = Path(tmp) / "latency.json"
+        command = [
+            bench,
+            "--model", ",".join(models),
+            "--batches", str(batch),
+            "--runs", str(runs),
+            "--threads", str(threads),
+            "--json", str(report_path),
+        ]
+        if images is not None:
+            command += ["--images", str(images)]
+        subprocess.run(command, check=True)
+        with open(report_path) as f:
+            report = json.load(f)
+    return {row["model"]: row["p50_us"] for row in report["models"]}
+
+
+def mark_pareto_front(rows: List[dict]) -> None:
+    """
+    Set row['pareto'] on every row no other row beats on both accuracy and
+    latency (at least as good on both, better on one).
+    """
+    for row in rows:
+        row["pareto"] = not any(
+            other["accuracy"] >= row["accuracy"]
+            and other["p50_us"] <= row["p50_us"]
+            and (other["accuracy"] > row["accuracy"] or other["p50_us"] < row["p50_us"])
+            for other in rows
+        )
+
+
+def distill_student(
+    student: nn.Module,
+    teacher: nn.Module,
+    loader: DataLoader,
+    epochs: int,
+    lr: float,
+    temperature: float,
+    alpha: float,
+    device: torch.device,
+) -> None:
+    """Train the student on the teacher's logits and the labels."""
+    optimizer = Adam(student.parameters(), lr=lr)
+    teacher.eval()
+    student.train()
+    for epoch in range(epochs):
+        running_loss = 0.0
+        for x, y in loader:
+            x, y = x.to(device), y.to(device)
+            with torch.no_grad():
+                teacher_logits = teacher(x)
+            optimizer.zero_grad()
+            loss = distillation_loss(student(x), teacher_logits, y, temperature, alpha)
+            loss.backward()
+            optimizer.step()
+            running_loss += loss.item()
+        print(f"  epoch {epoch+1}/{epochs} avg loss: "
+              f"{running_loss / len(loader):.4f}")
+
+
+def distill(
+    checkpoint_path: str = "models/digit_model.pth",
+    teacher_torchscript: str = "models/digit_model.ts",
+    students: Sequence[Tuple[int, int, int]] = DEFAULT_STUDENTS,
+    latency_budget_us: Optional[float] = None,
+    bench: str = DEFAULT_BENCH,
+    bench_batch: int = 1,
+    bench_runs: int = 2000,
+    bench_threads: int = 1,
+    epochs: int = 5,
+    lr: float = 1e-3,
+    temperature: float = 4.0,
+    alpha: float = 0.7,
+    batch_size: int = 64,
+    data_dir: str = "./data",
+    out_dir: str = "models/students",
+    deploy_path: Optional[str] = None,
+    device: Optional[str] = None,
+) -> List[dict]:
+    """
+    Distill the trained DigitRecognizer into smaller students and pick one
+    by its latency in the C++ server's InferenceEngine.
+
+    1. Every candidate is exported untrained and timed with
+       digit_latency_bench (a dense model's latency does not depend on its
+       weights); candidates over the budget are dropped before any
+       training.
+    2. The rest are distilled from the teacher and exported as
+       <out_dir>/student_<c1>x<c2>x<hidden>.{pth,ts}.
+    3. The exported students are timed again with the teacher. The table
+       of accuracy against C++ p50 latency, Pareto front marked, is
+       printed and written to <out_dir>/distillation.json.
+    4. The most accurate student within the budget is selected and, if
+       deploy_path is given, copied there (e.g. models/digit_model.ts).
+
+    Args:
+        checkpoint_path: Teacher checkpoint from digit-train
+        teacher_torchscript: The teacher's TorchScript, timed for reference
+        students: Candidate (channels1, channels2, hidden) widths
+        latency_budget_us: p50 budget in microseconds; None for no budget
+        bench: Path to the digit_latency_bench binary
+        bench_batch: Batch size the latency is measured at
+        bench_runs: Timed passes per model
+        bench_threads: Intra-op threads of the bench
+        epochs: Distillation epochs per student
+        lr: Learning rate
+        temperature: Softmax temperature of the distillation loss
+        alpha: Weight of the teacher's soft targets against the labels
+        batch_size: Batch size for distillation and evaluation
+        data_dir: MNIST directory; its t10k images feed the bench
+        out_dir: Output directory for the students and the report
+        deploy_path: Where to copy the selected student, or None
+        device: Device to train on ('cuda', 'cpu', or None for auto-detect)
+
+    Returns:
+        One dictionary per row of the table, the teacher first
+    """
+    if device is None:
+        device_obj = torch.device("cuda" if torch.cuda.is_available() else "cpu")
+    else:
+        device_obj = torch.device(device)
+    if not students:
+        raise ValueError("No candidate students")
+    if not 0.0 <= alpha <= 1.0 or temperature <= 0.0:
+        raise ValueError("alpha must be in [0, 1] and temperature positive")
+
+    print(f"Distilling on device: {device_obj}")
+    out_path = Path(out_dir)
+    out_path.mkdir(parents=True, exist_ok=True)
+    train_loader, test_loader = get_dataloaders(
+        batch_size=batch_size, data_dir=data_dir
+    )
+    images = Path(data_dir) / "MNIST" / "raw" / "t10k-images-idx3-ubyte"
+    timing = dict(
+        bench=bench,
+        batch=bench_batch,
+        runs=bench_runs,
+        threads=bench_threads,
+        images=images if images.is_file() else None,
+    )
+
+    # 1. The teacher, and every candidate's latency before training any
+    teacher = DigitRecognizer().to(device_obj)
+    state = torch.load(checkpoint_path, map_location=device_obj)
+    teacher.load_state_dict(state["model_state"])
+    teacher.eval()
+    teacher_params = sum(p.numel() for p in teacher.parameters())
+    candidates = []
+    for widths in students:
+        ts_path = out_path / f"{student_name(widths)}.ts"
+        export_torchscript(StudentRecognizer(*widths), ts_path)
+        candidates.append((tuple(widths), ts_path))
+    screening = measure_latency([str(ts) for _, ts in candidates], **timing)
+    within = []
+    for widths, ts_path in candidates:
+        p50 = screening[str(ts_path)]
+        if latency_budget_us is not None and p50 > latency_budget_us:
+            print(f"{student_name(widths)}: p50 {p50:.1f} us over the "
+                  f"{latency_budget_us:.1f} us budget, skipped")
+        else:
+            within.append((widths, ts_path))
+    if not within:
+        raise ValueError(
+            f"No candidate runs within {latency_budget_us} us; add smaller students"
+        )
+
+    # 2. Distill the candidates within the budget
+    trained = []
+    for widths, ts_path in within:
+        print(f"\nDistilling {student_name(widths)}")
+        student = StudentRecognizer(*widths).to(device_obj)
+        distill_student(
+            student, teacher, train_loader, epochs, lr, temperature, alpha, device_obj
+        )
+        torch.save(
+            {
+                "model_state": student.state_dict(),
+                "student": {"widths": list(widths), "teacher": checkpoint_path},
+            },
+            out_path / f"{student_name(widths)}.pth",
+        )
+        student.eval()
+        test_acc = accuracy(student, test_loader, device_obj)
+        export_torchscript(student, ts_path)
+        print(f"Accuracy {test_acc*100:.2f}%; saved {ts_path}")
+        trained.append(
+            (widths, ts_path, test_acc, sum(p.numel() for p in student.parameters()))
+        )
+
+    # 3. Time the exported files and build the table
+    latency = measure_latency(
+        [teacher_torchscript] + [str(ts) for _, ts, _, _ in trained], **timing
+    )
+    rows = [{
+        "model": teacher_torchscript,
+        "widths": [32, 64, 128],
+        "params": teacher_params,
+        "accuracy": accuracy(teacher, test_loader, device_obj),
+        "p50_us": latency[teacher_torchscript],
+        "teacher": True,
+    }]
+    for widths, ts_path, test_acc, params in trained:
+        rows.append({
+            "model": str(ts_path),
+            "widths": list(widths),
+            "params": params,
+            "accuracy": test_acc,
+            "p50_us": latency[str(ts_path)],
+            "teacher": False,
+        })
+    mark_pareto_front(rows)
+
+    # 4. Select the most accurate student within the budget
+    eligible = [
+        row for row in rows[1:]
+        if latency_budget_us is None or row["p50_us"] <= latency_budget_us
+    ]
+    selected = max(eligible, key=lambda row: (row["accuracy"], -row["p50_us"]),
+                   default=None)
+
+    print(f"\nC++ p50 at batch {bench_batch}, {bench_threads} thread(s)")
+    print(f"{'widths':>12} {'params':>8} {'size':>6} {'accuracy':>9} "
+          f"{'p50 us':>9} {'pareto':>6}  model")
+    for row in rows:
+        mark = " *" if row is selected else ""
+        print(f"{'x'.join(str(w) for w in row['widths']):>12} {row['params']:>8d} "
+              f"{teacher_params / row['params']:>5.1f}x "
+              f"{row['accuracy']*100:>8.2f}% {row['p50_us']:>9.1f} "
+              f"{'yes' if row['pareto'] else '':>6}  {row['model']}{mark}")
+    print("(size: teacher parameters / model parameters; * selected)")
+
+    report_path = out_path / "distillation.json"
+    with open(report_path, "w") as f:
+        json.dump(
+            {
+                "latency_budget_us": latency_budget_us,
+                "bench_batch": bench_batch,
+                "bench_threads": bench_threads,
+                "epochs": epochs,
+                "temperature": temperature,
+                "alpha": alpha,
+                "selected": selected["model"] if selected else None,
+                "rows": rows,
+            },
+            f,
+            indent=2,
+        )
+    print(f"Saved report: {report_path}")
+
+    if selected is None:
+        print("No trained student is within the budget at the final measurement")
+    elif deploy_path is not None:
+        shutil.copyfile(selected["model"], deploy_path)
+        print(f"Deployed {selected['model']} to {deploy_path}")
+    return rows
+
+
+if __name__ == "__main__":
+    distill()
@@ -6,11 +6,24 @@ from typing import Optional
 import torch
 import torch.nn as nn
 from sklearn.metrics import classification_report, confusion_matrix
+from torch.utils.data import DataLoader
 
 from .data import get_dataloaders
 from .model import DigitRecognizer
 
 
+def accuracy(model: nn.Module, loader: DataLoader, device: torch.device) -> float:
+    """Share of a loader's samples the model classifies correctly."""
+    model.eval()
+    correct, total = 0, 0
+    with torch.no_grad():
+        for x, y in loader:
+            x, y = x.to(device), y.to(device)
+            correct += (model(x).argmax(dim=1) == y).sum().item()
+            total += y.size(0)
+    return correct / total
+
+
 def evaluate(
     checkpoint_path: str = "models/digit_model.pth",
     batch_size: int = 64,
@@ -3,6 +3,7 @@
 import torch
 import torch.nn as nn
 import torch.nn.functional as F
+from torch.ao.quantization import DeQuantStub, QuantStub, fuse_modules_qat
 
 
 class DigitRecognizer(nn.Module):
@@ -47,3 +48,99 @@ class DigitRecognizer(nn.Module):
         x = F.relu(self.fc1(x))
         x = self.fc2(x)
         return x
+
+
+class QuantizableDigitRecognizer(DigitRecognizer):
+    """
+    DigitRecognizer prepared for quantization-aware training.
+
+    Same layers and state dict keys as DigitRecognizer, so a float
+    checkpoint loads directly. Quant/dequant stubs mark where the int8
+    region starts and ends, and each ReLU is a module so that fuse_model()
+    can fold it into the layer before it.
+
+    Input: (batch, 1, 28, 28) float, normalized as for DigitRecognizer
+    Output: (batch, 10) float logits
+    """
+
+    def __init__(self) -> None:
+        super().__init__()
+        self.quant = QuantStub()
+        self.dequant = DeQuantStub()
+        self.relu1 = nn.ReLU()
+        self.relu2 = nn.ReLU()
+        self.relu3 = nn.ReLU()
+
+    def forward(self, x: torch.Tensor) -> torch.Tensor:
+        """
+        Forward pass through the network.
+
+        Args:
+            x: Input tensor of shape (batch, 1, 28, 28)
+
+        Returns:
+            Output logits of shape (batch, 10)
+        """
+        x = self.quant(x)
+        x = self.pool(self.relu1(self.conv1(x)))
+        x = self.pool(self.relu2(self.conv2(x)))
+        x = torch.flatten(x, 1)
+        x = self.relu3(self.fc1(x))
+        x = self.fc2(x)
+        return self.dequant(x)
+
+    def fuse_model(self) -> None:
+        """Fuse conv/linear + ReLU pairs for QAT; the model must be in train mode."""
+        fuse_modules_qat(
+            self,
+            [["conv1", "relu1"], ["conv2", "relu2"], ["fc1", "relu3"]],
+            inplace=True,
+        )
+
+
+class StudentRecognizer(nn.Module):
+    """
+    DigitRecognizer's layout at smaller widths, for distillation.
+
+    Architecture:
+        - Conv2D (1 -> channels1, 3x3 kernel)
+        - ReLU + MaxPool2D (2x2)
+        - Conv2D (channels1 -> channels2, 3x3 kernel)
+        - ReLU + MaxPool2D (2x2)
+        - Flatten
+        - Linear (channels2*7*7 -> hidden)
+        - ReLU
+        - Linear (hidden -> 10)
+
+    StudentRecognizer(32, 64, 128) is DigitRecognizer. The input and output
+    are DigitRecognizer's, so a student's TorchScript is a drop-in
+    replacement for the server.
+
+    Input: (batch, 1, 28, 28) - grayscale images
+    Output: (batch, 10) - logits for 10 digit classes
+    """
+
+    def __init__(self, channels1: int, channels2: int, hidden: int) -> None:
+        super().__init__()
+        self.conv1 = nn.Conv2d(1, channels1, kernel_size=3, stride=1, padding=1)
+        self.conv2 = nn.Conv2d(channels1, channels2, kernel_size=3, stride=1, padding=1)
+        self.pool = nn.MaxPool2d(2, 2)
+        self.fc1 = nn.Linear(channels2 * 7 * 7, hidden)
+        self.fc2 = nn.Linear(hidden, 10)
+
+    def forward(self, x: torch.Tensor) -> torch.Tensor:
+        """
+        Forward pass through the network.
+
+        Args:
+            x: Input tensor of shape (batch, 1, 28, 28)
+
+        Returns:
+            Output logits of shape (batch, 10)
+        """
+        x = self.pool(F.relu(self.conv1(x)))
+        x = self.pool(F.relu(self.conv2(x)))
+        x = x.view(x.size(0), -1)
+        x = F.relu(self.fc1(x))
+        x = self.fc2(x)
+        return x
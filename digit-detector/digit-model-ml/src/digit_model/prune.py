@@ -0,0 +1,285 @@
+"""Block-structured magnitude pruning of fc1, with fine-tuning."""
+
+import json
+import struct
+from pathlib import Path
+from typing import List, Optional, Sequence
+
+import numpy as np
+import torch
+import torch.nn as nn
+from torch.optim import Adam
+from torch.utils.data import DataLoader
+
+from .data import get_dataloaders
+from .eval import accuracy
+from .model import DigitRecognizer
+
+# File magic of the block-sparse weights digit_detector's BlockSparseLinear reads
+BSR_MAGIC = b"BSR1"
+
+
+def block_norms(weight: torch.Tensor, block_rows: int, block_cols: int) -> torch.Tensor:
+    """
+    L2 norm of every block of a weight matrix.
+
+    Args:
+        weight: Tensor of shape (outputs, inputs)
+        block_rows: Rows per block; must divide outputs
+        block_cols: Columns per block; must divide inputs
+
+    Returns:
+        Tensor of shape (outputs // block_rows, inputs // block_cols)
+    """
+    outputs, inputs = weight.shape
+    if outputs % block_rows != 0 or inputs % block_cols != 0:
+        raise ValueError(
+            f"{outputs}x{inputs} is not whole {block_rows}x{block_cols} blocks"
+        )
+    blocks = weight.reshape(
+        outputs // block_rows, block_rows, inputs // block_cols, block_cols
+    )
+    return blocks.pow(2).sum(dim=(1, 3)).sqrt()
+
+
+def block_mask(
+    weight: torch.Tensor, sparsity: float, block_rows: int, block_cols: int
+) -> torch.Tensor:
+    """
+    Mask keeping the blocks with the largest L2 norm.
+
+    Blocks already pruned have norm zero, so raising the sparsity step by
+    step never brings one back.
+
+    Args:
+        weight: Tensor of shape (outputs, inputs)
+        sparsity: Share of blocks to prune, in [0, 1)
+        block_rows: Rows per block
+        block_cols: Columns per block
+
+    Returns:
+        Float mask of the weight's shape, 1 where weights are kept
+    """
+    norms = block_norms(weight, block_rows, block_cols)
+    pruned = int(round(sparsity * norms.numel()))
+    keep = torch.ones_like(norms)
+    if pruned > 0:
+        order = torch.argsort(norms.flatten())
+        keep.view(-1)[order[:pruned]] = 0.0
+    return keep.repeat_interleave(block_rows, 0).repeat_interleave(block_cols, 1)
+
+
+def write_bsr(
+    path: Path,
+    weight: torch.Tensor,
+    bias: torch.Tensor,
+    block_rows: int,
+    block_cols: int,
+) -> int:
+    """
+    Write a pruned linear layer as block-sparse rows for the C++ side.
+
+    The layout is torch's to_sparse_bsr() (crow_indices, col_indices,
+    values) with a header and the bias, little-endian; see
+    BlockSparseLinear in LayerKernels.h. All-zero blocks are left out.
+
+    Args:
+        path: Output file, conventionally <model>.fc1.bsr
+        weight: Tensor of shape (outputs, inputs)
+        bias: Tensor of shape (outputs,)
+        block_rows: Rows per block
+        block_cols: Columns per block
+
+    Returns:
+        Number of blocks written
+    """
+    w = weight.detach().cpu().float().numpy()
+    outputs, inputs = w.shape
+    kept = block_norms(weight.detach().cpu(), block_rows, block_cols).numpy() > 0
+    blocks = w.reshape(
+        outputs // block_rows, block_rows, inputs // block_cols, block_cols
+    ).transpose(0, 2, 1, 3)
+
+    row_start = np.zeros(kept.shape[0] + 1, dtype="<i4")
+    row_start[1:] = np.cumsum(kept.sum(axis=1))
+    columns = np.nonzero(kept)[1].astype("<i4")
+    values = blocks[kept].astype("<f4")
+
+    with open(path, "wb") as f:
+        f.write(BSR_MAGIC)
+        f.write(
+            struct.pack(
+                "<5I", outputs, inputs, block_rows, block_cols, int(columns.size)
+            )
+        )
+        f.write(row_start.tobytes())
+        f.write(columns.tobytes())
+        f.write(values.tobytes())
+        f.write(bias.detach().cpu().float().numpy().astype("<f4").tobytes())
+    return int(columns.size)
+
+
+def fine_tune(
+    model: DigitRecognizer,
+    loader: DataLoader,
+    mask: torch.Tensor,
+    epochs: int,
+    lr: float,
+    device: torch.device,
+) -> None:
+    """
+    Train with fc1's pruned weights held at zero.
+
+    The mask is re-applied after every optimizer step, so neither the
+    gradient nor Adam's momentum revives a pruned block.
+    """
+    optimizer = Adam(model.parameters(), lr=lr)
+    criterion = nn.CrossEntropyLoss()
+    model.train()
+    for epoch in range(epochs):
+        running_loss = 0.0
+        for x, y in loader:
+            x, y = x.to(device), y.to(device)
+            optimizer.zero_grad()
+            loss = criterion(model(x), y)
+            loss.backward()
+            optimizer.step()
+            with torch.no_grad():
+                model.fc1.weight.mul_(mask)
+            running_loss += loss.item()
+        print(f"  fine-tune epoch {epoch+1}/{epochs} avg loss: "
+              f"{running_loss / len(loader):.4f}")
+
+
+def prune(
+    checkpoint_path: str = "models/digit_model.pth",
+    sparsities: Sequence[float] = (0.5, 0.7, 0.8, 0.9, 0.95),
+    block_rows: int = 4,
+    block_cols: int = 16,
+    epochs: int = 1,
+    lr: float = 1e-4,
+    batch_size: int = 64,
+    out_dir: str = "models",
+    stem: str = "digit_model",
+    device: Optional[str] = None,
+) -> List[dict]:
+    """
+    Prune fc1 in blocks, gradually, fine-tuning after each step.
+
+    fc1 holds 95% of DigitRecognizer's weights. Starting from the dense
+    checkpoint, each sparsity in increasing order prunes the weakest blocks
+    of the model the last step left, fine-tunes it, and exports:
+
+        <stem>_s<pct>.pth      checkpoint
+        <stem>_s<pct>.ts       TorchScript, dense with zeros; runs anywhere
+        <stem>_s<pct>.fc1.bsr  fc1's kept blocks, for the C++ block-sparse kernel
+
+    The accuracy-vs-sparsity table is printed and written to
+    <stem>_pruning.json.
+
+    Args:
+        checkpoint_path: Dense checkpoint from digit-train
+        sparsities: Shares of fc1's blocks to prune, each in [0, 1)
+        block_rows: Rows per block (1, 2 or 4 for the C++ kernel)
+        block_cols: Columns per block (a multiple of 8 for the C++ kernel)
+        epochs: Fine-tuning epochs after each pruning step
+        lr: Fine-tuning learning rate
+        batch_size: Batch size for fine-tuning and evaluation
+        out_dir: Output directory
+        stem: Prefix of the exported files
+        device: Device to train on ('cuda', 'cpu', or None for auto-detect)
+
+    Returns:
+        One dictionary per row of the table, the dense model first
+    """
+    if device is None:
+        device_obj = torch.device("cuda" if torch.cuda.is_available() else "cpu")
+    else:
+        device_obj = torch.device(device)
+    targets = sorted(sparsities)
+    if not targets or targets[0] < 0.0 or targets[-1] >= 1.0:
+        raise ValueError("Sparsities must be in [0, 1)")
+    if block_rows not in (1, 2, 4) or block_cols % 8 != 0:
+        raise ValueError("Blocks must be 1, 2 or 4 rows by a multiple of 8 columns")
+
+    print(f"Pruning on device: {device_obj}")
+    out_path = Path(out_dir)
+    out_path.mkdir(parents=True, exist_ok=True)
+    train_loader, test_loader = get_dataloaders(batch_size=batch_size)
+
+    # 1. The dense baseline
+    model = DigitRecognizer().to(device_obj)
+    state = torch.load(checkpoint_path, map_location=device_obj)
+    model.load_state_dict(state["model_state"])
+    fc1_params = model.fc1.weight.numel()
+    total_params = sum(p.numel() for p in model.parameters())
+    print(f"fc1 holds {fc1_params} of {total_params} parameters "
+          f"({100.0 * fc1_params / total_params:.1f}%)")
+    rows = [{
+        "sparsity": 0.0,
+        "blocks": int(block_norms(model.fc1.weight, block_rows, block_cols).numel()),
+        "accuracy": accuracy(model, test_loader, device_obj),
+        "fc1_bytes": fc1_params * 4,
+        "model": checkpoint_path,
+    }]
+
+    for sparsity in targets:
+        # 2. Prune the weakest blocks and fine-tune around the gap
+        print(f"\nSparsity {sparsity:.2f} in {block_rows}x{block_cols} blocks")
+        with torch.no_grad():
+            mask = block_mask(model.fc1.weight, sparsity, block_rows, block_cols)
+            model.fc1.weight.mul_(mask)
+        fine_tune(model, train_loader, mask, epochs, lr, device_obj)
+        test_acc = accuracy(model, test_loader, device_obj)
+
+        # 3. Export checkpoint, TorchScript and fc1's blocks
+        name = f"{stem}_s{int(round(sparsity * 100)):02d}"
+        torch.save(
+            {
+                "model_state": model.state_dict(),
+                "pruning": {
+                    "layer": "fc1",
+                    "sparsity": sparsity,
+                    "block": [block_rows, block_cols],
+                },
+            },
+            out_path / f"{name}.pth",
+        )
+        model.eval()
+        cpu_model = DigitRecognizer()
+        cpu_model.load_state_dict({k: v.cpu() for k, v in model.state_dict().items()})
+        cpu_model.eval()
+        torch.jit.script(cpu_model).save(str(out_path / f"{name}.ts"))
+        bsr_path = out_path / f"{name}.fc1.bsr"
+        blocks = write_bsr(
+            bsr_path, cpu_model.fc1.weight, cpu_model.fc1.bias, block_rows, block_cols
+        )
+        rows.append({
+            "sparsity": sparsity,
+            "blocks": blocks,
+            "accuracy": test_acc,
+            # Values and indices, as BlockSparseLinear::weight_bytes() counts them
+            "fc1_bytes": 4 * (blocks * block_rows * block_cols
+                              + model.fc1.out_features // block_rows + 1 + blocks),
+            "model": str(out_path / f"{name}.ts"),
+        })
+        print(f"Accuracy {test_acc*100:.2f}%, {blocks} blocks kept; saved {name}.*")
+
+    # 4. Report
+    print(f"\n{'sparsity':>8} {'blocks':>7} {'accuracy':>9} {'fc1 bytes':>10}  model")
+    for row in rows:
+        print(f"{row['sparsity']:>8.2f} {row['blocks']:>7d} "
+              f"{row['accuracy']*100:>8.2f}% {row['fc1_bytes']:>10d}  {row['model']}")
+    report_path = out_path / f"{stem}_pruning.json"
+    with open(report_path, "w") as f:
+        json.dump(
+            {"block": [block_rows, block_cols], "epochs": epochs, "rows": rows},
+            f,
+            indent=2,
+        )
+    print(f"Saved report: {report_path}")
+    return rows
+
+
+if __name__ == "__main__":
+    prune()
@@ -1,14 +1,114 @@
 """Training logic for the digit recognition model."""
 
+import time
 from pathlib import Path
 from typing import Optional
 
 import torch
 import torch.nn as nn
+import torch.ao.quantization as tq
 from torch.optim import Adam
+from torch.utils.data import DataLoader
 
 from .data import get_dataloaders
-from .model import DigitRecognizer
+from .eval import accuracy
+from .model import DigitRecognizer, QuantizableDigitRecognizer
+
+# Extra file in the TorchScript archive naming the quantized backend the int8
+# weights were packed for; digit_detector's InferenceEngine selects it on load
+QUANTIZED_ENGINE_RECORD = "quantized_engine"
+
+# Training batches the post-training baseline calibrates on
+PTQ_CALIBRATION_BATCHES = 32
+
+
+def post_training_quantize(
+    model: DigitRecognizer, loader: DataLoader, backend: str
+) -> nn.Module:
+    """
+    Static post-training quantization, as a baseline for QAT.
+
+    Args:
+        model: Trained float model
+        loader: Training data to calibrate the observers on
+        backend: Quantized backend ('fbgemm' or 'qnnpack')
+
+    Returns:
+        int8 model on the CPU
+    """
+    torch.backends.quantized.engine = backend
+    ptq_model = QuantizableDigitRecognizer()
+    ptq_model.load_state_dict({k: v.cpu() for k, v in model.state_dict().items()})
+    ptq_model.eval()
+    tq.fuse_modules(
+        ptq_model,
+        [["conv1", "relu1"], ["conv2", "relu2"], ["fc1", "relu3"]],
+        inplace=True,
+    )
+    ptq_model.qconfig = tq.get_default_qconfig(backend)
+    tq.prepare(ptq_model, inplace=True)
+    with torch.no_grad():
+        for i, (x, _) in enumerate(loader):
+            if i >= PTQ_CALIBRATION_BATCHES:
+                break
+            ptq_model(x)
+    return tq.convert(ptq_model)
+
+
+def quantization_aware_train(
+    model: DigitRecognizer,
+    loader: DataLoader,
+    epochs: int,
+    lr: float,
+    backend: str,
+    device: torch.device,
+) -> nn.Module:
+    """
+    Fine-tune a trained float model with fake-quantized weights and
+    activations, then convert it to int8.
+
+    Observers track activation ranges for all but the last epoch, which
+    trains against frozen quantization parameters.
+
+    Args:
+        model: Trained float model
+        loader: Training data
+        epochs: QAT epochs
+        lr: Learning rate, typically well below the float run's
+        backend: Quantized backend ('fbgemm' or 'qnnpack')
+        device: Device to fine-tune on
+
+    Returns:
+        int8 model on the CPU
+    """
+    torch.backends.quantized.engine = backend
+    qat_model = QuantizableDigitRecognizer()
+    qat_model.load_state_dict(model.state_dict())
+    qat_model.train()
+    qat_model.fuse_model()
+    qat_model.qconfig = tq.get_default_qat_qconfig(backend)
+    tq.prepare_qat(qat_model, inplace=True)
+    qat_model.to(device)
+
+    optimizer = Adam(qat_model.parameters(), lr=lr)
+    criterion = nn.CrossEntropyLoss()
+    for epoch in range(epochs):
+        if epochs > 1 and epoch == epochs - 1:
+            qat_model.apply(tq.disable_observer)
+        qat_model.train()
+        running_loss = 0.0
+        for x, y in loader:
+            x, y = x.to(device), y.to(device)
+            optimizer.zero_grad()
+            loss = criterion(qat_model(x), y)
+            loss.backward()
+            optimizer.step()
+            running_loss += loss.item()
+        print(f"QAT epoch {epoch+1}/{epochs} avg loss: "
+              f"{running_loss / len(loader):.4f}")
+
+    qat_model.cpu().eval()
+    return tq.convert(qat_model)
 
 
 def train(
@@ -19,9 +119,19 @@ def train(
     checkpoint_name: str = "digit_model.pth",
     torchscript_name: str = "digit_model.ts",
     device: Optional[str] = None,
+    qat: bool = False,
+    qat_epochs: int = 2,
+    qat_lr: float = 1e-4,
+    qat_backend: str = "fbgemm",
+    qat_torchscript_name: str = "digit_model_int8.ts",
 ) -> None:
     """
     Train the digit recognition model.
+
+    With qat, the trained model is then fine-tuned with fake-quant
+    observers and exported as an int8 TorchScript model as well, with
+    the test accuracy of float, post-training-quantized and QAT int8
+    printed side by side.
     
     Args:
         epochs: Number of training epochs
@@ -31,7 +141,19 @@ def train(
         checkpoint_name: Name for the PyTorch checkpoint file
         torchscript_name: Name for the TorchScript export file
         device: Device to train on ('cuda', 'cpu', or None for auto-detect)
+        qat: Also export an int8 model trained quantization-aware
+        qat_epochs: QAT fine-tuning epochs
+        qat_lr: QAT learning rate
+        qat_backend: Quantized backend the int8 weights are packed for
+            ('fbgemm' for x86 servers, 'qnnpack' for ARM)
+        qat_torchscript_name: Name for the int8 TorchScript export file
     """
+    if qat and qat_backend not in torch.backends.quantized.supported_engines:
+        raise ValueError(
+            f"Quantized backend '{qat_backend}' is not available; this torch "
+            f"supports {torch.backends.quantized.supported_engines}"
+        )
+
     # Setup device
     if device is None:
         device_obj = torch.device("cuda" if torch.cuda.is_available() else "cpu")
@@ -45,7 +167,7 @@ def train(
     out_path.mkdir(parents=True, exist_ok=True)
     
     # Load data
-    train_loader, _ = get_dataloaders(batch_size=batch_size)
+    train_loader, test_loader = get_dataloaders(batch_size=batch_size)
 
     # Initialize model, optimizer, and loss
     model = DigitRecognizer().to(device_obj)
@@ -56,6 +178,7 @@ def train(
     model.train()
     for epoch in range(epochs):
         running_loss = 0.0
+        epoch_start = time.perf_counter()
         for i, (x, y) in enumerate(train_loader):
             x, y = x.to(device_obj), y.to(device_obj)
             
@@ -73,7 +196,11 @@ def train(
                 )
 
         avg_loss = running_loss / len(train_loader)
-        print(f"Epoch {epoch+1} avg loss: {avg_loss:.4f}")
+        seconds = time.perf_counter() - epoch_start
+        print(
+            f"Epoch {epoch+1} avg loss: {avg_loss:.4f} ({seconds:.1f} s, "
+            f"{len(train_loader.dataset) / seconds:.0f} images/s)"
+        )
 
     # Save PyTorch checkpoint
     checkpoint_path = out_path / checkpoint_name
@@ -87,6 +214,31 @@ def train(
     scripted.save(str(torchscript_path))
     print(f"Saved TorchScript: {torchscript_path}")
 
+    if not qat:
+        return
+
+    # Quantize after training, then quantization-aware, and export the latter
+    cpu = torch.device("cpu")
+    float_acc = accuracy(model, test_loader, cpu)
+    ptq_acc = accuracy(
+        post_training_quantize(model, train_loader, qat_backend), test_loader, cpu
+    )
+    model.to(device_obj)
+    int8_model = quantization_aware_train(
+        model, train_loader, qat_epochs, qat_lr, qat_backend, device_obj
+    )
+    qat_acc = accuracy(int8_model, test_loader, cpu)
+    print(f"\nTest accuracy  fp32: {float_acc*100:.2f}%  "
+          f"PTQ int8: {ptq_acc*100:.2f}%  QAT int8: {qat_acc*100:.2f}%")
+
+    int8_path = out_path / qat_torchscript_name
+    torch.jit.save(
+        torch.jit.script(int8_model),
+        str(int8_path),
+        _extra_files={QUANTIZED_ENGINE_RECORD: qat_backend},
+    )
+    print(f"Saved int8 TorchScript ({qat_backend}): {int8_path}")
+
 
 if __name__ == "__main__":
     train()